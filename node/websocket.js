@@ -0,0 +1,104 @@
+
+
+"use strict";
+
+/*
+ * Send transforms straight to `server -W PORT` over a WebSocket instead of
+ * piping them through bin/transform:
+ *
+ *   node circle | node websocket ws://HOST:PORT/
+ *
+ * Each input line is a transform as bin/transform reads it: 4 (or 7)
+ * values for axis-angle, 6 (or 9) for euler angles. Poses go out as
+ * protocol v2 frames with int16 fields (see src/PROTOCOL). Browsers can
+ * use the same encoding with their built in WebSocket.
+ */
+
+const readline = require("readline");
+const WebSocket = global.WebSocket || require("ws");
+
+const MESSAGE_SET_AXISANGLE = 1,
+  MESSAGE_SET_EUCLIDEAN = 5,
+  MESSAGE_HELLO = 7,
+  RECORD_QUANTIZED = 1,
+  QUANTIZE_AXIS = 10000,
+  QUANTIZE_ANGLE = 100,
+  QUANTIZE_TRANSLATE = 1000;
+
+const url = process.argv[2] || "ws://127.0.0.1:4001/";
+
+/* One frame holding one record; payload is an array of int16 values */
+function frame(type, flags, payload) {
+  let recordLength = 6 + payload.length * 2,
+    buffer = new ArrayBuffer(4 + recordLength),
+    view = new DataView(buffer);
+
+  view.setUint16(0, buffer.byteLength, true);
+  view.setUint8(2, 2);
+  view.setUint8(3, 1);
+  view.setUint16(4, recordLength, true);
+  view.setUint8(6, type);
+  view.setUint8(7, flags);
+  view.setUint16(8, 0, true);
+  payload.forEach(function(value, index) {
+    view.setInt16(10 + index * 2, value, true);
+  });
+
+  return buffer;
+}
+
+function hello() {
+  /* min_version, max_version, max_frame and tick_rate as int16 pairs */
+  return frame(MESSAGE_HELLO, 0, [ 2 | (2 << 8), 0, 0, 0 ]);
+}
+
+function pose(values) {
+  let q = function(value, scale) {
+    return Math.max(-32767, Math.min(32767, Math.round(value * scale)));
+  };
+
+  switch (values.length) {
+  case 4:
+  case 7:
+    return frame(MESSAGE_SET_AXISANGLE, RECORD_QUANTIZED, [
+      q(values[0], QUANTIZE_AXIS), q(values[1], QUANTIZE_AXIS),
+      q(values[2], QUANTIZE_AXIS), q(values[3], QUANTIZE_ANGLE),
+      q(values[4] || 0, QUANTIZE_TRANSLATE), q(values[5] || 0, QUANTIZE_TRANSLATE),
+      q(values[6] || 0, QUANTIZE_TRANSLATE)
+    ]);
+  case 6:
+  case 9:
+    /* Input is roll pitch yaw; the message is yaw pitch roll */
+    return frame(MESSAGE_SET_EUCLIDEAN, RECORD_QUANTIZED, [
+      q(values[2], QUANTIZE_ANGLE), q(values[1], QUANTIZE_ANGLE),
+      q(values[0], QUANTIZE_ANGLE), q(values[3], QUANTIZE_TRANSLATE),
+      q(values[4], QUANTIZE_TRANSLATE), q(values[5], QUANTIZE_TRANSLATE)
+    ]);
+  default:
+    return null;
+  }
+}
+
+let socket = new WebSocket(url);
+socket.binaryType = "arraybuffer";
+
+socket.onopen = function() {
+  socket.send(hello());
+
+  readline.createInterface({ input: process.stdin }).on("line", function(line) {
+    let values = line.trim().split(/\s+/).map(parseFloat),
+      message = pose(values);
+    if (!message || values.some(isNaN)) {
+      console.error("Error parsing input: '" + line + "'");
+      return;
+    }
+    socket.send(message);
+  }).on("close", function() {
+    socket.close();
+  });
+};
+
+socket.onerror = function(error) {
+  console.error("Error: " + (error.message || "Unable to connect to " + url));
+  process.exit(1);
+};
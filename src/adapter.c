@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adapter.h"
+
+#define OSC_PREFIX      "/stewart/"
+#define OSC_ARGS_MAX    7
+#define OSC_BUNDLE_MAX  4   /* Nesting depth of bundles */
+
+#define FIELD_S8   0
+#define FIELD_U8   1
+#define FIELD_S16  2
+#define FIELD_U16  3
+#define FIELD_S32  4
+#define FIELD_U32  5
+#define FIELD_F32  6
+#define FIELD_F64  7
+
+typedef struct {
+    int present;
+    size_t offset;
+    int type;                /* FIELD_* */
+    int big;                 /* Big endian */
+    float scale;
+    float bias;
+} AdapterField;
+
+struct _Adapter {
+    int kind;                /* ADAPTER_* */
+    StewartMessage pose;     /* Held between datagrams */
+
+    /* Telemetry layout */
+    AdapterField fields[ADAPTER_FIELDS];
+    size_t length;           /* Shortest datagram accepted */
+
+    unsigned long received;
+    unsigned long invalid;
+};
+
+const char *_adapter_field_names[ADAPTER_FIELDS] = {
+    "yaw", "pitch", "roll", "x", "y", "z"
+};
+
+const struct {
+    const char *name;
+    size_t size;
+} _adapter_field_types[] = {
+    [FIELD_S8] = { "s8", 1 },
+    [FIELD_U8] = { "u8", 1 },
+    [FIELD_S16] = { "s16", 2 },
+    [FIELD_U16] = { "u16", 2 },
+    [FIELD_S32] = { "s32", 4 },
+    [FIELD_U32] = { "u32", 4 },
+    [FIELD_F32] = { "f32", 4 },
+    [FIELD_F64] = { "f64", 8 },
+};
+
+Adapter *_adapter_create(int kind);
+void _adapter_home(Adapter *adapter);
+void _adapter_set(Adapter *adapter, int field, float value);
+int _adapter_field(const char *name);
+uint64_t _adapter_bytes(const uint8_t *data, size_t size, int big);
+float _adapter_read(const AdapterField *field, const uint8_t *data);
+int _adapter_osc_string(const uint8_t *data, size_t length, size_t *offset, const char **s);
+int _adapter_osc_message(Adapter *adapter, const uint8_t *data, size_t length);
+int _adapter_osc_packet(Adapter *adapter, const uint8_t *data, size_t length, int depth);
+int _adapter_telemetry(Adapter *adapter, const uint8_t *data, size_t length);
+
+Adapter *_adapter_create(int kind) {
+    Adapter *adapter;
+
+    adapter = calloc(1, sizeof(*adapter));
+    if (!adapter) {
+        return NULL;
+    }
+    adapter->kind = kind;
+    _adapter_home(adapter);
+
+    return adapter;
+}
+
+Adapter *adapter_create_osc(void) {
+    return _adapter_create(ADAPTER_OSC);
+}
+
+/* Read the field layout for a telemetry feed. Returns NULL if the file
+ * can't be read or describes nothing. */
+Adapter *adapter_create_telemetry(const char *layout) {
+    char buf[256], name[16], type[8];
+    AdapterField field;
+    Adapter *adapter;
+    size_t end = 0, length = 0;
+    int line = 0, ret, i, t;
+    FILE *file;
+
+    file = fopen(layout, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open telemetry layout %s\n", layout);
+        return NULL;
+    }
+
+    adapter = _adapter_create(ADAPTER_TELEMETRY);
+    if (!adapter) {
+        fclose(file);
+        return NULL;
+    }
+
+    while (fgets(buf, sizeof(buf), file)) {
+        line++;
+        if (strchr(buf, '#')) {
+            *strchr(buf, '#') = '\0';
+        }
+        if (sscanf(buf, " %15s", name) != 1) {
+            continue;
+        }
+        if (!strcmp(name, "length")) {
+            if (sscanf(buf, " length %zu", &length) != 1) {
+                goto invalid;
+            }
+            continue;
+        }
+
+        memset(&field, 0, sizeof(field));
+        field.scale = 1;
+        ret = sscanf(buf, " %15s %zu %7s %f %f", name, &field.offset, type,
+                     &field.scale, &field.bias);
+        i = _adapter_field(name);
+        if (ret < 3 || i < 0) {
+            goto invalid;
+        }
+
+        field.big = strlen(type) > 2 && !strcmp(type + strlen(type) - 2, "be");
+        if (field.big) {
+            type[strlen(type) - 2] = '\0';
+        }
+        for (t = 0; t < sizeof(_adapter_field_types) / sizeof(*_adapter_field_types); t++) {
+            if (!strcmp(type, _adapter_field_types[t].name)) {
+                break;
+            }
+        }
+        if (t == sizeof(_adapter_field_types) / sizeof(*_adapter_field_types)) {
+            goto invalid;
+        }
+        field.type = t;
+        field.present = 1;
+        adapter->fields[i] = field;
+
+        if (field.offset + _adapter_field_types[t].size > end) {
+            end = field.offset + _adapter_field_types[t].size;
+        }
+    }
+    fclose(file);
+
+    if (!end || end > ADAPTER_PACKET_MAX || length > ADAPTER_PACKET_MAX) {
+        fprintf(stderr, "Error: Telemetry layout %s has no fields within %d bytes\n",
+                layout, ADAPTER_PACKET_MAX);
+        free(adapter);
+        return NULL;
+    }
+    adapter->length = length > end ? length : end;
+
+    return adapter;
+
+invalid:
+    fprintf(stderr, "Error: Invalid telemetry layout %s, line %d: %s", layout, line, buf);
+    fclose(file);
+    free(adapter);
+    return NULL;
+}
+
+void adapter_delete(Adapter *adapter) {
+    free(adapter);
+}
+
+int adapter_get_kind(Adapter *adapter) {
+    return adapter->kind;
+}
+
+unsigned long adapter_get_received(Adapter *adapter) {
+    return adapter->received;
+}
+
+unsigned long adapter_get_invalid(Adapter *adapter) {
+    return adapter->invalid;
+}
+
+void _adapter_home(Adapter *adapter) {
+    memset(&adapter->pose, 0, sizeof(adapter->pose));
+    adapter->pose.version = STEWART_PROTOCOL;
+    adapter->pose.size = sizeof(adapter->pose);
+    adapter->pose.type = STEWART_MESSAGE_SET_EUCLIDEAN;
+}
+
+/* Move one axis of the Euclidean pose */
+void _adapter_set(Adapter *adapter, int field, float value) {
+    struct Euclidean *pose = &adapter->pose.euclidean;
+
+    switch (field) {
+        case 0:
+            pose->yaw = value;
+            break;
+        case 1:
+            pose->pitch = value;
+            break;
+        case 2:
+            pose->roll = value;
+            break;
+        case 3:
+            pose->translate.x = value;
+            break;
+        case 4:
+            pose->translate.y = value;
+            break;
+        case 5:
+            pose->translate.z = value;
+            break;
+    }
+}
+
+/* Index of a field by name, or -1 */
+int _adapter_field(const char *name) {
+    int i;
+
+    for (i = 0; i < ADAPTER_FIELDS; i++) {
+        if (!strcmp(name, _adapter_field_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint64_t _adapter_bytes(const uint8_t *data, size_t size, int big) {
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        value |= (uint64_t)data[big ? size - 1 - i : i] << (8 * i);
+    }
+    return value;
+}
+
+float _adapter_read(const AdapterField *field, const uint8_t *data) {
+    uint64_t raw = _adapter_bytes(data + field->offset, _adapter_field_types[field->type].size,
+                                  field->big);
+    uint32_t bits32;
+    double value;
+    float f;
+
+    switch (field->type) {
+        case FIELD_S8:
+            value = (int8_t)raw;
+            break;
+        case FIELD_U8:
+            value = (uint8_t)raw;
+            break;
+        case FIELD_S16:
+            value = (int16_t)raw;
+            break;
+        case FIELD_U16:
+            value = (uint16_t)raw;
+            break;
+        case FIELD_S32:
+            value = (int32_t)raw;
+            break;
+        case FIELD_U32:
+            value = (uint32_t)raw;
+            break;
+        case FIELD_F32:
+            bits32 = raw;
+            memcpy(&f, &bits32, sizeof(f));
+            value = f;
+            break;
+        default:
+            memcpy(&value, &raw, sizeof(value));
+            break;
+    }
+
+    return value * field->scale + field->bias;
+}
+
+/* An OSC string: NUL terminated and padded to four bytes */
+int _adapter_osc_string(const uint8_t *data, size_t length, size_t *offset, const char **s) {
+    const uint8_t *end = memchr(data + *offset, '\0', length - *offset);
+
+    if (*offset >= length || !end) {
+        return -1;
+    }
+    *s = (const char *)data + *offset;
+    *offset = ((end - data) + 4) & ~3;
+
+    return *offset > length ? -1 : 0;
+}
+
+/* Returns 1 if the message moved the pose, 0 if it isn't one of ours and
+ * -1 if it is malformed */
+int _adapter_osc_message(Adapter *adapter, const uint8_t *data, size_t length) {
+    const char *address, *tags = ",";
+    float args[OSC_ARGS_MAX];
+    size_t offset = 0;
+    uint64_t raw;
+    uint32_t bits32;
+    double d;
+    float f;
+    int count = 0, field;
+
+    if (_adapter_osc_string(data, length, &offset, &address)) {
+        return -1;
+    }
+    if (strncmp(address, OSC_PREFIX, strlen(OSC_PREFIX))) {
+        return 0;
+    }
+    address += strlen(OSC_PREFIX);
+
+    /* Very old senders leave out the type tags when there are no arguments */
+    if (offset < length && _adapter_osc_string(data, length, &offset, &tags)) {
+        return -1;
+    }
+    if (tags[0] != ',') {
+        return -1;
+    }
+
+    for (tags++; *tags; tags++) {
+        if (count == OSC_ARGS_MAX) {
+            return -1;
+        }
+        switch (*tags) {
+            case 'f':
+            case 'i':
+                if (offset + 4 > length) {
+                    return -1;
+                }
+                bits32 = _adapter_bytes(data + offset, 4, 1);
+                memcpy(&f, &bits32, sizeof(f));
+                args[count++] = *tags == 'f' ? f : (int32_t)bits32;
+                offset += 4;
+                break;
+            case 'd':
+                if (offset + 8 > length) {
+                    return -1;
+                }
+                raw = _adapter_bytes(data + offset, 8, 1);
+                memcpy(&d, &raw, sizeof(d));
+                args[count++] = d;
+                offset += 8;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (!strcmp(address, "euclidean") && count == 6) {
+        if (adapter->pose.type != STEWART_MESSAGE_SET_EUCLIDEAN) {
+            _adapter_home(adapter);
+        }
+        for (field = 0; field < ADAPTER_FIELDS; field++) {
+            _adapter_set(adapter, field, args[field]);
+        }
+        return 1;
+    }
+    if (!strcmp(address, "axisangle") && count == 7) {
+        adapter->pose.type = STEWART_MESSAGE_SET_AXISANGLE;
+        adapter->pose.axisAngle.x = args[0];
+        adapter->pose.axisAngle.y = args[1];
+        adapter->pose.axisAngle.z = args[2];
+        adapter->pose.axisAngle.angle = args[3];
+        adapter->pose.axisAngle.translate.x = args[4];
+        adapter->pose.axisAngle.translate.y = args[5];
+        adapter->pose.axisAngle.translate.z = args[6];
+        return 1;
+    }
+    if (!strcmp(address, "home") && count == 0) {
+        _adapter_home(adapter);
+        return 1;
+    }
+    field = _adapter_field(address);
+    if (field >= 0 && count == 1) {
+        if (adapter->pose.type != STEWART_MESSAGE_SET_EUCLIDEAN) {
+            _adapter_home(adapter);
+        }
+        _adapter_set(adapter, field, args[0]);
+        return 1;
+    }
+
+    return field >= 0 || !strcmp(address, "euclidean") || !strcmp(address, "axisangle") ||
+        !strcmp(address, "home") ? -1 : 0;
+}
+
+/* A message, or a bundle of them. Time tags are ignored; everything is
+ * applied as it arrives. */
+int _adapter_osc_packet(Adapter *adapter, const uint8_t *data, size_t length, int depth) {
+    static const char bundle[8] = "#bundle";
+    size_t offset = 16;
+    uint32_t size;
+    int moved = 0, ret;
+
+    if (length < 4 || length % 4) {
+        return -1;
+    }
+    if (data[0] == '/') {
+        return _adapter_osc_message(adapter, data, length);
+    }
+    if (length < offset || memcmp(data, bundle, sizeof(bundle)) || depth == OSC_BUNDLE_MAX) {
+        return -1;
+    }
+
+    while (offset < length) {
+        if (offset + 4 > length) {
+            return -1;
+        }
+        size = _adapter_bytes(data + offset, 4, 1);
+        offset += 4;
+        if (size > length - offset) {
+            return -1;
+        }
+        ret = _adapter_osc_packet(adapter, data + offset, size, depth + 1);
+        if (ret < 0) {
+            return -1;
+        }
+        moved |= ret;
+        offset += size;
+    }
+
+    return moved;
+}
+
+int _adapter_telemetry(Adapter *adapter, const uint8_t *data, size_t length) {
+    int i;
+
+    if (length < adapter->length) {
+        return -1;
+    }
+    for (i = 0; i < ADAPTER_FIELDS; i++) {
+        if (adapter->fields[i].present) {
+            _adapter_set(adapter, i, _adapter_read(&adapter->fields[i], data));
+        }
+    }
+    return 1;
+}
+
+/* Feed one datagram through the adapter. Returns 1 with the pose it now
+ * holds, 0 if it didn't move the pose and -1 if it was malformed. */
+int adapter_parse(Adapter *adapter, const uint8_t *data, size_t length,
+                  StewartMessage *pose) {
+    int ret;
+
+    adapter->received++;
+    if (adapter->kind == ADAPTER_OSC) {
+        ret = _adapter_osc_packet(adapter, data, length, 0);
+    } else {
+        ret = _adapter_telemetry(adapter, data, length);
+    }
+
+    if (ret < 0) {
+        adapter->invalid++;
+    } else if (ret) {
+        *pose = adapter->pose;
+    }
+    return ret;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __adapter_h__
+#define __adapter_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stewart-pubsub.h"
+
+/* Input adapters turn datagrams from other software straight into poses,
+ * so show control consoles and simulators can drive the server without a
+ * script translating for them.
+ *
+ * OSC (server -O PORT) takes messages and bundles addressed to
+ *
+ *   /stewart/euclidean  yaw pitch roll x y z
+ *   /stewart/axisangle  x y z angle tx ty tz
+ *   /stewart/yaw, /pitch, /roll, /x, /y, /z   one value each
+ *   /stewart/home       no arguments
+ *
+ * with float32, int32 or float64 arguments. Single values move one axis
+ * of the Euclidean pose and leave the rest where they were, which suits
+ * one fader per axis. Other addresses are ignored.
+ *
+ * Telemetry (server -T PORT:LAYOUT) reads fixed binary datagrams laid
+ * out as the LAYOUT file describes, one line per field:
+ *
+ *   # FIELD OFFSET TYPE [SCALE [BIAS]]
+ *   length 324            minimum datagram length; shorter ones are
+ *                         rejected (default: the end of the last field)
+ *   roll   124 f32 57.29578
+ *   pitch  128 f32 57.29578
+ *   z      68  f32 0.5 -1
+ *
+ * FIELD is yaw, pitch, roll (degrees) or x, y, z (inches) of a Euclidean
+ * pose; value = raw * SCALE + BIAS. TYPE is s8, u8, s16, u16, s32, u32,
+ * f32 or f64, little endian unless suffixed "be". Fields not listed stay
+ * at zero. */
+
+#define ADAPTER_OSC        0
+#define ADAPTER_TELEMETRY  1
+
+#define ADAPTER_PACKET_MAX 2048 /* Largest datagram read */
+#define ADAPTER_FIELDS     6    /* yaw, pitch, roll, x, y, z */
+
+typedef struct _Adapter Adapter;
+
+Adapter *adapter_create_osc(void);
+Adapter *adapter_create_telemetry(const char *layout);
+void adapter_delete(Adapter *adapter);
+
+int adapter_get_kind(Adapter *adapter);
+unsigned long adapter_get_received(Adapter *adapter);
+unsigned long adapter_get_invalid(Adapter *adapter);
+
+int adapter_parse(Adapter *adapter, const uint8_t *data, size_t length,
+                  StewartMessage *pose);
+
+#endif
@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "stewart-pubsub.h"
+#include "config.h"
+#include "client.h"
+#include "frame.h"
+#include "delay.h"
+
+#define RIGS_MAX          16
+#define PROBE_INTERVAL    200000LL  /* us between clock probes to a rig */
+#define RECONNECT_INTERVAL 1000000LL /* us before reconnecting a rig */
+#define LEAD_MARGIN       500       /* us allowed over the slowest rig's
+                                     * one way delay */
+
+/* A server poses are relayed to */
+typedef struct {
+    char *host;
+    int port;
+    StewartClient *client;   /* NULL while disconnected */
+    long long retry;         /* now_usec() to reconnect at */
+    long long probe;         /* now_usec() the next clock probe is due */
+    unsigned long sent;      /* Poses handed to the client */
+    unsigned long unsynced;  /* Poses not sent; clock not known yet */
+} Rig;
+
+/* The one motion source, speaking v1 or v2 like it would to a server */
+typedef struct {
+    int fd;                  /* -1 if none connected */
+    int protocol;
+    uint8_t input[STEWART_FRAME_MAX * 4];
+    size_t length;
+    unsigned long poses;
+} Source;
+
+int quiet = 0;
+volatile sig_atomic_t running = 1;
+volatile sig_atomic_t dumpStats = 0;
+
+Rig rigs[RIGS_MAX];
+int rigCount = 0;
+long long fixedLead = 0;     /* -L; 0 to follow the rigs' delays */
+int tickRate = 0;            /* The rigs' control tick rate */
+long long lastLead = 0;
+
+void usage(int ret) {
+    fprintf(stderr,
+            "usage: broker -p PORT -h HOST:PORT [-h HOST:PORT ...]\n"
+            "\n"
+            "Relays the poses of one motion source connecting on PORT (transform,\n"
+            "joytrack, ...) to several servers. Each pose is scheduled for the same\n"
+            "time on every server, on a common control tick, so the platforms move\n"
+            "in lockstep however different their network paths are.\n"
+            "\n"
+            "-p PORT       Accept the motion source on PORT\n"
+            "-i ADDRESS    Listen on ADDRESS (default 127.0.0.1)\n"
+            "-h HOST:PORT  Server to relay to (up to %d)\n"
+            "-L USEC       Schedule poses USEC ahead. The default follows the\n"
+            "              slowest server's one way delay plus %dus\n"
+            "-q            Quiet\n"
+            "-?            Help\n"
+            "-v            Version\n"
+            "\n"
+            "Send SIGUSR1 to print the clock offset, round trip and lag of\n"
+            "each server.\n"
+            "\n",
+            RIGS_MAX, LEAD_MARGIN);
+    exit(ret);
+}
+
+void version() {
+    fprintf(stdout,
+            "broker: Stewart platform fleet broker\n"
+            "Copyright (C) 2017 Intel Corporation\n"
+            "Licensed under the terms of the Apache 2.0 license. See LICENSE file.\n"
+            "\n"
+            "Version: " VERSION "\n");
+    exit(0);
+}
+
+void onSignal(int sig) {
+    if (sig == SIGUSR1) {
+        dumpStats = 1;
+    } else {
+        running = 0;
+    }
+}
+
+void printStats() {
+    StewartClientClock clock;
+    Rig *rig;
+    int i;
+
+    fprintf(stdout, "Scheduling %lldus ahead on a %dHz tick\n", lastLead, tickRate);
+    for (i = 0; i < rigCount; i++) {
+        rig = &rigs[i];
+        fprintf(stdout, "Rig %d %s:%d: ", i, rig->host, rig->port);
+        if (!rig->client || stewart_client_get_clock(rig->client, &clock)) {
+            fprintf(stdout, "%s, %lu poses sent, %lu not\n",
+                    rig->client ? "clock not known yet" : "disconnected",
+                    rig->sent, rig->unsynced);
+            continue;
+        }
+        fprintf(stdout, "rtt %lldus, clock %+lldus, %lu poses sent (%lu coalesced), "
+                "arriving %+dus ahead, applied %dus after their time, %u missed\n",
+                clock.rtt, clock.offset, rig->sent,
+                stewart_client_get_coalesced(rig->client),
+                clock.early, clock.late, clock.missed);
+    }
+    fflush(stdout);
+}
+
+void connectRig(Rig *rig, long long now) {
+    rig->client = stewart_client_create(rig->host, rig->port);
+    if (!rig->client) {
+        rig->retry = now + RECONNECT_INTERVAL;
+        return;
+    }
+    rig->probe = now;
+}
+
+void dropRig(Rig *rig, long long now) {
+    fprintf(stderr, "Error: Lost %s:%d; reconnecting\n", rig->host, rig->port);
+    stewart_client_delete(rig->client);
+    rig->client = NULL;
+    rig->retry = now + RECONNECT_INTERVAL;
+}
+
+/* How far ahead to schedule: far enough that the pose reaches the slowest
+ * rig in time */
+long long leadTime() {
+    StewartClientClock clock;
+    long long lead = 0;
+    int i;
+
+    if (fixedLead) {
+        return fixedLead;
+    }
+    for (i = 0; i < rigCount; i++) {
+        if (rigs[i].client && !stewart_client_get_clock(rigs[i].client, &clock) &&
+            clock.rtt / 2 > lead) {
+            lead = clock.rtt / 2;
+        }
+    }
+    return lead + LEAD_MARGIN;
+}
+
+/* Send the pose to every rig for the first tick of the common grid that
+ * all of them can make. Beyond the network's own delay that adds at most
+ * one tick. */
+void relayPose(const StewartMessage *pose) {
+    StewartClientClock clock;
+    long long period = 1000000LL / tickRate;
+    long long at;
+    Rig *rig;
+    int i;
+
+    lastLead = leadTime();
+    at = now_usec() + lastLead;
+    at = (at + period - 1) / period * period;
+
+    for (i = 0; i < rigCount; i++) {
+        rig = &rigs[i];
+        if (!rig->client || stewart_client_get_clock(rig->client, &clock)) {
+            rig->unsynced++;
+            continue;
+        }
+        if (stewart_client_set_pose_at(rig->client, pose, at + clock.offset)) {
+            dropRig(rig, now_usec());
+            continue;
+        }
+        rig->sent++;
+    }
+}
+
+int replySource(Source *source, const StewartMessage *message, uint16_t id) {
+    StewartFrame frame;
+    const void *data = message;
+    size_t length = sizeof(*message);
+
+    if (source->protocol == STEWART_PROTOCOL_V2) {
+        stewart_frame_begin(&frame);
+        stewart_frame_add(&frame, message, id, 0);
+        length = stewart_frame_end(&frame);
+        data = frame.data;
+    }
+    return send(source->fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL) == length ? 0 : -1;
+}
+
+void handleSource(Source *source, const StewartMessage *message, uint16_t id) {
+    StewartMessage reply;
+    int i;
+
+    switch (message->type) {
+        case STEWART_MESSAGE_SET_AXISANGLE:
+        case STEWART_MESSAGE_SET_EUCLIDEAN:
+            source->poses++;
+            relayPose(message);
+            break;
+
+        case STEWART_MESSAGE_SET_TRIM:
+            for (i = 0; i < rigCount; i++) {
+                if (rigs[i].client &&
+                    stewart_client_set_trim(rigs[i].client, message->trim.servo,
+                                            message->trim.angle)) {
+                    dropRig(&rigs[i], now_usec());
+                }
+            }
+            break;
+
+        case STEWART_MESSAGE_HELLO:
+            memset(&reply, 0, sizeof(reply));
+            reply.version = STEWART_PROTOCOL;
+            reply.size = sizeof(reply);
+            reply.type = STEWART_MESSAGE_HELLO;
+            reply.hello.min_version = STEWART_PROTOCOL;
+            reply.hello.max_version = STEWART_PROTOCOL_V2;
+            reply.hello.max_frame = STEWART_FRAME_MAX;
+            reply.hello.tick_rate = tickRate;
+            replySource(source, &reply, id);
+            break;
+
+        default:
+            if (!quiet) {
+                fprintf(stderr, "Warning: Message type %d isn't relayed; ask the "
+                        "servers directly\n", message->type);
+            }
+            break;
+    }
+}
+
+/* Read what the source sent and relay it. Returns -1 once the source has
+ * gone or sent something unreadable. */
+int readSource(Source *source) {
+    StewartMessage message;
+    size_t consumed, offset;
+    uint16_t first, id;
+    ssize_t ret;
+    int length;
+
+    while (1) {
+        ret = recv(source->fd, source->input + source->length,
+                   sizeof(source->input) - source->length, MSG_DONTWAIT);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        source->length += ret;
+
+        if (!source->protocol && source->length >= sizeof(first)) {
+            memcpy(&first, source->input, sizeof(first));
+            source->protocol = first == STEWART_PROTOCOL ?
+                STEWART_PROTOCOL : STEWART_PROTOCOL_V2;
+        }
+
+        consumed = 0;
+        if (source->protocol == STEWART_PROTOCOL) {
+            while (source->length - consumed >= sizeof(message)) {
+                memcpy(&message, source->input + consumed, sizeof(message));
+                handleSource(source, &message, 0);
+                consumed += sizeof(message);
+            }
+        } else {
+            while ((length = stewart_frame_check(source->input + consumed,
+                                                 source->length - consumed)) > 0 &&
+                   consumed + length <= source->length) {
+                offset = 0;
+                while ((ret = stewart_frame_next(source->input + consumed, length,
+                                                 &offset, &message, &id)) == 1) {
+                    handleSource(source, &message, id);
+                }
+                if (ret < 0) {
+                    return -1;
+                }
+                consumed += length;
+            }
+            if (length < 0) {
+                return -1;
+            }
+        }
+
+        memmove(source->input, source->input + consumed, source->length - consumed);
+        source->length -= consumed;
+    }
+}
+
+void acceptSource(int sock, Source *source) {
+    struct sockaddr_in peer;
+    socklen_t size = sizeof(peer);
+    int enable = 1;
+    int fd;
+
+    while ((fd = accept(sock, (struct sockaddr *)&peer, &size)) != -1) {
+        if (source->fd != -1) {
+            fprintf(stderr, "Error: Already relaying a source; closing %s:%d\n",
+                    inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        source->fd = fd;
+        source->protocol = 0;
+        source->length = 0;
+        if (!quiet) {
+            fprintf(stdout, "Source connected from %s:%d\n",
+                    inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    StewartConfig config;
+    struct sockaddr_in sin = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    struct pollfd fds[RIGS_MAX + 2];
+    Source source = { .fd = -1 };
+    int sock = -1, port = -1;
+    int enable = 1;
+    int err = 0;
+    long long now, wake;
+    int i, rate, timeout;
+    char *colon;
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            fprintf(stderr, "Invalid argument %d: %s\n", i, argv[i]);
+            usage(-1);
+        }
+        switch (argv[i][1]) {
+            case 'p':
+                i++;
+                if (i >= argc) {
+                    usage(-1);
+                }
+                port = strtol(argv[i], NULL, 0);
+                break;
+
+            case 'i':
+                i++;
+                if (i >= argc || !inet_aton(argv[i], &sin.sin_addr)) {
+                    usage(-1);
+                }
+                break;
+
+            case 'h':
+                i++;
+                if (i >= argc || !(colon = strchr(argv[i], ':')) || rigCount == RIGS_MAX) {
+                    fprintf(stderr, "-h HOST:PORT must be specified, at most %d times\n",
+                            RIGS_MAX);
+                    usage(-1);
+                }
+                *colon = '\0';
+                rigs[rigCount].host = argv[i];
+                rigs[rigCount].port = strtol(colon + 1, NULL, 0);
+                rigCount++;
+                break;
+
+            case 'L':
+                i++;
+                if (i >= argc || (fixedLead = strtol(argv[i], NULL, 0)) <= 0) {
+                    usage(-1);
+                }
+                break;
+
+            case 'q':
+                quiet = 1;
+                break;
+
+            case '?':
+                usage(0);
+                break;
+
+            case 'v':
+                version();
+                break;
+
+            default:
+                usage(-1);
+                break;
+        }
+    }
+
+    if (port == -1 || rigCount == 0) {
+        usage(-1);
+    }
+
+    /* Until the servers say otherwise they are taken to tick at the
+     * configured rate */
+    config_get(&config);
+    tickRate = config_get_tick_rate(&config);
+
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (sock == -1) {
+        fprintf(stderr, "Error: Unable to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sin.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+        listen(sock, 1) == -1) {
+        fprintf(stderr, "Error: Unable to listen on %s:%d: %s\n",
+                inet_ntoa(sin.sin_addr), port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    if (!quiet) {
+        fprintf(stdout, "Relaying %s:%d to %d servers\n", inet_ntoa(sin.sin_addr),
+                port, rigCount);
+    }
+
+    signal(SIGUSR1, onSignal);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    now = now_usec();
+    for (i = 0; i < rigCount; i++) {
+        connectRig(&rigs[i], now);
+    }
+
+    while (running) {
+        if (dumpStats) {
+            dumpStats = 0;
+            printStats();
+        }
+
+        /* Keep every clock estimate fresh and reconnect lost rigs */
+        now = now_usec();
+        wake = now + PROBE_INTERVAL;
+        for (i = 0; i < rigCount; i++) {
+            Rig *rig = &rigs[i];
+            if (!rig->client && rig->retry <= now) {
+                connectRig(rig, now);
+            }
+            if (rig->client && rig->probe <= now) {
+                if (stewart_client_probe_clock(rig->client)) {
+                    dropRig(rig, now);
+                } else {
+                    rig->probe = now + PROBE_INTERVAL;
+                }
+            }
+            if (rig->client && rig->probe < wake) {
+                wake = rig->probe;
+            }
+            if (!rig->client && rig->retry < wake) {
+                wake = rig->retry;
+            }
+            if (rig->client && (rate = stewart_client_get_tick_rate(rig->client)) &&
+                rate != tickRate) {
+                if (!quiet) {
+                    fprintf(stdout, "Control tick rate: %dHz (from %s:%d)\n", rate,
+                            rig->host, rig->port);
+                }
+                tickRate = rate;
+            }
+        }
+
+        fds[0].fd = sock;
+        fds[0].events = POLLIN;
+        fds[1].fd = source.fd;
+        fds[1].events = POLLIN;
+        for (i = 0; i < rigCount; i++) {
+            fds[i + 2].fd = rigs[i].client ? stewart_client_get_fd(rigs[i].client) : -1;
+            fds[i + 2].events = rigs[i].client ? stewart_client_get_events(rigs[i].client) : 0;
+        }
+
+        timeout = wake > now ? (wake - now + 999) / 1000 : 0;
+        if (poll(fds, rigCount + 2, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: Poll returned an error: %s\n", strerror(errno));
+            err = -1;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            acceptSource(sock, &source);
+        }
+        if (source.fd != -1 && fds[1].revents && readSource(&source)) {
+            if (!quiet) {
+                fprintf(stdout, "Source disconnected after %lu poses\n", source.poses);
+            }
+            close(source.fd);
+            source.fd = -1;
+            source.poses = 0;
+        }
+        for (i = 0; i < rigCount; i++) {
+            if (rigs[i].client && fds[i + 2].revents &&
+                stewart_client_process(rigs[i].client, fds[i + 2].revents)) {
+                dropRig(&rigs[i], now_usec());
+            }
+        }
+    }
+
+    if (!quiet) {
+        printStats();
+    }
+
+    for (i = 0; i < rigCount; i++) {
+        if (rigs[i].client) {
+            stewart_client_flush(rigs[i].client, 1000);
+            stewart_client_delete(rigs[i].client);
+        }
+    }
+    if (source.fd != -1) {
+        close(source.fd);
+    }
+    close(sock);
+
+    return err;
+}
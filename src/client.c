@@ -0,0 +1,662 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sys/socket.h>
+
+#include "client.h"
+#include "frame.h"
+
+typedef struct _StewartRequest {
+    StewartStatusCallback callback;  /* NULL if the slot is free */
+    void *data;
+} StewartRequest;
+
+struct _StewartClient {
+    int fd;
+    int connected;               /* Non-blocking connect has completed */
+    int quantize;                /* Send poses as int16 */
+    int tick_rate;               /* From the server's HELLO; 0 until then */
+
+    /* Records waiting for the next frame. The pose is kept apart so a newer
+     * one can replace it until it is actually handed to the socket. */
+    StewartFrame pending;
+    StewartMessage pose;
+    int pose_pending;
+    unsigned long coalesced;     /* Poses replaced before being sent */
+
+    uint8_t output[STEWART_FRAME_MAX];
+    size_t output_offset;
+    size_t output_length;
+
+    uint8_t input[STEWART_FRAME_MAX * 4];
+    size_t input_length;
+
+    uint16_t next_id;
+    int in_flight;
+    StewartRequest requests[STEWART_CLIENT_REQUESTS_MAX];
+    StewartRequest subscription;
+
+    /* Clock probes. One is in flight at a time; the last few samples are
+     * kept and the one with the shortest round trip is trusted. */
+    uint16_t probe_id;           /* 0 if none in flight */
+    long long probe_sent;        /* Our clock when it was queued */
+    struct {
+        long long offset;
+        long long rtt;
+    } samples[STEWART_CLIENT_CLOCK_SAMPLES];
+    int sample_count;
+    StewartClientClock clock;
+
+    /* History query; one at a time */
+    uint16_t history_id;         /* 0 if none in flight */
+    StewartHistoryCallback history_callback;
+    void *history_data;
+    HistoryEntry history[STEWART_CLIENT_HISTORY_CHUNK];
+};
+
+long long _client_now(void);
+uint16_t _client_next_id(StewartClient *client);
+int _client_queue(StewartClient *client, const StewartMessage *message, uint16_t id);
+int _client_pump(StewartClient *client);
+int _client_read(StewartClient *client);
+void _client_dispatch(StewartClient *client, const StewartMessage *message, uint16_t id);
+int _client_history(StewartClient *client, const StewartRecordHeader *record,
+                    const uint8_t *payload);
+
+StewartClient *stewart_client_create(const char *host, int port) {
+    struct addrinfo hint = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP
+    };
+    struct addrinfo *res;
+    StewartClient *client;
+    StewartMessage hello = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(hello),
+        .type = STEWART_MESSAGE_HELLO,
+        .hello = {
+            .min_version = STEWART_PROTOCOL_V2,
+            .max_version = STEWART_PROTOCOL_V2,
+            .max_frame = STEWART_FRAME_MAX
+        }
+    };
+    int enable = 1;
+
+    if (getaddrinfo(host, NULL, &hint, &res) != 0 || res == NULL) {
+        fprintf(stderr, "Error: Unable to get host address for %s\n", host);
+        return NULL;
+    }
+
+    client = calloc(1, sizeof(*client));
+    if (!client) {
+        freeaddrinfo(res);
+        return NULL;
+    }
+    client->next_id = 1;
+    stewart_frame_begin(&client->pending);
+
+    client->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (client->fd == -1) {
+        fprintf(stderr, "Error: Unable to open socket: %s\n", strerror(errno));
+        freeaddrinfo(res);
+        free(client);
+        return NULL;
+    }
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    ((struct sockaddr_in *)res->ai_addr)->sin_port = htons(port);
+    if (connect(client->fd, res->ai_addr, res->ai_addrlen) == 0) {
+        client->connected = 1;
+    } else if (errno != EINPROGRESS) {
+        fprintf(stderr, "Error: Unable to connect to %s:%d: %s\n", host, port, strerror(errno));
+        freeaddrinfo(res);
+        stewart_client_delete(client);
+        return NULL;
+    }
+    freeaddrinfo(res);
+
+    /* Goes out as soon as the connection is up */
+    _client_queue(client, &hello, 0);
+
+    return client;
+}
+
+void stewart_client_delete(StewartClient *client) {
+    if (client->fd != -1) {
+        close(client->fd);
+    }
+    free(client);
+}
+
+int stewart_client_get_fd(StewartClient *client) {
+    return client->fd;
+}
+
+/* poll() events the client needs on its descriptor right now */
+int stewart_client_get_events(StewartClient *client) {
+    if (!client->connected || client->output_offset < client->output_length ||
+        client->pending.records || client->pose_pending) {
+        return POLLIN | POLLOUT;
+    }
+    return POLLIN;
+}
+
+int stewart_client_get_tick_rate(StewartClient *client) {
+    return client->tick_rate;
+}
+
+unsigned long stewart_client_get_coalesced(StewartClient *client) {
+    return client->coalesced;
+}
+
+void stewart_client_set_quantize(StewartClient *client, int quantize) {
+    client->quantize = quantize;
+}
+
+long long _client_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/* Ids wrap but never use 0, which marks subscription updates */
+uint16_t _client_next_id(StewartClient *client) {
+    uint16_t id = client->next_id;
+
+    client->next_id = id == UINT16_MAX ? 1 : id + 1;
+    return id;
+}
+
+/* Nothing left to send */
+int stewart_client_is_idle(StewartClient *client) {
+    return client->connected && client->output_offset == client->output_length &&
+        !client->pending.records && !client->pose_pending;
+}
+
+int _client_queue(StewartClient *client, const StewartMessage *message, uint16_t id) {
+    if (stewart_frame_add(&client->pending, message, id, client->quantize) == 0) {
+        return 0;
+    }
+    /* The frame being built is full; try to get it onto the socket */
+    if (_client_pump(client) < 0) {
+        return -1;
+    }
+    return stewart_frame_add(&client->pending, message, id, client->quantize);
+}
+
+/* Once everything earlier has been sent, close the pending frame (with the
+ * newest pose) and send as much as the socket takes. Holding new records
+ * back until then is what lets a newer pose replace an unsent one. */
+int _client_pump(StewartClient *client) {
+    ssize_t ret;
+
+    if (!client->connected) {
+        return 0;
+    }
+
+    if (client->output_offset == client->output_length) {
+        client->output_offset = client->output_length = 0;
+
+        if (client->pose_pending &&
+            stewart_frame_add(&client->pending, &client->pose, 0, client->quantize) == 0) {
+            client->pose_pending = 0;
+        }
+        if (client->pending.records) {
+            client->output_length = stewart_frame_end(&client->pending);
+            memcpy(client->output, client->pending.data, client->output_length);
+            stewart_frame_begin(&client->pending);
+        }
+        /* Only if the pending frame was too full to take it */
+        if (client->pose_pending && client->output_length == 0) {
+            stewart_frame_add(&client->pending, &client->pose, 0, client->quantize);
+            client->pose_pending = 0;
+            client->output_length = stewart_frame_end(&client->pending);
+            memcpy(client->output, client->pending.data, client->output_length);
+            stewart_frame_begin(&client->pending);
+        }
+    }
+
+    while (client->output_offset < client->output_length) {
+        ret = send(client->fd, client->output + client->output_offset,
+                   client->output_length - client->output_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret == -1) {
+            fprintf(stderr, "Error: Unable to send to Stewart platform: %s\n", strerror(errno));
+            return -1;
+        }
+        client->output_offset += ret;
+    }
+
+    return 0;
+}
+
+void _client_dispatch(StewartClient *client, const StewartMessage *message, uint16_t id) {
+    StewartRequest *request;
+
+    switch (message->type) {
+        case STEWART_MESSAGE_HELLO:
+            client->tick_rate = message->hello.tick_rate;
+            break;
+
+        case STEWART_MESSAGE_CLOCK:
+            if (id && id == client->probe_id) {
+                long long now = _client_now();
+                int i = client->sample_count++ % STEWART_CLIENT_CLOCK_SAMPLES;
+                int best = 0, count;
+
+                /* The server read its clock halfway through the round trip,
+                 * give or take the asymmetry of the path */
+                client->probe_id = 0;
+                client->samples[i].rtt = now - client->probe_sent;
+                client->samples[i].offset = message->clock.usec -
+                    (client->probe_sent + now) / 2;
+                count = client->sample_count < STEWART_CLIENT_CLOCK_SAMPLES ?
+                    client->sample_count : STEWART_CLIENT_CLOCK_SAMPLES;
+                for (i = 1; i < count; i++) {
+                    if (client->samples[i].rtt < client->samples[best].rtt) {
+                        best = i;
+                    }
+                }
+                client->clock.offset = client->samples[best].offset;
+                client->clock.rtt = client->samples[best].rtt;
+                client->clock.early = message->clock.early;
+                client->clock.late = message->clock.late;
+                client->clock.missed = message->clock.missed;
+            }
+            break;
+
+        case STEWART_MESSAGE_STATUS:
+            if (id == 0) {
+                if (client->subscription.callback) {
+                    client->subscription.callback(client, &message->status, 0,
+                                                  client->subscription.data);
+                }
+                break;
+            }
+            request = &client->requests[id % STEWART_CLIENT_REQUESTS_MAX];
+            if (request->callback) {
+                StewartStatusCallback callback = request->callback;
+                request->callback = NULL;
+                client->in_flight--;
+                callback(client, &message->status, id, request->data);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Hand a record of the history answer to the callback. Returns -1 if it
+ * can't be decoded. */
+int _client_history(StewartClient *client, const StewartRecordHeader *record,
+                    const uint8_t *payload) {
+    StewartHistoryCallback callback = client->history_callback;
+    int last = record->flags & STEWART_RECORD_LAST;
+    int count;
+
+    if (!record->id || record->id != client->history_id) {
+        return 0;
+    }
+    count = history_decode(payload, record->length - sizeof(*record), client->history,
+                           STEWART_CLIENT_HISTORY_CHUNK);
+    if (count < 0) {
+        return -1;
+    }
+    if (last) {
+        client->history_id = 0;
+        client->history_callback = NULL;
+    }
+    if (callback) {
+        callback(client, client->history, count, last, client->history_data);
+    }
+    return 0;
+}
+
+/* Read what has arrived and dispatch every complete frame. Returns -1 if
+ * the server closed the connection or sent something unreadable. */
+int _client_read(StewartClient *client) {
+    StewartRecordHeader record;
+    const uint8_t *payload;
+    StewartMessage message;
+    size_t offset, consumed;
+    ssize_t ret;
+    int length;
+
+    while (1) {
+        ret = recv(client->fd, client->input + client->input_length,
+                   sizeof(client->input) - client->input_length, MSG_DONTWAIT);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret == 0) {
+            fprintf(stderr, "Error: Stewart platform closed the connection\n");
+            return -1;
+        }
+        if (ret == -1) {
+            fprintf(stderr, "Error: Unable to receive from Stewart platform: %s\n",
+                    strerror(errno));
+            return -1;
+        }
+        client->input_length += ret;
+
+        consumed = 0;
+        while ((length = stewart_frame_check(client->input + consumed,
+                                             client->input_length - consumed)) > 0 &&
+               consumed + length <= client->input_length) {
+            offset = 0;
+            while ((ret = stewart_frame_next_record(client->input + consumed, length, &offset,
+                                                    &record, &payload)) == 1) {
+                if (record.type == STEWART_MESSAGE_HISTORY_DATA) {
+                    ret = _client_history(client, &record, payload);
+                } else {
+                    ret = stewart_frame_decode(&record, payload, &message);
+                    if (!ret) {
+                        _client_dispatch(client, &message, record.id);
+                    }
+                }
+                if (ret) {
+                    break;
+                }
+            }
+            if (ret < 0) {
+                length = -1;
+                break;
+            }
+            consumed += length;
+        }
+        if (length < 0) {
+            fprintf(stderr, "Error: Invalid frame from Stewart platform\n");
+            return -1;
+        }
+
+        memmove(client->input, client->input + consumed, client->input_length - consumed);
+        client->input_length -= consumed;
+    }
+}
+
+/* Handle poll() revents for the client's descriptor. Returns -1 once the
+ * connection has failed; the client should then be deleted. */
+int stewart_client_process(StewartClient *client, int revents) {
+    socklen_t len = sizeof(int);
+    int error = 0;
+
+    if (!client->connected && revents & (POLLOUT | POLLERR | POLLHUP)) {
+        if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error) {
+            fprintf(stderr, "Error: Unable to connect to Stewart platform: %s\n",
+                    strerror(error ? error : errno));
+            return -1;
+        }
+        client->connected = 1;
+    }
+
+    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        if (_client_read(client)) {
+            return -1;
+        }
+    }
+
+    return _client_pump(client);
+}
+
+/* Wait up to timeout ms (-1 forever) for the connection to be ready and
+ * process it once. Returns -1 if the connection failed. */
+int stewart_client_wait(StewartClient *client, int timeout) {
+    struct pollfd fds = { .fd = client->fd, .events = stewart_client_get_events(client) };
+    int ret;
+
+    ret = poll(&fds, 1, timeout);
+    if (ret == -1 && errno != EINTR) {
+        return -1;
+    }
+    if (ret <= 0) {
+        return 0;
+    }
+
+    return stewart_client_process(client, fds.revents);
+}
+
+/* Wait up to timeout ms (-1 forever) until everything queued has been
+ * handed to the socket. Returns -1 on error or if time ran out. */
+int stewart_client_flush(StewartClient *client, int timeout) {
+    struct timespec start, now;
+    int remaining = timeout;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!stewart_client_is_idle(client)) {
+        if (timeout >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining = timeout - ((now.tv_sec - start.tv_sec) * 1000 +
+                                   (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (remaining <= 0) {
+                return -1;
+            }
+        }
+        if (stewart_client_wait(client, remaining)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Replaces any pose that hasn't been sent yet */
+int stewart_client_set_pose(StewartClient *client, const StewartMessage *pose) {
+    if (pose->type != STEWART_MESSAGE_SET_AXISANGLE &&
+        pose->type != STEWART_MESSAGE_SET_EUCLIDEAN &&
+        pose->type != STEWART_MESSAGE_SCHEDULE &&
+        pose->type != STEWART_MESSAGE_SET_COUNTS) {
+        return -1;
+    }
+    if (client->pose_pending) {
+        client->coalesced++;
+    }
+    client->pose = *pose;
+    client->pose_pending = 1;
+
+    return _client_pump(client);
+}
+
+/* A pose for the server to apply on its first tick at or after usec on its
+ * own clock (our clock plus stewart_client_get_clock()'s offset). Replaces
+ * any pose that hasn't been sent yet, like stewart_client_set_pose. */
+int stewart_client_set_pose_at(StewartClient *client, const StewartMessage *pose,
+                               long long usec) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_SCHEDULE,
+        .schedule = {
+            .usec = usec,
+            .type = pose->type
+        }
+    };
+
+    if (pose->type == STEWART_MESSAGE_SET_AXISANGLE) {
+        message.schedule.axisAngle = pose->axisAngle;
+    } else if (pose->type == STEWART_MESSAGE_SET_EUCLIDEAN) {
+        message.schedule.euclidean = pose->euclidean;
+    } else {
+        return -1;
+    }
+
+    return stewart_client_set_pose(client, &message);
+}
+
+/* Servo counts worked out ahead of time (see compile), for a server whose
+ * config_hash_counts() is hash. Replaces any pose that hasn't been sent
+ * yet, like stewart_client_set_pose. */
+int stewart_client_set_counts(StewartClient *client, uint32_t hash, const uint16_t counts[6]) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_SET_COUNTS,
+        .counts = {
+            .hash = hash
+        }
+    };
+
+    memcpy(message.counts.counts, counts, sizeof(message.counts.counts));
+
+    return stewart_client_set_pose(client, &message);
+}
+
+int stewart_client_set_trim(StewartClient *client, int servo, float angle) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_SET_TRIM,
+        .trim = {
+            .servo = servo,
+            .angle = angle
+        }
+    };
+
+    if (_client_queue(client, &message, 0)) {
+        return -1;
+    }
+    return _client_pump(client);
+}
+
+/* Ask for the status; callback gets it when the reply arrives. Several
+ * requests can be outstanding. Returns the request id, or -1 if too many
+ * are in flight. */
+int stewart_client_request_status(StewartClient *client, StewartStatusCallback callback,
+                                  void *data) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_GET_STATUS
+    };
+    StewartRequest *request;
+    uint16_t id = client->next_id;
+
+    request = &client->requests[id % STEWART_CLIENT_REQUESTS_MAX];
+    if (request->callback || _client_queue(client, &message, id)) {
+        return -1;
+    }
+    request->callback = callback;
+    request->data = data;
+    client->in_flight++;
+    _client_next_id(client);
+
+    if (_client_pump(client)) {
+        return -1;
+    }
+    return id;
+}
+
+/* Have the server push the status at up to rate Hz; rate 0 stops it */
+int stewart_client_subscribe(StewartClient *client, uint32_t rate, uint32_t fields,
+                             StewartStatusCallback callback, void *data) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_SUBSCRIBE,
+        .subscribe = {
+            .rate = rate,
+            .fields = fields
+        }
+    };
+
+    if (_client_queue(client, &message, 0)) {
+        return -1;
+    }
+    client->subscription.callback = rate ? callback : NULL;
+    client->subscription.data = data;
+
+    return _client_pump(client);
+}
+
+/* Ask for the poses the server applied between from and to on its clock
+ * (0 or less: us before now). callback gets the entries as they arrive.
+ * Returns the request id, or -1 if a query is already being answered. */
+int stewart_client_request_history(StewartClient *client, long long from, long long to,
+                                   StewartHistoryCallback callback, void *data) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_HISTORY,
+        .history = {
+            .from = from,
+            .to = to
+        }
+    };
+    uint16_t id;
+
+    if (client->history_id) {
+        return -1;
+    }
+    id = client->next_id;
+    if (_client_queue(client, &message, id)) {
+        return -1;
+    }
+    client->history_id = _client_next_id(client);
+    client->history_callback = callback;
+    client->history_data = data;
+
+    if (_client_pump(client)) {
+        return -1;
+    }
+    return id;
+}
+
+/* Send a clock probe unless one is still in flight. Call it every so often;
+ * the estimate follows drift between the clocks from the last
+ * STEWART_CLIENT_CLOCK_SAMPLES probes. */
+int stewart_client_probe_clock(StewartClient *client) {
+    StewartMessage message = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(message),
+        .type = STEWART_MESSAGE_CLOCK
+    };
+    uint16_t id;
+
+    if (client->probe_id) {
+        return 0;
+    }
+    id = client->next_id;
+    if (_client_queue(client, &message, id)) {
+        return -1;
+    }
+    client->probe_id = _client_next_id(client);
+    client->probe_sent = _client_now();
+
+    return _client_pump(client);
+}
+
+/* Returns -1 until a probe has been answered */
+int stewart_client_get_clock(StewartClient *client, StewartClientClock *clock) {
+    if (!client->sample_count) {
+        return -1;
+    }
+    *clock = client->clock;
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __client_h__
+#define __client_h__
+
+#include <stdint.h>
+
+#include "stewart-pubsub.h"
+#include "history.h"
+
+/* libstewart-client: a non-blocking connection to the server speaking
+ * protocol v2. Nothing here blocks except the name lookup in
+ * stewart_client_create. To drive it from an application's own event loop,
+ * wait for stewart_client_get_events() on stewart_client_get_fd() and pass
+ * what happened to stewart_client_process(); stewart_client_wait() does
+ * exactly that with poll() for programs without a loop of their own.
+ *
+ * Poses are latest-wins: while earlier data is still waiting for the
+ * socket, a new pose replaces the unsent one instead of queueing behind
+ * it. Status requests are pipelined and matched to their replies by id. */
+
+#define STEWART_CLIENT_REQUESTS_MAX 256 /* Status requests in flight */
+#define STEWART_CLIENT_CLOCK_SAMPLES 8  /* Clock probes the estimate uses */
+#define STEWART_CLIENT_HISTORY_CHUNK (STEWART_FRAME_MAX / 2) /* Most entries one
+                                                              * record holds */
+
+typedef struct _StewartClient StewartClient;
+
+/* The server's clock as seen from here, from the recent clock probe with
+ * the shortest round trip, and how its scheduled poses are doing */
+typedef struct _StewartClientClock {
+    long long offset;        /* us to add to our CLOCK_MONOTONIC for the
+                              * server's */
+    long long rtt;           /* us round trip of that probe */
+    int early;               /* us the newest scheduled pose arrived ahead
+                              * of its time; negative if late */
+    int late;                /* us after its time it was applied */
+    unsigned int missed;     /* Scheduled poses that arrived too late */
+} StewartClientClock;
+
+/* id is the request's id, or 0 for a subscription update */
+typedef void (*StewartStatusCallback)(StewartClient *client, const StewartStatus *status,
+                                      uint16_t id, void *data);
+
+/* Called per record of a history answer with the entries it held, oldest
+ * first; last is set on the final call */
+typedef void (*StewartHistoryCallback)(StewartClient *client, const HistoryEntry *entries,
+                                       int count, int last, void *data);
+
+StewartClient *stewart_client_create(const char *host, int port);
+void stewart_client_delete(StewartClient *client);
+
+int stewart_client_get_fd(StewartClient *client);
+int stewart_client_get_events(StewartClient *client);
+int stewart_client_get_tick_rate(StewartClient *client);
+unsigned long stewart_client_get_coalesced(StewartClient *client);
+void stewart_client_set_quantize(StewartClient *client, int quantize);
+
+int stewart_client_process(StewartClient *client, int revents);
+int stewart_client_wait(StewartClient *client, int timeout);
+int stewart_client_flush(StewartClient *client, int timeout);
+int stewart_client_is_idle(StewartClient *client);
+
+int stewart_client_set_pose(StewartClient *client, const StewartMessage *pose);
+int stewart_client_set_pose_at(StewartClient *client, const StewartMessage *pose,
+                               long long usec);
+int stewart_client_set_counts(StewartClient *client, uint32_t hash, const uint16_t counts[6]);
+int stewart_client_set_trim(StewartClient *client, int servo, float angle);
+int stewart_client_request_status(StewartClient *client, StewartStatusCallback callback,
+                                  void *data);
+int stewart_client_subscribe(StewartClient *client, uint32_t rate, uint32_t fields,
+                             StewartStatusCallback callback, void *data);
+int stewart_client_request_history(StewartClient *client, long long from, long long to,
+                                   StewartHistoryCallback callback, void *data);
+int stewart_client_probe_clock(StewartClient *client);
+int stewart_client_get_clock(StewartClient *client, StewartClientClock *clock);
+
+#endif
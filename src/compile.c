@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+
+#include "pca9685.h"
+#include "servo.h"
+
+#include "stewart.h"
+#include "stewart-pubsub.h"
+#include "config.h"
+#include "delay.h"
+#include "client.h"
+#include "recording.h"
+#include "trajectory.h"
+
+#define THREADS_MAX 256
+
+/* A slice of the recording for one thread to solve */
+typedef struct {
+    const RecordingFrame *in;
+    TrajectoryFrame *out;
+    long count;
+} Job;
+
+StewartPlatform *platform = NULL;
+ServoTable *table = NULL;
+volatile sig_atomic_t stop = 0;
+
+void usage(int ret);
+void onSignal(int sig);
+int readTransform(const RecordingFrame *frame, Transform *transform, Point *origin);
+RecordingFrame *loadRecording(const char *path, long *count);
+void *solveJob(void *data);
+int compile(StewartConfig *config, const char *input, const char *output, int threads);
+int play(StewartConfig *config, const char *path, const char *host, int port,
+         int simulate, int warm);
+
+void usage(int ret) {
+    fprintf(stderr,
+            "usage: compile [OPTIONS] RECORDING TRAJECTORY\n"
+            "       compile -p [OPTIONS] TRAJECTORY\n"
+            "\n"
+            "Solves every frame of RECORDING (text or binary, see record) into the\n"
+            "PWM count for each servo, using all cores, and writes them to\n"
+            "TRAJECTORY. Frames are poses as transform reads them.\n"
+            "\n"
+            "With -p, plays TRAJECTORY: each frame's counts are sent at its time\n"
+            "straight to the PCA9685, or to the server with -h, with nothing parsed\n"
+            "or solved. Counts are only right for the configuration they were\n"
+            "compiled with (geometry, trims, PWM frequency and calibration), so a\n"
+            "trajectory is refused by a rig configured differently; compile it\n"
+            "again.\n"
+            "\n"
+            "Options:\n"
+            "-j THREADS    Solve on THREADS threads (default: one per core)\n"
+            "-f HZ         PWM refresh rate the counts are for (default: stewart.cfg)\n"
+            "-p            Play a compiled trajectory\n"
+            "-h HOST:PORT  Play to the Stewart platform server on HOST:PORT\n"
+            "-s            Simulate. Play without a PCA9685.\n"
+            "-w            Warm start. Adopt a PCA9685 already running at the\n"
+            "              configured frequency without resetting the servos\n"
+            "\n");
+    exit(ret);
+}
+
+void onSignal(int sig) {
+    stop = 1;
+}
+
+/* Values as transform reads them; see set_transform there */
+int readTransform(const RecordingFrame *frame, Transform *transform, Point *origin) {
+    float v[RECORDING_VALUES_MAX];
+
+    memcpy(v, frame->values, sizeof(v));
+    memset(transform, 0, sizeof(*transform));
+    memset(origin, 0, sizeof(*origin));
+    switch (frame->count) {
+        case 4:
+        case 7:
+            transform->type = TRANSFORM_AXIS_ANGLE;
+            transform->rotate.x = v[0];
+            transform->rotate.y = v[1];
+            transform->rotate.z = v[2];
+            transform->angle = v[3];
+            if (frame->count == 7) {
+                transform->translate.x = v[4];
+                transform->translate.y = v[5];
+                transform->translate.z = v[6];
+            }
+            return 0;
+
+        case 6:
+        case 9:
+            transform->type = TRANSFORM_EUCLIDEAN;
+            transform->rotate.x = v[0];
+            transform->rotate.y = v[1];
+            transform->rotate.z = v[2];
+            transform->translate.x = v[3];
+            transform->translate.y = v[4];
+            transform->translate.z = v[5];
+            if (frame->count == 9) {
+                origin->x = v[6];
+                origin->y = v[7];
+                origin->z = v[8];
+            }
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+/* Every frame of the recording at path that holds a pose */
+RecordingFrame *loadRecording(const char *path, long *count) {
+    RecordingFrame *frames = NULL, *grown, frame;
+    RecordingReader *reader = NULL;
+    const char *data, *line, *next, *end;
+    long size = 0, skipped = 0;
+    char buf[1024];
+    Transform transform;
+    struct stat st;
+    Point origin;
+    int fd, rc;
+
+    *count = 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Unable to open '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st)) {
+        fprintf(stderr, "Error: Unable to open '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (!st.st_size) {
+        fprintf(stderr, "Error: '%s' is empty\n", path);
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    end = data + st.st_size;
+
+    if (recording_check(data, st.st_size)) {
+        reader = recording_reader_create(data, st.st_size);
+        if (!reader) {
+            munmap((void *)data, st.st_size);
+            return NULL;
+        }
+    }
+
+    line = data;
+    while (1) {
+        if (reader) {
+            rc = recording_read(reader, &frame);
+            if (rc <= 0) {
+                break;
+            }
+        } else {
+            if (line >= end) {
+                break;
+            }
+            next = memchr(line, '\n', end - line);
+            next = next ? next + 1 : end;
+            snprintf(buf, sizeof(buf), "%.*s", (int)(next - line), line);
+            line = next;
+            if (recording_parse_line(buf, &frame)) {
+                skipped++;
+                continue;
+            }
+        }
+        if (frame.kind != RECORDING_KIND_POSE || readTransform(&frame, &transform, &origin)) {
+            skipped++;
+            continue;
+        }
+
+        if (*count == size) {
+            size = size ? size * 2 : 4096;
+            grown = realloc(frames, size * sizeof(*frames));
+            if (!grown) {
+                fprintf(stderr, "Error: Out of memory loading '%s'\n", path);
+                free(frames);
+                frames = NULL;
+                break;
+            }
+            frames = grown;
+        }
+        frames[(*count)++] = frame;
+    }
+
+    if (skipped) {
+        fprintf(stderr, "Warning: Skipped %ld frames that aren't poses\n", skipped);
+    }
+    if (reader) {
+        recording_reader_delete(reader);
+    }
+    munmap((void *)data, st.st_size);
+
+    return frames;
+}
+
+/* The platform and tables are only read while solving, so the threads
+ * share them */
+void *solveJob(void *data) {
+    Job *job = data;
+    Solution solutions[6];
+    Transform transform;
+    TrajectoryFrame *out;
+    Point origin;
+    long n;
+    int i;
+
+    for (n = 0; n < job->count; n++) {
+        out = &job->out[n];
+        readTransform(&job->in[n], &transform, &origin);
+        stewart_get_solutions(platform, &origin, &transform, solutions, NULL);
+
+        memset(out, 0, sizeof(*out));
+        out->usec = job->in[n].usec;
+        for (i = 0; i < 6; i++) {
+            out->counts[i] = SERVO_COUNT_ROUND(servo_table_lookup(table, i, solutions[i].angle));
+            if ((solutions[i].type & MASK) == IMPOSSIBLE) {
+                out->impossible |= 1 << i;
+            } else if (solutions[i].type & LIMITED) {
+                out->limited |= 1 << i;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int compile(StewartConfig *config, const char *input, const char *output, int threads) {
+    pthread_t workers[THREADS_MAX];
+    TrajectoryHeader header;
+    TrajectoryFrame *frames;
+    RecordingFrame *poses;
+    Job jobs[THREADS_MAX];
+    long count, begin, limited = 0, impossible = 0, n;
+    int running[THREADS_MAX];
+    long long start;
+    int i, rc;
+
+    poses = loadRecording(input, &count);
+    if (!poses) {
+        return -1;
+    }
+    frames = calloc(count ? count : 1, sizeof(*frames));
+    if (!frames) {
+        fprintf(stderr, "Error: Out of memory for %ld frames\n", count);
+        free(poses);
+        return -1;
+    }
+
+    /* Not worth a thread for less than a few thousand solves */
+    if (threads > count / 1024 + 1) {
+        threads = count / 1024 + 1;
+    }
+
+    start = now_usec();
+    for (i = 0, begin = 0; i < threads; i++) {
+        jobs[i].in = poses + begin;
+        jobs[i].out = frames + begin;
+        jobs[i].count = count * (i + 1) / threads - begin;
+        begin += jobs[i].count;
+    }
+    /* This thread takes the last slice, and any a thread couldn't start for */
+    for (i = 0; i < threads - 1; i++) {
+        running[i] = !pthread_create(&workers[i], NULL, solveJob, &jobs[i]);
+        if (!running[i]) {
+            solveJob(&jobs[i]);
+        }
+    }
+    solveJob(&jobs[threads - 1]);
+    for (i = 0; i < threads - 1; i++) {
+        if (running[i]) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    for (n = 0; n < count; n++) {
+        limited += !!frames[n].limited;
+        impossible += !!frames[n].impossible;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+    header.version = TRAJECTORY_VERSION;
+    header.config_hash = config_hash(config);
+    header.counts_hash = config_hash_counts(config);
+    header.frequency = config->pulse_frequency;
+    header.frames = count;
+    header.duration = count ? frames[count - 1].usec : 0;
+
+    rc = trajectory_write(output, &header, frames);
+    if (!rc) {
+        fprintf(stdout, "%ld frames, %.3fs, solved in %.3fs on %d threads; "
+                "%ld limited, %ld impossible. Configuration %08x.\n",
+                count, header.duration / 1000000.0, (now_usec() - start) / 1000000.0,
+                threads, limited, impossible, header.counts_hash);
+    }
+
+    free(frames);
+    free(poses);
+
+    return rc;
+}
+
+int play(StewartConfig *config, const char *path, const char *host, int port,
+         int simulate, int warm) {
+    const TrajectoryHeader *header;
+    const TrajectoryFrame *frames;
+    StewartClient *client = NULL;
+    Trajectory *trajectory;
+    PCA9685 *pca = NULL;
+    long long start, late, latest = 0;
+    unsigned long n, behind = 0;
+    uint16_t counts[6];
+    int err = 0, i;
+
+    trajectory = trajectory_open(path);
+    if (!trajectory) {
+        return -1;
+    }
+    header = trajectory_get_header(trajectory);
+    frames = trajectory_get_frames(trajectory);
+
+    if (host) {
+        /* The server checks the counts are for its configuration */
+        client = stewart_client_create(host, port);
+        if (!client || stewart_client_flush(client, 5000)) {
+            fprintf(stderr, "Error: Unable to connect to %s:%d\n", host, port);
+            err = 1;
+            goto terminate;
+        }
+    } else if (header->counts_hash != config_hash_counts(config)) {
+        fprintf(stderr, "Error: '%s' was compiled for configuration %08x (geometry and "
+                "trims %08x, %dHz); this one is %08x (%08x, %dHz). Compile it again.\n",
+                path, header->counts_hash, header->config_hash, header->frequency,
+                config_hash_counts(config), config_hash(config), config->pulse_frequency);
+        err = 1;
+        goto terminate;
+    } else if (!simulate) {
+        if (warm) {
+            pca = pca9685_attach(1, 0x40, config->oscillator, config->pulse_frequency);
+        } else {
+            pca = pca9685_open(1, 0x40);
+        }
+        if (!pca) {
+            fprintf(stderr, "Could not initialize PCA9685!\n");
+            err = 1;
+            goto terminate;
+        }
+        if (!warm) {
+            pca9685_set_oscillator(pca, config->oscillator);
+            if (pca9685_set_pulse_frequency(pca, config->pulse_frequency)) {
+                fprintf(stderr, "Could not set PWM frequency!\n");
+                err = 2;
+                goto terminate;
+            }
+        }
+    }
+
+    /* Frames go out on absolute deadlines, as in playback */
+    prctl(PR_SET_TIMERSLACK, 1);
+    start = now_usec();
+    for (n = 0; n < header->frames && !stop; n++) {
+        while (now_usec() < start + frames[n].usec && !stop) {
+            delay_until(start + frames[n].usec);
+        }
+        if (stop) {
+            break;
+        }
+
+        if (client) {
+            memcpy(counts, frames[n].counts, sizeof(counts));
+            if (stewart_client_set_counts(client, header->counts_hash, counts) ||
+                stewart_client_wait(client, 0)) {
+                err = 1;
+                break;
+            }
+        } else if (pca) {
+            for (i = 0; i < 6; i++) {
+                pca9685_stage_channel_count(pca, i, 0, frames[n].counts[i]);
+            }
+            pca9685_commit(pca);
+        }
+
+        late = now_usec() - (start + frames[n].usec);
+        if (late > latest) {
+            latest = late;
+        }
+        if (late > 1000) {
+            behind++;
+        }
+    }
+
+    fprintf(stderr, "%lu of %u frames over %.3fs; %lu more than 1ms late, at most %lldus\n",
+            n, header->frames, (now_usec() - start) / 1000000.0, behind, latest);
+
+terminate:
+    if (client) {
+        if (!err && stewart_client_flush(client, 1000)) {
+            fprintf(stderr, "Error: Timed out sending to Stewart platform\n");
+        }
+        stewart_client_delete(client);
+    }
+    if (pca) {
+        pca9685_close(pca);
+    }
+    trajectory_close(trajectory);
+
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    StewartConfig config;
+    struct sigaction action;
+    char *host = NULL, *files[2];
+    int port = 0, frequency = 0, threads = 0, playing = 0, simulate = 0, warm = 0;
+    int nfiles = 0, err, i;
+
+    /* Parse command line arguments... */
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            switch (argv[i][1]) {
+                case 'j':
+                    i++;
+                    if (i == argc || (threads = strtol(argv[i], NULL, 0)) < 1 ||
+                        threads > THREADS_MAX) {
+                        fprintf(stderr, "-j THREADS must be 1 to %d\n", THREADS_MAX);
+                        usage(-1);
+                    }
+                    break;
+
+                case 'f':
+                    i++;
+                    if (i == argc) {
+                        usage(-1);
+                    }
+                    frequency = strtol(argv[i], NULL, 0);
+                    break;
+
+                case 'p':
+                    playing = 1;
+                    break;
+
+                case 's':
+                    simulate = 1;
+                    break;
+
+                case 'w':
+                    warm = 1;
+                    break;
+
+                case 'h':
+                    i++;
+                    if (i == argc || !strchr(argv[i], ':')) {
+                        fprintf(stderr, "-h HOST:PORT must be specified\n");
+                        usage(-1);
+                    }
+                    host = argv[i];
+                    *strchr(host, ':') = '\0';
+                    port = strtol(host + strlen(host) + 1, NULL, 0);
+                    break;
+
+                default:
+                    usage(argv[i][1] == '?' ? 0 : -1);
+            }
+        } else if (nfiles < 2) {
+            files[nfiles++] = argv[i];
+        } else {
+            usage(-1);
+        }
+    }
+    if (nfiles != (playing ? 1 : 2)) {
+        usage(-1);
+    }
+
+    config_get(&config);
+    if (frequency) {
+        config.pulse_frequency = frequency;
+    }
+    if (config_validate(&config)) {
+        usage(-1);
+    }
+
+    if (playing) {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onSignal;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+
+        return play(&config, files[0], host, port, simulate, warm);
+    }
+
+    platform = stewart_platform_create(&config);
+    table = servo_table_create(&config);
+    if (!platform || !table) {
+        fprintf(stderr, "Could not create the Stewart platform solver!\n");
+        return -1;
+    }
+
+    if (!threads) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = threads < 1 ? 1 : threads > THREADS_MAX ? THREADS_MAX : threads;
+    }
+    err = compile(&config, files[0], files[1], threads);
+
+    servo_table_delete(table);
+    stewart_platform_delete(platform);
+
+    return err ? -1 : 0;
+}
@@ -9,6 +9,7 @@
 #include "stewart.h"
 #include "config.h"
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -25,6 +26,57 @@ int config_write(StewartConfig *c) {
         fclose(cfg);
         return -1;
     }
+    if (c->pulse_frequency != PULSE_WIDTH_FREQUENCY) {
+        if (fprintf(cfg, "frequency=%d\n", c->pulse_frequency) < 0) {
+            fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+            fclose(cfg);
+            return -1;
+        }
+    }
+    if (c->oscillator != PWM_OSCILLATOR_FREQUENCY) {
+        if (fprintf(cfg, "oscillator=%d\n", c->oscillator) < 0) {
+            fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+            fclose(cfg);
+            return -1;
+        }
+    }
+    for (i = 0; i < 6; i++) {
+        if (c->pulse_min[i] != PULSE_WIDTH_MIN_POS) {
+            if (fprintf(cfg, "pulse_min[%d]=%f\n", i, c->pulse_min[i]) < 0) {
+                fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+                fclose(cfg);
+                return -1;
+            }
+        }
+        if (c->pulse_max[i] != PULSE_WIDTH_MAX_POS) {
+            if (fprintf(cfg, "pulse_max[%d]=%f\n", i, c->pulse_max[i]) < 0) {
+                fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+                fclose(cfg);
+                return -1;
+            }
+        }
+    }
+    if (c->dither) {
+        if (fprintf(cfg, "dither=%d\n", c->dither) < 0) {
+            fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+            fclose(cfg);
+            return -1;
+        }
+    }
+    if (c->ipc) {
+        if (fprintf(cfg, "ipc=%d\n", c->ipc) < 0) {
+            fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+            fclose(cfg);
+            return -1;
+        }
+    }
+    if (c->tick_rate != 0) {
+        if (fprintf(cfg, "rate=%d\n", c->tick_rate) < 0) {
+            fprintf(stderr, "Error: Unable to write to 'stewart.cfg': %s\n", strerror(errno));
+            fclose(cfg);
+            return -1;
+        }
+    }
     for (i = 0; i < 6; i++) {
         if (c->servo_trim[i] != 0.0) {
             if (fprintf(cfg, "trim[%d]=%f\n", i, c->servo_trim[i]) < 0) {
@@ -43,6 +95,8 @@ int config_write(StewartConfig *c) {
 }
 
 void config_get(StewartConfig *c) {
+    int i;
+
     /*
      *
      * To change these values, modify config.h
@@ -79,6 +133,16 @@ void config_get(StewartConfig *c) {
     c->servo_direction[4] =   SERVO_DIRECTION_4;
     c->servo_direction[5] =   SERVO_DIRECTION_5;
 
+    c->pulse_frequency =      PULSE_WIDTH_FREQUENCY;
+    c->tick_rate =            0;
+    c->oscillator =           PWM_OSCILLATOR_FREQUENCY;
+    c->dither =               0;
+    c->ipc =                  0;
+    for (i = 0; i < 6; i++) {
+        c->pulse_min[i] =     PULSE_WIDTH_MIN_POS;
+        c->pulse_max[i] =     PULSE_WIDTH_MAX_POS;
+    }
+
     FILE *cfg = fopen("stewart.cfg", "r");
     if (cfg != NULL) {
         char *version = NULL;
@@ -89,12 +153,55 @@ void config_get(StewartConfig *c) {
 
         if (!strcmp(VERSION, version)) {
             char buf[1024];
-            int i;
+            int n;
             float v;
             do {
                 if (buf != fgets(buf, sizeof(buf), cfg)) {
                     break;
                 }
+                if (sscanf(buf, " frequency = %d\n", &n) == 1) {
+                    if (c->debug) {
+                        fprintf(stdout, "Using PWM frequency from stewart.cfg: %dHz\n", n);
+                    }
+                    c->pulse_frequency = n;
+                    continue;
+                }
+                if (sscanf(buf, " oscillator = %d\n", &n) == 1) {
+                    if (c->debug) {
+                        fprintf(stdout, "Using calibrated oscillator from stewart.cfg: %dHz\n", n);
+                    }
+                    c->oscillator = n;
+                    continue;
+                }
+                if (sscanf(buf, " pulse_min [ %d ] = %f\n", &i, &v) == 2 ||
+                    sscanf(buf, " pulse_max [ %d ] = %f\n", &i, &v) == 2) {
+                    if (i < 0 || i > 5) {
+                        fprintf(stderr, "Invalid pulse index %d in stewart.cfg!\n",
+                                i);
+                        break;
+                    }
+                    if (strstr(buf, "pulse_min")) {
+                        c->pulse_min[i] = v;
+                    } else {
+                        c->pulse_max[i] = v;
+                    }
+                    continue;
+                }
+                if (sscanf(buf, " dither = %d\n", &n) == 1) {
+                    c->dither = n;
+                    continue;
+                }
+                if (sscanf(buf, " ipc = %d\n", &n) == 1) {
+                    c->ipc = n;
+                    continue;
+                }
+                if (sscanf(buf, " rate = %d\n", &n) == 1) {
+                    if (c->debug) {
+                        fprintf(stdout, "Using control tick rate from stewart.cfg: %dHz\n", n);
+                    }
+                    c->tick_rate = n;
+                    continue;
+                }
     	        if (sscanf(buf, " trim [ %d ] = %f\n", &i, &v) != 2) {
                     break;
                 }
@@ -116,3 +223,91 @@ void config_get(StewartConfig *c) {
         free(version);
     }
 }
+
+/* Returns the rate in Hz the control loop should run at. Unless
+ * configured otherwise, the loop is matched to the PWM refresh rate so
+ * every PWM period sees a fresh servo position. */
+int config_get_tick_rate(const StewartConfig *c) {
+    return c->tick_rate ? c->tick_rate : c->pulse_frequency;
+}
+
+int config_validate(const StewartConfig *c) {
+    int i;
+
+    if (c->pulse_frequency < PULSE_WIDTH_FREQUENCY_MIN ||
+        c->pulse_frequency > PULSE_WIDTH_FREQUENCY_MAX) {
+        fprintf(stderr, "Error: PWM frequency %dHz outside of %d-%dHz.\n",
+                c->pulse_frequency, PULSE_WIDTH_FREQUENCY_MIN,
+                PULSE_WIDTH_FREQUENCY_MAX);
+        return -1;
+    }
+    if (c->oscillator < PWM_OSCILLATOR_FREQUENCY / 2 ||
+        c->oscillator > PWM_OSCILLATOR_FREQUENCY * 2) {
+        fprintf(stderr, "Error: Oscillator calibration %dHz is not plausible.\n",
+                c->oscillator);
+        return -1;
+    }
+    for (i = 0; i < 6; i++) {
+        if (c->pulse_min[i] <= 0 || c->pulse_min[i] >= c->pulse_max[i] ||
+            c->pulse_max[i] >= 1000000.0 / c->pulse_frequency) {
+            fprintf(stderr, "Error: Servo %d pulse range %.0f-%.0fus does not fit "
+                    "in the %dHz PWM period.\n", i, c->pulse_min[i],
+                    c->pulse_max[i], c->pulse_frequency);
+            return -1;
+        }
+    }
+    if (c->tick_rate < 0 || c->tick_rate > CONTROL_TICK_RATE_MAX) {
+        fprintf(stderr, "Error: Control tick rate %dHz outside of 1-%dHz.\n",
+                c->tick_rate, CONTROL_TICK_RATE_MAX);
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t _config_hash_add(uint32_t hash, const void *data, size_t length);
+
+/* FNV-1a */
+uint32_t _config_hash_add(uint32_t hash, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Hash of everything that decides which servo angles a pose solves to: the
+ * geometry, servo limits and trims. Recordings carry it so a file made on
+ * one rig isn't silently played as if it matched another. */
+uint32_t config_hash(const StewartConfig *c) {
+    uint32_t hash = 2166136261u;
+
+    hash = _config_hash_add(hash, &c->servo_min, sizeof(c->servo_min));
+    hash = _config_hash_add(hash, &c->servo_max, sizeof(c->servo_max));
+    hash = _config_hash_add(hash, &c->servo_arm_length, sizeof(c->servo_arm_length));
+    hash = _config_hash_add(hash, c->servo_orientation, sizeof(c->servo_orientation));
+    hash = _config_hash_add(hash, c->servo_direction, sizeof(c->servo_direction));
+    hash = _config_hash_add(hash, c->servo_trim, sizeof(c->servo_trim));
+    hash = _config_hash_add(hash, &c->control_rod_length, sizeof(c->control_rod_length));
+    hash = _config_hash_add(hash, &c->platform_height, sizeof(c->platform_height));
+    hash = _config_hash_add(hash, &c->effector_radius, sizeof(c->effector_radius));
+    hash = _config_hash_add(hash, &c->base_radius, sizeof(c->base_radius));
+    hash = _config_hash_add(hash, &c->theta_base, sizeof(c->theta_base));
+    hash = _config_hash_add(hash, &c->theta_effector, sizeof(c->theta_effector));
+
+    return hash;
+}
+
+/* config_hash() plus what turns an angle into a PWM count, for counts
+ * worked out ahead of time (see compile) */
+uint32_t config_hash_counts(const StewartConfig *c) {
+    uint32_t hash = config_hash(c);
+
+    hash = _config_hash_add(hash, &c->pulse_frequency, sizeof(c->pulse_frequency));
+    hash = _config_hash_add(hash, &c->oscillator, sizeof(c->oscillator));
+    hash = _config_hash_add(hash, c->pulse_min, sizeof(c->pulse_min));
+    hash = _config_hash_add(hash, c->pulse_max, sizeof(c->pulse_max));
+
+    return hash;
+}
@@ -9,6 +9,8 @@
 #ifndef __config_h__
 #define __config_h__
 
+#include <stdint.h>
+
 #include "stewart.h"
 
 /***************************************************************************
@@ -55,6 +57,25 @@
 #define PULSE_WIDTH_FREQUENCY 100     /* in Hz - cycles per second   */
 #define PULSE_WIDTH_ZERO_POS  1500    /* in ms - ~1500 is "standard" */
 
+/* PULSE_WIDTH_FREQUENCY is only the default refresh rate. Digital servos
+ * accept a much faster refresh; the rate can be changed at runtime with
+ * "frequency=" in stewart.cfg or -f on the command line. The control loop
+ * runs at the PWM rate unless "rate=" / -r requests something else.
+ *
+ * The upper limit keeps the PWM period (3003us at 333Hz) longer than
+ * PULSE_WIDTH_MAX_POS; the lower limit is the slowest the PCA9685
+ * PRE_SCALE register can divide its 25MHz oscillator down to. */
+#define PULSE_WIDTH_FREQUENCY_MIN 24
+#define PULSE_WIDTH_FREQUENCY_MAX 333
+#define CONTROL_TICK_RATE_MAX     1000
+
+/* Nominal PCA9685 internal oscillator. Actual parts vary by several percent;
+ * measure the PWM output and set "oscillator=" in stewart.cfg (see "trim -m")
+ * so the angle to count tables are built from the real clock. Per servo end
+ * points can be calibrated with "pulse_min[N]=" and "pulse_max[N]=" (in us,
+ * at SERVO_MIN_ANGLE and SERVO_MAX_ANGLE respectively.) */
+#define PWM_OSCILLATOR_FREQUENCY  25000000
+
 /***************************************************************************
  *
  * If you build to the dimensions specified in the Developer Journey,
@@ -136,5 +157,9 @@
 
 void config_get(StewartConfig *c);
 int config_write(StewartConfig *c);
+int config_validate(const StewartConfig *c);
+int config_get_tick_rate(const StewartConfig *c);
+uint32_t config_hash(const StewartConfig *c);
+uint32_t config_hash_counts(const StewartConfig *c);
 
 #endif
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "connection.h"
+
+struct _ConnectionPool {
+    Connection *connections;
+    int size;
+    int count;            /* Open connections */
+    Connection *open;     /* Doubly linked list of open connections */
+    Connection *free;     /* Singly linked list of unused slots */
+    Connection *closed;   /* Closed this pass; not reusable until reaped */
+    Connection *subscribers;
+    int subscriber_count;
+};
+
+ConnectionPool *connection_pool_create(int size) {
+    ConnectionPool *pool;
+    int i;
+
+    if (size <= 0) {
+        fprintf(stderr, "Error: Invalid connection pool size: %d\n", size);
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->connections = calloc(size, sizeof(*pool->connections));
+    if (!pool->connections) {
+        fprintf(stderr, "Error: Unable to allocate %d connections\n", size);
+        free(pool);
+        return NULL;
+    }
+
+    pool->size = size;
+    for (i = size - 1; i >= 0; i--) {
+        pool->connections[i].fd = -1;
+        pool->connections[i].id = i;
+        pool->connections[i].next = pool->free;
+        pool->free = &pool->connections[i];
+    }
+
+    return pool;
+}
+
+void connection_pool_delete(ConnectionPool *pool) {
+    while (pool->open) {
+        connection_close(pool, pool->open);
+    }
+    free(pool->connections);
+    free(pool);
+}
+
+int connection_pool_get_size(ConnectionPool *pool) {
+    return pool->size;
+}
+
+int connection_pool_get_count(ConnectionPool *pool) {
+    return pool->count;
+}
+
+Connection *connection_pool_get(ConnectionPool *pool, int id) {
+    if (id < 0 || id >= pool->size) {
+        return NULL;
+    }
+    return &pool->connections[id];
+}
+
+Connection *connection_pool_first(ConnectionPool *pool) {
+    return pool->open;
+}
+
+Connection *connection_pool_first_subscriber(ConnectionPool *pool) {
+    return pool->subscribers;
+}
+
+int connection_pool_get_subscribers(ConnectionPool *pool) {
+    return pool->subscriber_count;
+}
+
+/* Slots closed while handling a batch of events stay off the free list until
+ * the batch is done, so a stale event for a closed slot can't be delivered
+ * to a new client that reused it. */
+void connection_pool_reap(ConnectionPool *pool) {
+    while (pool->closed) {
+        Connection *connection = pool->closed;
+        pool->closed = connection->next;
+        connection->next = pool->free;
+        pool->free = connection;
+    }
+}
+
+Connection *connection_open(ConnectionPool *pool, int fd, const struct sockaddr_in *peer) {
+    Connection *connection = pool->free;
+
+    if (!connection) {
+        return NULL;
+    }
+    pool->free = connection->next;
+
+    connection->fd = fd;
+    if (peer) {
+        connection->peer = *peer;
+    } else {
+        memset(&connection->peer, 0, sizeof(connection->peer));
+    }
+    connection->input_head = connection->input_tail = 0;
+    connection->protocol = 0;
+    connection->request = 0;
+    connection->websocket = 0;
+    connection->output_offset = connection->output_length = 0;
+    connection->received = connection->dropped = 0;
+    connection->subscribed = 0;
+    connection->status_pending = 0;
+    connection->conflated = 0;
+    connection->history = 0;
+    connection->history_next = connection->history_end = 0;
+    connection->channel = NULL;
+    connection->channel_fd = connection->wake = connection->notify = -1;
+
+    connection->prev = NULL;
+    connection->next = pool->open;
+    if (pool->open) {
+        pool->open->prev = connection;
+    }
+    pool->open = connection;
+    pool->count++;
+
+    return connection;
+}
+
+void connection_close(ConnectionPool *pool, Connection *connection) {
+    if (connection->fd == -1) {
+        return;
+    }
+
+    connection_unsubscribe(pool, connection);
+    close(connection->fd);
+    connection->fd = -1;
+
+    if (connection->channel) {
+        local_channel_unmap(connection->channel);
+        connection->channel = NULL;
+    }
+    if (connection->channel_fd != -1) {
+        close(connection->channel_fd);
+        connection->channel_fd = -1;
+    }
+    if (connection->wake != -1) {
+        close(connection->wake);
+        connection->wake = -1;
+    }
+    if (connection->notify != -1) {
+        close(connection->notify);
+        connection->notify = -1;
+    }
+
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        pool->open = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    }
+    pool->count--;
+
+    connection->prev = NULL;
+    connection->next = pool->closed;
+    pool->closed = connection;
+}
+
+/* Subscribing again only changes the fields and period */
+void connection_subscribe(ConnectionPool *pool, Connection *connection,
+                          uint32_t fields, long long period) {
+    connection->subscribe_fields = fields;
+    connection->subscribe_period = period;
+    connection->subscribe_next = 0;
+    if (connection->subscribed) {
+        return;
+    }
+
+    connection->subscribed = 1;
+    connection->sub_prev = NULL;
+    connection->sub_next = pool->subscribers;
+    if (pool->subscribers) {
+        pool->subscribers->sub_prev = connection;
+    }
+    pool->subscribers = connection;
+    pool->subscriber_count++;
+}
+
+void connection_unsubscribe(ConnectionPool *pool, Connection *connection) {
+    if (!connection->subscribed) {
+        return;
+    }
+
+    if (connection->sub_prev) {
+        connection->sub_prev->sub_next = connection->sub_next;
+    } else {
+        pool->subscribers = connection->sub_next;
+    }
+    if (connection->sub_next) {
+        connection->sub_next->sub_prev = connection->sub_prev;
+    }
+    connection->sub_prev = connection->sub_next = NULL;
+    connection->subscribed = 0;
+    connection->status_pending = 0;
+    pool->subscriber_count--;
+}
+
+/* Read as much as fits into the free part of the receive ring with a single
+ * recvmsg(), even when the free space wraps. requested is set to the space
+ * offered; getting less back means the socket has been drained. */
+ssize_t connection_receive(Connection *connection, size_t *requested) {
+    size_t used = connection->input_head - connection->input_tail;
+    size_t start = connection->input_head & (CONNECTION_INPUT_SIZE - 1);
+    size_t space = CONNECTION_INPUT_SIZE - used;
+    struct iovec iov[2];
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 1 };
+    ssize_t ret;
+
+    iov[0].iov_base = connection->input + start;
+    iov[0].iov_len = space;
+    if (start + space > CONNECTION_INPUT_SIZE) {
+        iov[0].iov_len = CONNECTION_INPUT_SIZE - start;
+        iov[1].iov_base = connection->input;
+        iov[1].iov_len = space - iov[0].iov_len;
+        msg.msg_iovlen = 2;
+    }
+
+    *requested = space;
+    if (space == 0) {
+        /* Only possible if the caller stopped parsing complete frames */
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ret = recvmsg(connection->fd, &msg, MSG_DONTWAIT);
+    if (ret > 0) {
+        connection->input_head += ret;
+    }
+
+    return ret;
+}
+
+/* Returns the next len bytes of received data without copying them, unless
+ * they wrap around the end of the ring; then they are copied into scratch.
+ * Either way the bytes may be decoded in place. Returns NULL if fewer than
+ * len bytes have been received. */
+void *connection_peek(Connection *connection, size_t len, void *scratch) {
+    size_t start = connection->input_tail & (CONNECTION_INPUT_SIZE - 1);
+    size_t first;
+
+    if (connection->input_head - connection->input_tail < len) {
+        return NULL;
+    }
+
+    if (start + len <= CONNECTION_INPUT_SIZE) {
+        return connection->input + start;
+    }
+
+    first = CONNECTION_INPUT_SIZE - start;
+    memcpy(scratch, connection->input + start, first);
+    memcpy((unsigned char *)scratch + first, connection->input, len - first);
+
+    return scratch;
+}
+
+void connection_consume(Connection *connection, size_t len) {
+    connection->input_tail += len;
+}
+
+/* Queue a reply for the client. Returns -1 if the client isn't keeping up and
+ * there is no room left; the caller decides whether that is fatal. */
+int connection_queue(Connection *connection, const void *data, size_t len) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+
+    return connection_queuev(connection, &iov, 1);
+}
+
+/* Queue the pieces of one reply (say, a header and its payload) together;
+ * either all of them fit or none are queued */
+int connection_queuev(Connection *connection, const struct iovec *iov, int count) {
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        len += iov[i].iov_len;
+    }
+
+    if (connection->output_offset && connection->output_offset == connection->output_length) {
+        connection->output_offset = connection->output_length = 0;
+    }
+
+    if (connection->output_length + len > sizeof(connection->output)) {
+        /* Reclaim the already sent prefix before giving up */
+        memmove(connection->output, connection->output + connection->output_offset,
+                connection->output_length - connection->output_offset);
+        connection->output_length -= connection->output_offset;
+        connection->output_offset = 0;
+        if (connection->output_length + len > sizeof(connection->output)) {
+            connection->dropped++;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        memcpy(connection->output + connection->output_length, iov[i].iov_base,
+               iov[i].iov_len);
+        connection->output_length += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+/* Send as much queued output as the socket takes. Returns 0 when everything
+ * was sent, 1 if the socket is full (wait for EPOLLOUT) and -1 on error. */
+int connection_flush(Connection *connection) {
+    ssize_t ret;
+
+    while (connection->output_offset < connection->output_length) {
+        ret = send(connection->fd, connection->output + connection->output_offset,
+                   connection->output_length - connection->output_offset,
+                   MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        if (ret == -1) {
+            return -1;
+        }
+        connection->output_offset += ret;
+    }
+
+    connection->output_offset = connection->output_length = 0;
+
+    return 0;
+}
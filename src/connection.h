@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __connection_h__
+#define __connection_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+
+#include "stewart-pubsub.h"
+#include "local.h"
+
+#define CONNECTION_MAX_DEFAULT  4096
+
+#define CONNECTION_INPUT_SIZE   4096 /* Power of two; ~29 messages */
+#define CONNECTION_OUTPUT_SIZE  (sizeof(StewartMessage) * 4)
+
+#define CONNECTION_WEBSOCKET_UPGRADE 1 /* Waiting for the HTTP upgrade */
+#define CONNECTION_WEBSOCKET         2 /* Messages travel in WebSocket frames */
+
+typedef struct _Connection Connection;
+typedef struct _ConnectionPool ConnectionPool;
+
+/* Per client state. Connections are preallocated by the pool and handed
+ * out from a free list, so accepting and dropping a client is O(1) and
+ * never allocates. */
+struct _Connection {
+    int fd;                  /* -1 once closed */
+    int id;                  /* Slot in the pool; stable while open */
+    struct sockaddr_in peer;
+
+    /* Receive ring. head and tail only ever increase; the ring index is
+     * taken modulo CONNECTION_INPUT_SIZE */
+    unsigned char input[CONNECTION_INPUT_SIZE];
+    size_t input_head;       /* Bytes received */
+    size_t input_tail;       /* Bytes parsed */
+
+    unsigned char output[CONNECTION_OUTPUT_SIZE];
+    size_t output_offset;    /* First byte not yet sent */
+    size_t output_length;    /* Bytes queued in output */
+
+    int protocol;            /* 0 until the first message, then the
+                              * STEWART_PROTOCOL* version the client speaks */
+    uint16_t request;        /* v2 id of the record being handled */
+    int websocket;           /* 0 for plain TCP, else CONNECTION_WEBSOCKET* */
+
+    unsigned long received;  /* Messages received */
+    unsigned long dropped;   /* Replies dropped; output was full */
+
+    /* Status subscription (STEWART_MESSAGE_SUBSCRIBE) */
+    int subscribed;
+    uint32_t subscribe_fields;
+    long long subscribe_period;  /* us between updates */
+    long long subscribe_next;    /* now_usec() the next update is due */
+    int status_pending;          /* Update waiting for output to drain */
+    unsigned long conflated;     /* Updates replaced before being sent */
+
+    /* History query being answered (STEWART_MESSAGE_HISTORY) */
+    int history;
+    uint16_t history_id;         /* Request id the records carry */
+    uint64_t history_next;       /* Next history entry to send */
+    uint64_t history_end;        /* One past the last */
+
+    /* Local clients (Unix socket) exchange messages through shared memory
+     * rings instead of the socket */
+    LocalChannel *channel;
+    int channel_fd;              /* memfd behind it, for a hot restart */
+    int wake;                    /* eventfd the client writes */
+    int notify;                  /* eventfd the server writes */
+
+    Connection *prev;        /* Open list, or free list (next only) */
+    Connection *next;
+    Connection *sub_prev;    /* Subscriber list */
+    Connection *sub_next;
+};
+
+ConnectionPool *connection_pool_create(int size);
+void connection_pool_delete(ConnectionPool *pool);
+int connection_pool_get_size(ConnectionPool *pool);
+int connection_pool_get_count(ConnectionPool *pool);
+Connection *connection_pool_get(ConnectionPool *pool, int id);
+Connection *connection_pool_first(ConnectionPool *pool);
+Connection *connection_pool_first_subscriber(ConnectionPool *pool);
+int connection_pool_get_subscribers(ConnectionPool *pool);
+void connection_pool_reap(ConnectionPool *pool);
+
+Connection *connection_open(ConnectionPool *pool, int fd, const struct sockaddr_in *peer);
+void connection_close(ConnectionPool *pool, Connection *connection);
+void connection_subscribe(ConnectionPool *pool, Connection *connection,
+                          uint32_t fields, long long period);
+void connection_unsubscribe(ConnectionPool *pool, Connection *connection);
+
+ssize_t connection_receive(Connection *connection, size_t *requested);
+void *connection_peek(Connection *connection, size_t len, void *scratch);
+void connection_consume(Connection *connection, size_t len);
+
+int connection_queue(Connection *connection, const void *data, size_t len);
+int connection_queuev(Connection *connection, const struct iovec *iov, int count);
+int connection_flush(Connection *connection);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stewart.h"
+#include "config.h"
+#include "recording.h"
+
+void usage(void);
+void *readAll(FILE *in, size_t *length);
+
+void usage(void) {
+    fprintf(stderr,
+        "usage: convert [-t|-b|-z] [INPUT [OUTPUT]]\n"
+        "\n"
+        "Converts recordings between the text format ('record') and the binary\n"
+        "one ('record -b'). The input format is detected; by default the output\n"
+        "is the other one. INPUT and OUTPUT default to STDIN and STDOUT.\n"
+        "\n"
+        "  -t  Write text\n"
+        "  -b  Write a binary recording\n"
+        "  -z  Write a compressed binary recording\n"
+        "\n"
+        "Text recordings don't say which rig they were made on, so binary ones\n"
+        "made from them carry the hash of the current stewart.cfg. Lines without\n"
+        "numbers are dropped.\n");
+}
+
+void *readAll(FILE *in, size_t *length) {
+    size_t size = 65536, got;
+    char *data = NULL, *grown;
+
+    *length = 0;
+    while (1) {
+        grown = realloc(data, size);
+        if (!grown) {
+            fprintf(stderr, "ERROR: Out of memory reading recording\n");
+            free(data);
+            return NULL;
+        }
+        data = grown;
+        got = fread(data + *length, 1, size - *length, in);
+        *length += got;
+        if (*length < size) {
+            break;
+        }
+        size *= 2;
+    }
+    if (ferror(in)) {
+        fprintf(stderr, "ERROR: Unable to read recording: %s\n", strerror(errno));
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    RecordingReader *reader = NULL;
+    RecordingWriter *writer = NULL;
+    RecordingFrame frame;
+    StewartConfig config;
+    FILE *in = stdin, *out = stdout;
+    char line[1024];
+    int text = -1, flags = 0, opt, c, rc = 0;
+    long frames = 0, skipped = 0;
+    size_t length;
+    uint32_t hash;
+    void *data = NULL;
+
+    while ((opt = getopt(argc, argv, "tbzh")) != -1) {
+        switch (opt) {
+        case 't':
+            text = 1;
+            break;
+        case 'z':
+            flags |= RECORDING_COMPRESSED;
+            /* fall through */
+        case 'b':
+            text = 0;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (argc - optind > 2) {
+        usage();
+        return 1;
+    }
+
+    if (optind < argc && strcmp(argv[optind], "-")) {
+        in = fopen(argv[optind], "r");
+        if (!in) {
+            fprintf(stderr, "ERROR: Unable to open '%s': %s\n", argv[optind],
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    c = getc(in);
+    ungetc(c, in);
+    if (c == RECORDING_MAGIC[0]) {
+        data = readAll(in, &length);
+        if (!data) {
+            return -1;
+        }
+        reader = recording_reader_create(data, length);
+        if (!reader) {
+            free(data);
+            return -1;
+        }
+        hash = recording_reader_get_header(reader)->config_hash;
+        if (text < 0) {
+            text = 1;
+        }
+    } else {
+        config_get(&config);
+        hash = config_hash(&config);
+        if (text < 0) {
+            text = 0;
+        }
+    }
+
+    if (optind + 1 < argc) {
+        out = fopen(argv[optind + 1], "w");
+        if (!out) {
+            fprintf(stderr, "ERROR: Unable to create '%s': %s\n", argv[optind + 1],
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    if (!text) {
+        writer = recording_writer_create(out, hash, flags);
+        if (!writer) {
+            return -1;
+        }
+    }
+
+    while (1) {
+        if (reader) {
+            rc = recording_read(reader, &frame);
+            if (rc <= 0) {
+                break;
+            }
+        } else {
+            if (fgets(line, sizeof(line), in) != line) {
+                break;
+            }
+            if (recording_parse_line(line, &frame) || !frame.count) {
+                skipped++;
+                continue;
+            }
+        }
+
+        if (writer) {
+            if (recording_write(writer, &frame)) {
+                rc = -1;
+                break;
+            }
+        } else {
+            if (recording_format_line(&frame, line, sizeof(line)) < 0) {
+                fprintf(stderr, "ERROR: Frame at %lldms is too long for a line\n",
+                        (long long)(frame.usec / 1000));
+                rc = -1;
+                break;
+            }
+            fputs(line, out);
+        }
+        frames++;
+    }
+
+    if (writer && recording_writer_finish(writer)) {
+        rc = -1;
+    }
+    if (fflush(out) || ferror(out)) {
+        fprintf(stderr, "ERROR: Unable to write output: %s\n", strerror(errno));
+        rc = -1;
+    }
+    if (skipped) {
+        fprintf(stderr, "Warning: Dropped %ld lines without a time or numbers\n", skipped);
+    }
+    fprintf(stderr, "%ld frames\n", frames);
+
+    if (reader) {
+        recording_reader_delete(reader);
+    }
+    free(data);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return rc < 0 ? -1 : 0;
+}
@@ -10,8 +10,25 @@
 
 void delay(long us) {
   struct timespec tv = {
-    .tv_sec = 0,
-    .tv_nsec = us * 1000
+    .tv_sec = us / 1000000,
+    .tv_nsec = (us % 1000000) * 1000
   };
   while (nanosleep(&tv, &tv));
 }
+
+long long now_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Sleep until CLOCK_MONOTONIC reaches usec, as now_usec() counts it. The
+ * deadline is absolute, so whatever the caller does between sleeps doesn't
+ * add up into drift. Returns -1 if a signal cut the sleep short. */
+int delay_until(long long usec) {
+  struct timespec deadline = {
+    .tv_sec = usec / 1000000,
+    .tv_nsec = (usec % 1000000) * 1000
+  };
+  return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ? -1 : 0;
+}
@@ -10,5 +10,7 @@
 #define __delay_h__
 
 void delay(long us);
+long long now_usec(void); /* CLOCK_MONOTONIC in microseconds */
+int delay_until(long long usec);
 
 #endif
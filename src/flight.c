@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+#define FLIGHT_DUMP_BATCH 32 /* Frames per write while dumping */
+
+struct _FlightRecorder {
+    RecordingFrame *frames;
+    uint64_t mask;                /* Slots - 1; slots are a power of two */
+    RecordingIndexEntry *index;   /* Built by each dump */
+    uint32_t hash;
+    _Alignas(64) atomic_uint_fast64_t head; /* Frames ever logged */
+};
+
+int _flight_write_fd(void *data, const void *bytes, size_t length);
+int64_t _flight_clock(clockid_t clock);
+
+/* Keeps at least size frames */
+FlightRecorder *flight_create(int size, uint32_t hash) {
+    FlightRecorder *flight;
+    uint64_t slots = 2;
+
+    while (slots < size) {
+        slots <<= 1;
+    }
+
+    flight = calloc(1, sizeof(*flight));
+    if (!flight) {
+        return NULL;
+    }
+    /* Touched now, so logging never takes a page fault */
+    flight->frames = calloc(slots, sizeof(*flight->frames));
+    flight->index = calloc(slots / RECORDING_KEYFRAME_INTERVAL + 1, sizeof(*flight->index));
+    if (!flight->frames || !flight->index) {
+        fprintf(stderr, "Error: Out of memory for %lu flight recorder frames\n",
+                (unsigned long)slots);
+        flight_delete(flight);
+        return NULL;
+    }
+    memset(flight->frames, 0, slots * sizeof(*flight->frames));
+    flight->mask = slots - 1;
+    flight->hash = hash;
+    atomic_init(&flight->head, 0);
+
+    return flight;
+}
+
+void flight_delete(FlightRecorder *flight) {
+    free(flight->frames);
+    free(flight->index);
+    free(flight);
+}
+
+/* config_hash() of the rig now, for the next dump's header */
+void flight_set_hash(FlightRecorder *flight, uint32_t hash) {
+    flight->hash = hash;
+}
+
+void flight_record(FlightRecorder *flight, int kind, int64_t usec,
+                   const float *values, int count) {
+    uint64_t head = atomic_load_explicit(&flight->head, memory_order_relaxed);
+    RecordingFrame frame;
+
+    if (count > RECORDING_VALUES_MAX) {
+        count = RECORDING_VALUES_MAX;
+    }
+    memset(&frame, 0, sizeof(frame));
+    frame.usec = usec;
+    frame.count = count;
+    frame.kind = kind;
+    memcpy(frame.values, values, count * sizeof(float));
+
+    flight->frames[head & flight->mask] = frame;
+    atomic_store_explicit(&flight->head, head + 1, memory_order_release);
+}
+
+uint64_t flight_head(FlightRecorder *flight) {
+    return atomic_load_explicit(&flight->head, memory_order_acquire);
+}
+
+int _flight_write_fd(void *data, const void *bytes, size_t length) {
+    int fd = *(int *)data;
+    ssize_t ret;
+
+    while (length) {
+        ret = write(fd, bytes, length);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        bytes = (const char *)bytes + ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+int64_t _flight_clock(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Hand the recording to out a batch of frames at a time. Returns the
+ * frames dumped, or -1 if write gave up. */
+int flight_dump(FlightRecorder *flight, FlightWrite out, void *data) {
+    RecordingFrame frames[FLIGHT_DUMP_BATCH];
+    RecordingIndexEntry *index;
+    RecordingHeader header;
+    RecordingFooter footer;
+    uint64_t head, first, seq, slots = flight->mask + 1;
+    int64_t base = 0, usec = 0;
+    uint32_t count, indexed = 0;
+    int batch = 0;
+
+    head = flight_head(flight);
+    first = head >= slots ? head - slots + 1 : 0;
+    if (first < head) {
+        base = flight->frames[first & flight->mask].usec;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RECORDING_VERSION;
+    header.config_hash = flight->hash;
+    header.start = _flight_clock(CLOCK_REALTIME) - (_flight_clock(CLOCK_MONOTONIC) - base);
+    if (out(data, &header, sizeof(header))) {
+        return -1;
+    }
+
+    for (seq = first; seq < head; seq++) {
+        count = seq - first;
+        frames[batch] = flight->frames[seq & flight->mask];
+        /* Commands are logged as they arrive and the rest on the tick, so
+         * the odd one may be a little behind the frame before it */
+        if (frames[batch].usec - base > usec) {
+            usec = frames[batch].usec - base;
+        }
+        frames[batch].usec = usec;
+        if (!(count % RECORDING_KEYFRAME_INTERVAL)) {
+            index = &flight->index[indexed++];
+            memset(index, 0, sizeof(*index));
+            index->usec = usec;
+            index->offset = sizeof(header) + (uint64_t)count * sizeof(RecordingFrame);
+            index->frame = count;
+        }
+        if (++batch == FLIGHT_DUMP_BATCH || seq + 1 == head) {
+            if (out(data, frames, batch * sizeof(*frames))) {
+                return -1;
+            }
+            batch = 0;
+        }
+    }
+
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = sizeof(header) + (head - first) * sizeof(RecordingFrame);
+    footer.index_count = indexed;
+    footer.frames = head - first;
+    footer.duration = usec;
+    memcpy(footer.magic, RECORDING_FOOTER_MAGIC, sizeof(footer.magic));
+    if ((indexed && out(data, flight->index, indexed * sizeof(*flight->index))) ||
+        out(data, &footer, sizeof(footer))) {
+        return -1;
+    }
+
+    return head - first;
+}
+
+/* Dump to a file at path, replacing it. Returns as flight_dump(). */
+int flight_dump_file(FlightRecorder *flight, const char *path) {
+    int fd, ret;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    ret = flight_dump(flight, _flight_write_fd, &fd);
+    if (close(fd) && ret >= 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __flight_h__
+#define __flight_h__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "recording.h"
+
+/* Flight recorder. The server logs every command it receives, each solve
+ * and every PWM frame it stages as RecordingFrames, tagged with their
+ * RECORDING_KIND_*, into a fixed ring that overwrites the oldest. Logging
+ * a frame is a copy into its slot and a release store of the head: no
+ * locks, allocation or system calls, so it can stay on all the time.
+ *
+ * The ring dumps as an uncompressed recording, oldest frame first, with
+ * times since that frame. flight_dump() and flight_dump_file() only make
+ * async-signal-safe calls, so they can run from a crash handler; the one
+ * slot a frame being logged at the time could have half overwritten is
+ * left out. */
+
+#define FLIGHT_DEFAULT 65536 /* Frames; about 2.5 minutes of 100Hz ticks
+                              * with a command each */
+
+/* Takes length bytes of the dump; returns non-zero to stop it */
+typedef int (*FlightWrite)(void *data, const void *bytes, size_t length);
+
+typedef struct _FlightRecorder FlightRecorder;
+
+FlightRecorder *flight_create(int size, uint32_t hash);
+void flight_delete(FlightRecorder *flight);
+void flight_set_hash(FlightRecorder *flight, uint32_t hash);
+void flight_record(FlightRecorder *flight, int kind, int64_t usec,
+                   const float *values, int count);
+uint64_t flight_head(FlightRecorder *flight);
+
+int flight_dump(FlightRecorder *flight, FlightWrite write, void *data);
+int flight_dump_file(FlightRecorder *flight, const char *path);
+
+#endif
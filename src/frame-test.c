@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "connection.h"
+#include "frame.h"
+#include "websocket.h"
+
+/* Feeds v2 frames, bare and in WebSocket frames, through a connection's
+ * receive ring at every alignment against its end and parses them the way
+ * the server does, then checks that malformed headers are refused. Exits
+ * non-zero if anything fails. */
+
+#define MESSAGES 12
+
+int failures = 0;
+
+ConnectionPool *pool;
+Connection *connection;
+int peer;                     /* Our end of the connection's socket */
+
+StewartMessage sent[MESSAGES];
+int received;                 /* Messages parsed back so far */
+int wrapped;                  /* Peeks that had to copy into scratch */
+
+void expect(int ok, const char *format, ...) {
+    va_list args;
+
+    if (ok) {
+        return;
+    }
+    failures++;
+    printf("FAIL: ");
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+void makeMessages() {
+    int i;
+
+    for (i = 0; i < MESSAGES; i++) {
+        memset(&sent[i], 0, sizeof(sent[i]));
+        sent[i].version = STEWART_PROTOCOL;
+        sent[i].size = sizeof(sent[i]);
+        if (i % 3 == 2) {
+            sent[i].type = STEWART_MESSAGE_SET_TRIM;
+            sent[i].trim.servo = i % 6;
+            sent[i].trim.angle = -0.5f * i;
+        } else {
+            /* Quantized ones survive exactly: these are whole 1/100ths of
+             * a degree and 1/1000ths of an inch */
+            sent[i].type = STEWART_MESSAGE_SET_EUCLIDEAN;
+            sent[i].euclidean.yaw = 12.5f - i;
+            sent[i].euclidean.pitch = -3.75f;
+            sent[i].euclidean.translate.z = 0.25f * i;
+        }
+    }
+}
+
+/* A v2 frame holding messages first to first + count - 1 */
+size_t makeFrame(int first, int count, uint8_t *out) {
+    StewartFrame frame;
+    size_t length;
+    int i;
+
+    stewart_frame_begin(&frame);
+    for (i = first; i < first + count; i++) {
+        stewart_frame_add(&frame, &sent[i], i, i % 2);
+    }
+    length = stewart_frame_end(&frame);
+    memcpy(out, frame.data, length);
+
+    return length;
+}
+
+/* Wrap a payload the way a browser would: masked, in one frame */
+size_t makeWebSocket(const uint8_t *payload, size_t length, uint8_t *out) {
+    uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    size_t header;
+
+    header = websocket_header(out, WEBSOCKET_OP_BINARY, length);
+    out[1] |= 0x80;
+    memcpy(out + header, mask, sizeof(mask));
+    header += sizeof(mask);
+    memcpy(out + header, payload, length);
+    websocket_unmask(out + header, length, mask);
+
+    return header + length;
+}
+
+/* Empty the ring and leave its tail offset bytes before the end */
+void alignRing(size_t offset) {
+    connection->input_head = connection->input_tail = CONNECTION_INPUT_SIZE * 3 - offset;
+}
+
+void feed(const uint8_t *data, size_t length) {
+    size_t requested;
+
+    if (send(peer, data, length, 0) != length ||
+        connection_receive(connection, &requested) != length) {
+        fprintf(stderr, "Error: Unable to feed %zu bytes\n", length);
+        exit(1);
+    }
+}
+
+void *peek(size_t length, void *scratch) {
+    void *data = connection_peek(connection, length, scratch);
+
+    if (data == scratch) {
+        wrapped++;
+    }
+    return data;
+}
+
+/* Check each record of a whole v2 frame against what was sent */
+int checkFrame(const uint8_t *data, size_t length) {
+    StewartMessage message;
+    size_t offset = 0;
+    uint16_t id;
+    int ret;
+
+    if (stewart_frame_check(data, length) != length) {
+        return -1;
+    }
+    while ((ret = stewart_frame_next(data, length, &offset, &message, &id)) == 1) {
+        if (received == MESSAGES || id != received ||
+            memcmp(&message, &sent[received], sizeof(message))) {
+            return -1;
+        }
+        received++;
+    }
+    return ret;
+}
+
+/* As parseStream does. Returns -1 on a bad frame. */
+int parseStream() {
+    uint8_t scratch[STEWART_FRAME_MAX];
+    const uint8_t *data;
+    int length;
+
+    while ((data = peek(sizeof(StewartFrameHeader), scratch))) {
+        length = stewart_frame_check(data, sizeof(StewartFrameHeader));
+        if (length < 0) {
+            return -1;
+        }
+        if (!(data = peek(length, scratch))) {
+            break;
+        }
+        if (checkFrame(data, length)) {
+            return -1;
+        }
+        connection_consume(connection, length);
+    }
+    return 0;
+}
+
+/* As parseWebSocket does once upgraded. Returns -1 on a bad frame. */
+int parseWebSocket() {
+    uint8_t scratch[CONNECTION_INPUT_SIZE];
+    WebSocketFrame frame;
+    size_t available;
+    uint8_t *data;
+    int ret;
+
+    while ((available = connection->input_head - connection->input_tail)) {
+        if (available > WEBSOCKET_HEADER_MAX) {
+            available = WEBSOCKET_HEADER_MAX;
+        }
+        data = peek(available, scratch);
+        ret = websocket_parse(data, available, &frame);
+        if (ret == 0) {
+            break;
+        }
+        if (ret < 0 || frame.length > CONNECTION_INPUT_SIZE - frame.header ||
+            frame.opcode != WEBSOCKET_OP_BINARY) {
+            return -1;
+        }
+        if (!(data = peek(frame.header + frame.length, scratch))) {
+            break;
+        }
+        websocket_unmask(data + frame.header, frame.length, frame.mask);
+        if (checkFrame(data + frame.header, frame.length)) {
+            return -1;
+        }
+        connection_consume(connection, frame.header + frame.length);
+    }
+    return 0;
+}
+
+/* Send stream at every alignment against the end of the ring, in two
+ * pieces split at every byte, and parse it back */
+void testStream(const char *name, const uint8_t *stream, size_t length, int (*parse)()) {
+    size_t offset, split;
+
+    wrapped = 0;
+    for (offset = 1; offset <= length; offset++) {
+        for (split = 1; split < length; split++) {
+            alignRing(offset);
+            received = 0;
+            feed(stream, split);
+            expect(!parse(), "%s: bad frame with %zu of %zu bytes at %zu from the end",
+                   name, split, length, offset);
+            feed(stream + split, length - split);
+            expect(!parse(), "%s: bad frame at %zu from the end", name, offset);
+            expect(received == MESSAGES && connection->input_tail == connection->input_head,
+                   "%s: %d messages back at %zu from the end, split at %zu",
+                   name, received, offset, split);
+        }
+    }
+    expect(wrapped > 0, "%s: nothing wrapped", name);
+}
+
+void testWebSocketHeaders() {
+    size_t lengths[] = { 0, 125, 126, 0xffff, 0x10000, 0x7fffffffffffffffULL };
+    uint8_t header[WEBSOCKET_HEADER_MAX];
+    WebSocketFrame frame;
+    size_t length, i, cut;
+
+    /* What websocket_header writes parses back once masked */
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        length = websocket_header(header, WEBSOCKET_OP_BINARY, lengths[i]);
+        header[1] |= 0x80;
+        memset(header + length, 0x5a, 4);
+        length += 4;
+        for (cut = 0; cut < length; cut++) {
+            expect(websocket_parse(header, cut, &frame) == 0,
+                   "length %zu parsed from %zu header bytes", lengths[i], cut);
+        }
+        expect(websocket_parse(header, length, &frame) == 1 && frame.length == lengths[i] &&
+               frame.header == length && frame.fin && frame.opcode == WEBSOCKET_OP_BINARY,
+               "length %zu did not round trip", lengths[i]);
+    }
+
+    /* Unmasked */
+    memcpy(header, "\x82\x05", 2);
+    expect(websocket_parse(header, 6, &frame) == -1, "unmasked frame accepted");
+    /* Reserved bit */
+    memcpy(header, "\xc2\x85", 2);
+    expect(websocket_parse(header, 6, &frame) == -1, "reserved bit accepted");
+    /* 16-bit length that fits in 7 */
+    memcpy(header, "\x82\xfe\x00\x7d", 4);
+    expect(websocket_parse(header, 8, &frame) == -1, "overlong 16-bit length accepted");
+    /* 64-bit length that fits in 16 */
+    memcpy(header, "\x82\xff\x00\x00\x00\x00\x00\x00\xff\xff", 10);
+    expect(websocket_parse(header, 14, &frame) == -1, "overlong 64-bit length accepted");
+    /* 64-bit length with the top bit set; it would wrap added to the header */
+    memcpy(header, "\x82\xff\xff\xff\xff\xff\xff\xff\xff\xf8", 10);
+    expect(websocket_parse(header, 14, &frame) == -1, "top bit of 64-bit length accepted");
+    /* Control frames longer than 125 bytes or fragmented */
+    memcpy(header, "\x89\xfe\x00\x7e", 4);
+    expect(websocket_parse(header, 8, &frame) == -1, "long ping accepted");
+    memcpy(header, "\x09\x80", 2);
+    expect(websocket_parse(header, 6, &frame) == -1, "fragmented ping accepted");
+}
+
+void testFrameHeaders() {
+    StewartFrameHeader header = { sizeof(header), STEWART_PROTOCOL_V2, 0 };
+    uint8_t data[STEWART_FRAME_MAX];
+    StewartMessage message;
+    size_t length, offset = 0;
+    uint16_t id;
+
+    expect(stewart_frame_check(&header, sizeof(header) - 1) == 0, "short header checked");
+    expect(stewart_frame_check(&header, sizeof(header)) == sizeof(header), "empty frame refused");
+    header.version = STEWART_PROTOCOL;
+    expect(stewart_frame_check(&header, sizeof(header)) == -1, "v1 frame accepted");
+    header.version = STEWART_PROTOCOL_V2;
+    header.length = sizeof(header) - 1;
+    expect(stewart_frame_check(&header, sizeof(header)) == -1, "frame shorter than header accepted");
+    header.length = STEWART_FRAME_MAX + 1;
+    expect(stewart_frame_check(&header, sizeof(header)) == -1, "oversized frame accepted");
+
+    /* A record running past the end of its frame */
+    length = makeFrame(0, 1, data);
+    expect(stewart_frame_next(data, length - 1, &offset, &message, &id) == -1,
+           "record past the end of the frame accepted");
+}
+
+int main() {
+    uint8_t stream[CONNECTION_INPUT_SIZE], frame[STEWART_FRAME_MAX];
+    size_t length, stream_length = 0;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        perror("Error: socketpair");
+        return 1;
+    }
+    pool = connection_pool_create(1);
+    connection = pool ? connection_open(pool, fds[0], NULL) : NULL;
+    if (!connection) {
+        return 1;
+    }
+    peer = fds[1];
+    makeMessages();
+
+    /* A small frame, then one too big for a 7-bit WebSocket length */
+    stream_length += makeFrame(0, 2, stream);
+    stream_length += makeFrame(2, MESSAGES - 2, stream + stream_length);
+    testStream("stream", stream, stream_length, parseStream);
+
+    stream_length = 0;
+    length = makeFrame(0, 2, frame);
+    stream_length += makeWebSocket(frame, length, stream);
+    length = makeFrame(2, MESSAGES - 2, frame);
+    expect(length >= 126, "second frame takes a 7-bit WebSocket length");
+    stream_length += makeWebSocket(frame, length, stream + stream_length);
+    testStream("websocket", stream, stream_length, parseWebSocket);
+
+    testWebSocketHeaders();
+    testFrameHeaders();
+
+    connection_close(pool, connection);
+    connection_pool_delete(pool);
+    close(peer);
+
+    if (failures) {
+        printf("%d failed\n", failures);
+        return 1;
+    }
+    printf("frame: ok\n");
+    return 0;
+}
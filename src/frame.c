@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include "frame.h"
+
+int _frame_payload_size(uint8_t type, uint8_t flags);
+int _frame_quantize(const float *values, const float *scales, int16_t *q, int count);
+
+/* Every payload starts at the beginning of the message union */
+#define PAYLOAD_OFFSET offsetof(StewartMessage, axisAngle)
+
+/* Bytes of payload a record of this type carries, or -1 if unknown */
+int _frame_payload_size(uint8_t type, uint8_t flags) {
+    StewartMessage *m = NULL;
+
+    switch (type) {
+        case STEWART_MESSAGE_SET_AXISANGLE:
+            return (flags & STEWART_RECORD_QUANTIZED) ?
+                sizeof(StewartQuantizedAxisAngle) : sizeof(m->axisAngle);
+        case STEWART_MESSAGE_SET_EUCLIDEAN:
+            return (flags & STEWART_RECORD_QUANTIZED) ?
+                sizeof(StewartQuantizedEuclidean) : sizeof(m->euclidean);
+        case STEWART_MESSAGE_GET_STATUS:
+            return 0;
+        case STEWART_MESSAGE_STATUS:
+            return sizeof(m->status);
+        case STEWART_MESSAGE_SET_TRIM:
+            return sizeof(m->trim);
+        case STEWART_MESSAGE_SUBSCRIBE:
+            return sizeof(m->subscribe);
+        case STEWART_MESSAGE_HELLO:
+            return sizeof(m->hello);
+        case STEWART_MESSAGE_CLOCK:
+            return sizeof(m->clock);
+        case STEWART_MESSAGE_SCHEDULE:
+            return sizeof(m->schedule);
+        case STEWART_MESSAGE_HISTORY:
+            return sizeof(m->history);
+        case STEWART_MESSAGE_SET_COUNTS:
+            return sizeof(m->counts);
+        default:
+            return -1;
+    }
+}
+
+/* Returns -1 if any value doesn't fit in an int16 at its scale */
+int _frame_quantize(const float *values, const float *scales, int16_t *q, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        float scaled = values[i] * scales[i];
+        if (scaled < -32767.0f || scaled > 32767.0f) {
+            return -1;
+        }
+        q[i] = (int16_t)(scaled >= 0 ? scaled + 0.5f : scaled - 0.5f);
+    }
+    return 0;
+}
+
+void stewart_frame_begin(StewartFrame *frame) {
+    frame->length = sizeof(StewartFrameHeader);
+    frame->records = 0;
+}
+
+/* Append message as a record. quantize asks for the int16 encoding of a
+ * pose; poses with values out of its range are sent as floats anyway.
+ * Returns -1 if the frame is full or the message type has no encoding. */
+int stewart_frame_add(StewartFrame *frame, const StewartMessage *message,
+                      uint16_t id, int quantize) {
+    StewartRecordHeader record;
+    int16_t q[7];
+    const void *payload = (const uint8_t *)message + PAYLOAD_OFFSET;
+    int size;
+
+    record.type = message->type;
+    record.flags = 0;
+
+    /* Both quantized layouts are the fields in message order as int16 */
+    if (quantize && message->type == STEWART_MESSAGE_SET_AXISANGLE) {
+        const float values[7] = {
+            message->axisAngle.x, message->axisAngle.y, message->axisAngle.z,
+            message->axisAngle.angle, message->axisAngle.translate.x,
+            message->axisAngle.translate.y, message->axisAngle.translate.z
+        };
+        const float scales[7] = {
+            STEWART_QUANTIZE_AXIS, STEWART_QUANTIZE_AXIS, STEWART_QUANTIZE_AXIS,
+            STEWART_QUANTIZE_ANGLE, STEWART_QUANTIZE_TRANSLATE,
+            STEWART_QUANTIZE_TRANSLATE, STEWART_QUANTIZE_TRANSLATE
+        };
+        if (!_frame_quantize(values, scales, q, 7)) {
+            record.flags |= STEWART_RECORD_QUANTIZED;
+            payload = q;
+        }
+    } else if (quantize && message->type == STEWART_MESSAGE_SET_EUCLIDEAN) {
+        const float values[6] = {
+            message->euclidean.yaw, message->euclidean.pitch, message->euclidean.roll,
+            message->euclidean.translate.x, message->euclidean.translate.y,
+            message->euclidean.translate.z
+        };
+        const float scales[6] = {
+            STEWART_QUANTIZE_ANGLE, STEWART_QUANTIZE_ANGLE, STEWART_QUANTIZE_ANGLE,
+            STEWART_QUANTIZE_TRANSLATE, STEWART_QUANTIZE_TRANSLATE,
+            STEWART_QUANTIZE_TRANSLATE
+        };
+        if (!_frame_quantize(values, scales, q, 6)) {
+            record.flags |= STEWART_RECORD_QUANTIZED;
+            payload = q;
+        }
+    }
+
+    size = _frame_payload_size(record.type, record.flags);
+    if (size < 0) {
+        return -1;
+    }
+
+    return stewart_frame_add_record(frame, record.type, record.flags, id, payload, size);
+}
+
+/* Append a record with its payload as is, for the types whose payload
+ * isn't a StewartMessage field (STEWART_MESSAGE_HISTORY_DATA). Returns -1
+ * if the frame is full. */
+int stewart_frame_add_record(StewartFrame *frame, uint8_t type, uint8_t flags, uint16_t id,
+                             const void *payload, size_t size) {
+    StewartRecordHeader record = {
+        .length = sizeof(record) + size,
+        .type = type,
+        .flags = flags,
+        .id = id
+    };
+
+    if (frame->records == UINT8_MAX ||
+        frame->length + sizeof(record) + size > sizeof(frame->data)) {
+        return -1;
+    }
+
+    memcpy(frame->data + frame->length, &record, sizeof(record));
+    memcpy(frame->data + frame->length + sizeof(record), payload, size);
+    frame->length += record.length;
+    frame->records++;
+
+    return 0;
+}
+
+/* Fill in the header. Returns the number of bytes in frame->data to send. */
+size_t stewart_frame_end(StewartFrame *frame) {
+    StewartFrameHeader header = {
+        .length = frame->length,
+        .version = STEWART_PROTOCOL_V2,
+        .records = frame->records
+    };
+
+    memcpy(frame->data, &header, sizeof(header));
+    return frame->length;
+}
+
+/* Look at the start of a frame. Returns its length once the header is
+ * available, 0 if more bytes are needed and -1 if it isn't a valid frame. */
+int stewart_frame_check(const void *data, size_t available) {
+    StewartFrameHeader header;
+
+    if (available < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (header.version != STEWART_PROTOCOL_V2 || header.length < sizeof(header) ||
+        header.length > STEWART_FRAME_MAX) {
+        return -1;
+    }
+
+    return header.length;
+}
+
+/* Step to the record at *offset (start at 0) of a complete frame, hand
+ * back its header and payload and advance past it. Returns 1 for a record,
+ * 0 at the end of the frame and -1 if the frame is malformed. */
+int stewart_frame_next_record(const void *frame, size_t length, size_t *offset,
+                              StewartRecordHeader *record, const uint8_t **payload) {
+    const uint8_t *data = frame;
+
+    if (*offset == 0) {
+        *offset = sizeof(StewartFrameHeader);
+    }
+    if (*offset == length) {
+        return 0;
+    }
+    if (*offset + sizeof(*record) > length) {
+        return -1;
+    }
+
+    memcpy(record, data + *offset, sizeof(*record));
+    if (record->length < sizeof(*record) || *offset + record->length > length) {
+        return -1;
+    }
+    *payload = data + *offset + sizeof(*record);
+    *offset += record->length;
+
+    return 1;
+}
+
+/* Decode a record into a v1 message. Returns -1 if its payload is the
+ * wrong size for its type. Unknown record types, and those with a payload
+ * of their own, decode to a message with just the type set. */
+int stewart_frame_decode(const StewartRecordHeader *record, const uint8_t *payload,
+                         StewartMessage *message) {
+    int size;
+
+    memset(message, 0, sizeof(*message));
+    message->version = STEWART_PROTOCOL;
+    message->size = sizeof(*message);
+    message->type = record->type;
+
+    size = _frame_payload_size(record->type, record->flags);
+    if (size < 0) {
+        return 0;
+    }
+    if (record->length != sizeof(*record) + size) {
+        return -1;
+    }
+
+    if ((record->flags & STEWART_RECORD_QUANTIZED) &&
+        record->type == STEWART_MESSAGE_SET_AXISANGLE) {
+        StewartQuantizedAxisAngle q;
+        memcpy(&q, payload, sizeof(q));
+        message->axisAngle.x = q.x / STEWART_QUANTIZE_AXIS;
+        message->axisAngle.y = q.y / STEWART_QUANTIZE_AXIS;
+        message->axisAngle.z = q.z / STEWART_QUANTIZE_AXIS;
+        message->axisAngle.angle = q.angle / STEWART_QUANTIZE_ANGLE;
+        message->axisAngle.translate.x = q.translate[0] / STEWART_QUANTIZE_TRANSLATE;
+        message->axisAngle.translate.y = q.translate[1] / STEWART_QUANTIZE_TRANSLATE;
+        message->axisAngle.translate.z = q.translate[2] / STEWART_QUANTIZE_TRANSLATE;
+    } else if ((record->flags & STEWART_RECORD_QUANTIZED) &&
+               record->type == STEWART_MESSAGE_SET_EUCLIDEAN) {
+        StewartQuantizedEuclidean q;
+        memcpy(&q, payload, sizeof(q));
+        message->euclidean.yaw = q.yaw / STEWART_QUANTIZE_ANGLE;
+        message->euclidean.pitch = q.pitch / STEWART_QUANTIZE_ANGLE;
+        message->euclidean.roll = q.roll / STEWART_QUANTIZE_ANGLE;
+        message->euclidean.translate.x = q.translate[0] / STEWART_QUANTIZE_TRANSLATE;
+        message->euclidean.translate.y = q.translate[1] / STEWART_QUANTIZE_TRANSLATE;
+        message->euclidean.translate.z = q.translate[2] / STEWART_QUANTIZE_TRANSLATE;
+    } else {
+        memcpy((uint8_t *)message + PAYLOAD_OFFSET, payload, size);
+    }
+
+    return 0;
+}
+
+/* Decode the record at *offset (start at 0) of a complete frame into a v1
+ * message and advance past it. Returns 1 for a record, 0 at the end of the
+ * frame and -1 if the frame is malformed. */
+int stewart_frame_next(const void *frame, size_t length, size_t *offset,
+                       StewartMessage *message, uint16_t *id) {
+    StewartRecordHeader record;
+    const uint8_t *payload;
+    int ret;
+
+    ret = stewart_frame_next_record(frame, length, offset, &record, &payload);
+    if (ret != 1) {
+        return ret;
+    }
+    *id = record.id;
+
+    return stewart_frame_decode(&record, payload, message) ? -1 : 1;
+}
+
+/* Blocking read of one whole frame from a socket into frame->data. Returns
+ * the frame length, or -1 on error, a bad frame or the server closing. */
+int stewart_frame_recv(int sock, StewartFrame *frame) {
+    int length;
+
+    if (recv(sock, frame->data, sizeof(StewartFrameHeader), MSG_WAITALL) !=
+        sizeof(StewartFrameHeader)) {
+        return -1;
+    }
+    length = stewart_frame_check(frame->data, sizeof(StewartFrameHeader));
+    if (length <= 0) {
+        return -1;
+    }
+    if (length > sizeof(StewartFrameHeader) &&
+        recv(sock, frame->data + sizeof(StewartFrameHeader),
+             length - sizeof(StewartFrameHeader), MSG_WAITALL) !=
+        length - sizeof(StewartFrameHeader)) {
+        return -1;
+    }
+
+    frame->length = length;
+    return length;
+}
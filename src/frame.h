@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __frame_h__
+#define __frame_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stewart-pubsub.h"
+
+/* Protocol v2 framing. Messages are still handled as StewartMessage on
+ * either side; these convert them to and from compact records. */
+
+typedef struct _StewartFrame {
+    uint8_t data[STEWART_FRAME_MAX];
+    size_t length;
+    int records;
+} StewartFrame;
+
+void stewart_frame_begin(StewartFrame *frame);
+int stewart_frame_add(StewartFrame *frame, const StewartMessage *message,
+                      uint16_t id, int quantize);
+int stewart_frame_add_record(StewartFrame *frame, uint8_t type, uint8_t flags, uint16_t id,
+                             const void *payload, size_t size);
+size_t stewart_frame_end(StewartFrame *frame);
+
+int stewart_frame_check(const void *data, size_t available);
+int stewart_frame_next_record(const void *frame, size_t length, size_t *offset,
+                              StewartRecordHeader *record, const uint8_t **payload);
+int stewart_frame_decode(const StewartRecordHeader *record, const uint8_t *payload,
+                         StewartMessage *message);
+int stewart_frame_next(const void *frame, size_t length, size_t *offset,
+                       StewartMessage *message, uint16_t *id);
+int stewart_frame_recv(int sock, StewartFrame *frame);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "handoff.h"
+
+/* Send one message with count descriptors attached */
+int handoff_send(int sock, const void *data, size_t length, const int *fds, int count) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = length };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_MAX)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1
+    };
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    if (count > HANDOFF_FDS_MAX || length > HANDOFF_MESSAGE_MAX) {
+        return -1;
+    }
+
+    if (count) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+
+    do {
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret == length ? 0 : -1;
+}
+
+/* Receive one message. On entry *count is the room in fds; on return it
+ * is the number of descriptors that came with the message. Returns the
+ * message length, 0 if the peer closed, or -1. */
+ssize_t handoff_recv(int sock, void *data, size_t size, int *fds, int *count) {
+    struct iovec iov = { .iov_base = data, .iov_len = size };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_MAX)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    struct cmsghdr *cmsg;
+    int received = 0, i;
+    ssize_t ret;
+
+    do {
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret == -1 && errno == EINTR);
+    if (ret <= 0) {
+        *count = 0;
+        return ret;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            break;
+        }
+    }
+
+    /* Never leak descriptors the caller can't take */
+    if (received > *count || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (i = 0; cmsg && i < received; i++) {
+            close(((int *)CMSG_DATA(cmsg))[i]);
+        }
+        *count = 0;
+        fprintf(stderr, "Error: Handoff message too large\n");
+        return -1;
+    }
+
+    if (received) {
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * received);
+    }
+    *count = received;
+
+    return ret;
+}
+
+/* Bound how long either side blocks on the other (ms) */
+int handoff_set_timeout(int sock, int timeout) {
+    struct timeval tv = {
+        .tv_sec = timeout / 1000,
+        .tv_usec = (timeout % 1000) * 1000
+    };
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) {
+        return -1;
+    }
+    return 0;
+}
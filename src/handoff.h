@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __handoff_h__
+#define __handoff_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+#include <sys/types.h>
+
+#include "pca9685.h"
+#include "stewart.h"
+
+/* Hot restart. A server started with -H PATH listens there (a Unix
+ * SOCK_SEQPACKET socket) for its successor. A new server started with the
+ * same -H PATH connects, and the running one sends it, with SCM_RIGHTS,
+ * its listening sockets and every client socket together with the pose,
+ * trims, PWM shadow and tick phase. The old server exits once the new one
+ * has acknowledged; the new one commits nothing until then, so the servos
+ * see no reset and no gap.
+ *
+ *   new -> old  HandoffRequest
+ *   old -> new  HandoffState, listening sockets attached
+ *   old -> new  connection batches: HandoffBatch, then per connection a
+ *               HandoffConnection and its unread input and unsent output,
+ *               the sockets attached in the same order. A local client's
+ *               socket is followed by its channel memfd and wake and
+ *               notify eventfds (LOCAL_FD_* order), so its shared memory
+ *               rings carry on as they are.
+ *   new -> old  one byte: taken over
+ *
+ * Both ends must be built from the same source; the request carries the
+ * sizes of the structures and a mismatch is refused. */
+
+#define HANDOFF_MAGIC          0x48545453 /* "STTH" */
+#define HANDOFF_VERSION        2
+#define HANDOFF_MESSAGE_MAX    65536
+#define HANDOFF_FDS_MAX        64         /* Per message; SCM_MAX_FD is 253 */
+#define HANDOFF_TIMEOUT        2000       /* ms either side waits */
+#define HANDOFF_SCHEDULE_MAX   64         /* Scheduled poses carried over */
+
+/* Listening sockets, by role */
+#define HANDOFF_LISTEN_TCP       0
+#define HANDOFF_LISTEN_UDP       1
+#define HANDOFF_LISTEN_WEBSOCKET 2
+#define HANDOFF_LISTEN_METRICS   3
+#define HANDOFF_LISTEN_LOCAL     4
+#define HANDOFF_LISTEN_HANDOFF   5
+#define HANDOFF_LISTEN_OSC       6
+#define HANDOFF_LISTEN_TELEMETRY 7
+#define HANDOFF_LISTENERS        8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state_size;      /* sizeof(HandoffState) */
+    uint32_t connection_size; /* sizeof(HandoffConnection) */
+} HandoffRequest;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t listeners;       /* Bit per HANDOFF_LISTEN_* attached, in order */
+    uint32_t connections;     /* Connections in the batches that follow */
+
+    /* Pose as last solved and committed */
+    Transform transform;
+    float origin[3];
+    Solution solutions[6];
+    float rotation[9];
+    int32_t pose_pending;     /* A newer pose is waiting for the tick */
+    uint32_t scheduled;       /* Poses waiting for their time, oldest first */
+    struct {
+        int64_t usec;
+        Transform transform;
+    } schedule[HANDOFF_SCHEDULE_MAX];
+    float servo_trim[6];
+
+    int64_t last_tick;        /* now_usec() of the last PWM commit */
+    int64_t tick_due;         /* Next expiry of the tick timer; 0 if it
+                               * isn't running */
+    uint32_t multicast_sequence;
+
+    int32_t boards;
+    PCA9685Shadow shadows[PCA9685_GROUP_MAX];
+} HandoffState;
+
+typedef struct {
+    uint32_t count;           /* HandoffConnection records in this message */
+} HandoffBatch;
+
+typedef struct {
+    struct sockaddr_in peer;
+    int32_t protocol;
+    int32_t websocket;
+    uint64_t received;
+    int32_t subscribed;
+    uint32_t subscribe_fields;
+    int32_t status_pending;
+    int64_t subscribe_period;
+    int64_t subscribe_next;
+    int32_t history;           /* Answering a history query */
+    uint16_t history_id;
+    uint16_t input_length;     /* Bytes of input, then output, follow */
+    uint16_t output_length;
+    int32_t local;             /* LOCAL_FDS more descriptors follow its
+                                * socket */
+} HandoffConnection;
+
+int handoff_send(int sock, const void *data, size_t length, const int *fds, int count);
+ssize_t handoff_recv(int sock, void *data, size_t size, int *fds, int *count);
+int handoff_set_timeout(int sock, int timeout);
+
+#endif
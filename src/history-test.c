@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "varint.h"
+
+/* Round trips status history through the delta encoding, in chunks, and
+ * checks that cut or malformed chunks are refused. Exits non-zero if
+ * anything fails. */
+
+#define SIZE    64
+#define ENTRIES 100 /* Laps the ring */
+#define CHUNK   256 /* Small enough to take several chunks */
+
+int failures = 0;
+
+void expect(int ok, const char *format, ...) {
+    va_list args;
+
+    if (ok) {
+        return;
+    }
+    failures++;
+    printf("FAIL: ");
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+void makeEntry(int n, HistoryEntry *entry) {
+    int i;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->usec = 5000000 + n * 10000LL;
+    entry->pose_type = n < 50 ? 1 : 2;
+    /* Every fourth entry repeats the pose and angles and only moves the counts */
+    for (i = 0; i < 7; i++) {
+        entry->pose[i] = (n & ~3) * 0.0123f * (i + 1) - 0.5f;
+    }
+    for (i = 0; i < 6; i++) {
+        entry->angles[i] = -(n & ~3) * 0.37f + i * 10;
+        entry->types[i] = (n / 10 + i) % 3;
+        entry->counts[i] = (1200 + (n % 7) * 40 - i * 3) << 4;
+    }
+}
+
+/* What the decoder should give back: pose and angles round to HISTORY_SCALE */
+int sameEntry(const HistoryEntry *decoded, const HistoryEntry *entry) {
+    int i;
+
+    if (decoded->usec != entry->usec || decoded->pose_type != entry->pose_type ||
+        memcmp(decoded->types, entry->types, sizeof(entry->types)) ||
+        memcmp(decoded->counts, entry->counts, sizeof(entry->counts))) {
+        return 0;
+    }
+    for (i = 0; i < 7; i++) {
+        if (decoded->pose[i] != lrintf(entry->pose[i] * HISTORY_SCALE) / HISTORY_SCALE) {
+            return 0;
+        }
+    }
+    for (i = 0; i < 6; i++) {
+        if (decoded->angles[i] != lrintf(entry->angles[i] * HISTORY_SCALE) / HISTORY_SCALE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void testRoundTrip(History *history) {
+    HistoryEntry decoded[ENTRIES], expected;
+    uint64_t seq = 0, start, n = 0;
+    uint8_t chunk[CHUNK];
+    size_t length;
+    int count, chunks = 0, i;
+
+    expect(history_tail(history) == ENTRIES - SIZE + 1, "tail is %llu",
+           (unsigned long long)history_tail(history));
+
+    /* Asking for overwritten entries starts at the oldest left */
+    n = history_tail(history);
+    while (seq < history_head(history)) {
+        start = seq;
+        length = history_encode(history, &seq, history_head(history), chunk, sizeof(chunk));
+        expect(length > 0, "chunk %d is empty", chunks);
+        if (!length) {
+            return;
+        }
+        count = history_decode(chunk, length, decoded, ENTRIES);
+        expect(count > 0 && seq - count == (chunks ? start : history_tail(history)),
+               "chunk %d decoded to %d entries", chunks, count);
+        /* Each chunk starts from zero, so the first entry of each is whole */
+        for (i = 0; i < count; i++, n++) {
+            makeEntry(n, &expected);
+            expect(sameEntry(&decoded[i], &expected), "entry %llu differs",
+                   (unsigned long long)n);
+        }
+        chunks++;
+    }
+    expect(n == ENTRIES && chunks > 1, "decoded %llu entries in %d chunks",
+           (unsigned long long)n, chunks);
+
+    makeEntry(80, &expected);
+    expect(history_find(history, expected.usec) == 80, "find landed on %llu",
+           (unsigned long long)history_find(history, expected.usec));
+    expect(history_find(history, 0) == history_tail(history), "find before the tail");
+}
+
+void testTruncated(History *history) {
+    uint8_t chunk[CHUNK], scratch[CHUNK];
+    HistoryEntry decoded[ENTRIES];
+    uint64_t seq, whole;
+    size_t length, cut, fits;
+    int count;
+
+    seq = history_tail(history);
+    length = history_encode(history, &seq, history_head(history), chunk, sizeof(chunk));
+
+    /* A cut on an entry boundary decodes the entries before it; anywhere
+     * else the chunk is refused */
+    for (cut = 1; cut < length; cut++) {
+        whole = history_tail(history);
+        fits = history_encode(history, &whole, history_head(history), scratch, cut);
+        count = history_decode(chunk, cut, decoded, ENTRIES);
+        if (fits == cut) {
+            expect(count == whole - history_tail(history), "cut at %zu gave %d entries",
+                   cut, count);
+        } else {
+            expect(count == -1, "cut at %zu mid entry gave %d entries", cut, count);
+        }
+    }
+
+    count = history_decode(chunk, length, decoded, 2);
+    expect(count == -1, "chunk longer than max gave %d entries", count);
+
+    /* A time delta that never ends */
+    memset(chunk, 0x80, VARINT_MAX + 1);
+    count = history_decode(chunk, VARINT_MAX + 1, decoded, ENTRIES);
+    expect(count == -1, "overlong varint gave %d entries", count);
+
+    /* An entry whose pose runs past VARINT_MAX */
+    length = varint_put(chunk, 1000);
+    chunk[length++] = HISTORY_POSE;
+    chunk[length++] = 1;
+    memset(chunk + length, 0xff, VARINT_MAX + 1);
+    length += VARINT_MAX + 1;
+    memset(chunk + length, 0, 7);
+    length += 7;
+    count = history_decode(chunk, length, decoded, ENTRIES);
+    expect(count == -1, "overlong pose varint gave %d entries", count);
+}
+
+int main() {
+    HistoryEntry entry;
+    History *history;
+    int n;
+
+    history = history_create(SIZE);
+    if (!history) {
+        return 1;
+    }
+    for (n = 0; n < ENTRIES; n++) {
+        makeEntry(n, &entry);
+        history_append(history, &entry);
+    }
+
+    testRoundTrip(history);
+    testTruncated(history);
+    history_delete(history);
+
+    if (failures) {
+        printf("%d failed\n", failures);
+        return 1;
+    }
+    printf("history: ok\n");
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "varint.h"
+
+/* Bytes an entry takes at most, mask and pose type included */
+#define ENTRY_MAX (VARINT_MAX + 2 + VARINT_MAX * 19 + 6)
+
+struct _History {
+    HistoryEntry *entries;
+    int size;
+    _Alignas(64) atomic_uint_fast64_t head; /* Entries ever appended */
+};
+
+size_t _history_encode_entry(const HistoryEntry *entry, const HistoryEntry *prev, uint8_t *out);
+int32_t _history_fixed(float value);
+
+History *history_create(int size) {
+    History *history;
+
+    history = calloc(1, sizeof(*history));
+    if (!history) {
+        return NULL;
+    }
+    history->entries = calloc(size, sizeof(*history->entries));
+    if (!history->entries) {
+        fprintf(stderr, "Error: Out of memory for %d history entries\n", size);
+        free(history);
+        return NULL;
+    }
+    history->size = size;
+    atomic_init(&history->head, 0);
+
+    return history;
+}
+
+void history_delete(History *history) {
+    free(history->entries);
+    free(history);
+}
+
+/* Single writer */
+void history_append(History *history, const HistoryEntry *entry) {
+    uint64_t head = atomic_load_explicit(&history->head, memory_order_relaxed);
+
+    history->entries[head % history->size] = *entry;
+    atomic_store_explicit(&history->head, head + 1, memory_order_release);
+}
+
+uint64_t history_head(History *history) {
+    return atomic_load_explicit(&history->head, memory_order_acquire);
+}
+
+/* Oldest entry still in the ring. Once it is full the slot the writer
+ * fills next doesn't count: it may be overwritten while it is read. */
+uint64_t history_tail(History *history) {
+    uint64_t head = history_head(history);
+
+    return head >= history->size ? head - history->size + 1 : 0;
+}
+
+/* Copy out entry seq. Returns -1 if it hasn't been written yet or has been
+ * overwritten, including while it was being copied. */
+int history_read(History *history, uint64_t seq, HistoryEntry *entry) {
+    uint64_t head = history_head(history);
+
+    if (seq >= head || seq + history->size <= head) {
+        return -1;
+    }
+    *entry = history->entries[seq % history->size];
+
+    /* The writer is a whole lap ahead only if it may have reused the slot */
+    atomic_thread_fence(memory_order_acquire);
+    if (seq + history->size <= atomic_load_explicit(&history->head, memory_order_relaxed)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* First entry applied at or after usec; history_head() if none is */
+uint64_t history_find(History *history, int64_t usec) {
+    uint64_t lo = history_tail(history), hi = history_head(history), mid;
+    HistoryEntry entry;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (history_read(history, mid, &entry)) {
+            /* Overwritten while searching; it was older anyway */
+            lo = mid + 1;
+        } else if (entry.usec < usec) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+int32_t _history_fixed(float value) {
+    return lrintf(value * HISTORY_SCALE);
+}
+
+size_t _history_encode_entry(const HistoryEntry *entry, const HistoryEntry *prev, uint8_t *out) {
+    size_t length;
+    uint8_t mask = 0;
+    int i;
+
+    if (entry->pose_type != prev->pose_type ||
+        memcmp(entry->pose, prev->pose, sizeof(entry->pose))) {
+        mask |= HISTORY_POSE;
+    }
+    if (memcmp(entry->angles, prev->angles, sizeof(entry->angles))) {
+        mask |= HISTORY_ANGLES;
+    }
+    if (memcmp(entry->types, prev->types, sizeof(entry->types))) {
+        mask |= HISTORY_TYPES;
+    }
+    if (memcmp(entry->counts, prev->counts, sizeof(entry->counts))) {
+        mask |= HISTORY_COUNTS;
+    }
+
+    length = varint_put(out, entry->usec - prev->usec);
+    out[length++] = mask;
+    if (mask & HISTORY_POSE) {
+        out[length++] = entry->pose_type;
+        for (i = 0; i < 7; i++) {
+            length += varint_put(out + length, ZIGZAG((int64_t)_history_fixed(entry->pose[i]) -
+                                                      _history_fixed(prev->pose[i])));
+        }
+    }
+    if (mask & HISTORY_ANGLES) {
+        for (i = 0; i < 6; i++) {
+            length += varint_put(out + length, ZIGZAG((int64_t)_history_fixed(entry->angles[i]) -
+                                                      _history_fixed(prev->angles[i])));
+        }
+    }
+    if (mask & HISTORY_TYPES) {
+        memcpy(out + length, entry->types, sizeof(entry->types));
+        length += sizeof(entry->types);
+    }
+    if (mask & HISTORY_COUNTS) {
+        for (i = 0; i < 6; i++) {
+            length += varint_put(out + length, ZIGZAG((int64_t)entry->counts[i] -
+                                                      prev->counts[i]));
+        }
+    }
+
+    return length;
+}
+
+/* Encode entries from *seq up to end into out, as many as fit in size
+ * bytes, and advance *seq past them. Entries overwritten since *seq was
+ * picked are skipped. Returns the bytes written. */
+size_t history_encode(History *history, uint64_t *seq, uint64_t end,
+                      uint8_t *out, size_t size) {
+    uint8_t scratch[ENTRY_MAX];
+    HistoryEntry prev, entry;
+    size_t length = 0, added;
+
+    memset(&prev, 0, sizeof(prev));
+    while (*seq < end) {
+        if (*seq < history_tail(history)) {
+            *seq = history_tail(history);
+            continue;
+        }
+        if (history_read(history, *seq, &entry)) {
+            /* Lapped while copying it */
+            (*seq)++;
+            continue;
+        }
+        added = _history_encode_entry(&entry, &prev, scratch);
+        if (length + added > size) {
+            break;
+        }
+        memcpy(out + length, scratch, added);
+        length += added;
+        (*seq)++;
+
+        /* What the decoder will have; the pose and angles round */
+        prev = entry;
+    }
+
+    return length;
+}
+
+/* Decode one chunk. Returns the number of entries, or -1 if it is
+ * malformed or holds more than max. */
+int history_decode(const uint8_t *data, size_t length, HistoryEntry *entries, int max) {
+    int32_t pose[7] = { 0 }, angles[6] = { 0 };
+    HistoryEntry entry;
+    size_t offset = 0, used;
+    uint64_t value;
+    uint8_t mask;
+    int count = 0, i;
+
+    memset(&entry, 0, sizeof(entry));
+    while (offset < length) {
+        if (count == max) {
+            return -1;
+        }
+        if (!(used = varint_get(data + offset, length - offset, &value))) {
+            return -1;
+        }
+        offset += used;
+        entry.usec += value;
+
+        if (offset == length) {
+            return -1;
+        }
+        mask = data[offset++];
+        if (mask & HISTORY_POSE) {
+            if (offset == length) {
+                return -1;
+            }
+            entry.pose_type = data[offset++];
+            for (i = 0; i < 7; i++) {
+                if (!(used = varint_get(data + offset, length - offset, &value))) {
+                    return -1;
+                }
+                offset += used;
+                pose[i] += UNZIGZAG(value);
+                entry.pose[i] = pose[i] / HISTORY_SCALE;
+            }
+        }
+        if (mask & HISTORY_ANGLES) {
+            for (i = 0; i < 6; i++) {
+                if (!(used = varint_get(data + offset, length - offset, &value))) {
+                    return -1;
+                }
+                offset += used;
+                angles[i] += UNZIGZAG(value);
+                entry.angles[i] = angles[i] / HISTORY_SCALE;
+            }
+        }
+        if (mask & HISTORY_TYPES) {
+            if (offset + sizeof(entry.types) > length) {
+                return -1;
+            }
+            memcpy(entry.types, data + offset, sizeof(entry.types));
+            offset += sizeof(entry.types);
+        }
+        if (mask & HISTORY_COUNTS) {
+            for (i = 0; i < 6; i++) {
+                if (!(used = varint_get(data + offset, length - offset, &value))) {
+                    return -1;
+                }
+                offset += used;
+                entry.counts[i] += UNZIGZAG(value);
+            }
+        }
+
+        entries[count++] = entry;
+    }
+
+    return count;
+}
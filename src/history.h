@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __history_h__
+#define __history_h__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Status history. The server appends an entry every tick it applies a pose
+ * to a fixed ring, overwriting the oldest. The writer never waits for
+ * readers: it fills the slot and then publishes the new head, and a reader
+ * that finds its entry overwritten while copying it just moves on to the
+ * oldest one left.
+ *
+ * Ranges go out delta encoded (see PROTOCOL): each chunk starts from a zero
+ * entry and every entry after that only carries what changed since the one
+ * before it, as zigzag varints. */
+
+#define HISTORY_DEFAULT      8192     /* Entries; 82s at 100Hz */
+#define HISTORY_SCALE        10000.0f /* Pose and angles go out in 1/10000ths */
+
+/* HistoryEntry groups that changed, in the mask leading each encoded entry */
+#define HISTORY_POSE         (1 << 0)
+#define HISTORY_ANGLES       (1 << 1)
+#define HISTORY_TYPES        (1 << 2)
+#define HISTORY_COUNTS       (1 << 3)
+
+typedef struct _HistoryEntry {
+    int64_t usec;            /* Server CLOCK_MONOTONIC when applied */
+    uint8_t pose_type;       /* STEWART_MESSAGE_SET_{AXISANGLE,EUCLIDEAN} */
+    float pose[7];           /* The commanded pose: rotation (axis and angle,
+                              * or yaw, pitch, roll), then translation */
+    float angles[6];         /* Solved servo angles, degrees */
+    uint8_t types[6];        /* SolutionType per servo */
+    uint32_t counts[6];      /* PWM counts, SERVO_COUNT_SHIFT fraction bits */
+} HistoryEntry;
+
+typedef struct _History History;
+
+History *history_create(int size);
+void history_delete(History *history);
+void history_append(History *history, const HistoryEntry *entry);
+
+uint64_t history_head(History *history);
+uint64_t history_tail(History *history);
+uint64_t history_find(History *history, int64_t usec);
+int history_read(History *history, uint64_t seq, HistoryEntry *entry);
+
+size_t history_encode(History *history, uint64_t *seq, uint64_t end,
+                      uint8_t *out, size_t size);
+int history_decode(const uint8_t *data, size_t length, HistoryEntry *entries, int max);
+
+#endif
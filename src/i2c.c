@@ -23,6 +23,8 @@
 
 #include "i2c.h"
 
+#define I2C_WRITE_MAX 256 /* Largest payload for i2c_write */
+
 struct _I2CDev {
     int fd;
     int addr;
@@ -103,6 +105,60 @@ int i2c_write8(I2CDev *dev, unsigned char reg, unsigned char value) {
     return 0;
 }
 
+/* Writes len bytes starting at reg in a single transaction. The device must
+ * auto-increment its register pointer for this to reach reg + 1 onward. */
+int i2c_write(I2CDev *dev, unsigned char reg, const unsigned char *buf, size_t len) {
+    unsigned char data[I2C_WRITE_MAX + 1];
+    I2CWrite write = {
+        .addr = dev->addr,
+        .buf = data,
+        .len = len + 1
+    };
+
+    if (len > I2C_WRITE_MAX) {
+        return -EINVAL;
+    }
+
+    data[0] = reg;
+    memcpy(&data[1], buf, len);
+
+    return i2c_write_combined(dev, &write, 1);
+}
+
+/* Issues all writes as one combined transaction: a repeated START between
+ * each write and a single STOP at the end. The writes may be addressed to
+ * different devices on the bus; devices that latch on STOP therefore all
+ * latch at the same instant. */
+int i2c_write_combined(I2CDev *dev, const I2CWrite *writes, int count) {
+    struct i2c_msg messages[I2C_RDWR_IOCTL_MAX_MSGS];
+    struct i2c_rdwr_ioctl_data data;
+    int i;
+
+    if (count <= 0 || count > I2C_RDWR_IOCTL_MAX_MSGS) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < count; i++) {
+        messages[i].addr = writes[i].addr;
+        messages[i].len = writes[i].len;
+        messages[i].buf = writes[i].buf;
+        messages[i].flags = 0;
+    }
+
+    data.msgs = messages;
+    data.nmsgs = count;
+
+    if (ioctl(dev->fd, I2C_RDWR, &data) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+int i2c_get_addr(I2CDev *dev) {
+    return dev->addr;
+}
+
 I2CDev *i2c_open(int device, int addr) {
     I2CDev *dev;
     char filename[PATH_MAX];
@@ -11,9 +11,20 @@
 
 typedef struct _I2CDev I2CDev;
 
+/* One write within a combined transaction: buf holds the register followed
+ * by the payload. */
+typedef struct {
+    int addr;
+    unsigned char *buf;
+    size_t len;
+} I2CWrite;
+
 int i2c_read8(I2CDev *, unsigned char, unsigned char *);
 int i2c_read(I2CDev *, unsigned char, unsigned char*, size_t);
 int i2c_write8(I2CDev *, unsigned char, unsigned char);
+int i2c_write(I2CDev *, unsigned char, const unsigned char *, size_t);
+int i2c_write_combined(I2CDev *, const I2CWrite *, int);
+int i2c_get_addr(I2CDev *);
 I2CDev *i2c_open(int, int);
 void i2c_close(I2CDev *);
 
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ipc.h"
+#include "delay.h"
+
+#define BENCH_NAME     "/stewart-ipc-bench"
+#define HISTOGRAM_NS   10000 /* 1ns buckets; slower reads land in the last */
+
+volatile int writing = 1;
+StewartIPCRegion *region = NULL;
+int writerRate = 0;
+unsigned long published = 0;
+
+void usage(int ret) {
+    fprintf(stderr,
+            "usage: ipc-bench [-n READS] [-r HZ] [-a]\n"
+            "\n"
+            "Measures how long a shared memory status read takes while the\n"
+            "status is being rewritten.\n"
+            "\n"
+            "-n READS  Number of reads to time (default 1000000)\n"
+            "-r HZ     Writer publish rate. 0 writes flat out (default 0)\n"
+            "-a        Attach to a running server (server -I) instead of\n"
+            "          starting a writer thread\n"
+            "-?        Help\n"
+            "-v        Version\n"
+            "\n");
+    exit(ret);
+}
+
+void version() {
+    fprintf(stdout,
+            "ipc-bench: Stewart platform shared memory status benchmark\n"
+            "Copyright (C) 2017 Intel Corporation\n"
+            "Licensed under the terms of the Apache 2.0 license. See LICENSE file.\n"
+            "\n"
+            "Version: " VERSION "\n");
+    exit(0);
+}
+
+long long now_nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Stands in for the server's control tick */
+void *writer(void *arg) {
+    StewartIPC status;
+    long long period = writerRate ? 1000000LL / writerRate : 0;
+    long long next = now_usec();
+    int i;
+
+    memset(&status, 0, sizeof(status));
+    while (writing) {
+        long long now = now_usec();
+        status.ts_sec = now / 1000000;
+        status.ts_usec = now % 1000000;
+        status.tick++;
+        for (i = 0; i < 6; i++) {
+            status.servos[i].angle = status.tick + i;
+        }
+        stewart_ipc_publish(region, &status);
+        published++;
+
+        if (period) {
+            next += period;
+            if (next > now_usec()) {
+                delay(next - now_usec());
+            }
+        }
+    }
+
+    return NULL;
+}
+
+long percentile(const unsigned long *histogram, unsigned long total, double p) {
+    unsigned long target = total * p, seen = 0;
+    long i;
+
+    for (i = 0; i < HISTOGRAM_NS; i++) {
+        seen += histogram[i];
+        if (seen > target) {
+            break;
+        }
+    }
+    return i;
+}
+
+int main(int argc, char *argv[]) {
+    const StewartIPCRegion *reader;
+    unsigned long *histogram;
+    unsigned long reads = 1000000, retried = 0, retries = 0, torn = 0;
+    long long start, elapsed, overhead, before, after, worst = 0;
+    pthread_t thread;
+    StewartIPC status;
+    int attach = 0;
+    unsigned long i;
+    int j, ret;
+
+    for (j = 1; j < argc; j++) {
+        if (argv[j][0] != '-') {
+            usage(-1);
+        }
+        switch (argv[j][1]) {
+            case 'n':
+                j++;
+                if (j >= argc) {
+                    usage(-1);
+                }
+                reads = strtoul(argv[j], NULL, 0);
+                break;
+            case 'r':
+                j++;
+                if (j >= argc) {
+                    usage(-1);
+                }
+                writerRate = strtol(argv[j], NULL, 0);
+                break;
+            case 'a':
+                attach = 1;
+                break;
+            case 'v':
+                version();
+                break;
+            case '?':
+                usage(0);
+                break;
+            default:
+                usage(-1);
+                break;
+        }
+    }
+
+    if (reads == 0 || writerRate < 0) {
+        usage(-1);
+    }
+
+    histogram = calloc(HISTOGRAM_NS, sizeof(*histogram));
+    if (!histogram) {
+        return -1;
+    }
+
+    if (!attach) {
+        region = stewart_ipc_create(BENCH_NAME, writerRate);
+        if (!region) {
+            return -1;
+        }
+        pthread_create(&thread, NULL, writer, NULL);
+    }
+
+    reader = stewart_ipc_open(attach ? STEWART_IPC_NAME : BENCH_NAME);
+    if (!reader) {
+        return -1;
+    }
+
+    /* Wait for the first status */
+    while ((ret = stewart_ipc_read(reader, &status)) < 0) {
+        if (ret == -2) {
+            fprintf(stderr, "Error: The server died while publishing its status\n");
+            return -1;
+        }
+        delay(1000);
+    }
+
+    /* What it costs just to read the clock twice, so it can be discounted
+     * from the per read numbers below */
+    start = now_nsec();
+    for (i = 0; i < 1000; i++) {
+        before = now_nsec();
+        after = now_nsec();
+    }
+    overhead = (now_nsec() - start) / 1000 / 2;
+
+    start = now_nsec();
+    for (i = 0; i < reads; i++) {
+        before = now_nsec();
+        ret = stewart_ipc_read(reader, &status);
+        after = now_nsec();
+
+        if (ret > 0) {
+            retried++;
+            retries += ret;
+        }
+        /* The writer sets every servo from the same tick; a mismatch would
+         * mean the seqlock let a torn status through */
+        if (!attach && status.servos[5].angle != (int32_t)(status.tick + 5)) {
+            torn++;
+        }
+
+        elapsed = after - before - overhead;
+        if (elapsed < 0) {
+            elapsed = 0;
+        }
+        if (elapsed > worst) {
+            worst = elapsed;
+        }
+        histogram[elapsed < HISTOGRAM_NS ? elapsed : HISTOGRAM_NS - 1]++;
+    }
+    elapsed = now_nsec() - start;
+
+    if (!attach) {
+        writing = 0;
+        pthread_join(thread, NULL);
+    }
+
+    fprintf(stdout, "Reads: %lu in %.03fs while %s\n", reads, elapsed / 1e9,
+            attach ? "attached to the server" :
+            writerRate ? "publishing at a fixed rate" : "publishing flat out");
+    if (!attach) {
+        fprintf(stdout, "Writer: %lu status updates\n", published);
+    }
+    fprintf(stdout, "Read latency: p50 %ldns, p99 %ldns, p99.9 %ldns, max %lldns "
+            "(clock overhead %lldns removed)\n",
+            percentile(histogram, reads, 0.5), percentile(histogram, reads, 0.99),
+            percentile(histogram, reads, 0.999), worst, overhead);
+    fprintf(stdout, "Retried: %lu reads (%.03f%%), %lu retries; %lu torn\n",
+            retried, 100.0 * retried / reads, retries, torn);
+
+    stewart_ipc_close(reader);
+    if (region) {
+        stewart_ipc_destroy(region, BENCH_NAME);
+    }
+    free(histogram);
+
+    return torn ? -1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ipc.h"
+
+StewartIPCRegion *stewart_ipc_create(const char *name, int tick_rate) {
+    StewartIPCRegion *region;
+    unsigned int seq;
+    int fd;
+
+    fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Unable to create shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(*region)) == -1) {
+        fprintf(stderr, "Error: Unable to size shared memory %s: %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    /* Readers still attached from a previous server see the sequence go
+     * odd and wait (it may already be odd if that server died mid write);
+     * a fresh region starts out zeroed */
+    seq = atomic_load_explicit(&region->sequence, memory_order_relaxed) | 1;
+    atomic_store_explicit(&region->sequence, seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    region->status.tick = 0;
+    region->magic = STEWART_IPC_MAGIC;
+    region->version = STEWART_IPC_VERSION;
+    region->size = sizeof(*region);
+    region->tick_rate = tick_rate;
+    region->pid = getpid();
+    atomic_store_explicit(&region->sequence, seq + 1, memory_order_release);
+
+    return region;
+}
+
+/* One writer only. The sequence is odd for the duration of the copy so
+ * readers that overlap it retry instead of seeing a torn status. */
+void stewart_ipc_publish(StewartIPCRegion *region, const StewartIPC *status) {
+    unsigned int seq = atomic_load_explicit(&region->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&region->sequence, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&region->status, status, sizeof(*status));
+    atomic_store_explicit(&region->sequence, seq + 2, memory_order_release);
+}
+
+/* A NULL name leaves the region in place for a server taking over */
+void stewart_ipc_destroy(StewartIPCRegion *region, const char *name) {
+    munmap(region, sizeof(*region));
+    if (name) {
+        shm_unlink(name);
+    }
+}
+
+const StewartIPCRegion *stewart_ipc_open(const char *name) {
+    const StewartIPCRegion *region;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Unable to open shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(*region)) {
+        fprintf(stderr, "Error: Shared memory %s is not a Stewart status region\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    region = mmap(NULL, sizeof(*region), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (region->magic != STEWART_IPC_MAGIC || region->version != STEWART_IPC_VERSION ||
+        region->size != sizeof(*region)) {
+        fprintf(stderr, "Error: Shared memory %s has an incompatible layout\n", name);
+        munmap((void *)region, sizeof(*region));
+        return NULL;
+    }
+
+    return region;
+}
+
+/* Copy a consistent snapshot of the status. Returns the number of times the
+ * read had to be retried because the server was writing, -1 if nothing
+ * has been published yet, or -2 if the server died while writing. */
+int stewart_ipc_read(const StewartIPCRegion *region, StewartIPC *status) {
+    unsigned int seq;
+    int retries = -1;
+
+    do {
+        retries++;
+        seq = stewart_ipc_read_begin(region);
+        if ((seq & 1) && !stewart_ipc_alive(region)) {
+            return -2;
+        }
+        memcpy(status, (const void *)&region->status, sizeof(*status));
+    } while (stewart_ipc_read_retry(region, seq));
+
+    return status->tick ? retries : -1;
+}
+
+/* Whether the server that last published is still running */
+int stewart_ipc_alive(const StewartIPCRegion *region) {
+    return !kill(region->pid, 0) || errno != ESRCH;
+}
+
+void stewart_ipc_close(const StewartIPCRegion *region) {
+    munmap((void *)region, sizeof(*region));
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __ipc_h__
+#define __ipc_h__
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Shared memory status export. See PROTOCOL for the layout and the
+ * seqlock rules readers have to follow. */
+
+#define STEWART_IPC_NAME         "/stewart-status"
+#define STEWART_IPC_MAGIC        0x50495453 /* "STIP" */
+#define STEWART_IPC_VERSION      1
+
+#define STEWART_IPC_SPINS        100000 /* Odd sequences seen before a
+                                         * reader checks the server lives */
+
+#define STEWART_SERVO_STATIONARY 0
+#define STEWART_SERVO_MOVING     1
+
+typedef struct _StewartIPCServo {
+    uint8_t status;     /* STEWART_SERVO_* */
+    int32_t angle;      /* Angle in degrees * 10^3 */
+    int32_t speed;      /* Degrees per second * 10^3 */
+    int64_t ts_sec;     /* Estimated timestamp of move completion */
+    int64_t ts_usec;    /* Estimated timestamp of move completion */
+} __attribute__((packed)) StewartIPCServo;
+
+typedef struct _StewartIPC {
+    int64_t ts_sec;     /* CLOCK_MONOTONIC seconds when published */
+    int64_t ts_usec;    /* CLOCK_MONOTONIC microseconds when published */
+    StewartIPCServo servos[6];
+    float origin[3];    /* Point the rotation is applied around */
+    float rotation[9];  /* Rotation matrix applied to the platform */
+    uint64_t tick;      /* Control ticks published since server start */
+} __attribute__((packed)) StewartIPC;
+
+typedef struct _StewartIPCRegion {
+    uint32_t magic;     /* STEWART_IPC_MAGIC */
+    uint32_t version;   /* STEWART_IPC_VERSION */
+    uint32_t size;      /* sizeof(StewartIPCRegion) */
+    uint32_t tick_rate; /* Hz the status is published at */
+    int32_t pid;        /* Server process */
+
+    /* Seqlock: odd while the server is writing status. A read is only
+     * consistent if the same even value is seen before and after it. */
+    _Alignas(64) atomic_uint sequence;
+    StewartIPC status;
+} StewartIPCRegion;
+
+/* Server (single writer) */
+StewartIPCRegion *stewart_ipc_create(const char *name, int tick_rate);
+void stewart_ipc_publish(StewartIPCRegion *region, const StewartIPC *status);
+void stewart_ipc_destroy(StewartIPCRegion *region, const char *name);
+
+/* Readers */
+const StewartIPCRegion *stewart_ipc_open(const char *name);
+int stewart_ipc_read(const StewartIPCRegion *region, StewartIPC *status);
+int stewart_ipc_alive(const StewartIPCRegion *region);
+void stewart_ipc_close(const StewartIPCRegion *region);
+
+/* Zero copy access to individual fields:
+ *
+ *     do {
+ *         seq = stewart_ipc_read_begin(region);
+ *         if ((seq & 1) && !stewart_ipc_alive(region)) {
+ *             return -1;
+ *         }
+ *         angle = region->status.servos[0].angle;
+ *     } while (stewart_ipc_read_retry(region, seq));
+ *
+ * read_begin gives up waiting for the server to finish writing after
+ * STEWART_IPC_SPINS tries and returns the odd sequence; a server that died
+ * mid write never will. */
+static inline unsigned int stewart_ipc_read_begin(const StewartIPCRegion *region) {
+    unsigned int seq;
+    int spins = STEWART_IPC_SPINS;
+
+    while (((seq = atomic_load_explicit(&region->sequence, memory_order_acquire)) & 1) &&
+           --spins) {
+    }
+
+    return seq;
+}
+
+static inline int stewart_ipc_read_retry(const StewartIPCRegion *region, unsigned int seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return (seq & 1) || atomic_load_explicit(&region->sequence, memory_order_relaxed) != seq;
+}
+
+#endif
@@ -17,10 +17,14 @@
 #include <linux/limits.h>
 #include <linux/joystick.h>
 
+#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <poll.h>
+
 #include "config.h"
+#include "client.h"
 
 typedef struct {
     float x;
@@ -128,8 +132,10 @@ int main(int argc, char *argv[]) {
     char *device;
     struct js_event event;
     Joystick joystick;
-    fd_set read_fd;
-    int fd = -1;
+    fd_set read_fd, write_fd;
+    int fd = -1, maxfd;
+    StewartClient *client = NULL;
+    int events, revents;
     int axis, buttons;
     char name[PATH_MAX];
 
@@ -138,15 +144,31 @@ int main(int argc, char *argv[]) {
     /* Parse command line arguments... */
     if (argc < 2) {
         fprintf(stderr,
-                "usage: joytrack device-id | transform\n");
+                "usage: joytrack device-id | transform\n"
+                "       joytrack device-id HOST:PORT\n");
         fprintf(stderr,
                 "This program will output Axis-Angle data in the format:\n"
-                " |X| |Y| |Z| Angle(deg)\n");
+                " |X| |Y| |Z| Angle(deg)\n"
+                "or, given HOST:PORT, send it straight to the Stewart platform\n"
+                "server there.\n");
         return 1;
     }
 
     device = argv[1];
 
+    if (argc > 2) {
+        char *colon = strchr(argv[2], ':');
+        if (!colon) {
+            fprintf(stderr, "Invalid argument: %s\n", argv[2]);
+            return 1;
+        }
+        *colon = '\0';
+        client = stewart_client_create(argv[2], strtol(colon + 1, NULL, 0));
+        if (!client) {
+            return 1;
+        }
+    }
+
     /* Attempt to open the Joystick device */
     fd = open(device, O_RDONLY);
     if (fd < 0) {
@@ -169,17 +191,46 @@ int main(int argc, char *argv[]) {
      * Loop on select on Joystick input
      * Read all Joystick input, translating values into Axis Angle
      */
-    FD_ZERO(&read_fd);
-    FD_SET(fd, &read_fd);
-
-    while (select(fd + 1, &read_fd, NULL, NULL, NULL) > 0) {
+    while (1) {
         int update = 0;
 
-        if (!FD_ISSET(fd, &read_fd)) {
-            fprintf(stderr, "Select returned with no data!\n");
+        FD_ZERO(&read_fd);
+        FD_ZERO(&write_fd);
+        FD_SET(fd, &read_fd);
+        maxfd = fd;
+        if (client) {
+            events = stewart_client_get_events(client);
+            FD_SET(stewart_client_get_fd(client), &read_fd);
+            if (events & POLLOUT) {
+                FD_SET(stewart_client_get_fd(client), &write_fd);
+            }
+            if (stewart_client_get_fd(client) > maxfd) {
+                maxfd = stewart_client_get_fd(client);
+            }
+        }
+
+        if (select(maxfd + 1, &read_fd, &write_fd, NULL, NULL) <= 0) {
             break;
         }
 
+        if (client) {
+            revents = 0;
+            if (FD_ISSET(stewart_client_get_fd(client), &read_fd)) {
+                revents |= POLLIN;
+            }
+            if (FD_ISSET(stewart_client_get_fd(client), &write_fd)) {
+                revents |= POLLOUT;
+            }
+            if (revents && stewart_client_process(client, revents)) {
+                err = 1;
+                goto terminate;
+            }
+        }
+
+        if (!FD_ISSET(fd, &read_fd)) {
+            continue;
+        }
+
         while (read(fd, &event, sizeof(event)) > 0) {
             update |= joystick_parse(&event, &joystick);
         }
@@ -203,13 +254,36 @@ int main(int argc, char *argv[]) {
          */
         float angle_length = sqrt(joystick.left.x * joystick.left.x +
                                   joystick.left.y * joystick.left.y);
+        float x = 0, z = 1, angle = 0;
         if (angle_length > 0) {
             float clamped = angle_length > 1.0 ? 1 : angle_length;
-            fprintf(stdout, "%f %f %f %f\n",
-                    joystick.left.x / angle_length,
-                    0.0f,
-                    joystick.left.y / angle_length,
-                    clamped * (MAX_ROLL + MAX_PITCH) / 2.0f);
+            x = joystick.left.x / angle_length;
+            z = joystick.left.y / angle_length;
+            angle = clamped * (MAX_ROLL + MAX_PITCH) / 2.0f;
+        }
+
+        if (client) {
+            /* Moves faster than the socket drains replace each other */
+            StewartMessage message = {
+                .version = STEWART_PROTOCOL,
+                .size = sizeof(message),
+                .type = STEWART_MESSAGE_SET_AXISANGLE,
+                .axisAngle = {
+                    .x = x,
+                    .y = 0,
+                    .z = z,
+                    .angle = angle
+                }
+            };
+            if (stewart_client_set_pose(client, &message)) {
+                err = 1;
+                goto terminate;
+            }
+            continue;
+        }
+
+        if (angle_length > 0) {
+            fprintf(stdout, "%f %f %f %f\n", x, 0.0f, z, angle);
         } else {
             fprintf(stdout, "0 0 1 0\n");
         }
@@ -226,5 +300,9 @@ terminate:
         close(fd);
     }
 
+    if (client) {
+        stewart_client_delete(client);
+    }
+
     return err;
 }
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "stewart-pubsub.h"
+#include "local.h"
+
+typedef struct {
+    long long *rtt;      /* ns per round trip */
+    long long send;      /* ns spent handing requests to the transport */
+    int count;
+} Results;
+
+void usage(int ret) {
+    fprintf(stderr,
+            "usage: local-bench -h HOST:PORT -l PATH [-n ROUNDS]\n"
+            "\n"
+            "Compares status round trips to a server on this machine over TCP\n"
+            "loopback and over the local shared memory transport (server -l).\n"
+            "\n"
+            "-h HOST:PORT  Server TCP address\n"
+            "-l PATH       Server local socket\n"
+            "-n ROUNDS     Round trips per transport (default 10000)\n"
+            "-?            Help\n"
+            "-v            Version\n"
+            "\n"
+            "Local commands are drained on the server's control tick when it is\n"
+            "running; otherwise the client wakes the server for each one.\n"
+            "\n");
+    exit(ret);
+}
+
+void version() {
+    fprintf(stdout,
+            "local-bench: Stewart platform local transport benchmark\n"
+            "Copyright (C) 2017 Intel Corporation\n"
+            "Licensed under the terms of the Apache 2.0 license. See LICENSE file.\n"
+            "\n"
+            "Version: " VERSION "\n");
+    exit(0);
+}
+
+long long now_nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int compare(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+void report(const char *name, Results *results) {
+    long long total = 0;
+    int i;
+
+    qsort(results->rtt, results->count, sizeof(*results->rtt), compare);
+    for (i = 0; i < results->count; i++) {
+        total += results->rtt[i];
+    }
+    fprintf(stdout, "%-6s round trip: avg %.01fus, p50 %.01fus, p99 %.01fus, max %.01fus; "
+            "send %.0fns\n", name,
+            total / 1000.0 / results->count,
+            results->rtt[results->count / 2] / 1000.0,
+            results->rtt[results->count * 99 / 100] / 1000.0,
+            results->rtt[results->count - 1] / 1000.0,
+            (double)results->send / results->count);
+}
+
+int benchTcp(const char *host, int port, Results *results) {
+    struct addrinfo hint = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP
+    };
+    struct addrinfo *res;
+    struct sockaddr_in sin;
+    StewartMessage request = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(request),
+        .type = STEWART_MESSAGE_GET_STATUS
+    }, reply;
+    long long start, sent;
+    int enable = 1;
+    int sock, i;
+
+    if (getaddrinfo(host, NULL, &hint, &res) != 0 || res == NULL) {
+        fprintf(stderr, "Error: Unable to get host address for %s\n", host);
+        return -1;
+    }
+    memcpy(&sin, res->ai_addr, sizeof(sin));
+    sin.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+        fprintf(stderr, "Error: Unable to connect to %s:%d: %s\n", host, port, strerror(errno));
+        return -1;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    for (i = 0; i < results->count; i++) {
+        start = now_nsec();
+        if (send(sock, &request, sizeof(request), 0) != sizeof(request)) {
+            fprintf(stderr, "Error: Unable to send: %s\n", strerror(errno));
+            close(sock);
+            return -1;
+        }
+        sent = now_nsec();
+        if (recv(sock, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)) {
+            fprintf(stderr, "Error: Unable to receive: %s\n", strerror(errno));
+            close(sock);
+            return -1;
+        }
+        results->rtt[i] = now_nsec() - start;
+        results->send += sent - start;
+    }
+
+    close(sock);
+
+    return 0;
+}
+
+int benchLocal(const char *path, Results *results) {
+    StewartMessage request = {
+        .version = STEWART_PROTOCOL,
+        .size = sizeof(request),
+        .type = STEWART_MESSAGE_GET_STATUS
+    }, reply;
+    LocalClient *client;
+    long long start, sent;
+    int i;
+
+    client = local_client_connect(path);
+    if (!client) {
+        return -1;
+    }
+
+    for (i = 0; i < results->count; i++) {
+        start = now_nsec();
+        if (local_client_send(client, &request)) {
+            fprintf(stderr, "Error: Local ring full\n");
+            local_client_close(client);
+            return -1;
+        }
+        sent = now_nsec();
+        if (local_client_recv(client, &reply, 1) != 1) {
+            fprintf(stderr, "Error: Server closed the local connection\n");
+            local_client_close(client);
+            return -1;
+        }
+        results->rtt[i] = now_nsec() - start;
+        results->send += sent - start;
+    }
+
+    local_client_close(client);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Results tcp = { 0 }, local = { 0 };
+    char *host = NULL, *path = NULL, *colon;
+    int port = 0, rounds = 10000;
+    int i, err = -1;
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            usage(-1);
+        }
+        switch (argv[i][1]) {
+            case 'h':
+                i++;
+                if (i >= argc || !(colon = strchr(argv[i], ':'))) {
+                    usage(-1);
+                }
+                *colon = '\0';
+                host = argv[i];
+                port = strtol(colon + 1, NULL, 0);
+                break;
+            case 'l':
+                i++;
+                if (i >= argc) {
+                    usage(-1);
+                }
+                path = argv[i];
+                break;
+            case 'n':
+                i++;
+                if (i >= argc) {
+                    usage(-1);
+                }
+                rounds = strtol(argv[i], NULL, 0);
+                break;
+            case 'v':
+                version();
+                break;
+            case '?':
+                usage(0);
+                break;
+            default:
+                usage(-1);
+                break;
+        }
+    }
+
+    if (!host || !path || rounds <= 0) {
+        usage(-1);
+    }
+
+    tcp.count = local.count = rounds;
+    tcp.rtt = calloc(rounds, sizeof(*tcp.rtt));
+    local.rtt = calloc(rounds, sizeof(*local.rtt));
+    if (!tcp.rtt || !local.rtt) {
+        goto terminate;
+    }
+
+    if (benchTcp(host, port, &tcp) || benchLocal(path, &local)) {
+        goto terminate;
+    }
+
+    report("TCP", &tcp);
+    report("Local", &local);
+    err = 0;
+
+terminate:
+    free(tcp.rtt);
+    free(local.rtt);
+
+    return err;
+}
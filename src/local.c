@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#define _GNU_SOURCE /* memfd_create */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "local.h"
+
+#define LOCAL_SPIN 4096 /* Polls of the reply ring before sleeping */
+
+struct _LocalClient {
+    int sock;
+    LocalChannel *channel;
+    int wake;
+    int notify;
+};
+
+LocalChannel *local_channel_create(int *fd) {
+    LocalChannel *channel;
+
+    *fd = memfd_create("stewart-local", MFD_CLOEXEC);
+    if (*fd == -1) {
+        fprintf(stderr, "Error: Unable to create local channel: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(*fd, sizeof(*channel)) == -1) {
+        fprintf(stderr, "Error: Unable to size local channel: %s\n", strerror(errno));
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+
+    channel = mmap(NULL, sizeof(*channel), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (channel == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map local channel: %s\n", strerror(errno));
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+
+    /* memfd pages start zeroed, so the rings are already empty */
+    channel->magic = LOCAL_MAGIC;
+    channel->version = LOCAL_VERSION;
+    channel->size = sizeof(*channel);
+
+    return channel;
+}
+
+LocalChannel *local_channel_map(int fd) {
+    LocalChannel *channel;
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(*channel)) {
+        fprintf(stderr, "Error: Local channel is too small\n");
+        return NULL;
+    }
+
+    channel = mmap(NULL, sizeof(*channel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (channel == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map local channel: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    if (channel->magic != LOCAL_MAGIC || channel->version != LOCAL_VERSION ||
+        channel->size != sizeof(*channel)) {
+        fprintf(stderr, "Error: Local channel has an incompatible layout\n");
+        munmap(channel, sizeof(*channel));
+        return NULL;
+    }
+
+    return channel;
+}
+
+void local_channel_unmap(LocalChannel *channel) {
+    munmap(channel, sizeof(*channel));
+}
+
+/* Producer side. Returns -1 if the ring is full, 1 if the consumer asked to
+ * be woken (write its eventfd) and 0 otherwise. */
+int local_ring_push(LocalRing *ring, const StewartMessage *message) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail >= LOCAL_RING_SLOTS) {
+        return -1;
+    }
+
+    memcpy(&ring->slots[head & (LOCAL_RING_SLOTS - 1)], message, sizeof(*message));
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    /* Pairs with the fence in local_ring_set_wakeup: either the consumer
+     * sees this message when it rechecks the ring, or this sees its
+     * request to be woken */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    return atomic_load_explicit(&ring->wakeup, memory_order_relaxed) ? 1 : 0;
+}
+
+/* Consumer side. Returns 1 if a message was taken, 0 if the ring is empty */
+int local_ring_pop(LocalRing *ring, StewartMessage *message) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail == head) {
+        return 0;
+    }
+
+    memcpy(message, &ring->slots[tail & (LOCAL_RING_SLOTS - 1)], sizeof(*message));
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return 1;
+}
+
+/* A consumer about to sleep sets wakeup and must then check the ring once
+ * more before sleeping; anything pushed after that check is signalled */
+void local_ring_set_wakeup(LocalRing *ring, int wakeup) {
+    atomic_store_explicit(&ring->wakeup, wakeup, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+int local_ring_is_empty(LocalRing *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+        atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+void local_signal(int fd) {
+    uint64_t one = 1;
+
+    /* Only fails if the counter would overflow, which still wakes */
+    if (write(fd, &one, sizeof(one)) == -1) {
+        return;
+    }
+}
+
+int local_send_fds(int sock, const int *fds, int count) {
+    char data = 0;
+    struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * LOCAL_FDS * 4)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * count)
+    };
+    struct cmsghdr *cmsg;
+
+    if (count > LOCAL_FDS * 4) {
+        return -1;
+    }
+
+    memset(&control, 0, sizeof(control));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(data) ? 0 : -1;
+}
+
+/* Returns the number of descriptors received, at most count (any more are
+ * closed), or -1 */
+int local_recv_fds(int sock, int *fds, int count) {
+    char data;
+    struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * LOCAL_FDS * 4)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    struct cmsghdr *cmsg;
+    int received, i;
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(data)) {
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+
+    received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (received > count ? count : received));
+    /* Any more than asked for are already ours, so close them */
+    for (i = count; i < received; i++) {
+        int extra;
+
+        memcpy(&extra, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(extra));
+        close(extra);
+    }
+    if (received > count) {
+        received = count;
+    }
+
+    return received;
+}
+
+LocalClient *local_client_connect(const char *path) {
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    int fds[LOCAL_FDS];
+    LocalClient *client;
+    int received, i;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return NULL;
+    }
+    strcpy(sun.sun_path, path);
+
+    client = calloc(1, sizeof(*client));
+    if (!client) {
+        return NULL;
+    }
+    client->wake = client->notify = -1;
+
+    client->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->sock == -1) {
+        fprintf(stderr, "Error: Unable to open socket: %s\n", strerror(errno));
+        free(client);
+        return NULL;
+    }
+
+    if (connect(client->sock, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+        fprintf(stderr, "Error: Unable to connect to %s: %s\n", path, strerror(errno));
+        goto failed;
+    }
+
+    received = local_recv_fds(client->sock, fds, LOCAL_FDS);
+    if (received != LOCAL_FDS) {
+        fprintf(stderr, "Error: Server at %s did not set up a local channel\n", path);
+        for (i = 0; i < received; i++) {
+            close(fds[i]);
+        }
+        goto failed;
+    }
+
+    client->wake = fds[LOCAL_FD_WAKE];
+    client->notify = fds[LOCAL_FD_NOTIFY];
+    client->channel = local_channel_map(fds[LOCAL_FD_CHANNEL]);
+    close(fds[LOCAL_FD_CHANNEL]);
+    if (!client->channel) {
+        goto failed;
+    }
+
+    return client;
+
+failed:
+    local_client_close(client);
+    return NULL;
+}
+
+/* Returns -1 if the server isn't keeping up and the ring is full */
+int local_client_send(LocalClient *client, const StewartMessage *message) {
+    int ret = local_ring_push(&client->channel->commands, message);
+
+    if (ret == 1) {
+        local_signal(client->wake);
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+
+/* Returns 1 if a message was received, 0 if none is waiting (and block is
+ * 0) and -1 if the server went away. Blocking spins on the ring for a
+ * while before asking to be woken. */
+int local_client_recv(LocalClient *client, StewartMessage *message, int block) {
+    LocalRing *ring = &client->channel->replies;
+    struct pollfd fds[2] = {
+        { .fd = client->notify, .events = POLLIN },
+        { .fd = client->sock, .events = POLLIN }
+    };
+    uint64_t count;
+    int i;
+
+    for (i = 0; i < LOCAL_SPIN; i++) {
+        if (local_ring_pop(ring, message)) {
+            return 1;
+        }
+        if (!block) {
+            return 0;
+        }
+    }
+
+    while (1) {
+        local_ring_set_wakeup(ring, 1);
+        if (local_ring_pop(ring, message)) {
+            local_ring_set_wakeup(ring, 0);
+            return 1;
+        }
+
+        if (poll(fds, 2, -1) == -1 && errno != EINTR) {
+            return -1;
+        }
+        if (fds[1].revents) {
+            /* The socket only ever becomes readable when the server closes */
+            return -1;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (read(client->notify, &count, sizeof(count)) == -1) {
+                return -1;
+            }
+        }
+    }
+}
+
+void local_client_close(LocalClient *client) {
+    if (client->channel) {
+        local_channel_unmap(client->channel);
+    }
+    if (client->wake != -1) {
+        close(client->wake);
+    }
+    if (client->notify != -1) {
+        close(client->notify);
+    }
+    if (client->sock != -1) {
+        close(client->sock);
+    }
+    free(client);
+}
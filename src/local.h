@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __local_h__
+#define __local_h__
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "stewart-pubsub.h"
+
+/* Local transport for clients on the same machine as the server. A client
+ * connects to the server's Unix domain socket and is handed a shared memory
+ * channel and two eventfds (SCM_RIGHTS). Messages then go through a single
+ * producer, single consumer ring in each direction without any syscall;
+ * the eventfds are only written when the other side has asked to be woken
+ * because it is about to sleep. */
+
+#define LOCAL_MAGIC        0x4c435453 /* "STCL" */
+#define LOCAL_VERSION      1
+#define LOCAL_RING_SLOTS   64         /* Power of two */
+
+typedef struct _LocalRing {
+    _Alignas(64) atomic_uint head;    /* Next slot the producer fills */
+    _Alignas(64) atomic_uint tail;    /* Next slot the consumer reads */
+    _Alignas(64) atomic_uint wakeup;  /* Consumer wants the eventfd written */
+    StewartMessage slots[LOCAL_RING_SLOTS];
+} LocalRing;
+
+typedef struct _LocalChannel {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    LocalRing commands;               /* Client to server */
+    LocalRing replies;                /* Server to client */
+} LocalChannel;
+
+/* Descriptors handed to the client, in order */
+#define LOCAL_FD_CHANNEL   0
+#define LOCAL_FD_WAKE      1          /* Client writes; server wakes */
+#define LOCAL_FD_NOTIFY    2          /* Server writes; client wakes */
+#define LOCAL_FDS          3
+
+typedef struct _LocalClient LocalClient;
+
+LocalChannel *local_channel_create(int *fd);
+LocalChannel *local_channel_map(int fd);
+void local_channel_unmap(LocalChannel *channel);
+
+int local_ring_push(LocalRing *ring, const StewartMessage *message);
+int local_ring_pop(LocalRing *ring, StewartMessage *message);
+void local_ring_set_wakeup(LocalRing *ring, int wakeup);
+int local_ring_is_empty(LocalRing *ring);
+void local_signal(int fd);
+
+int local_send_fds(int sock, const int *fds, int count);
+int local_recv_fds(int sock, int *fds, int count);
+
+LocalClient *local_client_connect(const char *path);
+int local_client_send(LocalClient *client, const StewartMessage *message);
+int local_client_recv(LocalClient *client, StewartMessage *message, int block);
+void local_client_close(LocalClient *client);
+
+#endif
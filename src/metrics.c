@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#define METRICS_BUFFER_INITIAL 16384
+
+/* Bucket i counts values up to 2^i us; anything past the last finite
+ * bucket lands in +Inf */
+void metrics_observe(MetricsHistogram *histogram, long long usec) {
+    int bucket = 0;
+
+    if (usec < 0) {
+        usec = 0;
+    }
+    if (usec > 1) {
+        bucket = 64 - __builtin_clzll((unsigned long long)usec - 1);
+        if (bucket > METRICS_BUCKETS - 1) {
+            bucket = METRICS_BUCKETS - 1;
+        }
+    }
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum += usec;
+}
+
+int metrics_printf(MetricsBuffer *buffer, const char *format, ...) {
+    va_list args;
+    size_t size;
+    char *data;
+    int len;
+
+    while (1) {
+        if (buffer->size) {
+            va_start(args, format);
+            len = vsnprintf(buffer->data + buffer->length, buffer->size - buffer->length,
+                            format, args);
+            va_end(args);
+            if (len < 0) {
+                return -1;
+            }
+            if (buffer->length + len < buffer->size) {
+                buffer->length += len;
+                return 0;
+            }
+        }
+
+        size = buffer->size ? buffer->size * 2 : METRICS_BUFFER_INITIAL;
+        data = realloc(buffer->data, size);
+        if (!data) {
+            fprintf(stderr, "Error: Out of memory formatting metrics\n");
+            return -1;
+        }
+        buffer->data = data;
+        buffer->size = size;
+    }
+}
+
+int metrics_family(MetricsBuffer *buffer, const char *name, const char *type,
+                   const char *help) {
+    return metrics_printf(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* A family with a single, unlabelled sample */
+int metrics_value(MetricsBuffer *buffer, const char *name, const char *type,
+                  const char *help, unsigned long value) {
+    if (metrics_family(buffer, name, type, help)) {
+        return -1;
+    }
+    return metrics_printf(buffer, "%s %lu\n", name, value);
+}
+
+int metrics_histogram(MetricsBuffer *buffer, const char *name, const char *help,
+                      const MetricsHistogram *histogram) {
+    unsigned long cumulative = 0;
+    int i, err;
+
+    err = metrics_family(buffer, name, "histogram", help);
+    for (i = 0; !err && i < METRICS_BUCKETS - 1; i++) {
+        cumulative += histogram->buckets[i];
+        err = metrics_printf(buffer, "%s_bucket{le=\"%g\"} %lu\n", name,
+                             (double)(1LL << i) / 1000000, cumulative);
+    }
+    if (!err) {
+        err = metrics_printf(buffer, "%s_bucket{le=\"+Inf\"} %lu\n"
+                             "%s_sum %.6f\n"
+                             "%s_count %lu\n",
+                             name, histogram->count,
+                             name, (double)histogram->sum / 1000000,
+                             name, histogram->count);
+    }
+
+    return err;
+}
+
+/* Append bytes as they are, for a body that isn't text */
+int metrics_write(MetricsBuffer *buffer, const void *data, size_t length) {
+    size_t size = buffer->size ? buffer->size : METRICS_BUFFER_INITIAL;
+    char *grown;
+
+    while (buffer->length + length > size) {
+        size *= 2;
+    }
+    if (size != buffer->size) {
+        grown = realloc(buffer->data, size);
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory formatting metrics\n");
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->size = size;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+
+    return 0;
+}
+
+void metrics_buffer_free(MetricsBuffer *buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+/* Look at an HTTP request. Returns 0 until the whole request head has
+ * arrived, then METRICS_GET_* for what it asked for or -1 for anything
+ * else. */
+int metrics_request(const char *request, size_t length) {
+    size_t i;
+
+    for (i = 3; i < length; i++) {
+        if (!memcmp(request + i - 3, "\r\n\r\n", 4)) {
+            break;
+        }
+    }
+    if (i >= length) {
+        return length < METRICS_REQUEST_MAX ? 0 : -1;
+    }
+
+    if ((length > 13 && !memcmp(request, "GET /metrics ", 13)) ||
+        (length > 6 && !memcmp(request, "GET / ", 6))) {
+        return METRICS_GET_METRICS;
+    }
+    if (length > 12 && !memcmp(request, "GET /flight ", 12)) {
+        return METRICS_GET_FLIGHT;
+    }
+
+    return -1;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __metrics_h__
+#define __metrics_h__
+
+#include <stddef.h>
+
+/* Server metrics in the Prometheus text exposition format. Counters and
+ * histograms are plain memory updated in place by the control loop; an
+ * observation is a few instructions with no locks or syscalls. Formatting
+ * only happens when a scrape asks for it. */
+
+#define METRICS_BUCKETS      18   /* le 1us, 2us, .. 65.536ms, then +Inf */
+#define METRICS_REQUEST_MAX  1024 /* Largest scrape request accepted */
+
+/* What a request asked for (metrics_request) */
+#define METRICS_GET_METRICS  1
+#define METRICS_GET_FLIGHT   2    /* The flight recorder, see flight.h */
+
+typedef struct _MetricsHistogram {
+    unsigned long buckets[METRICS_BUCKETS]; /* Bucket i: <= 2^i us, not
+                                             * cumulative */
+    unsigned long count;
+    long long sum;                          /* us */
+} MetricsHistogram;
+
+/* Text being built for a scrape. Grows as needed. */
+typedef struct _MetricsBuffer {
+    char *data;
+    size_t length;
+    size_t size;
+} MetricsBuffer;
+
+void metrics_observe(MetricsHistogram *histogram, long long usec);
+
+int metrics_printf(MetricsBuffer *buffer, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+int metrics_family(MetricsBuffer *buffer, const char *name, const char *type,
+                   const char *help);
+int metrics_value(MetricsBuffer *buffer, const char *name, const char *type,
+                  const char *help, unsigned long value);
+int metrics_histogram(MetricsBuffer *buffer, const char *name, const char *help,
+                      const MetricsHistogram *histogram);
+int metrics_write(MetricsBuffer *buffer, const void *data, size_t length);
+void metrics_buffer_free(MetricsBuffer *buffer);
+
+int metrics_request(const char *request, size_t length);
+
+#endif
@@ -27,13 +27,22 @@
 typedef struct {
     int on;        /* Last requested PWM ON */
     int off;       /* Last requested PWM OFF */
+    int next_on;   /* Staged PWM ON for the next commit */
+    int next_off;  /* Staged PWM OFF for the next commit */
+    int fine;      /* Dithered OFF target, PCA9685_FRACTION_BITS fixed point */
+    int residual;  /* Sigma-delta accumulator of the fraction not yet output */
 } PCA9685Channel;
 
 struct _PCA9685 {
     I2CDev *dev;
     PCA9685Channel channels[16];
+    unsigned int staged;  /* Bit per channel with a value waiting to commit */
+    unsigned int dithered; /* Bit per channel being dithered every commit */
     int frequency;
     int pulse_width;
+    int oscillator;
+    double counts_per_us; /* From the calibrated oscillator and PRE_SCALE */
+    int warm;             /* Adopted a running PCA9685 without resetting it */
 };
 
 /*
@@ -59,9 +68,13 @@ enum {
     PCA9685_OFF_H,
 
     PCA9685_PRE_SCALE   = 0xFE,
+    PCA9685_PRE_SCALE_MIN = 0x03,
+    PCA9685_PRE_SCALE_MAX = 0xFF,
 
     PCA9685_MODE1_RESTART = 1 << 7,
+    PCA9685_MODE1_AI      = 1 << 5,
     PCA9685_MODE1_SLEEP   = 1 << 4,
+    PCA9685_MODE1_SUB1    = 1 << 3,
     PCA9685_MODE1_ALLCALL = 1 << 0,
 
     PCA9685_MODE2_INVRT   = 1 << 4,
@@ -70,11 +83,20 @@ enum {
     PCA9685_INTERNAL_OSCILLATOR = 25000000 /* 25MHz */
 };
 
+/* Register address followed by every channel's ON/OFF registers */
+#define PCA9685_FRAME_MAX (1 + 16 * PCA9685_CHANNEL_SIZE)
+
+int _pca9685_adopt(PCA9685 *pca, int frequency);
+int _pca9685_frame(const PCA9685 *pca, unsigned char frame[PCA9685_FRAME_MAX]);
+void _pca9685_dither(PCA9685 *pca);
+void _pca9685_committed(PCA9685 *pca);
+
 PCA9685 *pca9685_open(int bus, int addr) {
     int i;
     PCA9685 *pca = malloc(sizeof(*pca));
 
     memset(pca, 0, sizeof(*pca));
+    pca->oscillator = PCA9685_INTERNAL_OSCILLATOR;
     pca->dev = i2c_open(bus, addr);
     if (!pca->dev) {
         pca9685_close(pca);
@@ -82,20 +104,24 @@ PCA9685 *pca9685_open(int bus, int addr) {
     }
 
     int err;
-    err = pca9685_set_channel_pulse(pca, PCA9685_ALL_CHANNELS, 0, 0);
+
+    /* Register auto-increment (AI) lets a channel, or a run of channels, be
+     * written in a single bus transaction */
+    err = i2c_write8(pca->dev, PCA9685_MODE1,
+                     PCA9685_MODE1_ALLCALL | PCA9685_MODE1_AI);
     if (err) {
-        fprintf(stderr, "Could not reset all PWM fields!\n");
         pca9685_close(pca);
         return NULL;
     }
 
-    err = i2c_write8(pca->dev, PCA9685_MODE2, PCA9685_MODE2_OUTDRV);
+    err = pca9685_set_channel_pulse(pca, PCA9685_ALL_CHANNELS, 0, 0);
     if (err) {
+        fprintf(stderr, "Could not reset all PWM fields!\n");
         pca9685_close(pca);
         return NULL;
     }
 
-    err = i2c_write8(pca->dev, PCA9685_MODE1, PCA9685_MODE1_ALLCALL);
+    err = i2c_write8(pca->dev, PCA9685_MODE2, PCA9685_MODE2_OUTDRV);
     if (err) {
         pca9685_close(pca);
         return NULL;
@@ -122,14 +148,59 @@ PCA9685 *pca9685_open(int bus, int addr) {
     /* Wait 500us again after clearing SLEEP for clock to get back */
     delay(500);
 
+    /* All channels were just zeroed, so the shadow matches the hardware */
     for (i = 0; i < sizeof(pca->channels) / sizeof(pca->channels[0]); i++) {
         pca->channels[i].on =
-        pca->channels[i].off = -1;
+        pca->channels[i].off = 0;
+    }
+    pca->staged = 0;
+
+    return pca;
+}
+
+/* Warm attach: if the PCA9685 is already running with this driver's mode
+ * and the PRE_SCALE for 'frequency', adopt it as is. Nothing is written, so
+ * the servos hold position across a restart, and the channel shadow is
+ * seeded from the hardware so only channels that change get written.
+ *
+ * A PCA9685 in any other state gets the full pca9685_open() and
+ * pca9685_set_pulse_frequency() initialization. */
+PCA9685 *pca9685_attach(int bus, int addr, int oscillator, int frequency) {
+    PCA9685 *pca = malloc(sizeof(*pca));
+    int err;
+
+    memset(pca, 0, sizeof(*pca));
+    pca->oscillator = oscillator;
+    pca->dev = i2c_open(bus, addr);
+    if (!pca->dev) {
+        pca9685_close(pca);
+        return NULL;
+    }
+
+    if (_pca9685_adopt(pca, frequency) == 0) {
+        pca->warm = 1;
+        return pca;
+    }
+    pca9685_close(pca);
+
+    pca = pca9685_open(bus, addr);
+    if (!pca) {
+        return NULL;
+    }
+    pca9685_set_oscillator(pca, oscillator);
+    err = pca9685_set_pulse_frequency(pca, frequency);
+    if (err) {
+        pca9685_close(pca);
+        return NULL;
     }
 
     return pca;
 }
 
+int pca9685_is_warm(const PCA9685 *pca) {
+    return pca->warm;
+}
+
 void pca9685_close(PCA9685 *pca) {
     if (!pca) {
         return;
@@ -138,6 +209,26 @@ void pca9685_close(PCA9685 *pca) {
     free(pca);
 }
 
+/* Parts drift several percent from the nominal 25MHz. Setting the measured
+ * oscillator frequency lets PRE_SCALE be chosen for the closest real PWM
+ * rate and keeps pulse widths accurate. */
+void pca9685_set_oscillator(PCA9685 *pca, int oscillator) {
+    pca->oscillator = oscillator;
+}
+
+int pca9685_compute_prescale(int oscillator, int frequency) {
+    /* Determine PRE_SCALE value based on 7.3.5 PWM frequency PRE_SCALE
+     * from http://www.nxp.com/documents/data_sheet/PCA9685.pdf */
+    return round((double)oscillator / (4096.0 * frequency)) - 1.0;
+}
+
+/* PRE_SCALE quantizes the PWM frequency; this returns the frequency the
+ * PCA9685 actually generates when asked for 'frequency' */
+float pca9685_compute_frequency(int oscillator, int frequency) {
+    return (double)oscillator /
+        (4096.0 * (pca9685_compute_prescale(oscillator, frequency) + 1));
+}
+
 int pca9685_set_pulse_frequency(PCA9685 *pca, int frequency) {
     if (pca == NULL) {
         fprintf(stderr, "NULL passed to pca9685_set_pulse_frequency!\n");
@@ -148,12 +239,15 @@ int pca9685_set_pulse_frequency(PCA9685 *pca, int frequency) {
         return -2;
     }
 
-    /* Determine PRE_SCALE value based on 7.3.5 PWM frequency PRE_SCALE
-     * from http://www.nxp.com/documents/data_sheet/PCA9685.BASE_DISTANCEf */
     int err;
     int prescale;
     unsigned char mode = 0, tmp;
-    prescale = round((float)PCA9685_INTERNAL_OSCILLATOR / (4096.0 * frequency)) - 1.0;
+    prescale = pca9685_compute_prescale(pca->oscillator, frequency);
+    if (prescale < PCA9685_PRE_SCALE_MIN || prescale > PCA9685_PRE_SCALE_MAX) {
+        fprintf(stderr, "PWM frequency %dHz is outside what the PCA9685 can generate!\n",
+                frequency);
+        return -2;
+    }
 
     /* The PRE_SCALE can only be set if SLEEP is set to 1 */
     err = i2c_read8(pca->dev, PCA9685_MODE1, &mode);
@@ -194,80 +288,681 @@ int pca9685_set_pulse_frequency(PCA9685 *pca, int frequency) {
 
     pca->frequency = frequency;
     pca->pulse_width = 1000000L / pca->frequency;
+    pca->counts_per_us = (double)pca->oscillator / (1000000.0 * (prescale + 1));
 
     return 0;
 }
 
 int pca9685_set_channel_pulse(PCA9685 *pca, int channel,
                               unsigned int on, unsigned int off) {
-    int channel_offset;
-    int i;
-    int err;
-
     /* frequency isn't set during initialization, which is when the pulse is being
-     * set to 0 */
+     * set to 0.
+     *
+     * Convert with the period the PCA9685 really generates (oscillator and
+     * PRE_SCALE) and round, rather than truncating against the requested
+     * period. */
     if (pca->frequency > 0) {
-        on = 4096 * on / (1000000L / pca->frequency);
-        off = 4096 * off / (1000000L / pca->frequency);
+        on = on * pca->counts_per_us + 0.5;
+        off = off * pca->counts_per_us + 0.5;
     } else {
         on = off = 0;
     }
 
-    if (channel == PCA9685_ALL_CHANNELS) {
-        for (i = 0; i < sizeof(pca->channels) / sizeof(pca->channels[0]); i++) {
-            pca->channels[i].on = -1;
-            pca->channels[i].off = -1;
+    return pca9685_set_channel_count(pca, channel, on, off);
+}
+
+/* Sets the raw 12-bit ON and OFF counts for a channel. Callers that already
+ * hold counts (eg. from a ServoTable) use this directly and skip the pulse
+ * width conversion. */
+int pca9685_set_channel_count(PCA9685 *pca, int channel,
+                              unsigned int on, unsigned int off) {
+    unsigned char buf[PCA9685_CHANNEL_SIZE];
+    int i;
+    int err;
+
+    if (channel != PCA9685_ALL_CHANNELS) {
+        err = pca9685_stage_channel_count(pca, channel, on, off);
+        if (err) {
+            return err;
         }
-        channel_offset = PCA9685_ALL_OFFSET;
+        return pca9685_commit(pca);
+    }
+
+    buf[PCA9685_ON_L] = on & 0xff;
+    buf[PCA9685_ON_H] = on >> 8;
+    buf[PCA9685_OFF_L] = off & 0xff;
+    buf[PCA9685_OFF_H] = off >> 8;
+
+    err = i2c_write(pca->dev, PCA9685_ALL_OFFSET, buf, sizeof(buf));
+    if (err) {
+        fprintf(stderr, "Unable to set all channels to 0x%03x 0x%03x\n", on, off);
+        return err;
+    }
+
+    for (i = 0; i < sizeof(pca->channels) / sizeof(pca->channels[0]); i++) {
+        pca->channels[i].on = on;
+        pca->channels[i].off = off;
+    }
+    pca->staged = 0;
+    pca->dithered = 0;
+
+    return 0;
+}
+
+/* Stages ON and OFF counts for a channel without touching the bus. Staged
+ * channels are written together, in one transaction, by pca9685_commit (or
+ * pca9685_group_commit.) Staging a value the channel already has clears it
+ * from the next commit. */
+int pca9685_stage_channel_count(PCA9685 *pca, int channel,
+                                unsigned int on, unsigned int off) {
+    PCA9685Channel *c;
+
+    if (channel < 0 || channel >= sizeof(pca->channels) / sizeof(pca->channels[0])) {
+        fprintf(stderr, "Invalid PCA9685 channel: %d\n", channel);
+        return -EINVAL;
+    }
+
+    c = &pca->channels[channel];
+    c->next_on = on & 0x1fff;
+    c->next_off = off & 0x1fff;
+    pca->dithered &= ~(1 << channel);
+    if (c->on == c->next_on && c->off == c->next_off) {
+        pca->staged &= ~(1 << channel);
     } else {
-        if (pca->channels[channel].on == on &&
-            pca->channels[channel].off == off) {
-            return 0;
-        }
-        channel_offset = PCA9685_CHANNEL_0_OFFSET + channel * PCA9685_CHANNEL_SIZE;
+        pca->staged |= 1 << channel;
     }
 
-    err = i2c_write8(pca->dev, channel_offset + PCA9685_ON_L, on & 0x0ff);
+    return 0;
+}
+
+/* Stages an OFF count with PCA9685_FRACTION_BITS of fraction (ON is 0.)
+ *
+ * A count with no fraction is staged like pca9685_stage_channel_count.
+ * Otherwise the channel is dithered: every commit outputs either the count
+ * or the count + 1, chosen by a first order sigma-delta so the average over
+ * consecutive PWM periods is the fractional count. Commit once per PWM
+ * period (see pca9685_is_dithering) for the average to hold. The dithered
+ * values are written in the same frame as everything else staged, and
+ * channels without a fraction don't generate any writes. */
+int pca9685_stage_channel_fine(PCA9685 *pca, int channel, unsigned int off) {
+    PCA9685Channel *c;
+    int err;
+
+    err = pca9685_stage_channel_count(pca, channel, 0, off >> PCA9685_FRACTION_BITS);
+    if (err || !(off & PCA9685_FRACTION_MASK)) {
+        return err;
+    }
+
+    c = &pca->channels[channel];
+    c->fine = off;
+    pca->dithered |= 1 << channel;
+
+    return 0;
+}
+
+int pca9685_is_dithering(const PCA9685 *pca) {
+    return pca->dithered != 0;
+}
+
+void pca9685_get_shadow(const PCA9685 *pca, PCA9685Shadow *shadow) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        shadow->channels[i].on = pca->channels[i].on;
+        shadow->channels[i].off = pca->channels[i].off;
+        shadow->channels[i].fine = pca->channels[i].fine;
+        shadow->channels[i].residual = pca->channels[i].residual;
+    }
+    shadow->dithered = pca->dithered;
+}
+
+/* Take the shadow as what the hardware is outputting. Nothing is written;
+ * anything staged is dropped. */
+void pca9685_set_shadow(PCA9685 *pca, const PCA9685Shadow *shadow) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        pca->channels[i].on = pca->channels[i].next_on = shadow->channels[i].on;
+        pca->channels[i].off = pca->channels[i].next_off = shadow->channels[i].off;
+        pca->channels[i].fine = shadow->channels[i].fine;
+        pca->channels[i].residual = shadow->channels[i].residual;
+    }
+    pca->dithered = shadow->dithered & 0xffff;
+    pca->staged = 0;
+}
+
+int pca9685_commit(PCA9685 *pca) {
+    unsigned char frame[PCA9685_FRAME_MAX];
+    I2CWrite write;
+    int err;
+
+    _pca9685_dither(pca);
+
+    write.len = _pca9685_frame(pca, frame);
+    if (write.len == 0) {
+        return 0;
+    }
+    write.addr = i2c_get_addr(pca->dev);
+    write.buf = frame;
+
+    err = i2c_write_combined(pca->dev, &write, 1);
     if (err) {
-        fprintf(stderr, "Unable to set channel ON LOW to 0x%02x\n", on & 0xff);
+        fprintf(stderr, "Unable to write PWM frame to PCA9685: %s\n", strerror(-err));
         return err;
     }
-    err = i2c_write8(pca->dev, channel_offset + PCA9685_ON_H, on >> 8);
+
+    _pca9685_committed(pca);
+
+    return 0;
+}
+
+int pca9685_get_frequency(PCA9685 *pca) {
+    return pca->frequency;
+}
+
+float pca9685_get_effective_frequency(PCA9685 *pca) {
+    return pca9685_compute_frequency(pca->oscillator, pca->frequency);
+}
+
+
+/************************************************************
+ *
+ * Board groups
+ *
+ ************************************************************/
+
+struct _PCA9685Group {
+    PCA9685 *boards[PCA9685_GROUP_MAX];
+    int count;
+    int combined;               /* Cleared if the adapter rejects combined
+                                 * multi-address transactions */
+    PCA9685GroupStats stats;
+};
+
+int _pca9685_group_write8(PCA9685Group *group, unsigned char reg, unsigned char value);
+
+PCA9685Group *_pca9685_group_create(int bus, const int *addrs, int count,
+                                    int oscillator, int frequency);
+
+PCA9685Group *pca9685_group_open(int bus, const int *addrs, int count) {
+    return _pca9685_group_create(bus, addrs, count, 0, 0);
+}
+
+/* Warm attaches every board (see pca9685_attach.) Boards that can't be
+ * adopted are initialized individually for 'frequency'. */
+PCA9685Group *pca9685_group_attach(int bus, const int *addrs, int count,
+                                   int oscillator, int frequency) {
+    return _pca9685_group_create(bus, addrs, count, oscillator, frequency);
+}
+
+PCA9685Group *_pca9685_group_create(int bus, const int *addrs, int count,
+                                    int oscillator, int frequency) {
+    PCA9685Group *group;
+    int i, err;
+
+    if (count <= 0 || count > PCA9685_GROUP_MAX) {
+        fprintf(stderr, "Invalid number of PCA9685 boards: %d\n", count);
+        return NULL;
+    }
+
+    group = malloc(sizeof(*group));
+    if (!group) {
+        return NULL;
+    }
+    memset(group, 0, sizeof(*group));
+    group->combined = 1;
+    group->stats.skew_min = group->stats.write_min = -1;
+
+    for (i = 0; i < count; i++) {
+        if (addrs[i] == PCA9685_GROUP_ADDRESS) {
+            fprintf(stderr, "PCA9685 address 0x%02x is reserved for the group!\n",
+                    addrs[i]);
+            pca9685_group_close(group);
+            return NULL;
+        }
+
+        if (frequency) {
+            group->boards[i] = pca9685_attach(bus, addrs[i], oscillator, frequency);
+        } else {
+            group->boards[i] = pca9685_open(bus, addrs[i]);
+        }
+        if (!group->boards[i]) {
+            fprintf(stderr, "Could not initialize PCA9685 at 0x%02x!\n", addrs[i]);
+            pca9685_group_close(group);
+            return NULL;
+        }
+        group->count++;
+
+        if (count == 1) {
+            break;
+        }
+
+        /* Every board answers to the group sub-address as well as its own.
+         * Rewriting these on an adopted board doesn't disturb its outputs. */
+        err = i2c_write8(group->boards[i]->dev, PCA9685_SUBADR1,
+                         PCA9685_GROUP_ADDRESS << 1);
+        if (!err) {
+            err = i2c_write8(group->boards[i]->dev, PCA9685_MODE1,
+                             PCA9685_MODE1_ALLCALL | PCA9685_MODE1_AI |
+                             PCA9685_MODE1_SUB1);
+        }
+        if (err) {
+            fprintf(stderr, "Could not set sub-address on PCA9685 at 0x%02x!\n",
+                    addrs[i]);
+            pca9685_group_close(group);
+            return NULL;
+        }
+    }
+
+    return group;
+}
+
+void pca9685_group_close(PCA9685Group *group) {
+    int i;
+
+    if (!group) {
+        return;
+    }
+    for (i = 0; i < group->count; i++) {
+        pca9685_close(group->boards[i]);
+    }
+    free(group);
+}
+
+int pca9685_group_get_count(const PCA9685Group *group) {
+    return group->count;
+}
+
+PCA9685 *pca9685_group_get_board(PCA9685Group *group, int board) {
+    if (board < 0 || board >= group->count) {
+        return NULL;
+    }
+    return group->boards[board];
+}
+
+void pca9685_group_set_oscillator(PCA9685Group *group, int oscillator) {
+    int i;
+
+    for (i = 0; i < group->count; i++) {
+        pca9685_set_oscillator(group->boards[i], oscillator);
+    }
+}
+
+/* Programs PRE_SCALE on every board at once through the sub-address. The
+ * RESTART is broadcast too, so all boards begin their PWM periods together. */
+int pca9685_group_set_pulse_frequency(PCA9685Group *group, int frequency) {
+    unsigned char mode = PCA9685_MODE1_ALLCALL | PCA9685_MODE1_AI | PCA9685_MODE1_SUB1;
+    PCA9685 *first = group->boards[0];
+    int prescale;
+    int err, i;
+
+    if (group->count == 1) {
+        return pca9685_set_pulse_frequency(first, frequency);
+    }
+
+    if (frequency <= 0) {
+        fprintf(stderr, "Attempt to set frequency to %dHz!\n", frequency);
+        return -2;
+    }
+
+    prescale = pca9685_compute_prescale(first->oscillator, frequency);
+    if (prescale < PCA9685_PRE_SCALE_MIN || prescale > PCA9685_PRE_SCALE_MAX) {
+        fprintf(stderr, "PWM frequency %dHz is outside what the PCA9685 can generate!\n",
+                frequency);
+        return -2;
+    }
+
+    /* The PRE_SCALE can only be set if SLEEP is set to 1 */
+    err = _pca9685_group_write8(group, PCA9685_MODE1, mode | PCA9685_MODE1_SLEEP);
+    if (!err) {
+        err = _pca9685_group_write8(group, PCA9685_PRE_SCALE, prescale);
+    }
+    if (!err) {
+        err = _pca9685_group_write8(group, PCA9685_MODE1, mode);
+    }
     if (err) {
-        fprintf(stderr, "Unable to set channel ON HI to 0x%02x\n", on >> 8);
+        fprintf(stderr, "Could not write PRE_SCALE to PCA9685 group!\n");
         return err;
     }
 
-    err = i2c_write8(pca->dev, channel_offset + PCA9685_OFF_L, off & 0x0ff);
+    /* After 500us, raise the RESTART bit to resume PWM values */
+    delay(500);
+    err = _pca9685_group_write8(group, PCA9685_MODE1, mode | PCA9685_MODE1_RESTART);
     if (err) {
-        fprintf(stderr, "Unable to set channel OFF LOW to 0x%02x\n", off & 0xff);
+        fprintf(stderr, "Could not raise RESTART on PCA9685 group!\n");
         return err;
     }
-    err = i2c_write8(pca->dev, channel_offset + PCA9685_OFF_H, off >> 8);
+
+    for (i = 0; i < group->count; i++) {
+        PCA9685 *pca = group->boards[i];
+        pca->frequency = frequency;
+        pca->pulse_width = 1000000L / pca->frequency;
+        pca->counts_per_us = (double)pca->oscillator / (1000000.0 * (prescale + 1));
+    }
+
+    return 0;
+}
+
+int pca9685_group_stage_channel_count(PCA9685Group *group, int board, int channel,
+                                      unsigned int on, unsigned int off) {
+    int i, err;
+
+    if (board != PCA9685_ALL_BOARDS) {
+        if (board < 0 || board >= group->count) {
+            fprintf(stderr, "Invalid PCA9685 board: %d\n", board);
+            return -EINVAL;
+        }
+        return pca9685_stage_channel_count(group->boards[board], channel, on, off);
+    }
+
+    for (i = 0; i < group->count; i++) {
+        err = pca9685_stage_channel_count(group->boards[i], channel, on, off);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/* Writes every board's staged channels.
+ *
+ * Identical frames on all boards go out once, addressed to the group
+ * sub-address. Otherwise one message per changed board is sent in a single
+ * combined transaction. Either way the whole frame costs one transaction,
+ * and every board latches on the same STOP. Adapters that refuse combined
+ * multi-address transfers fall back to one transaction per board; the skew
+ * between the first and last board latching is then measured and reported
+ * in the stats. */
+int pca9685_group_commit(PCA9685Group *group) {
+    unsigned char frames[PCA9685_GROUP_MAX][PCA9685_FRAME_MAX];
+    I2CWrite writes[PCA9685_GROUP_MAX];
+    PCA9685 *changed[PCA9685_GROUP_MAX];
+    PCA9685GroupStats *stats = &group->stats;
+    long long start, first, last;
+    int count = 0, messages, transactions;
+    int broadcast = 0;
+    int i, err = 0;
+
+    for (i = 0; i < group->count; i++) {
+        int len;
+
+        _pca9685_dither(group->boards[i]);
+        len = _pca9685_frame(group->boards[i], frames[count]);
+        if (len == 0) {
+            continue;
+        }
+        writes[count].addr = i2c_get_addr(group->boards[i]->dev);
+        writes[count].buf = frames[count];
+        writes[count].len = len;
+        changed[count++] = group->boards[i];
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    messages = count;
+    if (count > 1 && count == group->count) {
+        broadcast = 1;
+        for (i = 1; i < count && broadcast; i++) {
+            broadcast = writes[i].len == writes[0].len &&
+                !memcmp(writes[i].buf, writes[0].buf, writes[0].len);
+        }
+        if (broadcast) {
+            writes[0].addr = PCA9685_GROUP_ADDRESS;
+            messages = 1;
+        }
+    }
+
+    start = now_usec();
+    first = last = start;
+    transactions = 1;
+
+    if (group->combined || messages == 1) {
+        err = i2c_write_combined(changed[0]->dev, writes, messages);
+        first = last = now_usec();
+        if (err && messages > 1) {
+            fprintf(stderr, "Warning: Combined PCA9685 writes not supported (%s). "
+                    "Writing boards one at a time.\n", strerror(-err));
+            group->combined = 0;
+        }
+    }
+
+    if (!group->combined && messages > 1) {
+        transactions = messages;
+        for (i = 0; i < messages; i++) {
+            err = i2c_write_combined(changed[0]->dev, &writes[i], 1);
+            if (err) {
+                break;
+            }
+            last = now_usec();
+            if (i == 0) {
+                first = last;
+            }
+        }
+    }
+
     if (err) {
-        fprintf(stderr, "Unable to set channel OFF HI to 0x%02x\n", off >> 8);
+        fprintf(stderr, "Unable to write PWM frame to PCA9685 group: %s\n",
+                strerror(-err));
         return err;
     }
 
-    if (channel == PCA9685_ALL_CHANNELS) {
-        for (i = 0; i < sizeof(pca->channels) / sizeof(pca->channels[0]); i++) {
-            pca->channels[i].on = on;
-            pca->channels[i].off = off;
+    for (i = 0; i < count; i++) {
+        _pca9685_committed(changed[i]);
+    }
+
+    stats->frames++;
+    stats->transactions += transactions;
+    stats->messages += messages;
+    stats->broadcasts += broadcast;
+    if (stats->skew_min == -1 || last - first < stats->skew_min) {
+        stats->skew_min = last - first;
+    }
+    if (last - first > stats->skew_max) {
+        stats->skew_max = last - first;
+    }
+    stats->skew_total += last - first;
+    if (stats->write_min == -1 || last - start < stats->write_min) {
+        stats->write_min = last - start;
+    }
+    if (last - start > stats->write_max) {
+        stats->write_max = last - start;
+    }
+    stats->write_total += last - start;
+    stats->write_last = last - start;
+
+    return 0;
+}
+
+int pca9685_group_stage_channel_fine(PCA9685Group *group, int board, int channel,
+                                     unsigned int off) {
+    int i, err;
+
+    if (board != PCA9685_ALL_BOARDS) {
+        if (board < 0 || board >= group->count) {
+            fprintf(stderr, "Invalid PCA9685 board: %d\n", board);
+            return -EINVAL;
+        }
+        return pca9685_stage_channel_fine(group->boards[board], channel, off);
+    }
+
+    for (i = 0; i < group->count; i++) {
+        err = pca9685_stage_channel_fine(group->boards[i], channel, off);
+        if (err) {
+            return err;
         }
-    } else {
-        pca->channels[channel].on = on;
-        pca->channels[channel].off = off;
     }
 
     return 0;
 }
 
-int pca9685_get_frequency(PCA9685 *pca) {
-    return pca->frequency;
+int pca9685_group_is_dithering(const PCA9685Group *group) {
+    int i;
+
+    for (i = 0; i < group->count; i++) {
+        if (pca9685_is_dithering(group->boards[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
-float pca9685_get_effective_frequency(PCA9685 *pca) {
-    int prescale = round((float)PCA9685_INTERNAL_OSCILLATOR /
-                         (4096.0 * pca->frequency)) - 1.0;
-    return (float)PCA9685_INTERNAL_OSCILLATOR / (prescale * 4096);
+void pca9685_group_get_stats(const PCA9685Group *group, PCA9685GroupStats *stats) {
+    memcpy(stats, &group->stats, sizeof(*stats));
+}
+
+/************************************************************
+ *
+ * Internal helper functions
+ *
+ ************************************************************/
+
+/* Builds the register address and payload covering the lowest through the
+ * highest staged channel. Channels in between that aren't staged are
+ * rewritten with their current value; one contiguous write is cheaper on
+ * the bus than a transaction per channel.
+ *
+ * Returns the number of bytes in frame, or 0 if nothing is staged. */
+int _pca9685_frame(const PCA9685 *pca, unsigned char frame[PCA9685_FRAME_MAX]) {
+    const PCA9685Channel *c;
+    int first, last, i;
+    unsigned char *p;
+
+    if (!pca->staged) {
+        return 0;
+    }
+
+    first = __builtin_ctz(pca->staged);
+    last = 31 - __builtin_clz(pca->staged);
+
+    frame[0] = PCA9685_CHANNEL_0_OFFSET + first * PCA9685_CHANNEL_SIZE;
+    p = &frame[1];
+    for (i = first; i <= last; i++) {
+        int on, off;
+
+        c = &pca->channels[i];
+        if (pca->staged & (1 << i)) {
+            on = c->next_on;
+            off = c->next_off;
+        } else {
+            on = c->on;
+            off = c->off;
+        }
+        *p++ = on & 0xff;
+        *p++ = on >> 8;
+        *p++ = off & 0xff;
+        *p++ = off >> 8;
+    }
+
+    return p - frame;
+}
+
+/* One sigma-delta step for every dithered channel: add the fraction to the
+ * channel's accumulator and output one count more whenever it overflows */
+void _pca9685_dither(PCA9685 *pca) {
+    unsigned int pending = pca->dithered;
+    PCA9685Channel *c;
+    int i, off;
+
+    for (i = 0; pending; i++) {
+        if (!(pending & (1 << i))) {
+            continue;
+        }
+        pending &= ~(1 << i);
+
+        c = &pca->channels[i];
+        c->residual += c->fine & PCA9685_FRACTION_MASK;
+        off = c->fine >> PCA9685_FRACTION_BITS;
+        if (c->residual >= (1 << PCA9685_FRACTION_BITS)) {
+            c->residual -= 1 << PCA9685_FRACTION_BITS;
+            off++;
+        }
+
+        c->next_on = 0;
+        c->next_off = off;
+        if (c->on == 0 && c->off == off) {
+            pca->staged &= ~(1 << i);
+        } else {
+            pca->staged |= 1 << i;
+        }
+    }
+}
+
+/* The staged values made it to the hardware; move them to the shadow */
+void _pca9685_committed(PCA9685 *pca) {
+    int i;
+
+    for (i = 0; pca->staged; i++) {
+        if (pca->staged & (1 << i)) {
+            pca->channels[i].on = pca->channels[i].next_on;
+            pca->channels[i].off = pca->channels[i].next_off;
+            pca->staged &= ~(1 << i);
+        }
+    }
+}
+
+int _pca9685_group_write8(PCA9685Group *group, unsigned char reg, unsigned char value) {
+    unsigned char buf[2] = { reg, value };
+    I2CWrite write = {
+        .addr = PCA9685_GROUP_ADDRESS,
+        .buf = buf,
+        .len = sizeof(buf)
+    };
+
+    return i2c_write_combined(group->boards[0]->dev, &write, 1);
+}
+
+/* Checks the PCA9685 is running as pca9685_open() and
+ * pca9685_set_pulse_frequency() would leave it. If so, takes the current
+ * channel values as the shadow and returns 0. */
+int _pca9685_adopt(PCA9685 *pca, int frequency) {
+    unsigned char regs[PCA9685_CHANNEL_0_OFFSET + 16 * PCA9685_CHANNEL_SIZE];
+    unsigned char prescale = 0;
+    int expected = pca9685_compute_prescale(pca->oscillator, frequency);
+    int err, i;
+
+    /* MODE1 first; without auto-increment a burst read would return the
+     * same register over and over */
+    err = i2c_read(pca->dev, PCA9685_MODE1, regs, 1);
+    if (err) {
+        return err;
+    }
+    if ((regs[PCA9685_MODE1] & (PCA9685_MODE1_SLEEP | PCA9685_MODE1_AI)) !=
+        PCA9685_MODE1_AI) {
+        fprintf(stderr, "PCA9685 0x%02x: MODE1 0x%02x needs initialization.\n",
+                i2c_get_addr(pca->dev), regs[PCA9685_MODE1]);
+        return -1;
+    }
+
+    err = i2c_read(pca->dev, PCA9685_MODE1, regs, sizeof(regs));
+    if (!err) {
+        err = i2c_read(pca->dev, PCA9685_PRE_SCALE, &prescale, 1);
+    }
+    if (err) {
+        return err;
+    }
+
+    if (regs[PCA9685_MODE2] != PCA9685_MODE2_OUTDRV || prescale != expected) {
+        fprintf(stderr, "PCA9685 0x%02x: MODE2 0x%02x, PRE_SCALE %d (want %d) "
+                "needs initialization.\n", i2c_get_addr(pca->dev),
+                regs[PCA9685_MODE2], prescale, expected);
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(pca->channels) / sizeof(pca->channels[0]); i++) {
+        unsigned char *led = &regs[PCA9685_CHANNEL_0_OFFSET + i * PCA9685_CHANNEL_SIZE];
+        pca->channels[i].on = (led[PCA9685_ON_L] | led[PCA9685_ON_H] << 8) & 0x1fff;
+        pca->channels[i].off = (led[PCA9685_OFF_L] | led[PCA9685_OFF_H] << 8) & 0x1fff;
+    }
+    pca->staged = 0;
+    pca->dithered = 0;
+
+    pca->frequency = frequency;
+    pca->pulse_width = 1000000L / pca->frequency;
+    pca->counts_per_us = (double)pca->oscillator / (1000000.0 * (prescale + 1));
+
+    return 0;
 }
@@ -10,15 +10,91 @@
 #define __pca9685_h__
 
 typedef struct _PCA9685 PCA9685;
+typedef struct _PCA9685Group PCA9685Group;
 
 #define PCA9685_ALL_CHANNELS -1
+#define PCA9685_COUNTS       4096 /* 12-bit counter per PWM period */
+
+/* Fractional bits of the counts passed to the *_fine (dithered) calls */
+#define PCA9685_FRACTION_BITS 8
+#define PCA9685_FRACTION_MASK ((1 << PCA9685_FRACTION_BITS) - 1)
+
+/* Output state of one board as this driver last wrote it, including the
+ * dither accumulators. Lets a server taking over from another carry on
+ * exactly where it left off (see pca9685_set_shadow.) */
+typedef struct {
+    struct {
+        int on;
+        int off;
+        int fine;
+        int residual;
+    } channels[16];
+    unsigned int dithered;
+} PCA9685Shadow;
 
 PCA9685 *pca9685_open(int bus, int addr);
+PCA9685 *pca9685_attach(int bus, int addr, int oscillator, int frequency);
+int pca9685_is_warm(const PCA9685 *pca);
 void pca9685_close(PCA9685 *pca);
 int pca9685_set_channel_pulse(PCA9685 *pca, int channel,
                               unsigned int on, unsigned int off);
+int pca9685_set_channel_count(PCA9685 *pca, int channel,
+                              unsigned int on, unsigned int off);
+int pca9685_stage_channel_count(PCA9685 *pca, int channel,
+                                unsigned int on, unsigned int off);
+int pca9685_stage_channel_fine(PCA9685 *pca, int channel, unsigned int off);
+int pca9685_is_dithering(const PCA9685 *pca);
+int pca9685_commit(PCA9685 *pca);
+void pca9685_get_shadow(const PCA9685 *pca, PCA9685Shadow *shadow);
+void pca9685_set_shadow(PCA9685 *pca, const PCA9685Shadow *shadow);
+void pca9685_set_oscillator(PCA9685 *pca, int oscillator);
 int pca9685_set_pulse_frequency(PCA9685 *pca, int frequency);
 int pca9685_get_frequency(PCA9685 *pca);
 float pca9685_get_effective_frequency(PCA9685 *pca);
 
+int pca9685_compute_prescale(int oscillator, int frequency);
+float pca9685_compute_frequency(int oscillator, int frequency);
+
+/*
+ * Several PCA9685 boards on one bus driven as a unit. Channel values are
+ * staged per board and pca9685_group_commit() sends every board's frame in
+ * a single combined I2C transaction. The PCA9685 latches new outputs on the
+ * I2C STOP, so all boards change together on the transaction's one STOP.
+ * When every board has the same frame it is sent once to the group's
+ * sub-address (SUBADR1) instead.
+ */
+#define PCA9685_ALL_BOARDS    -1
+#define PCA9685_GROUP_MAX     16
+#define PCA9685_GROUP_ADDRESS 0x71 /* SUBADR1 programmed into every board */
+
+typedef struct {
+    unsigned long frames;        /* Commits that wrote at least one board */
+    unsigned long transactions;  /* Bus transactions (one STOP each) */
+    unsigned long messages;      /* Addressed writes within those */
+    unsigned long broadcasts;    /* Frames sent once to the sub-address */
+    long long skew_min;          /* First to last board latch, in us */
+    long long skew_max;
+    long long skew_total;
+    long long write_min;         /* Time on the bus per frame, in us */
+    long long write_max;
+    long long write_total;
+    long long write_last;        /* Time on the bus for the newest frame */
+} PCA9685GroupStats;
+
+PCA9685Group *pca9685_group_open(int bus, const int *addrs, int count);
+PCA9685Group *pca9685_group_attach(int bus, const int *addrs, int count,
+                                   int oscillator, int frequency);
+void pca9685_group_close(PCA9685Group *group);
+int pca9685_group_get_count(const PCA9685Group *group);
+PCA9685 *pca9685_group_get_board(PCA9685Group *group, int board);
+void pca9685_group_set_oscillator(PCA9685Group *group, int oscillator);
+int pca9685_group_set_pulse_frequency(PCA9685Group *group, int frequency);
+int pca9685_group_stage_channel_count(PCA9685Group *group, int board, int channel,
+                                      unsigned int on, unsigned int off);
+int pca9685_group_stage_channel_fine(PCA9685Group *group, int board, int channel,
+                                     unsigned int off);
+int pca9685_group_is_dithering(const PCA9685Group *group);
+int pca9685_group_commit(PCA9685Group *group);
+void pca9685_group_get_stats(const PCA9685Group *group, PCA9685GroupStats *stats);
+
 #endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,75 +17,655 @@
 
 #include <linux/limits.h>
 
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
-#include <sys/time.h>
 #include <sys/types.h>
 
+#include "stewart.h"
+#include "config.h"
 #include "delay.h"
+#include "recording.h"
 
-int main(int argc, char *argv[]) {
-    struct timeval now, start;
-    FILE *in = stdin;
+/* How late each line went out, for the report at the end */
+typedef struct {
+    long long *samples;
+    long count;
+    long size;
+} Lateness;
 
-    /* Parse command line arguments... */
-    if (argc > 1) {
-        if (argv[1][0] == '-') {
-            fprintf(stderr,
-                "usage: playback [FILENAME]\n"
-                "\n"
-                "The above will read from FILENAME (or STDIN if no file provided.)\n"
-                "\n"
-                "Each line of input must contain the number of milliseconds from\n"
-                "program launch when the rest of that line should be sent to STDOUT.\n"
-                "\n");
-            return 1;
-        } else {
-            in = fopen(argv[1], "r");
-            if (in == NULL) {
-                fprintf(stderr, "ERROR: Unable to open '%s': %s\n", argv[1],
-                        strerror(errno));
+/* A recording being played. Text lines are indexed by time up front. */
+typedef struct {
+    long long usec;
+    const char *text;          /* After the time, newline included */
+    size_t length;
+} TextLine;
+
+typedef struct {
+    RecordingReader *reader;   /* Binary recordings */
+    TextLine *lines;           /* Text ones */
+    long count;
+    long next;
+} Source;
+
+volatile sig_atomic_t stop = 0;
+Lateness lateness;
+
+double speed = 1;              /* -x */
+long long from = 0, to = -1;   /* -a and -b, recording usec */
+int loop = 0;                  /* -l */
+int tickRate = 0;              /* -r, Hz; 0 plays frames as recorded */
+long long lap = 0;             /* Recording time played in earlier laps */
+
+void onSignal(int sig);
+void *mapInput(int fd, size_t *length, int *mapped);
+int emit(long long deadline, const char *line, size_t length);
+int compareLateness(const void *a, const void *b);
+void reportLateness(long long start, long long end);
+int isPose(const char *text, const char *end);
+int openSource(Source *source, const void *data, size_t length);
+void closeSource(Source *source);
+void seekSource(Source *source, long long usec);
+int readSource(Source *source, RecordingFrame *frame, const char **text, size_t *length);
+long long scaleTime(long long usec);
+size_t formatValues(const RecordingFrame *frame, char *line, size_t size);
+int playFrames(Source *source, long long start);
+void interpolate(const RecordingFrame *a, const RecordingFrame *b, double u,
+                 RecordingFrame *out);
+long long tickOffset(long tick);
+int playResampled(Source *source, long long start);
+void usage(int ret);
+
+void onSignal(int sig) {
+    stop = 1;
+}
+
+/* Map the input if it is a file. Pipes are read into memory first, so
+ * playing doesn't wait on whatever feeds them. */
+void *mapInput(int fd, size_t *length, int *mapped) {
+    size_t size = 65536;
+    char *data = NULL, *grown;
+    struct stat st;
+    ssize_t got;
+
+    *length = 0;
+    *mapped = 0;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        if (!st.st_size) {
+            return "";
+        }
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "ERROR: Unable to map input: %s\n", strerror(errno));
+            return NULL;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        *length = st.st_size;
+        *mapped = 1;
+        return data;
+    }
+
+    while (1) {
+        if (*length == size || !data) {
+            size = data ? size * 2 : size;
+            grown = realloc(data, size);
+            if (!grown) {
+                fprintf(stderr, "ERROR: Out of memory reading input\n");
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+        got = read(fd, data + *length, size - *length);
+        if (got < 0 && errno == EINTR && !stop) {
+            continue;
+        }
+        if (got < 0) {
+            fprintf(stderr, "ERROR: Unable to read input: %s\n", strerror(errno));
+            free(data);
+            return NULL;
+        }
+        if (!got) {
+            break;
+        }
+        *length += got;
+    }
+    if (!*length) {
+        free(data);
+        return "";
+    }
+
+    return data;
+}
+
+/* Write line at deadline (now_usec() time) and note how late it was */
+int emit(long long deadline, const char *line, size_t length) {
+    long long *grown;
+
+    if (stop) {
+        return -1;
+    }
+    while (now_usec() < deadline) {
+        if (delay_until(deadline) && stop) {
+            return -1;
+        }
+    }
+    if (fwrite(line, 1, length, stdout) != length || fflush(stdout)) {
+        return -1;
+    }
+
+    if (lateness.count == lateness.size) {
+        lateness.size = lateness.size ? lateness.size * 2 : 4096;
+        grown = realloc(lateness.samples, lateness.size * sizeof(*grown));
+        if (!grown) {
+            /* Only the report loses out */
+            lateness.size = lateness.count;
+            return 0;
+        }
+        lateness.samples = grown;
+    }
+    lateness.samples[lateness.count++] = now_usec() - deadline;
+
+    return 0;
+}
+
+int compareLateness(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* end is when the last line was due */
+void reportLateness(long long start, long long end) {
+    static const double percentiles[] = { 50, 90, 99, 99.9 };
+    long long *samples = lateness.samples;
+    long count = lateness.count;
+    int i;
+
+    if (!count) {
+        return;
+    }
+    qsort(samples, count, sizeof(*samples), compareLateness);
+
+    fprintf(stderr, "%ld lines over %.3fs; late by", count, (end - start) / 1000000.0);
+    for (i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+        fprintf(stderr, " p%g %lldus,", percentiles[i],
+                samples[(long)ceil(percentiles[i] / 100 * count) - 1]);
+    }
+    if (stop) {
+        fprintf(stderr, " max %lldus; stopped\n", samples[count - 1]);
+    } else {
+        fprintf(stderr, " max %lldus; finished %lldus after the last was due\n",
+                samples[count - 1], now_usec() - end);
+    }
+}
+
+/* A line from a flight recorder dump converted to text says what it holds
+ * after its time; only poses are played */
+int isPose(const char *text, const char *end) {
+    const char *name;
+    size_t length;
+    int kind;
+
+    for (kind = RECORDING_KIND_POSE + 1; kind < RECORDING_KINDS; kind++) {
+        name = recording_kind_name(kind);
+        length = strlen(name);
+        if (end - text > length && !memcmp(text, name, length) &&
+            (text[length] == ' ' || text[length] == '\t')) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Text recordings are indexed by time when they are opened, so they seek
+ * like binary ones do through their keyframe index. Returns -1 at a line
+ * that isn't "<ms> <rest>"; the lines before it still play. */
+int openSource(Source *source, const void *data, size_t length) {
+    const char *line = data, *end = (const char *)data + length, *next, *after, *rest;
+    StewartConfig config;
+    TextLine *grown;
+    long size = 0;
+    long long ms;
+
+    memset(source, 0, sizeof(*source));
+    if (recording_check(data, length)) {
+        source->reader = recording_reader_create(data, length);
+        if (!source->reader) {
+            return -1;
+        }
+        config_get(&config);
+        if (recording_reader_get_header(source->reader)->config_hash != config_hash(&config)) {
+            fprintf(stderr, "WARNING: Recording was made with different geometry or trims "
+                    "(config hash %08x, this stewart.cfg %08x)\n",
+                    recording_reader_get_header(source->reader)->config_hash,
+                    config_hash(&config));
+        }
+        return 0;
+    }
+
+    for (; line < end; line = next) {
+        next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+
+        /* The input needn't end in a newline or NUL, so no strtol */
+        for (after = line, ms = 0; after < next && *after >= '0' && *after <= '9'; after++) {
+            ms = ms * 10 + *after - '0';
+        }
+        if (after == line || after >= next || (*after != ' ' && *after != '\t')) {
+            fprintf(stderr, "Error parsing line %ld from input.\n", source->count + 1);
+            return -1;
+        }
+        for (rest = after; rest < next && (*rest == ' ' || *rest == '\t'); rest++);
+        if (!isPose(rest, next)) {
+            continue;
+        }
+
+        if (source->count == size) {
+            size = size ? size * 2 : 4096;
+            grown = realloc(source->lines, size * sizeof(*grown));
+            if (!grown) {
+                fprintf(stderr, "ERROR: Out of memory indexing input\n");
                 return -1;
             }
+            source->lines = grown;
         }
+        source->lines[source->count].usec = ms * 1000;
+        source->lines[source->count].text = rest;
+        source->lines[source->count].length = next - rest;
+        source->count++;
+    }
+
+    return 0;
+}
+
+void closeSource(Source *source) {
+    if (source->reader) {
+        recording_reader_delete(source->reader);
     }
+    free(source->lines);
+}
 
-    gettimeofday(&start, NULL);
+/* The next frame read is the first at or after usec */
+void seekSource(Source *source, long long usec) {
+    long lo = 0, hi = source->count, mid;
 
+    if (source->reader) {
+        recording_seek(source->reader, usec);
+        return;
+    }
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (source->lines[mid].usec < usec) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    source->next = lo;
+}
+
+/* Returns 1 with the next frame, 0 at the end. For text, line is set to
+ * the line as recorded; for binary, to NULL. */
+int readSource(Source *source, RecordingFrame *frame, const char **text, size_t *length) {
+    const TextLine *line;
     char buf[1024];
-    long pos = 0;
-    while (fgets(buf, sizeof(buf), in) == buf) {
-        long wait, elapsed;
-        char *line = NULL;
 
-        pos++;
+    if (source->reader) {
+        *text = NULL;
+        /* A flight recorder dump holds more than poses; play just those.
+         * Text lines that aren't were left out of the index. */
+        do {
+            if (recording_read(source->reader, frame) <= 0) {
+                return 0;
+            }
+        } while (frame->kind != RECORDING_KIND_POSE);
+        return 1;
+    }
+    if (source->next == source->count) {
+        return 0;
+    }
+    line = &source->lines[source->next++];
+    snprintf(buf, sizeof(buf), "%.*s", (int)line->length, line->text);
+    recording_parse_values(buf, frame);
+    frame->usec = line->usec;
+    *text = line->text;
+    *length = line->length;
+
+    return 1;
+}
+
+/* Wall clock time for recording time usec, from the start of the lap */
+long long scaleTime(long long usec) {
+    return llround(usec / speed);
+}
+
+size_t formatValues(const RecordingFrame *frame, char *line, size_t size) {
+    size_t used = 0;
+    int i;
+
+    for (i = 0; i < frame->count; i++) {
+        if (i) {
+            line[used++] = ' ';
+        }
+        used += recording_format_value(frame->values[i], line + used, size - used);
+    }
+    line[used++] = '\n';
+
+    return used;
+}
+
+/* Each frame at its own time, scaled by speed */
+int playFrames(Source *source, long long start) {
+    char line[RECORDING_VALUES_MAX * 16 + 2];
+    long long base = start, due = start, last = -1, gap = 0, end;
+    RecordingFrame frame;
+    const char *text;
+    size_t length;
 
-        gettimeofday(&now, NULL);
+    seekSource(source, from);
+    while (!stop) {
+        if (!readSource(source, &frame, &text, &length) || (to >= 0 && frame.usec >= to)) {
+            if (!loop || last < 0) {
+                break;
+            }
+            /* The next lap starts where this one ends: at B, or a frame's
+             * spacing after the last frame */
+            end = to >= 0 ? to : last + gap;
+            if (end <= from) {
+                break;
+            }
+            base += scaleTime(end - from);
+            seekSource(source, from);
+            last = -1;
+            continue;
+        }
+        if (last >= 0) {
+            gap = frame.usec - last;
+        }
+        last = frame.usec;
 
-        if (sscanf(buf, "%ld %m[+a-z \n\tA-Z0-9.-]\n", &wait, &line) != 2) {
-            fprintf(stderr, "Error parsing line from input.\n");
+        if (!text) {
+            length = formatValues(&frame, line, sizeof(line));
+            text = line;
+        }
+        due = base + scaleTime(frame.usec - from);
+        if (emit(due, text, length)) {
             break;
         }
+    }
+
+    reportLateness(start, due);
+
+    return 0;
+}
+
+/* Blend a into b by u. Axis-angle rotations take the shortest arc between
+ * them (slerp); Euler angles and translations are blended linearly. Frames
+ * of different kinds don't blend; a holds until b. */
+void interpolate(const RecordingFrame *a, const RecordingFrame *b, double u,
+                 RecordingFrame *out) {
+    double qa[4], qb[4], q[4], dot, theta, wa, wb, s, angle;
+    int i;
+
+    *out = *a;
+    if (a->count != b->count || u <= 0) {
+        return;
+    }
+    for (i = 0; i < a->count; i++) {
+        out->values[i] = a->values[i] + (b->values[i] - a->values[i]) * u;
+    }
+    if (a->count != 4 && a->count != 7) {
+        return;
+    }
+
+    /* Axis and angle (degrees) to unit quaternions */
+    for (i = 0; i < 2; i++) {
+        const RecordingFrame *f = i ? b : a;
+        double *qf = i ? qb : qa;
+        double n = sqrt(f->values[0] * f->values[0] + f->values[1] * f->values[1] +
+                        f->values[2] * f->values[2]);
+        double half = f->values[3] * M_PI / 360.0;
+
+        qf[0] = cos(half);
+        qf[1] = n > 0 ? f->values[0] / n * sin(half) : 0;
+        qf[2] = n > 0 ? f->values[1] / n * sin(half) : 0;
+        qf[3] = n > 0 ? f->values[2] / n * sin(half) : 0;
+    }
+    dot = qa[0] * qb[0] + qa[1] * qb[1] + qa[2] * qb[2] + qa[3] * qb[3];
+    if (dot < 0) {
+        for (i = 0; i < 4; i++) {
+            qb[i] = -qb[i];
+        }
+        dot = -dot;
+    }
+    if (dot > 0.9995) {
+        wa = 1 - u;
+        wb = u;
+    } else {
+        theta = acos(dot);
+        wa = sin((1 - u) * theta) / sin(theta);
+        wb = sin(u * theta) / sin(theta);
+    }
+    for (i = 0; i < 4; i++) {
+        q[i] = wa * qa[i] + wb * qb[i];
+    }
+    s = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (i = 0; i < 4; i++) {
+        q[i] /= s;
+    }
+
+    angle = 2 * acos(q[0] > 1 ? 1 : q[0]);
+    s = sin(angle / 2);
+    if (s > 1e-6) {
+        out->values[0] = q[1] / s;
+        out->values[1] = q[2] / s;
+        out->values[2] = q[3] / s;
+    } else {
+        /* No rotation; any axis will do, so keep a's */
+        memcpy(out->values, a->values, 3 * sizeof(float));
+    }
+    out->values[3] = angle * 180.0 / M_PI;
+}
+
+/* Wall clock time of resampled tick n from the start of the lap. Worked
+ * out from n in nanoseconds each time, so rates that don't divide a second
+ * don't drift. */
+long long tickOffset(long tick) {
+    return tick * 1000000000LL / tickRate / 1000;
+}
+
+/* One frame every tick of wall clock time, interpolated from the frames
+ * either side of it, so the consumer gets exactly one per control tick */
+int playResampled(Source *source, long long start) {
+    char line[RECORDING_VALUES_MAX * 16 + 2];
+    RecordingFrame prev, next, out;
+    long long due = start, t, sent = -1, gap = 0, end;
+    const char *text;
+    size_t length;
+    int haveNext;
+    long tick;
+
+    seekSource(source, from);
+    if (!readSource(source, &prev, &text, &length) || (to >= 0 && prev.usec >= to)) {
+        return 0;
+    }
+    haveNext = readSource(source, &next, &text, &length);
+
+    for (tick = 0; !stop; tick++) {
+        /* Recording time of this tick. Ticks are counted from the start
+         * rather than added up, so rounding doesn't drift. */
+        t = from + llround(tick * 1000000.0 / tickRate * speed) - lap;
 
-        elapsed = (now.tv_sec - start.tv_sec) * 1000 +
-                  (now.tv_usec - start.tv_usec) / 1000;
+        while (haveNext && next.usec <= t) {
+            gap = next.usec - prev.usec;
+            prev = next;
+            haveNext = readSource(source, &next, &text, &length);
+        }
 
-        if (elapsed > wait) {
-            fprintf(stderr, "WARNING: Playback can't keep up at line %ld! Behind by %ldms\n",
-                    pos, elapsed - wait);
+        if (to >= 0 ? t >= to : !haveNext && t > prev.usec) {
+            /* The lap ends at B, or a frame's spacing after the last frame */
+            end = to >= 0 ? to : prev.usec + gap;
+            if (!loop) {
+                /* Finish on the last frame itself */
+                if (to < 0 && sent < prev.usec) {
+                    due = start + tickOffset(tick);
+                    emit(due, line, formatValues(&prev, line, sizeof(line)));
+                }
+                break;
+            }
+            if (t >= end) {
+                if (end <= from) {
+                    break;
+                }
+                lap += end - from;
+                seekSource(source, from);
+                readSource(source, &prev, &text, &length);
+                haveNext = readSource(source, &next, &text, &length);
+                tick--;
+                continue;
+            }
+            out = prev;
+        } else if (haveNext && t > prev.usec) {
+            interpolate(&prev, &next, (double)(t - prev.usec) / (next.usec - prev.usec), &out);
         } else {
-            delay((wait - elapsed) * 1000);
+            out = prev;
         }
 
-        if (line) {
-            fputs(line, stdout);
-            fflush(stdout);
-            free(line);
+        sent = t;
+        due = start + tickOffset(tick);
+        if (emit(due, line, formatValues(&out, line, sizeof(line)))) {
+            break;
         }
     }
 
-    if (in != stdin) {
-        fclose(in);
-    }
+    reportLateness(start, due);
 
     return 0;
 }
+
+void usage(int ret) {
+    fprintf(stderr,
+        "usage: playback [OPTIONS] [FILENAME]\n"
+        "\n"
+        "The above will read from FILENAME (or STDIN if no file provided.)\n"
+        "\n"
+        "Each line of input must contain the number of milliseconds from\n"
+        "program launch when the rest of that line should be sent to STDOUT.\n"
+        "\n"
+        "Binary recordings (record -b or -z) are recognized and played the same\n"
+        "way, each frame going out as a line of numbers.\n"
+        "\n"
+        "Lines are due at fixed offsets from the start on the monotonic clock,\n"
+        "so time spent writing one doesn't delay the rest. At the end (or on\n"
+        "CTRL-C) how late they went out is reported on STDERR.\n"
+        "\n"
+        "Options:\n"
+        "-x SPEED    Play SPEED times as fast; below 1 is slow motion (default 1)\n"
+        "-a SECONDS  Start SECONDS into the recording (A)\n"
+        "-b SECONDS  Stop SECONDS into the recording (B)\n"
+        "-l          Loop from A to B (or the end) until stopped\n"
+        "-r HZ       Resample: send one line every 1/HZ seconds, interpolated\n"
+        "            from the frames either side. 0 uses the control tick\n"
+        "            rate in stewart.cfg. Lines must be poses, as transform\n"
+        "            reads them.\n"
+        "\n");
+    exit(ret);
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction action;
+    StewartConfig config;
+    int fd = STDIN_FILENO, mapped, rate = -1, opt, rc;
+    Source source;
+    size_t length;
+    void *data;
+
+    /* Parse command line arguments... */
+    while ((opt = getopt(argc, argv, "x:a:b:lr:")) != -1) {
+        switch (opt) {
+        case 'x':
+            speed = strtod(optarg, NULL);
+            if (speed <= 0) {
+                fprintf(stderr, "-x SPEED must be more than 0\n");
+                usage(-1);
+            }
+            break;
+        case 'a':
+            from = llround(strtod(optarg, NULL) * 1000000);
+            break;
+        case 'b':
+            to = llround(strtod(optarg, NULL) * 1000000);
+            break;
+        case 'l':
+            loop = 1;
+            break;
+        case 'r':
+            rate = strtol(optarg, NULL, 0);
+            if (rate < 0 || rate > CONTROL_TICK_RATE_MAX) {
+                fprintf(stderr, "-r HZ must be 0 to %d\n", CONTROL_TICK_RATE_MAX);
+                usage(-1);
+            }
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if (from < 0 || (to >= 0 && to <= from)) {
+        fprintf(stderr, "-a must be before -b\n");
+        usage(-1);
+    }
+    if (optind < argc) {
+        fd = open(argv[optind], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "ERROR: Unable to open '%s': %s\n", argv[optind],
+                    strerror(errno));
+            return -1;
+        }
+    }
+    if (rate == 0) {
+        config_get(&config);
+        rate = config_get_tick_rate(&config);
+    }
+    if (rate > 0) {
+        tickRate = rate;
+    }
+
+    /* No SA_RESTART, so ^C wakes the sleep and still gets the report */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    /* The default 50us of timer slack would be most of the lateness */
+    prctl(PR_SET_TIMERSLACK, 1);
+
+    data = mapInput(fd, &length, &mapped);
+    if (!data) {
+        return -1;
+    }
+
+    /* Whatever parsed before an error still plays */
+    rc = openSource(&source, data, length);
+    if (source.reader || source.count) {
+        if (tickRate) {
+            playResampled(&source, now_usec());
+        } else {
+            playFrames(&source, now_usec());
+        }
+    }
+    closeSource(&source);
+
+    if (mapped) {
+        munmap(data, length);
+    } else if (length) {
+        free(data);
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    free(lateness.samples);
+
+    return rc ? -1 : 0;
+}
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,15 +21,38 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include "stewart.h"
+#include "config.h"
+#include "delay.h"
+#include "recording.h"
+
+volatile sig_atomic_t stop = 0;
+
+void onSignal(int sig) {
+    stop = 1;
+}
+
 int main(int argc, char *argv[]) {
-    struct timeval now, start;
+    RecordingWriter *writer = NULL;
+    RecordingFrame frame;
+    StewartConfig config;
+    struct sigaction action;
+    long long start, now;
+    int binary = 0, flags = 0, bad = 0, opt, rc = 0;
     FILE *out = stdout;
 
     /* Parse command line arguments... */
-    if (argc > 1) {
-        if (argv[1][0] == '-') {
+    while ((opt = getopt(argc, argv, "bz")) != -1) {
+        switch (opt) {
+        case 'z':
+            flags |= RECORDING_COMPRESSED;
+            /* fall through */
+        case 'b':
+            binary = 1;
+            break;
+        default:
             fprintf(stderr,
-                "usage: record [FILENAME]\n"
+                "usage: record [-b|-z] [FILENAME]\n"
                 "\n"
                 "The above will read from STDIN. Every time a newline is received, it\n"
                 "will write what it received to FILENAME prefixed with a timestamp\n"
@@ -42,36 +66,74 @@ int main(int argc, char *argv[]) {
                 "If FILENAMEis provided, timestamped values are sent to FILENAME, and\n"
                 "the original STDIN is echoed back to STDOUT.\n"
                 "\n"
-                "This allows you to record a live session for playback later.\n");
+                "This allows you to record a live session for playback later.\n"
+                "\n"
+                "  -b  Write a binary recording instead: microsecond timestamps, the\n"
+                "      numbers on each line (up to %d) and the hash of stewart.cfg's\n"
+                "      geometry and trims. Lines without numbers are skipped.\n"
+                "  -z  As -b, delta compressed\n",
+                RECORDING_VALUES_MAX);
             return 1;
-        } else {
-            out = fopen(argv[1], "w");
-            if (out == NULL) {
-                fprintf(stderr, "ERROR: Unable to create '%s': %s\n", argv[1],
-                        strerror(errno));
-                return -1;
-            }
         }
     }
 
-    gettimeofday(&start, NULL);
+    if (optind < argc) {
+        out = fopen(argv[optind], "w");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: Unable to create '%s': %s\n", argv[optind],
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    if (binary) {
+        config_get(&config);
+        writer = recording_writer_create(out, config_hash(&config), flags);
+        if (!writer) {
+            return -1;
+        }
+
+        /* No SA_RESTART: ^C interrupts fgets so the index still gets written */
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onSignal;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
+
+    start = now_usec();
 
     char buf[1024];
-    while (fgets(buf, sizeof(buf), stdin) == buf) {
-        gettimeofday(&now, NULL);
-        fprintf(out, "%ld %s",
-               (long)((now.tv_sec - start.tv_sec) * 1000 +
-                      (now.tv_usec - start.tv_usec) / 1000), buf);
-        fflush(out);
+    while (!stop && fgets(buf, sizeof(buf), stdin) == buf) {
+        now = now_usec();
+        if (writer) {
+            recording_parse_values(buf, &frame);
+            frame.usec = now - start;
+            if (!frame.count) {
+                if (!bad++) {
+                    fprintf(stderr, "Warning: Skipping lines without numbers\n");
+                }
+            } else if (recording_write(writer, &frame)) {
+                fprintf(stderr, "ERROR: Unable to write recording: %s\n", strerror(errno));
+                rc = -1;
+                break;
+            }
+        } else {
+            fprintf(out, "%lld %s", (now - start) / 1000, buf);
+            fflush(out);
+        }
         if (out != stdout) {
             fputs(buf, stdout);
             fflush(stdout);
         }
     }
 
+    if (writer && recording_writer_finish(writer)) {
+        rc = -1;
+    }
+
     if (out != stdout) {
         fclose(out);
     }
 
-    return 0;
+    return rc;
 }
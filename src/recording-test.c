@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "recording.h"
+#include "varint.h"
+
+/* Round trips recordings through the writer and reader, both layouts, and
+ * checks the varints under them. Exits non-zero if anything fails. */
+
+#define FRAMES 600 /* Past the third keyframe */
+
+int failures = 0;
+
+void expect(int ok, const char *format, ...) {
+    va_list args;
+
+    if (ok) {
+        return;
+    }
+    failures++;
+    printf("FAIL: ");
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+void makeFrame(int n, RecordingFrame *frame) {
+    int i;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->usec = 1000000 + n * 10000LL + (n % 3);
+    frame->kind = n % RECORDING_KINDS;
+    frame->count = 1 + n % RECORDING_VALUES_MAX;
+    for (i = 0; i < frame->count; i++) {
+        /* Some values hold still, some creep, one goes negative */
+        frame->values[i] = i == 0 ? 1.5f : i % 2 ? n * 0.001f * i : -n * 37.25f;
+    }
+}
+
+int sameFrame(const RecordingFrame *a, const RecordingFrame *b) {
+    return a->usec == b->usec && a->count == b->count && a->kind == b->kind &&
+           !memcmp(a->values, b->values, a->count * sizeof(float));
+}
+
+void testVarints() {
+    uint64_t values[] = { 0, 1, 127, 128, 16383, 16384, 0xffffffffULL,
+                          0x8000000000000000ULL, 0xffffffffffffffffULL };
+    uint8_t data[VARINT_MAX + 2];
+    uint64_t value;
+    size_t length, i, cut;
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        length = varint_put(data, values[i]);
+        expect(length >= 1 && length <= VARINT_MAX, "varint %llx took %zu bytes",
+               (unsigned long long)values[i], length);
+        expect(varint_get(data, length, &value) == length && value == values[i],
+               "varint %llx did not round trip", (unsigned long long)values[i]);
+        for (cut = 0; cut < length; cut++) {
+            expect(!varint_get(data, cut, &value), "varint %llx cut to %zu bytes was read",
+                   (unsigned long long)values[i], cut);
+        }
+    }
+
+    /* Eleven bytes that all say more follows */
+    memset(data, 0x80, sizeof(data));
+    expect(!varint_get(data, sizeof(data), &value), "overlong varint was read");
+}
+
+/* Write FRAMES frames; returns the file in memory */
+char *writeRecording(int flags, size_t *length) {
+    RecordingWriter *writer;
+    RecordingFrame frame;
+    char *data = NULL;
+    FILE *out;
+    int n;
+
+    out = open_memstream(&data, length);
+    writer = out ? recording_writer_create(out, 0x1234, flags) : NULL;
+    if (!writer) {
+        fprintf(stderr, "Error: Unable to write a recording\n");
+        exit(1);
+    }
+    for (n = 0; n < FRAMES; n++) {
+        makeFrame(n, &frame);
+        recording_write(writer, &frame);
+    }
+    recording_writer_finish(writer);
+    fclose(out);
+
+    return data;
+}
+
+void testRoundTrip(int flags) {
+    const char *name = flags & RECORDING_COMPRESSED ? "compressed" : "uncompressed";
+    int seeks[] = { 0, 1, 255, 256, 300, 512, FRAMES - 1 };
+    RecordingFrame frame, expected;
+    RecordingReader *reader;
+    size_t length;
+    char *data;
+    int n, rc;
+
+    data = writeRecording(flags, &length);
+    reader = recording_reader_create(data, length);
+    expect(reader != NULL, "%s: reader refused the recording", name);
+    if (!reader) {
+        free(data);
+        return;
+    }
+    expect(recording_reader_get_header(reader)->config_hash == 0x1234, "%s: hash lost", name);
+    expect(recording_reader_get_frames(reader) == FRAMES, "%s: footer has %ld frames", name,
+           recording_reader_get_frames(reader));
+
+    for (n = 0; (rc = recording_read(reader, &frame)) > 0; n++) {
+        makeFrame(n, &expected);
+        expect(sameFrame(&frame, &expected), "%s: frame %d differs", name, n);
+    }
+    expect(!rc && n == FRAMES, "%s: read %d frames, rc %d", name, n, rc);
+    makeFrame(FRAMES - 1, &expected);
+    expect(recording_reader_get_duration(reader) == expected.usec, "%s: duration %lld", name,
+           recording_reader_get_duration(reader));
+
+    /* Seeks land on keyframes, between them, and on the last frame */
+    for (n = 0; n < sizeof(seeks) / sizeof(seeks[0]); n++) {
+        makeFrame(seeks[n], &expected);
+        expect(!recording_seek(reader, expected.usec) && recording_read(reader, &frame) == 1 &&
+               sameFrame(&frame, &expected), "%s: seek to frame %d", name, seeks[n]);
+        makeFrame(seeks[n] + 1, &expected);
+        expect(seeks[n] == FRAMES - 1 ||
+               (recording_read(reader, &frame) == 1 && sameFrame(&frame, &expected)),
+               "%s: frame after seeking to %d", name, seeks[n]);
+    }
+    expect(recording_seek(reader, expected.usec + 1000000) == -1, "%s: seek past the end", name);
+    recording_reader_delete(reader);
+
+    /* Cut short partway through a frame: what was whole still reads */
+    length -= sizeof(RecordingFooter) + 3 * sizeof(RecordingIndexEntry) + 3;
+    reader = recording_reader_create(data, length);
+    expect(reader && recording_reader_get_frames(reader) == -1, "%s: cut short has an index", name);
+    if (reader) {
+        for (n = 0; (rc = recording_read(reader, &frame)) > 0; n++) {
+            makeFrame(n, &expected);
+            expect(sameFrame(&frame, &expected), "%s: cut short frame %d differs", name, n);
+        }
+        expect(!rc && n == FRAMES - 1, "%s: cut short read %d frames, rc %d", name, n, rc);
+        recording_reader_delete(reader);
+    }
+
+    free(data);
+}
+
+void testMalformed() {
+    uint8_t data[sizeof(RecordingHeader) + 16];
+    RecordingHeader *header = (RecordingHeader *)data;
+    RecordingReader *reader;
+    RecordingFrame frame;
+
+    memset(data, 0, sizeof(data));
+    memcpy(header->magic, RECORDING_MAGIC, sizeof(header->magic));
+    header->version = RECORDING_VERSION;
+    header->flags = RECORDING_COMPRESSED;
+
+    /* An overlong time varint */
+    memset(data + sizeof(*header), 0x80, 16);
+    reader = recording_reader_create(data, sizeof(data));
+    expect(reader && recording_read(reader, &frame) == -1, "overlong time was read");
+    recording_reader_delete(reader);
+
+    /* More values than a frame holds */
+    data[sizeof(*header)] = 0;
+    data[sizeof(*header) + 1] = RECORDING_VALUES_MAX + 1;
+    reader = recording_reader_create(data, sizeof(data));
+    expect(reader && recording_read(reader, &frame) == -1, "oversized count was read");
+    recording_reader_delete(reader);
+}
+
+int main() {
+    testVarints();
+    testRoundTrip(0);
+    testRoundTrip(RECORDING_COMPRESSED);
+    testMalformed();
+
+    if (failures) {
+        printf("%d failed\n", failures);
+        return 1;
+    }
+    printf("recording: ok\n");
+    return 0;
+}
@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "recording.h"
+#include "varint.h"
+
+/* Bytes a compressed frame takes at most */
+#define FRAME_MAX  (VARINT_MAX + 1 + VARINT_MAX * RECORDING_VALUES_MAX)
+
+struct _RecordingWriter {
+    FILE *out;
+    int flags;
+    uint64_t offset;                 /* Bytes written so far */
+    uint32_t frames;
+    int64_t usec;                    /* Time of the last frame */
+    uint32_t bits[RECORDING_VALUES_MAX]; /* Values of the last frame */
+    RecordingIndexEntry *index;
+    int index_count;
+    int index_size;
+};
+
+struct _RecordingReader {
+    const uint8_t *data;
+    size_t length;
+    size_t end;                      /* Where the frames stop */
+    RecordingHeader header;
+    const RecordingFooter *footer;   /* NULL if the recording was cut short */
+    const RecordingIndexEntry *index;
+    size_t offset;                   /* Next frame */
+    uint32_t frame;                  /* Its number */
+    int64_t usec;
+    uint32_t bits[RECORDING_VALUES_MAX];
+    int pending;                     /* peek holds the next frame */
+    RecordingFrame peek;
+};
+
+int _recording_emit(RecordingWriter *writer, const void *data, size_t length);
+int _recording_decode(RecordingReader *reader, RecordingFrame *frame);
+
+int _recording_emit(RecordingWriter *writer, const void *data, size_t length) {
+    if (fwrite(data, 1, length, writer->out) != length) {
+        return -1;
+    }
+    writer->offset += length;
+    return 0;
+}
+
+/* The writer only appends, so out may be a pipe */
+RecordingWriter *recording_writer_create(FILE *out, uint32_t hash, int flags) {
+    RecordingWriter *writer;
+    RecordingHeader header;
+    struct timeval now;
+
+    writer = calloc(1, sizeof(*writer));
+    if (!writer) {
+        return NULL;
+    }
+    writer->out = out;
+    writer->flags = flags;
+
+    gettimeofday(&now, NULL);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RECORDING_VERSION;
+    header.flags = flags;
+    header.config_hash = hash;
+    header.start = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+    if (_recording_emit(writer, &header, sizeof(header))) {
+        fprintf(stderr, "Error: Unable to write recording header\n");
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+int recording_write(RecordingWriter *writer, const RecordingFrame *frame) {
+    uint8_t out[FRAME_MAX];
+    RecordingIndexEntry *index;
+    RecordingFrame fixed;
+    uint32_t bits;
+    size_t length;
+    int64_t usec;
+    int keyframe, count, i;
+
+    count = frame->count > RECORDING_VALUES_MAX ? RECORDING_VALUES_MAX : frame->count;
+
+    /* Time only moves forward, or seeking couldn't bisect it */
+    usec = frame->usec < writer->usec ? writer->usec : frame->usec;
+    if (usec < 0) {
+        usec = 0;
+    }
+
+    keyframe = !(writer->frames % RECORDING_KEYFRAME_INTERVAL);
+    if (keyframe) {
+        if (writer->index_count == writer->index_size) {
+            writer->index_size = writer->index_size ? writer->index_size * 2 : 64;
+            index = realloc(writer->index, writer->index_size * sizeof(*index));
+            if (!index) {
+                fprintf(stderr, "Error: Out of memory for the recording index\n");
+                return -1;
+            }
+            writer->index = index;
+        }
+        index = &writer->index[writer->index_count++];
+        memset(index, 0, sizeof(*index));
+        index->usec = usec;
+        index->offset = writer->offset;
+        index->frame = writer->frames;
+    }
+
+    if (!(writer->flags & RECORDING_COMPRESSED)) {
+        memset(&fixed, 0, sizeof(fixed));
+        fixed.usec = usec;
+        fixed.count = count;
+        fixed.kind = frame->kind;
+        memcpy(fixed.values, frame->values, count * sizeof(float));
+        if (_recording_emit(writer, &fixed, sizeof(fixed))) {
+            return -1;
+        }
+    } else {
+        if (keyframe) {
+            memset(writer->bits, 0, sizeof(writer->bits));
+            length = varint_put(out, usec);
+        } else {
+            length = varint_put(out, usec - writer->usec);
+        }
+        out[length++] = count | (frame->kind & 0x0f) << 4;
+        for (i = 0; i < count; i++) {
+            memcpy(&bits, &frame->values[i], sizeof(bits));
+            length += varint_put(out + length, bits ^ writer->bits[i]);
+            writer->bits[i] = bits;
+        }
+        if (_recording_emit(writer, out, length)) {
+            return -1;
+        }
+    }
+
+    writer->usec = usec;
+    writer->frames++;
+
+    return 0;
+}
+
+/* Write the index and footer and free the writer. out is left open. */
+int recording_writer_finish(RecordingWriter *writer) {
+    RecordingFooter footer;
+    int rc = 0;
+
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = writer->offset;
+    footer.index_count = writer->index_count;
+    footer.frames = writer->frames;
+    footer.duration = writer->usec;
+    memcpy(footer.magic, RECORDING_FOOTER_MAGIC, sizeof(footer.magic));
+
+    if ((writer->index_count &&
+         _recording_emit(writer, writer->index, writer->index_count * sizeof(*writer->index))) ||
+        _recording_emit(writer, &footer, sizeof(footer)) ||
+        fflush(writer->out)) {
+        fprintf(stderr, "Error: Unable to finish writing the recording\n");
+        rc = -1;
+    }
+
+    free(writer->index);
+    free(writer);
+
+    return rc;
+}
+
+/* Non-zero if data starts like a binary recording */
+int recording_check(const void *data, size_t length) {
+    return length >= sizeof(RecordingHeader) &&
+           !memcmp(data, RECORDING_MAGIC, sizeof(((RecordingHeader *)0)->magic));
+}
+
+/* Read a recording held in memory (data must outlive the reader) */
+RecordingReader *recording_reader_create(const void *data, size_t length) {
+    const RecordingFooter *footer;
+    RecordingReader *reader;
+
+    if (!recording_check(data, length)) {
+        fprintf(stderr, "Error: Not a binary recording\n");
+        return NULL;
+    }
+
+    reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        return NULL;
+    }
+    reader->data = data;
+    reader->length = length;
+    memcpy(&reader->header, data, sizeof(reader->header));
+    if (reader->header.version != RECORDING_VERSION) {
+        fprintf(stderr, "Error: Recording version %d not supported\n",
+                reader->header.version);
+        free(reader);
+        return NULL;
+    }
+
+    reader->end = length;
+    if (length >= sizeof(RecordingHeader) + sizeof(*footer)) {
+        footer = (const RecordingFooter *)(reader->data + length - sizeof(*footer));
+        if (!memcmp(footer->magic, RECORDING_FOOTER_MAGIC, sizeof(footer->magic)) &&
+            footer->index_offset >= sizeof(RecordingHeader) &&
+            footer->index_offset + (uint64_t)footer->index_count * sizeof(RecordingIndexEntry) ==
+                length - sizeof(*footer)) {
+            reader->footer = footer;
+            reader->index = (const RecordingIndexEntry *)(reader->data + footer->index_offset);
+            reader->end = footer->index_offset;
+        }
+    }
+    if (!reader->footer) {
+        fprintf(stderr, "Warning: Recording has no index; it was cut short\n");
+    }
+
+    reader->offset = sizeof(RecordingHeader);
+
+    return reader;
+}
+
+void recording_reader_delete(RecordingReader *reader) {
+    free(reader);
+}
+
+const RecordingHeader *recording_reader_get_header(RecordingReader *reader) {
+    return &reader->header;
+}
+
+/* -1 if the recording was cut short */
+long long recording_reader_get_duration(RecordingReader *reader) {
+    return reader->footer ? reader->footer->duration : -1;
+}
+
+long recording_reader_get_frames(RecordingReader *reader) {
+    return reader->footer ? (long)reader->footer->frames : -1;
+}
+
+/* Returns 1 with the frame decoded, 0 at the end (including a final frame
+ * that was only partly written), -1 if the data is malformed */
+int _recording_decode(RecordingReader *reader, RecordingFrame *frame) {
+    const uint8_t *data = reader->data + reader->offset;
+    size_t length = reader->end - reader->offset, offset = 0, used;
+    uint64_t value;
+    uint32_t bits;
+    int i;
+
+    if (!(reader->header.flags & RECORDING_COMPRESSED)) {
+        if (length < sizeof(*frame)) {
+            return 0;
+        }
+        memcpy(frame, data, sizeof(*frame));
+        if (frame->count > RECORDING_VALUES_MAX) {
+            return -1;
+        }
+        reader->offset += sizeof(*frame);
+        reader->frame++;
+        return 1;
+    }
+
+    if (!(used = varint_get(data, length, &value))) {
+        return length >= VARINT_MAX ? -1 : 0;
+    }
+    offset += used;
+    if (!(reader->frame % RECORDING_KEYFRAME_INTERVAL)) {
+        memset(reader->bits, 0, sizeof(reader->bits));
+        reader->usec = value;
+    } else {
+        reader->usec += value;
+    }
+
+    if (offset == length) {
+        return 0;
+    }
+    memset(frame, 0, sizeof(*frame));
+    frame->usec = reader->usec;
+    frame->count = data[offset] & 0x0f;
+    frame->kind = data[offset++] >> 4;
+    if (frame->count > RECORDING_VALUES_MAX) {
+        return -1;
+    }
+    for (i = 0; i < frame->count; i++) {
+        if (!(used = varint_get(data + offset, length - offset, &value))) {
+            return length - offset >= VARINT_MAX ? -1 : 0;
+        }
+        offset += used;
+        bits = reader->bits[i] ^ (uint32_t)value;
+        reader->bits[i] = bits;
+        memcpy(&frame->values[i], &bits, sizeof(bits));
+    }
+
+    reader->offset += offset;
+    reader->frame++;
+
+    return 1;
+}
+
+int recording_read(RecordingReader *reader, RecordingFrame *frame) {
+    int rc;
+
+    if (reader->pending) {
+        *frame = reader->peek;
+        reader->pending = 0;
+        return 1;
+    }
+    if (reader->offset >= reader->end) {
+        return 0;
+    }
+    rc = _recording_decode(reader, frame);
+    if (rc < 0) {
+        fprintf(stderr, "Error: Recording is corrupt at byte %zu\n", reader->offset);
+    }
+    if (rc <= 0) {
+        /* Don't try the rest */
+        reader->offset = reader->end;
+    }
+    return rc;
+}
+
+/* Position so the next frame read is the first at or after usec. Returns
+ * -1 if the recording ends first. */
+int recording_seek(RecordingReader *reader, long long usec) {
+    int lo = 0, hi, mid, rc;
+
+    reader->pending = 0;
+    reader->offset = sizeof(RecordingHeader);
+    reader->frame = 0;
+    reader->usec = 0;
+
+    if (reader->footer && reader->footer->index_count) {
+        /* Last keyframe at or before usec */
+        hi = reader->footer->index_count - 1;
+        while (lo < hi) {
+            mid = lo + (hi - lo + 1) / 2;
+            if (reader->index[mid].usec <= usec) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        reader->offset = reader->index[lo].offset;
+        reader->frame = reader->index[lo].frame;
+    }
+
+    while ((rc = recording_read(reader, &reader->peek)) > 0) {
+        if (reader->peek.usec >= usec) {
+            reader->pending = 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Read up to RECORDING_VALUES_MAX numbers separated by spaces, commas or
+ * tabs into frame, stopping at anything else. Returns how many. */
+int recording_parse_values(const char *text, RecordingFrame *frame) {
+    const char *p = text;
+    char *end;
+    double value;
+
+    memset(frame, 0, sizeof(*frame));
+    while (frame->count < RECORDING_VALUES_MAX) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        value = strtod(p, &end);
+        if (end == p) {
+            break;
+        }
+        frame->values[frame->count++] = value;
+        p = end;
+    }
+
+    return frame->count;
+}
+
+const char *recording_kind_name(int kind) {
+    static const char *names[RECORDING_KINDS] = {
+        "pose", "command", "solve", "actual", "output"
+    };
+
+    return kind >= 0 && kind < RECORDING_KINDS ? names[kind] : NULL;
+}
+
+/* Text recordings hold "<ms> <line>" (see record), or "<ms> <kind>
+ * <values>" for anything but a pose. Returns -1 if line doesn't start
+ * with a time. */
+int recording_parse_line(const char *line, RecordingFrame *frame) {
+    const char *name;
+    char *end;
+    long long ms;
+    size_t length;
+    int kind = RECORDING_KIND_POSE, i;
+
+    ms = strtoll(line, &end, 10);
+    if (end == line) {
+        return -1;
+    }
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    for (i = RECORDING_KIND_POSE + 1; i < RECORDING_KINDS; i++) {
+        name = recording_kind_name(i);
+        length = strlen(name);
+        if (!strncmp(end, name, length) && (end[length] == ' ' || end[length] == '\t')) {
+            kind = i;
+            end += length;
+            break;
+        }
+    }
+    recording_parse_values(end, frame);
+    frame->usec = ms * 1000;
+    frame->kind = kind;
+
+    return 0;
+}
+
+/* The shortest of %g and %.9g that reads back as the same float, so text
+ * made from a binary recording looks like what was recorded */
+int recording_format_value(float value, char *text, size_t size) {
+    int length;
+
+    length = snprintf(text, size, "%g", value);
+    if (length < size && strtof(text, NULL) != value) {
+        length = snprintf(text, size, "%.9g", value);
+    }
+    return length;
+}
+
+/* The reverse of recording_parse_line, newline included. Returns the
+ * length, or -1 if the line doesn't fit in size. */
+int recording_format_line(const RecordingFrame *frame, char *line, size_t size) {
+    const char *name = recording_kind_name(frame->kind);
+    size_t length;
+    int used, i;
+
+    used = snprintf(line, size, "%lld", (long long)(frame->usec / 1000));
+    if (used < 0 || used >= size) {
+        return -1;
+    }
+    length = used;
+    if (frame->kind != RECORDING_KIND_POSE && name) {
+        used = snprintf(line + length, size - length, " %s", name);
+        if (used < 0 || used >= size - length) {
+            return -1;
+        }
+        length += used;
+    }
+    for (i = 0; i < frame->count; i++) {
+        if (length + 1 >= size) {
+            return -1;
+        }
+        line[length++] = ' ';
+        used = recording_format_value(frame->values[i], line + length, size - length);
+        if (used < 0 || used >= size - length) {
+            return -1;
+        }
+        length += used;
+    }
+    if (length + 1 >= size) {
+        return -1;
+    }
+    line[length++] = '\n';
+    line[length] = '\0';
+
+    return length;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __recording_h__
+#define __recording_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Binary recordings (record -b). A file is
+ *
+ *   RecordingHeader
+ *   frames, oldest first
+ *   RecordingIndexEntry per keyframe
+ *   RecordingFooter
+ *
+ * A frame is what one input line held: up to RECORDING_VALUES_MAX numbers
+ * (as transform reads them) and when it arrived, in microseconds on the
+ * monotonic clock since recording started. Uncompressed frames are
+ * RecordingFrame as is. With RECORDING_COMPRESSED each frame is a varint
+ * of its time (since the previous frame; since the start on a keyframe),
+ * the value count as a byte, then per value a varint of its IEEE bits
+ * XORed with the previous frame's, so values that didn't change take a
+ * byte and small changes a few. Every RECORDING_KEYFRAME_INTERVAL-th frame
+ * is a keyframe, encoded against zero, and gets an index entry, so a
+ * reader can seek by time without decoding from the start.
+ *
+ * A recording cut short (no footer) still plays; it just has no index.
+ *
+ * Frames made by record are all poses. The server's flight recorder (see
+ * flight.h) also logs what it did with them, each frame tagged with a
+ * RECORDING_KIND_*; compressed, the kind rides in the top four bits of the
+ * count byte, and in text it follows the time as a word. */
+
+#define RECORDING_MAGIC             "STRC"
+#define RECORDING_FOOTER_MAGIC      "STRX"
+#define RECORDING_VERSION           1
+#define RECORDING_VALUES_MAX        9
+#define RECORDING_KEYFRAME_INTERVAL 256
+
+#define RECORDING_COMPRESSED        (1 << 0)
+
+#define RECORDING_KIND_POSE         0 /* A line as transform reads it */
+#define RECORDING_KIND_COMMAND      1 /* Message type, then its payload */
+#define RECORDING_KIND_SOLVE        2 /* Servo angles, then SolutionTypes two
+                                       * to a value (low byte first) */
+#define RECORDING_KIND_ACTUAL       3 /* Angles each servo can actually reach */
+#define RECORDING_KIND_OUTPUT       4 /* PWM counts as staged for the PCA9685 */
+#define RECORDING_KINDS             5
+
+typedef struct {
+    char magic[4];            /* RECORDING_MAGIC */
+    uint16_t version;
+    uint16_t flags;           /* RECORDING_* */
+    uint32_t config_hash;     /* config_hash() of the rig it was made on */
+    uint32_t reserved;
+    int64_t start;            /* CLOCK_REALTIME us when recording started */
+} __attribute__((packed)) RecordingHeader;
+
+typedef struct {
+    int64_t usec;             /* Since the start of the recording */
+    uint8_t count;            /* Values used */
+    uint8_t kind;             /* RECORDING_KIND_* */
+    uint8_t reserved[2];
+    float values[RECORDING_VALUES_MAX];
+} __attribute__((packed)) RecordingFrame;
+
+typedef struct {
+    int64_t usec;
+    uint64_t offset;          /* From the start of the file */
+    uint32_t frame;
+    uint32_t reserved;
+} __attribute__((packed)) RecordingIndexEntry;
+
+typedef struct {
+    uint64_t index_offset;
+    uint32_t index_count;
+    uint32_t frames;
+    int64_t duration;         /* usec of the last frame */
+    char magic[4];            /* RECORDING_FOOTER_MAGIC */
+    uint32_t reserved;
+} __attribute__((packed)) RecordingFooter;
+
+typedef struct _RecordingWriter RecordingWriter;
+typedef struct _RecordingReader RecordingReader;
+
+RecordingWriter *recording_writer_create(FILE *out, uint32_t hash, int flags);
+int recording_write(RecordingWriter *writer, const RecordingFrame *frame);
+int recording_writer_finish(RecordingWriter *writer);
+
+int recording_check(const void *data, size_t length);
+RecordingReader *recording_reader_create(const void *data, size_t length);
+void recording_reader_delete(RecordingReader *reader);
+const RecordingHeader *recording_reader_get_header(RecordingReader *reader);
+long long recording_reader_get_duration(RecordingReader *reader);
+long recording_reader_get_frames(RecordingReader *reader);
+int recording_read(RecordingReader *reader, RecordingFrame *frame);
+int recording_seek(RecordingReader *reader, long long usec);
+
+int recording_parse_values(const char *text, RecordingFrame *frame);
+int recording_parse_line(const char *line, RecordingFrame *frame);
+int recording_format_value(float value, char *text, size_t size);
+const char *recording_kind_name(int kind);
+int recording_format_line(const RecordingFrame *frame, char *line, size_t size);
+
+#endif
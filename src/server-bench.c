@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "stewart-pubsub.h"
+#include "frame.h"
+#include "delay.h"
+
+void usage(int ret) {
+    fprintf(stderr,
+            "usage: server-bench -h HOST:PORT [-c CONNECTIONS] [-n ROUNDS] [-2 [-b BATCH]]\n"
+            "\n"
+            "Opens CONNECTIONS clients to a running server (start it with -q and,\n"
+            "without hardware, -s) and then has every client do ROUNDS status\n"
+            "round trips, reporting connections/s and messages/s.\n"
+            "\n"
+            "-h HOST:PORT   Server to connect to\n"
+            "-c CONNECTIONS Number of concurrent clients (default 1000)\n"
+            "-n ROUNDS      Status requests per client (default 100)\n"
+            "-2             Use protocol v2 framing\n"
+            "-b BATCH       With -2, pipeline BATCH requests in each frame\n"
+            "               (default 1)\n"
+            "-?             Help\n"
+            "-v             Version\n"
+            "\n");
+    exit(ret);
+}
+
+void version() {
+    fprintf(stdout,
+            "server-bench: Stewart platform server loopback benchmark\n"
+            "Copyright (C) 2017 Intel Corporation\n"
+            "Licensed under the terms of the Apache 2.0 license. See LICENSE file.\n"
+            "\n"
+            "Version: " VERSION "\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in sin;
+    struct addrinfo hint = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP
+    };
+    struct addrinfo *res;
+    struct rlimit limit;
+    StewartMessage request, reply;
+    long long start, connected, finished;
+    int connections = 1000, rounds = 100;
+    int v2 = 0, batch = 1;
+    StewartFrame frame;
+    uint16_t id;
+    size_t offset;
+    int k;
+    int *socks = NULL;
+    char *host = NULL, *colon;
+    int port = 0;
+    int enable = 1;
+    int err = -1;
+    int i, j, opened = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            usage(-1);
+        }
+        switch (argv[i][1]) {
+            case 'h':
+                i++;
+                if (i >= argc || !(colon = strchr(argv[i], ':'))) {
+                    usage(-1);
+                }
+                *colon = '\0';
+                host = argv[i];
+                port = strtol(colon + 1, NULL, 0);
+                break;
+            case 'c':
+                i++;
+                if (i >= argc) {
+                    usage(-1);
+                }
+                connections = strtol(argv[i], NULL, 0);
+                break;
+            case 'n':
+                i++;
+                if (i >= argc) {
+                    usage(-1);
+                }
+                rounds = strtol(argv[i], NULL, 0);
+                break;
+            case '2':
+                v2 = 1;
+                break;
+            case 'b':
+                i++;
+                if (i >= argc) {
+                    usage(-1);
+                }
+                batch = strtol(argv[i], NULL, 0);
+                break;
+            case 'v':
+                version();
+                break;
+            case '?':
+                usage(0);
+                break;
+            default:
+                usage(-1);
+                break;
+        }
+    }
+
+    if (!host || connections <= 0 || rounds <= 0 || batch <= 0 ||
+        (!v2 && batch != 1) ||
+        batch * sizeof(StewartRecordHeader) + sizeof(StewartFrameHeader) > STEWART_FRAME_MAX) {
+        usage(-1);
+    }
+
+    if (getaddrinfo(host, NULL, &hint, &res) != 0 || res == NULL) {
+        fprintf(stderr, "Error: Unable to get host address for %s\n", host);
+        return -1;
+    }
+    memcpy(&sin, res->ai_addr, sizeof(sin));
+    sin.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < connections + 16) {
+        limit.rlim_cur = connections + 16;
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+        }
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    socks = calloc(connections, sizeof(*socks));
+    if (!socks) {
+        return -1;
+    }
+
+    start = now_usec();
+    for (opened = 0; opened < connections; opened++) {
+        socks[opened] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socks[opened] == -1) {
+            fprintf(stderr, "Error: Unable to open socket %d: %s\n", opened, strerror(errno));
+            goto terminate;
+        }
+        if (connect(socks[opened], (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+            fprintf(stderr, "Error: Unable to connect socket %d: %s\n", opened, strerror(errno));
+            close(socks[opened]);
+            goto terminate;
+        }
+        setsockopt(socks[opened], IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    connected = now_usec();
+
+    memset(&request, 0, sizeof(request));
+    request.version = STEWART_PROTOCOL;
+    request.size = sizeof(request);
+    request.type = STEWART_MESSAGE_GET_STATUS;
+
+    if (v2) {
+        /* Pipelined requests carry their round and position in the batch
+         * as the id, which the replies have to echo back in order */
+        for (j = 0; j < rounds; j++) {
+            stewart_frame_begin(&frame);
+            for (k = 0; k < batch; k++) {
+                stewart_frame_add(&frame, &request, j * batch + k, 0);
+            }
+            stewart_frame_end(&frame);
+            for (i = 0; i < connections; i++) {
+                if (send(socks[i], frame.data, frame.length, 0) != frame.length) {
+                    fprintf(stderr, "Error: Unable to send on connection %d: %s\n", i,
+                            strerror(errno));
+                    goto terminate;
+                }
+            }
+            for (i = 0; i < connections; i++) {
+                StewartFrame in;
+                for (k = 0; k < batch; k++) {
+                    offset = 0;
+                    if (stewart_frame_recv(socks[i], &in) < 0 ||
+                        stewart_frame_next(in.data, in.length, &offset, &reply, &id) != 1 ||
+                        reply.type != STEWART_MESSAGE_STATUS ||
+                        id != (uint16_t)(j * batch + k)) {
+                        fprintf(stderr, "Error: Bad reply on connection %d\n", i);
+                        goto terminate;
+                    }
+                }
+            }
+        }
+        rounds *= batch;
+    } else {
+        /* Every client has one request in flight per round, so the server
+         * sees all of the connections active at once */
+        for (j = 0; j < rounds; j++) {
+            for (i = 0; i < connections; i++) {
+                if (send(socks[i], &request, sizeof(request), 0) != sizeof(request)) {
+                    fprintf(stderr, "Error: Unable to send on connection %d: %s\n", i, strerror(errno));
+                    goto terminate;
+                }
+            }
+            for (i = 0; i < connections; i++) {
+                if (recv(socks[i], &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply) ||
+                    reply.type != STEWART_MESSAGE_STATUS) {
+                    fprintf(stderr, "Error: Bad reply on connection %d\n", i);
+                    goto terminate;
+                }
+            }
+        }
+    }
+    finished = now_usec();
+
+    fprintf(stdout, "Connections: %d in %.03fs (%.0f connections/s)\n",
+            connections, (connected - start) / 1000000.0,
+            connections * 1000000.0 / (connected - start));
+    fprintf(stdout, "Messages: %lld round trips in %.03fs (%.0f messages/s)\n",
+            (long long)connections * rounds, (finished - connected) / 1000000.0,
+            (double)connections * rounds * 1000000.0 / (finished - connected));
+    err = 0;
+
+terminate:
+    for (i = 0; i < opened; i++) {
+        close(socks[i]);
+    }
+    free(socks);
+
+    return err;
+}
@@ -6,12 +6,14 @@
  * http://www.apache.org/licenses/LICENSE-2.0
  *
  */
+#define _GNU_SOURCE /* accept4 */
 #include <errno.h>
 #include <fcntl.h>
 #include <ifaddrs.h>
 #include <math.h>
 #include <netdb.h>
-#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,13 +24,31 @@
 #include <linux/limits.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 #include "pca9685.h"
+#include "servo.h"
+#include "connection.h"
+#include "setpoint.h"
+#include "ipc.h"
+#include "local.h"
+#include "frame.h"
+#include "websocket.h"
+#include "metrics.h"
+#include "handoff.h"
+#include "history.h"
+#include "adapter.h"
+#include "flight.h"
 
 #include "stewart.h"
 #include "config.h"
@@ -36,13 +56,117 @@
 #include "delay.h"
 
 int quiet = 0;
+volatile sig_atomic_t dumpStats = 0;
+volatile sig_atomic_t dumpFlight = 0;
+volatile sig_atomic_t running = 1;
+long long lastTick = 0; /* When the PWM frame was last committed */
+
+/* epoll_event.data carries the event source in the low byte and, for
+ * clients, the connection pool slot above it */
+#define EVENT_LISTEN      0
+#define EVENT_TICK        1
+#define EVENT_CLIENT      2
+#define EVENT_SETPOINT    3
+#define EVENT_LOCAL_LISTEN 4
+#define EVENT_LOCAL       5
+#define EVENT_WEBSOCKET_LISTEN 6
+#define EVENT_METRICS_LISTEN 7
+#define EVENT_METRICS     8
+#define EVENT_HANDOFF_LISTEN 9
+#define EVENT_ADAPTER     10 /* id: ADAPTER_* */
+#define EVENT_DATA(type, id) (((uint64_t)(id) << 8) | (type))
+#define EVENT_TYPE(data)  ((int)((data) & 0xff))
+#define EVENT_ID(data)    ((int)((data) >> 8))
+
+#define MAX_EVENTS        256
+
+#define LOCAL_CLIENTS_MAX 64
+
+#define SUBSCRIBER_SEND_BUFFER (sizeof(StewartMessage) * 8)
+
+#define SCHEDULE_MAX      HANDOFF_SCHEDULE_MAX /* Poses waiting for their time */
+#define SCHEDULE_AHEAD_MAX 10000000LL /* us; further ahead is a clock mixup */
+#define SCHEDULE_PHASE_SLACK 100      /* us the tick may be off a scheduled time */
+
+#define SCRAPES_MAX       4
+#define SCRAPE_SLOTS_PER_PASS 256 /* Pool slots formatted per loop pass */
+
+#define SCRAPE_REQUEST    0
+#define SCRAPE_FORMAT     1
+#define SCRAPE_SEND       2
+
+/* Per client metric families, formatted in this order */
+#define SCRAPE_CLIENT_MESSAGES 0
+#define SCRAPE_CLIENT_OUTPUT   1
+#define SCRAPE_CLIENT_INPUT    2
+#define SCRAPE_CLIENT_FAMILIES 3
+
+/* A metrics scrape in progress. The per client metrics are formatted a
+ * slice of the connection pool per pass of the event loop, so scraping a
+ * server with thousands of clients can't hold up a tick. */
+typedef struct {
+    int fd;                      /* -1 if unused */
+    int state;                   /* SCRAPE_* */
+    char request[METRICS_REQUEST_MAX];
+    size_t received;
+    int family;                  /* SCRAPE_CLIENT_* being formatted */
+    int slot;                    /* Next pool slot of that family; -1
+                                  * until its header is written */
+    MetricsBuffer response;
+    size_t sent;
+} Scrape;
+
+/* A pose waiting for its time (STEWART_MESSAGE_SCHEDULE) */
+typedef struct {
+    long long usec;
+    Transform transform;
+} Scheduled;
+
+ConnectionPool *pool = NULL;
+SetpointSources *setpoints = NULL;
+unsigned long setpointsInvalid = 0;
+StewartIPCRegion *ipcRegion = NULL;
+StewartIPC ipcStatus;
+int multicast = -1; /* Connected to the status multicast group */
+uint32_t multicastSequence = 0;
+unsigned long multicastDropped = 0;
+Connection *locals[LOCAL_CLIENTS_MAX];
+int localCount = 0;
+int ticking = 0; /* The control tick timer is running */
+int posePending = 0; /* A pose or trim arrived since the last solve */
+int countsPending = 0; /* ...and it was counts (STEWART_MESSAGE_SET_COUNTS) */
+uint16_t counts[6];
+unsigned long countsApplied = 0, countsRefused = 0;
+unsigned long posesCoalesced = 0; /* Poses replaced before being solved */
+int handedOff = 0; /* A new server has taken over our sockets (-H) */
+int spareFd = -1;  /* Given up to turn clients away when out of descriptors */
+History *history = NULL; /* Poses applied, for STEWART_MESSAGE_HISTORY (-R) */
+Adapter *adapters[2];    /* OSC (-O) and telemetry (-T) input, by ADAPTER_* */
+FlightRecorder *flight = NULL; /* Recent commands, solves and output (-F) */
+const char *flightPath = NULL; /* Where it is dumped */
+unsigned long flightDumps = 0;
+
+/* Scheduled poses, oldest first, in a ring */
+Scheduled schedule[SCHEDULE_MAX];
+int scheduleHead = 0, scheduled = 0;
+long long tickAlign = 0;          /* Move the tick timer onto this time */
+long long scheduleEarly = 0;      /* Newest arrival ahead of its time */
+long long scheduleLate = 0;       /* Newest applied after its time */
+unsigned long scheduledPoses = 0, scheduledMissed = 0;
+
+/* Metrics served by -M. Only ever updated in place by the event loop. */
+Scrape scrapes[SCRAPES_MAX];
+int scraping = 0;                 /* Scrapes still being formatted */
+MetricsHistogram tickJitter;      /* Tick timer expiry to the tick running */
+MetricsHistogram solveTime;
+MetricsHistogram writeTime;       /* PWM frames on the bus */
+unsigned long ticks = 0, ticksMissed = 0;
+long long tickDue = 0;            /* Next expiry of the tick timer */
+unsigned long messagesReceived = 0;
+unsigned long servoLimited[6], servoImpossible[6];
 
-#define MAX_CONNECTIONS 11 /* 10 CLIENTs, and 1 SERVER */
-struct pollfd fds[MAX_CONNECTIONS];
-char buffer[MAX_CONNECTIONS][sizeof(StewartMessage) * 2];
-int bufferIndex[MAX_CONNECTIONS];
-StewartMessage pending[MAX_CONNECTIONS];
 Transform transform;
+ServoTable *servoTable = NULL;
 
 float origin[3] = { 0, 0, 0 };
 Solution solutions[6];
@@ -56,10 +180,52 @@ void usage(int ret) {
             "-q            Quiet. Supress transform output.\n"
             "-d            Debug. Turn on Stewart platform debug information (if local)\n"
             "-s            Simulate. Don't try and connect to the PCA9685.\n"
+            "-f HZ         PWM refresh rate sent to the servos (default %d, max %d)\n"
+            "-r HZ         Control loop tick rate (default: matches -f)\n"
+            "-b BUS        i2c bus the PCA9685 boards are on (default 0)\n"
+            "-a ADDR[,..]  PCA9685 board addresses (default 0x40). Every board\n"
+            "              is driven with the same frame, latched together\n"
+            "-D            Dither between PWM counts every tick for sub-count\n"
+            "              servo resolution (best with -r matching -f)\n"
+            "-w            Warm start. Adopt PCA9685 boards already running at the\n"
+            "              configured frequency without resetting the servos\n"
+            "-c MAX        Maximum number of client connections (default %d)\n"
+            "-u PORT       Also accept pose setpoints as UDP datagrams on PORT\n"
+            "-I            Export status every tick in shared memory (" STEWART_IPC_NAME ")\n"
+            "-l PATH       Accept local clients on the Unix socket PATH; they send\n"
+            "              messages through shared memory rings\n"
+            "-m GROUP:PORT Send the status to multicast GROUP:PORT every control\n"
+            "              tick, for any number of passive observers\n"
+            "-W PORT       Also accept WebSocket clients (browsers, Node) on PORT;\n"
+            "              each binary message carries protocol messages\n"
+            "-M PORT       Serve Prometheus metrics over HTTP on PORT\n"
+            "-O PORT       Accept poses as OSC messages on UDP PORT\n"
+            "-T PORT:LAYOUT\n"
+            "              Accept poses from binary UDP motion telemetry (racing\n"
+            "              and flight simulators) on PORT, with the fields laid\n"
+            "              out as the file LAYOUT describes (see adapter.h)\n"
+            "-R ENTRIES    Keep the last ENTRIES applied poses, servo angles and\n"
+            "              PWM counts for clients to query (default %d, 0 for none)\n"
+            "-F PATH[:FRAMES]\n"
+            "              Flight recorder. Log the last FRAMES (default %d) commands,\n"
+            "              solves and PWM frames in memory, and write them to PATH\n"
+            "              as a binary recording on SIGUSR2 or a crash. With -M they\n"
+            "              can also be fetched from /flight\n"
+            "-H PATH       Hot restart. Take over from the server listening on the\n"
+            "              Unix socket PATH, if there is one, keeping its clients,\n"
+            "              pose and servo output; then listen there for the next\n"
+            "              server to take over from this one\n"
             "-?            Help\n"
             "-v            Version\n"
             "\n"
-            "See PROTOCOL for details on the Stewart platform protocol.\n");
+            "Send SIGUSR1 to print PCA9685 bus and inter-board skew statistics\n"
+            "and UDP setpoint loss and reordering per source.\n"
+            "\n"
+            "Send SIGUSR2 to dump the flight recorder (-F).\n"
+            "\n"
+            "See PROTOCOL for details on the Stewart platform protocol.\n",
+            PULSE_WIDTH_FREQUENCY, PULSE_WIDTH_FREQUENCY_MAX, CONNECTION_MAX_DEFAULT,
+            HISTORY_DEFAULT, FLIGHT_DEFAULT);
     exit(ret);
 }
 
@@ -73,12 +239,10 @@ void version() {
     exit(0);
 }
 
-int init_platform(StewartConfig *config, PCA9685 **pca, StewartPlatform ** platform) {
+int init_platform(StewartConfig *config, int bus, const int *addrs, int count,
+                  int warm, PCA9685Group **boards, StewartPlatform ** platform) {
     int err = 0;
-
-    /* Initialize the default values for the Stewart platform as
-     * documented at https://01.org/developerjourney/recipe/stewert-platform */
-    config_get(config);
+    int i;
 
     /* Create the Stewart platform solver as configured */
     *platform = stewart_platform_create(config);
@@ -91,17 +255,43 @@ int init_platform(StewartConfig *config, PCA9685 **pca, StewartPlatform ** platf
         stewart_platform_dump(*platform);
     }
 
-    /* If pca == NULL then this is a simulator; don't connect to the PCA9685 */
-    if (pca) {
-        /* Attempt to connect to PCA9685 in order to program the servo locations */
-        *pca = pca9685_open(0, 0x40);
-        if (!*pca) {
+    /* Build the per servo angle to PWM count tables for the configured
+     * PWM frequency and calibration */
+    servoTable = servo_table_create(config);
+    if (!servoTable) {
+        fprintf(stderr, "Could not create servo tables!\n");
+        err = -1;
+        goto terminate;
+    }
+
+    /* If boards == NULL then this is a simulator; don't connect to the PCA9685 */
+    if (boards) {
+        /* Attempt to connect to the PCA9685s in order to program the servo
+         * locations. A warm start adopts boards that are already running
+         * so the servos don't go limp and jump on a server restart. */
+        if (warm) {
+            *boards = pca9685_group_attach(bus, addrs, count, config->oscillator,
+                                           config->pulse_frequency);
+        } else {
+            *boards = pca9685_group_open(bus, addrs, count);
+        }
+        if (!*boards) {
             fprintf(stderr, "Could not initialize PCA9685!\n");
             err = -2;
             goto terminate;
         }
 
-        err = pca9685_set_pulse_frequency(*pca, PULSE_WIDTH_FREQUENCY);
+        if (warm) {
+            for (i = 0; i < count && !quiet; i++) {
+                fprintf(stdout, "PCA9685 0x%02x: %s\n", addrs[i],
+                        pca9685_is_warm(pca9685_group_get_board(*boards, i)) ?
+                        "adopted running configuration" : "initialized");
+            }
+            return 0;
+        }
+
+        pca9685_group_set_oscillator(*boards, config->oscillator);
+        err = pca9685_group_set_pulse_frequency(*boards, config->pulse_frequency);
         if (err) {
             fprintf(stderr, "Could not set PWM frequency!\n");
             err = -3;
@@ -117,9 +307,14 @@ terminate:
         *platform = NULL;
     }
 
-    if (pca && *pca) {
-        pca9685_close(*pca);
-        *pca = NULL;
+    if (servoTable) {
+        servo_table_delete(servoTable);
+        servoTable = NULL;
+    }
+
+    if (boards && *boards) {
+        pca9685_group_close(*boards);
+        *boards = NULL;
     }
 
     return err;
@@ -144,61 +339,458 @@ void getStatus(StewartConfig *config, StewartPlatform *platform, StewartStatus *
     memcpy(status->rotation, rotationMatrix, sizeof(rotationMatrix));
 }
 
-void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685 *pca, int index, const StewartMessage *message) {
-    static long now = 0;
-    static long then = 0;
-    struct timeval tv;
+void printBoardStats(PCA9685Group *boards) {
+    PCA9685GroupStats stats;
+
+    if (!boards) {
+        fprintf(stdout, "Simulating PCA9685; no bus statistics.\n");
+        fflush(stdout);
+        return;
+    }
+
+    pca9685_group_get_stats(boards, &stats);
+    if (stats.frames == 0) {
+        fprintf(stdout, "No PWM frames written yet.\n");
+        fflush(stdout);
+        return;
+    }
+
+    fprintf(stdout, "PWM frames: %lu to %d board(s), %.02f transactions/frame, "
+            "%.02f messages/frame, %lu broadcast\n",
+            stats.frames, pca9685_group_get_count(boards),
+            (double)stats.transactions / stats.frames,
+            (double)stats.messages / stats.frames, stats.broadcasts);
+    fprintf(stdout, "Bus time per frame: min %lldus, avg %.01fus, max %lldus\n",
+            stats.write_min, (double)stats.write_total / stats.frames, stats.write_max);
+    fprintf(stdout, "Inter-board skew: min %lldus, avg %.01fus, max %lldus\n",
+            stats.skew_min, (double)stats.skew_total / stats.frames, stats.skew_max);
+    fflush(stdout);
+}
+
+void printSetpointStats() {
     int i;
-    Point _origin = { .x = origin[0], .y = origin[1], .z = origin[2] };
+
+    if (!setpoints) {
+        return;
+    }
+
+    for (i = 0; i < setpoint_sources_get_count(setpoints); i++) {
+        const SetpointSource *source = setpoint_sources_get(setpoints, i);
+        fprintf(stdout, "UDP %s:%d: %lu received, %lu used, %lu lost, "
+                "%lu reordered, %lu stale\n",
+                inet_ntoa(source->peer.sin_addr), ntohs(source->peer.sin_port),
+                source->received, source->accepted,
+                setpoint_source_get_lost(source), source->reordered, source->stale);
+    }
+    if (setpointsInvalid) {
+        fprintf(stdout, "UDP: %lu invalid datagrams\n", setpointsInvalid);
+    }
+    fflush(stdout);
+}
+
+void onSignal(int sig) {
+    if (sig == SIGUSR1) {
+        dumpStats = 1;
+    } else if (sig == SIGUSR2) {
+        dumpFlight = 1;
+    } else {
+        running = 0;
+    }
+}
+
+/* Leave the flight recorder behind, then die of sig as we would have. Runs
+ * on its own stack, so a stack overflow gets here too. */
+void onCrash(int sig) {
+    static const char dumped[] = "Flight recorder dumped\n";
+    static const char failed[] = "Error: Unable to dump the flight recorder\n";
+
+    if (flight_dump_file(flight, flightPath) < 0) {
+        write(STDERR_FILENO, failed, sizeof(failed) - 1);
+    } else {
+        write(STDERR_FILENO, dumped, sizeof(dumped) - 1);
+    }
+    /* The handler was reset on the way in */
+    raise(sig);
+}
+
+/* Catch the signals that end the server abnormally, if there is a flight
+ * recorder to dump */
+int catchCrashes() {
+    int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    struct sigaction action;
+    stack_t stack;
+    int i;
+
+    stack.ss_size = SIGSTKSZ > 65536 ? SIGSTKSZ : 65536;
+    stack.ss_sp = malloc(stack.ss_size);
+    stack.ss_flags = 0;
+    if (!stack.ss_sp || sigaltstack(&stack, NULL)) {
+        fprintf(stderr, "Error: Unable to set up the crash handler stack\n");
+        free(stack.ss_sp);
+        return -1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onCrash;
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (i = 0; i < sizeof(signals) / sizeof(*signals); i++) {
+        sigaction(signals[i], &action, NULL);
+    }
+
+    return 0;
+}
+
+/* Log a message as it arrived: its type, then what it carried */
+void recordCommand(const StewartMessage *message) {
+    float values[RECORDING_VALUES_MAX];
+    int count = 0, i;
+
+    values[count++] = message->type;
+    switch (message->type) {
+        case STEWART_MESSAGE_SET_AXISANGLE:
+            memcpy(values + count, &message->axisAngle, 7 * sizeof(float));
+            count += 7;
+            break;
+        case STEWART_MESSAGE_SET_EUCLIDEAN:
+            memcpy(values + count, &message->euclidean, 6 * sizeof(float));
+            count += 6;
+            break;
+        case STEWART_MESSAGE_SCHEDULE:
+            /* When it is for doesn't fit a float; it shows as the pose
+             * being applied */
+            values[count++] = message->schedule.type;
+            i = message->schedule.type == STEWART_MESSAGE_SET_AXISANGLE ? 7 : 6;
+            memcpy(values + count, &message->schedule.axisAngle, i * sizeof(float));
+            count += i;
+            break;
+        case STEWART_MESSAGE_SET_COUNTS:
+            for (i = 0; i < 6; i++) {
+                values[count++] = message->counts.counts[i];
+            }
+            break;
+        case STEWART_MESSAGE_SET_TRIM:
+            values[count++] = message->trim.servo;
+            values[count++] = message->trim.angle;
+            break;
+        case STEWART_MESSAGE_SUBSCRIBE:
+            values[count++] = message->subscribe.rate;
+            values[count++] = message->subscribe.fields;
+            break;
+    }
+
+    flight_record(flight, RECORDING_KIND_COMMAND, now_usec(), values, count);
+}
+
+/* Log the solve just done: the angles with their SolutionTypes, then the
+ * angles the limited servos actually get to */
+void recordSolve() {
+    float values[RECORDING_VALUES_MAX];
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        values[i] = solutions[i].angle;
+    }
+    for (i = 0; i < 3; i++) {
+        values[6 + i] = (solutions[i * 2].type & 0xff) | (solutions[i * 2 + 1].type & 0xff) << 8;
+    }
+    flight_record(flight, RECORDING_KIND_SOLVE, lastTick, values, 9);
+
+    for (i = 0; i < 6; i++) {
+        values[i] = solutions[i].actual;
+    }
+    flight_record(flight, RECORDING_KIND_ACTUAL, lastTick, values, 6);
+}
+
+/* Write the flight recorder to its file, on SIGUSR2 */
+void dumpFlightRecorder() {
+    int frames;
+
+    frames = flight_dump_file(flight, flightPath);
+    if (frames < 0) {
+        fprintf(stderr, "Error: Unable to dump the flight recorder to '%s': %s\n",
+                flightPath, strerror(errno));
+        return;
+    }
+    flightDumps++;
+    fprintf(stdout, "Flight recorder: %d frames written to '%s'\n", frames, flightPath);
+    fflush(stdout);
+}
+
+/* Queue data as a single WebSocket frame; the header goes in front of the
+ * payload in the output buffer, with no intermediate copy */
+int queueWebSocket(Connection *connection, int opcode, const void *data, size_t length) {
+    uint8_t header[WEBSOCKET_HEADER_MAX];
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = websocket_header(header, opcode, length) },
+        { .iov_base = (void *)data, .iov_len = length }
+    };
+
+    if (connection->output_length - connection->output_offset + iov[0].iov_len + length >
+        sizeof(connection->output)) {
+        connection_flush(connection);
+    }
+    return connection_queuev(connection, iov, 2);
+}
+
+/* Replies go out through the client's shared memory ring if it has one,
+ * otherwise into its socket output queue */
+int queueReply(Connection *connection, const StewartMessage *message) {
+    StewartFrame frame;
+    const void *data = message;
+    size_t length = sizeof(*message);
+    int ret;
+
+    if (!connection->channel) {
+        if (connection->protocol == STEWART_PROTOCOL_V2) {
+            stewart_frame_begin(&frame);
+            if (stewart_frame_add(&frame, message, connection->request, 0)) {
+                return -1;
+            }
+            data = frame.data;
+            length = stewart_frame_end(&frame);
+        }
+        if (connection->websocket) {
+            return queueWebSocket(connection, WEBSOCKET_OP_BINARY, data, length);
+        }
+        /* A client pipelining requests can have more replies due than
+         * the output buffer holds */
+        if (connection->output_length - connection->output_offset + length >
+            sizeof(connection->output)) {
+            connection_flush(connection);
+        }
+        return connection_queue(connection, data, length);
+    }
+
+    ret = local_ring_push(&connection->channel->replies, message);
+    if (ret < 0) {
+        connection->dropped++;
+        return -1;
+    }
+    if (ret == 1) {
+        local_signal(connection->notify);
+    }
+
+    return 0;
+}
+
+/* Stream the rest of a history query, a record at a time sized to the room
+ * left in the output buffer, until the socket is full. Picked up again
+ * when it drains. Returns -1 if the connection failed. */
+int pumpHistory(Connection *connection) {
+    uint8_t payload[STEWART_FRAME_MAX];
+    size_t overhead = sizeof(StewartFrameHeader) + sizeof(StewartRecordHeader) +
+        (connection->websocket ? WEBSOCKET_HEADER_MAX : 0);
+    size_t queued, room, length;
+    StewartFrame frame;
+    int last, ret;
+
+    while (connection->history) {
+        queued = connection->output_length - connection->output_offset;
+        room = sizeof(connection->output) - queued;
+        room = room > overhead ? room - overhead : 0;
+        if (room > sizeof(payload) - overhead) {
+            room = sizeof(payload) - overhead;
+        }
+
+        length = history ? history_encode(history, &connection->history_next,
+                                          connection->history_end, payload, room) : 0;
+        last = !history || connection->history_next >= connection->history_end;
+        if (!length && !last) {
+            /* Not even one entry fits; make room */
+            ret = connection_flush(connection);
+            if (ret) {
+                return ret == -1 ? -1 : 0;
+            }
+            continue;
+        }
+
+        stewart_frame_begin(&frame);
+        stewart_frame_add_record(&frame, STEWART_MESSAGE_HISTORY_DATA,
+                                 last ? STEWART_RECORD_LAST : 0, connection->history_id,
+                                 payload, length);
+        stewart_frame_end(&frame);
+        if (connection->websocket) {
+            ret = queueWebSocket(connection, WEBSOCKET_OP_BINARY, frame.data, frame.length);
+        } else {
+            ret = connection_queue(connection, frame.data, frame.length);
+        }
+        if (ret) {
+            return -1;
+        }
+        if (last) {
+            connection->history = 0;
+        }
+    }
+
+    return connection_flush(connection) == -1 ? -1 : 0;
+}
+
+/* Fill t from the axis-angle or Euclidean pose of a message */
+void readPose(Transform *t, uint32_t type, const void *pose) {
+    const struct AxisAngle *axisAngle = pose;
+    const struct Euclidean *euclidean = pose;
+
+    memset(t, 0, sizeof(*t));
+    if (type == STEWART_MESSAGE_SET_AXISANGLE) {
+        t->type = TRANSFORM_AXIS_ANGLE;
+        t->rotate.x = axisAngle->x;
+        t->rotate.y = axisAngle->y;
+        t->rotate.z = axisAngle->z;
+        t->angle = axisAngle->angle;
+        t->translate.x = axisAngle->translate.x;
+        t->translate.y = axisAngle->translate.y;
+        t->translate.z = axisAngle->translate.z;
+    } else {
+        t->type = TRANSFORM_EUCLIDEAN;
+        t->rotate.x = euclidean->pitch;
+        t->rotate.y = euclidean->yaw;
+        t->rotate.z = euclidean->roll;
+        t->translate.x = euclidean->translate.x;
+        t->translate.y = euclidean->translate.y;
+        t->translate.z = euclidean->translate.z;
+    }
+}
+
+/* Queue a pose for its time. A time at or before the newest one queued
+ * means the source started over, so the queued poses from then on go. */
+void schedulePose(StewartConfig *config, const StewartMessage *message) {
+    long long period = 1000000LL / config_get_tick_rate(config);
+    long long now = now_usec();
+    long long phase;
+    Scheduled *entry;
+
+    if ((message->schedule.type != STEWART_MESSAGE_SET_AXISANGLE &&
+         message->schedule.type != STEWART_MESSAGE_SET_EUCLIDEAN) ||
+        message->schedule.usec > now + SCHEDULE_AHEAD_MAX) {
+        fprintf(stderr, "Warning: Invalid scheduled pose (type %u, %lldus ahead)\n",
+                message->schedule.type, (long long)message->schedule.usec - now);
+        return;
+    }
+
+    while (scheduled && schedule[(scheduleHead + scheduled - 1) % SCHEDULE_MAX].usec >=
+           message->schedule.usec) {
+        scheduled--;
+    }
+    if (scheduled == SCHEDULE_MAX) {
+        scheduleHead = (scheduleHead + 1) % SCHEDULE_MAX;
+        scheduled--;
+        posesCoalesced++;
+    }
+    entry = &schedule[(scheduleHead + scheduled++) % SCHEDULE_MAX];
+    entry->usec = message->schedule.usec;
+    readPose(&entry->transform, message->schedule.type, &message->schedule.axisAngle);
+
+    scheduledPoses++;
+    scheduleEarly = entry->usec - now;
+    if (scheduleEarly < 0) {
+        scheduledMissed++;
+    }
+
+    /* Servers fed the same times all apply the pose on a tick at that
+     * time, rather than each on its own next tick. Once in phase, a steady
+     * stream stays there. */
+    phase = (entry->usec - tickDue) % period;
+    if (phase < 0) {
+        phase += period;
+    }
+    if (scheduled == 1 && (!ticking || (phase > SCHEDULE_PHASE_SLACK &&
+                                        phase < period - SCHEDULE_PHASE_SLACK))) {
+        tickAlign = entry->usec;
+    }
+}
+
+/* On the tick: the newest scheduled pose whose time has come becomes the
+ * pose to apply. Half a tick of slack absorbs timer jitter and the error
+ * in the sender's estimate of our clock. */
+void takeScheduled(long long now, long long period) {
+    Scheduled *entry;
+
+    while (scheduled && schedule[scheduleHead].usec <= now + period / 2) {
+        entry = &schedule[scheduleHead];
+        if (posePending) {
+            posesCoalesced++;
+        }
+        transform = entry->transform;
+        posePending = 1;
+        countsPending = 0;
+        scheduleLate = now - entry->usec;
+        scheduleHead = (scheduleHead + 1) % SCHEDULE_MAX;
+        scheduled--;
+    }
+}
+
+void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards, Connection *connection, const StewartMessage *message) {
+    StewartMessage reply;
+    long long period, start, end;
+    int sndbuf;
 
     if (message->version != STEWART_PROTOCOL ||
         message->size != sizeof(*message)) {
         fprintf(stdout, "Invalid message received %d %d.\n", message->version, message->size);
         return;
     }
+    messagesReceived++;
+    if (flight) {
+        recordCommand(message);
+    }
 
     switch (message->type) {
         case STEWART_MESSAGE_SET_AXISANGLE:
-            memset(&transform, 0, sizeof(transform));
-
-            fprintf(stdout, "Axis-Angle: <%+.02f, %+.02f, %+.02f>, Angle: %+.02fdeg\n",
-                    message->axisAngle.x, message->axisAngle.y, message->axisAngle.z,
-                    message->axisAngle.angle);
-            fprintf(stdout, "Translation: <X: %+.02f, Y: %+.02f, Z: %+.02f>\n",
-                    message->axisAngle.translate.x,
-                    message->axisAngle.translate.y,
-                    message->axisAngle.translate.z);
-
-            transform.type = TRANSFORM_AXIS_ANGLE;
-            transform.rotate.x = message->axisAngle.x;
-            transform.rotate.y = message->axisAngle.y;
-            transform.rotate.z = message->axisAngle.z;
-            transform.angle = message->axisAngle.angle;
-            transform.translate.x = message->axisAngle.translate.x;
-            transform.translate.y = message->axisAngle.translate.y;
-            transform.translate.z = message->axisAngle.translate.z;
+            if (posePending) {
+                posesCoalesced++;
+            }
+
+            if (!quiet) {
+                fprintf(stdout, "Axis-Angle: <%+.02f, %+.02f, %+.02f>, Angle: %+.02fdeg\n",
+                        message->axisAngle.x, message->axisAngle.y, message->axisAngle.z,
+                        message->axisAngle.angle);
+                fprintf(stdout, "Translation: <X: %+.02f, Y: %+.02f, Z: %+.02f>\n",
+                        message->axisAngle.translate.x,
+                        message->axisAngle.translate.y,
+                        message->axisAngle.translate.z);
+            }
 
+            readPose(&transform, message->type, &message->axisAngle);
+            countsPending = 0;
             break;
 
         case STEWART_MESSAGE_SET_EUCLIDEAN:
-            memset(&transform, 0, sizeof(transform));
-
-            fprintf(stdout, "Rotation: <Roll: %+.02f, Pitch: %+.02f, Yaw: %+.02f>\n",
-                    message->euclidean.roll,
-                    message->euclidean.pitch,
-                    message->euclidean.yaw);
-            fprintf(stdout, "Translation: <X: %+.02f, Y: %+.02f, Z: %+.02f>\n",
-                    message->euclidean.translate.x,
-                    message->euclidean.translate.y,
-                    message->euclidean.translate.z);
-
-            transform.type = TRANSFORM_EUCLIDEAN;
-            transform.rotate.x = message->euclidean.pitch;
-            transform.rotate.y = message->euclidean.yaw;
-            transform.rotate.z = message->euclidean.roll;
-            transform.translate.x = message->euclidean.translate.x;
-            transform.translate.y = message->euclidean.translate.y;
-            transform.translate.z = message->euclidean.translate.z;
+            if (posePending) {
+                posesCoalesced++;
+            }
+
+            if (!quiet) {
+                fprintf(stdout, "Rotation: <Roll: %+.02f, Pitch: %+.02f, Yaw: %+.02f>\n",
+                        message->euclidean.roll,
+                        message->euclidean.pitch,
+                        message->euclidean.yaw);
+                fprintf(stdout, "Translation: <X: %+.02f, Y: %+.02f, Z: %+.02f>\n",
+                        message->euclidean.translate.x,
+                        message->euclidean.translate.y,
+                        message->euclidean.translate.z);
+            }
+
+            readPose(&transform, message->type, &message->euclidean);
+            countsPending = 0;
+            break;
+
+        case STEWART_MESSAGE_SET_COUNTS:
+            /* Counts from another rig, or from before a trim, would put the
+             * platform somewhere nobody asked for */
+            if (message->counts.hash != config_hash_counts(config)) {
+                if (!countsRefused++ || !quiet) {
+                    fprintf(stderr, "Warning: Counts for configuration %08x refused; "
+                            "this server's is %08x.\n", message->counts.hash,
+                            config_hash_counts(config));
+                }
+                return;
+            }
+            if (posePending) {
+                posesCoalesced++;
+            }
+            memcpy(counts, message->counts.counts, sizeof(counts));
+            countsPending = 1;
             break;
 
         case STEWART_MESSAGE_SET_TRIM:
@@ -209,21 +801,129 @@ void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685 *p
             if (message->trim.servo >= 0 && message->trim.servo <= 5) {
                 config->servo_trim[message->trim.servo] = message->trim.angle;
                 config_write(config);
+                /* Counts still waiting were checked against the old trims */
+                countsPending = 0;
+                if (flight) {
+                    flight_set_hash(flight, config_hash(config));
+                }
             }
             /* Fall through to set the servos to their value based on the new
              * trim values */
             break;
 
         case STEWART_MESSAGE_GET_STATUS:
+            if (!connection) {
+                /* Setpoint datagrams have nowhere to reply to */
+                return;
+            }
             if (!quiet) {
                 fprintf(stdout, "Status requested. Sending...\n");
             }
-            memset(&pending[index], 0, sizeof(pending[index]));
-            pending[index].type = STEWART_MESSAGE_STATUS;
-            pending[index].version = STEWART_PROTOCOL;
-            pending[index].size = sizeof(pending[index]);
-            getStatus(config, platform, &pending[index].status);
-            fds[index].events |= POLLOUT;
+            memset(&reply, 0, sizeof(reply));
+            reply.type = STEWART_MESSAGE_STATUS;
+            reply.version = STEWART_PROTOCOL;
+            reply.size = sizeof(reply);
+            getStatus(config, platform, &reply.status);
+            if (queueReply(connection, &reply) && !quiet) {
+                fprintf(stderr, "Warning: Client %d isn't reading; status dropped.\n",
+                        connection->fd);
+            }
+            return;
+
+        case STEWART_MESSAGE_SUBSCRIBE:
+            if (!connection) {
+                return;
+            }
+            if (message->subscribe.rate == 0) {
+                if (!quiet) {
+                    fprintf(stdout, "Status subscription cancelled.\n");
+                }
+                connection_unsubscribe(pool, connection);
+                return;
+            }
+            /* Updates go out on the control tick, so that's the most often
+             * a subscriber can get them */
+            period = 1000000LL / message->subscribe.rate;
+            if (period < 1000000LL / config_get_tick_rate(config)) {
+                period = 1000000LL / config_get_tick_rate(config);
+            }
+            if (!quiet) {
+                fprintf(stdout, "Status subscription every %lldus, fields 0x%02x.\n",
+                        period, message->subscribe.fields);
+            }
+            /* Keep the kernel from buffering seconds of old updates for a
+             * stalled subscriber; conflation only starts once it is full */
+            sndbuf = SUBSCRIBER_SEND_BUFFER;
+            setsockopt(connection->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+            connection_subscribe(pool, connection,
+                                 message->subscribe.fields ? message->subscribe.fields :
+                                 STEWART_FIELD_ALL, period);
+            return;
+
+        case STEWART_MESSAGE_HELLO:
+            if (!connection) {
+                return;
+            }
+            if (!quiet) {
+                fprintf(stdout, "Client speaks protocol %d to %d.\n",
+                        message->hello.min_version, message->hello.max_version);
+            }
+            memset(&reply, 0, sizeof(reply));
+            reply.type = STEWART_MESSAGE_HELLO;
+            reply.version = STEWART_PROTOCOL;
+            reply.size = sizeof(reply);
+            reply.hello.min_version = STEWART_PROTOCOL;
+            reply.hello.max_version = STEWART_PROTOCOL_V2;
+            reply.hello.max_frame = STEWART_FRAME_MAX;
+            reply.hello.tick_rate = config_get_tick_rate(config);
+            queueReply(connection, &reply);
+            return;
+
+        case STEWART_MESSAGE_SCHEDULE:
+            schedulePose(config, message);
+            return;
+
+        case STEWART_MESSAGE_HISTORY:
+            if (!connection) {
+                return;
+            }
+            /* The answer comes as records of its own size */
+            if (connection->channel || connection->protocol != STEWART_PROTOCOL_V2) {
+                fprintf(stderr, "Warning: History needs protocol v2 over TCP or WebSocket.\n");
+                return;
+            }
+            start = message->history.from > 0 ? message->history.from :
+                now_usec() + message->history.from;
+            end = message->history.to > 0 ? message->history.to :
+                now_usec() + message->history.to;
+            if (!quiet) {
+                fprintf(stdout, "History requested from %lldus to %lldus.\n", start, end);
+            }
+            /* A new query replaces one still being sent */
+            connection->history = 1;
+            connection->history_id = connection->request;
+            connection->history_next = connection->history_end = 0;
+            if (history && end >= start) {
+                connection->history_next = history_find(history, start);
+                connection->history_end = history_find(history, end + 1);
+            }
+            pumpHistory(connection);
+            return;
+
+        case STEWART_MESSAGE_CLOCK:
+            if (!connection) {
+                return;
+            }
+            memset(&reply, 0, sizeof(reply));
+            reply.type = STEWART_MESSAGE_CLOCK;
+            reply.version = STEWART_PROTOCOL;
+            reply.size = sizeof(reply);
+            reply.clock.usec = now_usec();
+            reply.clock.early = scheduleEarly < INT32_MIN ? INT32_MIN :
+                scheduleEarly > INT32_MAX ? INT32_MAX : scheduleEarly;
+            reply.clock.late = scheduleLate > INT32_MAX ? INT32_MAX : scheduleLate;
+            reply.clock.missed = scheduledMissed;
+            queueReply(connection, &reply);
             return;
 
         default:
@@ -231,7 +931,107 @@ void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685 *p
             return;
     }
 
+    /* Poses are solved and sent to the servos once per control tick; a
+     * newer pose arriving before then replaces this one */
+    posePending = 1;
+}
+
+/* Commit the staged PWM frame. Only commits that reach the bus are timed;
+ * one with nothing changed writes nothing. */
+void commitFrame(PCA9685Group *boards) {
+    PCA9685GroupStats stats;
+    unsigned long frames;
+
+    pca9685_group_get_stats(boards, &stats);
+    frames = stats.frames;
+    pca9685_group_commit(boards);
+    pca9685_group_get_stats(boards, &stats);
+    if (stats.frames != frames) {
+        metrics_observe(&writeTime, stats.write_last);
+    }
+}
+
+/* Add the pose just solved to the history, in the order of the fields of
+ * the message it came in */
+void recordHistory() {
+    HistoryEntry entry;
+    int i;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.usec = lastTick;
+    if (transform.type == TRANSFORM_AXIS_ANGLE) {
+        entry.pose_type = STEWART_MESSAGE_SET_AXISANGLE;
+        entry.pose[0] = transform.rotate.x;
+        entry.pose[1] = transform.rotate.y;
+        entry.pose[2] = transform.rotate.z;
+        entry.pose[3] = transform.angle;
+        i = 4;
+    } else {
+        entry.pose_type = STEWART_MESSAGE_SET_EUCLIDEAN;
+        entry.pose[0] = transform.rotate.y;
+        entry.pose[1] = transform.rotate.x;
+        entry.pose[2] = transform.rotate.z;
+        i = 3;
+    }
+    entry.pose[i++] = transform.translate.x;
+    entry.pose[i++] = transform.translate.y;
+    entry.pose[i++] = transform.translate.z;
+
+    for (i = 0; i < 6; i++) {
+        entry.angles[i] = solutions[i].angle;
+        entry.types[i] = solutions[i].type;
+        entry.counts[i] = servo_table_lookup(servoTable, i, solutions[i].angle);
+    }
+
+    history_append(history, &entry);
+}
+
+/* Send counts worked out ahead of time to the servos as they are. Status
+ * and history keep the last pose that was solved. */
+void applyCounts(StewartConfig *config, PCA9685Group *boards) {
+    float output[6];
+    int i;
+
+    posePending = countsPending = 0;
+    countsApplied++;
+    lastTick = now_usec();
+    if (flight) {
+        for (i = 0; i < 6; i++) {
+            output[i] = counts[i];
+        }
+        flight_record(flight, RECORDING_KIND_OUTPUT, lastTick, output, 6);
+    }
+
+    if (boards) {
+        for (i = 0; i < 6; i++) {
+            if (config->dither) {
+                pca9685_group_stage_channel_fine(boards, PCA9685_ALL_BOARDS, i,
+                                                 counts[i] << SERVO_COUNT_SHIFT);
+            } else {
+                pca9685_group_stage_channel_count(boards, PCA9685_ALL_BOARDS, i, 0, counts[i]);
+            }
+        }
+        commitFrame(boards);
+    }
+}
+
+/* Solve the newest pose and send it to the servos. Called at most once per
+ * control tick however many poses arrived since the last one. */
+void applyPose(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards) {
+    Point _origin = { .x = origin[0], .y = origin[1], .z = origin[2] };
+    float output[6];
+    long long start;
+    int i;
+
+    if (countsPending) {
+        applyCounts(config, boards);
+        return;
+    }
+    posePending = 0;
+
+    start = now_usec();
     stewart_get_solutions(platform, &_origin, &transform, solutions, rotationMatrix);
+    metrics_observe(&solveTime, now_usec() - start);
 
     int constrained = 0;
     for (i = 0; i < 6; i++) {
@@ -242,6 +1042,7 @@ void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685 *p
                 if (solutions[i].type & LIMITED) {
                     type = "LIMITED";
                     constrained++;
+                    servoLimited[i]++;
                 } else {
                     type = "SOLUTION";
                 }
@@ -249,6 +1050,7 @@ void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685 *p
             case IMPOSSIBLE:
                 type = "IMPOSSIBLE";
                 constrained++;
+                servoImpossible[i]++;
                 break;
             default:
                 fprintf(stderr, "Error: Invalid solution type: %d\n", solutions[i].type);
@@ -260,53 +1062,1617 @@ void processMessage(StewartConfig *config, StewartPlatform *platform, PCA9685 *p
         }
     }
 
-    /* Only output to the PWM once per cycle */
-    gettimeofday(&tv, NULL);
-    now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-    if (now - then < 1000 / PULSE_WIDTH_FREQUENCY) {
-        delay(1000 * (1000 / PULSE_WIDTH_FREQUENCY - (now - then)));
+    lastTick = now_usec();
+    if (history) {
+        recordHistory();
+    }
+    if (flight) {
+        recordSolve();
     }
-    then = now;
 
     /* Send servo positions to servos */
-    if (pca) {
+    if (boards) {
         for (i = 0; i < 6; i++) {
-            pca9685_set_channel_pulse(
-                pca, i, 0, RADIANS_TO_PULSE_WIDTH(DEG2RAD(solutions[i].angle)));
+            unsigned int count = servo_table_lookup(servoTable, i, solutions[i].angle);
+            if (config->dither) {
+                pca9685_group_stage_channel_fine(boards, PCA9685_ALL_BOARDS, i, count);
+                output[i] = (float)count / SERVO_COUNT_ONE;
+            } else {
+                pca9685_group_stage_channel_count(boards, PCA9685_ALL_BOARDS, i, 0,
+                                                  SERVO_COUNT_ROUND(count));
+                output[i] = SERVO_COUNT_ROUND(count);
+            }
+        }
+        if (flight) {
+            flight_record(flight, RECORDING_KIND_OUTPUT, lastTick, output, 6);
         }
+        commitFrame(boards);
     }
 }
 
-int main(int argc, char *argv[]) {
-    PCA9685 *pca = NULL;
-    StewartConfig _c;
-    StewartConfig *config = &_c;
-    StewartPlatform *platform = NULL;
-    int err = 0;
-    int sock = -1;
-    int i, port = -1;
-    char *iface = "lo";
-    int simulate = 0;
-    int ret;
+/* Clear the status fields a subscriber didn't ask for */
+void maskStatus(StewartStatus *status, uint32_t fields) {
+    if (!(fields & STEWART_FIELD_TIME)) {
+        status->sec = status->usec = 0;
+    }
+    if (!(fields & STEWART_FIELD_SERVOS)) {
+        memset(status->servos, 0, sizeof(status->servos));
+    }
+    if (!(fields & STEWART_FIELD_STATUS)) {
+        status->status = 0;
+    }
+    if (!(fields & STEWART_FIELD_ORIGIN)) {
+        memset(status->origin, 0, sizeof(status->origin));
+    }
+    if (!(fields & STEWART_FIELD_ROTATION)) {
+        memset(status->rotation, 0, sizeof(status->rotation));
+    }
+}
 
-    struct ifaddrs *ifaddr = NULL, *p;
-    char hostIpAddr[NI_MAXHOST];
+/* Push a status update to a subscriber. If earlier output hasn't drained the
+ * update is only marked pending and the newest status is sent once the
+ * socket is writable again, so a slow client never builds up a backlog.
+ * Returns -1 if the connection failed. */
+int sendStatus(Connection *connection, const StewartStatus *status) {
+    StewartMessage message;
+
+    /* A full ring just misses this update; the next tick sends a newer one */
+    if (!connection->output_length && connection->channel) {
+        memset(&message, 0, sizeof(message));
+        message.version = STEWART_PROTOCOL;
+        message.size = sizeof(message);
+        message.type = STEWART_MESSAGE_STATUS;
+        message.status = *status;
+        maskStatus(&message.status, connection->subscribe_fields);
+        if (queueReply(connection, &message)) {
+            connection->conflated++;
+        }
+        return 0;
+    }
 
-    config->debug = 0;
+    if (connection->output_length) {
+        if (connection->status_pending) {
+            connection->conflated++;
+        }
+        connection->status_pending = 1;
+        return 0;
+    }
+    connection->status_pending = 0;
 
-    for (i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
-            switch (argv[i][1]) {
-                case 's':
-                    simulate = 1;
+    memset(&message, 0, sizeof(message));
+    message.version = STEWART_PROTOCOL;
+    message.size = sizeof(message);
+    message.type = STEWART_MESSAGE_STATUS;
+    message.status = *status;
+    maskStatus(&message.status, connection->subscribe_fields);
+
+    queueReply(connection, &message);
+
+    return connection_flush(connection) == -1 ? -1 : 0;
+}
+
+void closeConnection(ConnectionPool *pool, Connection *connection, const char *reason) {
+    int i;
+
+    if (!quiet) {
+        fprintf(stdout, "Socket %d %s (%d clients).\n", connection->fd, reason,
+                connection_pool_get_count(pool) - 1);
+    }
+
+    for (i = 0; connection->channel && i < localCount; i++) {
+        if (locals[i] == connection) {
+            locals[i] = locals[--localCount];
+            break;
+        }
+    }
+    /* Closing the descriptor also removes it from the epoll set */
+    connection_close(pool, connection);
+}
+
+/* The listening socket is edge triggered, so accept until the backlog is
+ * empty. Clients beyond the pool size are turned away immediately. */
+int acceptConnections(ConnectionPool *pool, int epfd, int sock, int websocket) {
+    struct sockaddr_in peerAddr;
+    socklen_t peerAddrSize;
+    struct epoll_event event;
+    Connection *connection;
+    int enable = 1;
+    int peer;
+
+    while (1) {
+        peerAddrSize = sizeof(peerAddr);
+        peer = accept4(sock, (struct sockaddr *)&peerAddr, &peerAddrSize, SOCK_NONBLOCK);
+        if (peer == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (peer == -1 && (errno == EINTR || errno == ECONNABORTED)) {
+            continue;
+        }
+        if (peer == -1 && (errno == EMFILE || errno == ENFILE)) {
+            fprintf(stderr, "Error: Out of file descriptors accepting connection.\n");
+            if (spareFd == -1) {
+                return 0;
+            }
+            /* The listener won't signal again for clients already queued,
+             * so free a descriptor to accept and close each of them */
+            close(spareFd);
+            peer = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+            if (peer != -1) {
+                close(peer);
+            }
+            spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (peer == -1) {
+                return 0;
+            }
+            continue;
+        }
+        if (peer == -1) {
+            fprintf(stderr, "Error: Unable to accept connect: %s\n", strerror(errno));
+            return -1;
+        }
+
+        connection = connection_open(pool, peer, &peerAddr);
+        if (!connection) {
+            fprintf(stderr, "Error: Too many connections (%d). Closing new connection.\n",
+                    connection_pool_get_size(pool));
+            close(peer);
+            continue;
+        }
+
+        if (!quiet) {
+            fprintf(stdout, "%s from %s on %d (%d)\n", websocket ? "WebSocket" : "Connection",
+                    inet_ntoa(peerAddr.sin_addr), ntohs(peerAddr.sin_port), peer);
+        }
+        if (websocket) {
+            connection->websocket = CONNECTION_WEBSOCKET_UPGRADE;
+        }
+
+        /* Replies are single small messages; don't hold them for Nagle */
+        setsockopt(peer, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = EVENT_DATA(EVENT_CLIENT, connection->id);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, peer, &event) == -1) {
+            fprintf(stderr, "Error: Unable to watch connection: %s\n", strerror(errno));
+            connection_close(pool, connection);
+        }
+    }
+}
+
+/* Handle one v2 frame. Returns -1 if it is malformed. */
+int processFrame(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                 Connection *connection, const void *frame, size_t length) {
+    StewartMessage message;
+    size_t offset = 0;
+    int ret;
+
+    while ((ret = stewart_frame_next(frame, length, &offset, &message,
+                                     &connection->request)) == 1) {
+        connection->received++;
+        processMessage(config, platform, boards, connection, &message);
+    }
+    connection->request = 0;
+
+    return ret;
+}
+
+/* Handle the protocol messages in data, the payload of one WebSocket
+ * message: v1 messages, or a single v2 frame. Returns -1 if it is malformed. */
+int processPayload(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                   Connection *connection, const uint8_t *data, size_t length) {
+    uint16_t first;
+    size_t offset;
+
+    if (length < sizeof(first)) {
+        return -1;
+    }
+    if (!connection->protocol) {
+        memcpy(&first, data, sizeof(first));
+        connection->protocol = first == STEWART_PROTOCOL ?
+            STEWART_PROTOCOL : STEWART_PROTOCOL_V2;
+    }
+
+    if (connection->protocol == STEWART_PROTOCOL_V2) {
+        if (stewart_frame_check(data, length) != length) {
+            return -1;
+        }
+        return processFrame(config, platform, boards, connection, data, length);
+    }
+
+    if (length % sizeof(StewartMessage)) {
+        return -1;
+    }
+    for (offset = 0; offset < length; offset += sizeof(StewartMessage)) {
+        connection->received++;
+        processMessage(config, platform, boards, connection,
+                       (const StewartMessage *)(data + offset));
+    }
+    return 0;
+}
+
+/* Parse the plain TCP byte stream. Returns -1 to close the connection. */
+int parseStream(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                Connection *connection) {
+    uint8_t scratch[STEWART_FRAME_MAX];
+    const void *data;
+    uint16_t first;
+    int length;
+
+    /* A v1 message starts with its version, 1, which is too short to be
+     * the length of a v2 frame */
+    if (!connection->protocol &&
+        (data = connection_peek(connection, sizeof(first), scratch))) {
+        memcpy(&first, data, sizeof(first));
+        connection->protocol = first == STEWART_PROTOCOL ?
+            STEWART_PROTOCOL : STEWART_PROTOCOL_V2;
+    }
+
+    /* Messages are handled where they landed in the ring; only one that
+     * wraps around the end is copied out */
+    if (connection->protocol == STEWART_PROTOCOL) {
+        while ((data = connection_peek(connection, sizeof(StewartMessage), scratch))) {
+            connection->received++;
+            processMessage(config, platform, boards, connection, data);
+            connection_consume(connection, sizeof(StewartMessage));
+        }
+    } else if (connection->protocol == STEWART_PROTOCOL_V2) {
+        while ((data = connection_peek(connection, sizeof(StewartFrameHeader), scratch))) {
+            length = stewart_frame_check(data, sizeof(StewartFrameHeader));
+            if (length < 0) {
+                fprintf(stderr, "Error: Invalid frame from client %d\n", connection->fd);
+                return -1;
+            }
+            data = connection_peek(connection, length, scratch);
+            if (!data) {
+                break;
+            }
+            if (processFrame(config, platform, boards, connection, data, length)) {
+                fprintf(stderr, "Error: Malformed frame from client %d\n", connection->fd);
+                return -1;
+            }
+            connection_consume(connection, length);
+        }
+    }
+
+    return 0;
+}
+
+/* Parse the upgrade request, then WebSocket frames. Payloads are unmasked
+ * where they sit in the receive ring and handed on from there. Returns -1
+ * to close the connection. */
+int parseWebSocket(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                   Connection *connection) {
+    uint8_t scratch[CONNECTION_INPUT_SIZE];
+    char response[WEBSOCKET_RESPONSE_MAX];
+    WebSocketFrame frame;
+    size_t available;
+    uint8_t *data;
+    int ret;
+
+    while (1) {
+        available = connection->input_head - connection->input_tail;
+        if (!available) {
+            return 0;
+        }
+
+        if (connection->websocket == CONNECTION_WEBSOCKET_UPGRADE) {
+            data = connection_peek(connection, available, scratch);
+            ret = websocket_handshake((const char *)data, available, response, sizeof(response));
+            if (ret == 0) {
+                return 0;
+            }
+            connection_queue(connection, response, strlen(response));
+            if (ret < 0) {
+                connection_flush(connection);
+                return -1;
+            }
+            connection_consume(connection, ret);
+            connection->websocket = CONNECTION_WEBSOCKET;
+            continue;
+        }
+
+        if (available > WEBSOCKET_HEADER_MAX) {
+            available = WEBSOCKET_HEADER_MAX;
+        }
+        data = connection_peek(connection, available, scratch);
+        ret = websocket_parse(data, available, &frame);
+        if (ret == 0) {
+            return 0;
+        }
+        if (ret < 0 || frame.length > CONNECTION_INPUT_SIZE - frame.header) {
+            fprintf(stderr, "Error: Invalid WebSocket frame from client %d\n", connection->fd);
+            return -1;
+        }
+        data = connection_peek(connection, frame.header + frame.length, scratch);
+        if (!data) {
+            return 0;
+        }
+
+        data += frame.header;
+        websocket_unmask(data, frame.length, frame.mask);
+
+        switch (frame.opcode) {
+            case WEBSOCKET_OP_BINARY:
+                /* Each message is whole; fragmented ones aren't needed for
+                 * messages this small */
+                if (!frame.fin ||
+                    processPayload(config, platform, boards, connection, data, frame.length)) {
+                    fprintf(stderr, "Error: Malformed message from WebSocket client %d\n",
+                            connection->fd);
+                    return -1;
+                }
+                break;
+            case WEBSOCKET_OP_PING:
+                queueWebSocket(connection, WEBSOCKET_OP_PONG, data, frame.length);
+                break;
+            case WEBSOCKET_OP_PONG:
+                break;
+            case WEBSOCKET_OP_CLOSE:
+                /* Echo the status code back and hang up */
+                queueWebSocket(connection, WEBSOCKET_OP_CLOSE, data,
+                               frame.length < 2 ? frame.length : 2);
+                connection_flush(connection);
+                return -1;
+            default:
+                fprintf(stderr, "Error: Unsupported WebSocket message %d from client %d\n",
+                        frame.opcode, connection->fd);
+                return -1;
+        }
+
+        connection_consume(connection, frame.header + frame.length);
+    }
+}
+
+/* Client sockets are edge triggered; read until recv would block and handle
+ * every complete message received. Returns -1 if the connection is gone. */
+int readConnection(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                   Connection *connection) {
+    size_t requested;
+    ssize_t ret;
+
+    while (1) {
+        ret = connection_receive(connection, &requested);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+
+        if (connection->websocket) {
+            if (parseWebSocket(config, platform, boards, connection)) {
+                return -1;
+            }
+        } else if (parseStream(config, platform, boards, connection)) {
+            return -1;
+        }
+
+        /* A short read means the socket is drained, so with edge triggering
+         * there is nothing more until the next event */
+        if (ret < requested) {
+            return 0;
+        }
+    }
+}
+
+/* Set up a local client: hand it a shared memory channel and the two
+ * eventfds over the Unix socket. The socket itself stays open only so a
+ * client exiting is noticed. */
+int acceptLocal(ConnectionPool *pool, int epfd, int sock) {
+    struct epoll_event event;
+    Connection *connection;
+    int fds[LOCAL_FDS];
+    int peer;
+
+    while (1) {
+        peer = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (peer == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (peer == -1 && (errno == EINTR || errno == ECONNABORTED)) {
+            continue;
+        }
+        if (peer == -1) {
+            fprintf(stderr, "Error: Unable to accept local connection: %s\n", strerror(errno));
+            return 0;
+        }
+
+        connection = localCount < LOCAL_CLIENTS_MAX ? connection_open(pool, peer, NULL) : NULL;
+        if (!connection) {
+            fprintf(stderr, "Error: Too many local connections. Closing new connection.\n");
+            close(peer);
+            continue;
+        }
+
+        /* The memfd is kept so a hot restart can hand the channel over */
+        connection->channel = local_channel_create(&connection->channel_fd);
+        connection->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        connection->notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!connection->channel || connection->wake == -1 || connection->notify == -1) {
+            fprintf(stderr, "Error: Unable to set up local channel: %s\n", strerror(errno));
+            connection_close(pool, connection);
+            continue;
+        }
+
+        /* Without a tick nothing polls the ring, so the client has to wake
+         * the server for every command */
+        local_ring_set_wakeup(&connection->channel->commands, !ticking);
+
+        fds[LOCAL_FD_CHANNEL] = connection->channel_fd;
+        fds[LOCAL_FD_WAKE] = connection->wake;
+        fds[LOCAL_FD_NOTIFY] = connection->notify;
+        if (local_send_fds(peer, fds, LOCAL_FDS)) {
+            fprintf(stderr, "Error: Unable to send local channel: %s\n", strerror(errno));
+            connection_close(pool, connection);
+            continue;
+        }
+
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = EVENT_DATA(EVENT_CLIENT, connection->id);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, peer, &event);
+        event.events = EPOLLIN | EPOLLET;
+        event.data.u64 = EVENT_DATA(EVENT_LOCAL, connection->id);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, connection->wake, &event);
+
+        locals[localCount++] = connection;
+
+        if (!quiet) {
+            fprintf(stdout, "Local connection (%d)\n", peer);
+        }
+    }
+}
+
+/* Handle everything a local client has queued. Only touches shared memory. */
+void drainLocal(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                Connection *connection) {
+    StewartMessage message;
+
+    while (connection->channel && local_ring_pop(&connection->channel->commands, &message)) {
+        connection->received++;
+        processMessage(config, platform, boards, connection, &message);
+    }
+}
+
+/* While the tick runs it drains the local rings, so clients needn't make a
+ * syscall per command. Otherwise they are asked to signal their eventfd,
+ * and the rings are checked once more in case a command raced the change. */
+void setLocalWakeup(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                    int wakeup) {
+    int i;
+
+    for (i = 0; i < localCount; i++) {
+        local_ring_set_wakeup(&locals[i]->channel->commands, wakeup);
+    }
+    for (i = 0; wakeup && i < localCount; i++) {
+        drainLocal(config, platform, boards, locals[i]);
+    }
+}
+
+/* Drain the UDP setpoint socket. Only the newest pose matters, so every
+ * datagram is checked against its sender's sequence but just the last one
+ * accepted is solved and sent to the servos. */
+void readSetpoints(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                   int udp) {
+    StewartSetpoint setpoint;
+    StewartMessage latest;
+    struct sockaddr_in peer;
+    socklen_t peerSize;
+    int have = 0;
+    ssize_t ret;
+
+    while (1) {
+        peerSize = sizeof(peer);
+        ret = recvfrom(udp, &setpoint, sizeof(setpoint), MSG_DONTWAIT,
+                       (struct sockaddr *)&peer, &peerSize);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            break;
+        }
+
+        if (ret != sizeof(setpoint) ||
+            setpoint.message.version != STEWART_PROTOCOL ||
+            setpoint.message.size != sizeof(setpoint.message) ||
+            (setpoint.message.type != STEWART_MESSAGE_SET_AXISANGLE &&
+             setpoint.message.type != STEWART_MESSAGE_SET_EUCLIDEAN)) {
+            setpointsInvalid++;
+            continue;
+        }
+
+        if (setpoint_check(setpoints, &peer, setpoint.sequence, setpoint.usec,
+                           now_usec()) != SETPOINT_ACCEPT) {
+            continue;
+        }
+
+        memcpy(&latest, &setpoint.message, sizeof(latest));
+        have = 1;
+    }
+
+    if (have) {
+        processMessage(config, platform, boards, NULL, &latest);
+    }
+}
+
+/* Poses from an input adapter. Every datagram moves the pose it holds; only
+ * where it ended up once the socket is drained goes on to be solved. */
+void readAdapter(StewartConfig *config, StewartPlatform *platform, PCA9685Group *boards,
+                 int sock, Adapter *adapter) {
+    uint8_t packet[ADAPTER_PACKET_MAX];
+    StewartMessage latest;
+    int have = 0;
+    ssize_t ret;
+
+    while (1) {
+        ret = recv(sock, packet, sizeof(packet), MSG_DONTWAIT);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            break;
+        }
+        if (adapter_parse(adapter, packet, ret, &latest) == 1) {
+            have = 1;
+        }
+    }
+
+    if (have) {
+        processMessage(config, platform, boards, NULL, &latest);
+    }
+}
+
+/* Write this tick's status into shared memory. Speed is estimated from the
+ * change since the previous tick. */
+void publishIPC(long long now) {
+    long long elapsed = now - (ipcStatus.ts_sec * 1000000LL + ipcStatus.ts_usec);
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        StewartIPCServo *servo = &ipcStatus.servos[i];
+        int32_t angle = lrintf(solutions[i].angle * 1000);
+
+        servo->speed = (ipcStatus.tick && elapsed > 0) ?
+            (int32_t)((angle - servo->angle) * 1000000LL / elapsed) : 0;
+        servo->status = servo->speed ? STEWART_SERVO_MOVING : STEWART_SERVO_STATIONARY;
+        servo->angle = angle;
+        servo->ts_sec = now / 1000000;
+        servo->ts_usec = now % 1000000;
+    }
+    memcpy(ipcStatus.origin, origin, sizeof(origin));
+    memcpy(ipcStatus.rotation, rotationMatrix, sizeof(rotationMatrix));
+    ipcStatus.ts_sec = now / 1000000;
+    ipcStatus.ts_usec = now % 1000000;
+    ipcStatus.tick++;
+
+    stewart_ipc_publish(ipcRegion, &ipcStatus);
+}
+
+/* One datagram per tick to the multicast group, however many observers
+ * have joined it. A full socket buffer just skips this tick. */
+void publishMulticast(StewartConfig *config, StewartPlatform *platform, long long now) {
+    StewartStatusDatagram datagram;
+
+    datagram.sequence = multicastSequence++;
+    datagram.usec = now;
+    getStatus(config, platform, &datagram.status);
+
+    if (send(multicast, &datagram, sizeof(datagram), MSG_DONTWAIT) == -1) {
+        multicastDropped++;
+    }
+}
+
+/* Send the status to every subscriber due an update this tick. The status is
+ * only assembled once however many subscribers there are. */
+void publishStatus(StewartConfig *config, StewartPlatform *platform, long long now) {
+    long long tickPeriod = 1000000LL / config_get_tick_rate(config);
+    Connection *connection, *next;
+    StewartStatus status;
+    int built = 0;
+
+    for (connection = connection_pool_first_subscriber(pool); connection; connection = next) {
+        next = connection->sub_next;
+
+        /* Half a tick of slack absorbs timer jitter */
+        if (now + tickPeriod / 2 < connection->subscribe_next) {
+            continue;
+        }
+        connection->subscribe_next += connection->subscribe_period;
+        if (connection->subscribe_next <= now) {
+            connection->subscribe_next = now + connection->subscribe_period;
+        }
+
+        if (!built) {
+            getStatus(config, platform, &status);
+            built = 1;
+        }
+        if (sendStatus(connection, &status)) {
+            closeConnection(pool, connection, "send failed");
+        }
+    }
+}
+
+/* The tick timer only runs while it has work: dithering needs a frame every
+ * tick even without new transforms, subscribers get status pushed on the
+ * tick and the shared memory status is refreshed every tick. The first
+ * expiry is at start (CLOCK_MONOTONIC usec) so a pose that arrived mid
+ * period is applied a period after the last one, not after it. */
+void armTick(int timer, StewartConfig *config, int enable, long long start) {
+    struct itimerspec spec;
+    long long period = 1000000LL / config_get_tick_rate(config);
+
+    memset(&spec, 0, sizeof(spec));
+    if (enable) {
+        spec.it_interval.tv_sec = period / 1000000;
+        spec.it_interval.tv_nsec = (period % 1000000) * 1000;
+        spec.it_value.tv_sec = start / 1000000;
+        spec.it_value.tv_nsec = (start % 1000000) * 1000;
+        tickDue = start;
+    }
+    timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/* The timer fires at tickDue and every period after. How late the loop got
+ * to the newest expiry is the tick jitter; any expiries before it were
+ * missed ticks. */
+void observeTick(long long period, uint64_t expirations, long long now) {
+    long long due = tickDue + (long long)(expirations - 1) * period;
+
+    ticks += expirations;
+    ticksMissed += expirations - 1;
+    tickDue = due + period;
+    metrics_observe(&tickJitter, now - due);
+}
+
+/* Everything but the per client metrics. Constant size, however many
+ * clients there are. */
+void formatMetrics(MetricsBuffer *out) {
+    int i;
+
+    metrics_value(out, "stewart_ticks_total", "counter",
+                  "Control ticks run", ticks);
+    metrics_value(out, "stewart_ticks_missed_total", "counter",
+                  "Control ticks that expired before the previous one was handled",
+                  ticksMissed);
+    metrics_histogram(out, "stewart_tick_jitter_seconds",
+                      "Delay from the tick timer expiring to the tick running", &tickJitter);
+    metrics_histogram(out, "stewart_solve_seconds",
+                      "Time to solve a pose for the servo angles", &solveTime);
+    metrics_histogram(out, "stewart_i2c_write_seconds",
+                      "Time on the i2c bus per PWM frame", &writeTime);
+
+    metrics_family(out, "stewart_servo_limited_total", "counter",
+                   "Solves that limited the servo to its range");
+    for (i = 0; i < 6; i++) {
+        metrics_printf(out, "stewart_servo_limited_total{servo=\"%d\"} %lu\n",
+                       i, servoLimited[i]);
+    }
+    metrics_family(out, "stewart_servo_impossible_total", "counter",
+                   "Solves with no solution for the servo");
+    for (i = 0; i < 6; i++) {
+        metrics_printf(out, "stewart_servo_impossible_total{servo=\"%d\"} %lu\n",
+                       i, servoImpossible[i]);
+    }
+
+    metrics_value(out, "stewart_messages_total", "counter",
+                  "Messages received from all clients and setpoint senders",
+                  messagesReceived);
+    metrics_value(out, "stewart_poses_coalesced_total", "counter",
+                  "Poses replaced by a newer one before being solved", posesCoalesced);
+    metrics_value(out, "stewart_counts_applied_total", "counter",
+                  "Precomputed servo counts applied without solving", countsApplied);
+    metrics_value(out, "stewart_counts_refused_total", "counter",
+                  "Precomputed servo counts refused for another configuration",
+                  countsRefused);
+    metrics_value(out, "stewart_pose_pending", "gauge",
+                  "1 if a pose is waiting for the next tick", posePending);
+    metrics_value(out, "stewart_scheduled_poses_total", "counter",
+                  "Poses received to apply at a given time", scheduledPoses);
+    metrics_value(out, "stewart_scheduled_missed_total", "counter",
+                  "Scheduled poses that arrived after their time", scheduledMissed);
+    metrics_value(out, "stewart_scheduled", "gauge",
+                  "Scheduled poses waiting for their time", scheduled);
+    metrics_value(out, "stewart_clients", "gauge",
+                  "Connected clients", connection_pool_get_count(pool));
+    metrics_value(out, "stewart_subscribers", "gauge",
+                  "Clients subscribed to the status", connection_pool_get_subscribers(pool));
+    if (setpoints) {
+        metrics_value(out, "stewart_setpoints_invalid_total", "counter",
+                      "UDP setpoint datagrams that weren't a pose", setpointsInvalid);
+    }
+    if (multicast != -1) {
+        metrics_value(out, "stewart_multicast_sent_total", "counter",
+                      "Status datagrams sent to the multicast group", multicastSequence);
+        metrics_value(out, "stewart_multicast_dropped_total", "counter",
+                      "Status datagrams dropped with the socket buffer full",
+                      multicastDropped);
+    }
+    if (adapters[ADAPTER_OSC]) {
+        metrics_value(out, "stewart_osc_packets_total", "counter",
+                      "OSC datagrams received", adapter_get_received(adapters[ADAPTER_OSC]));
+        metrics_value(out, "stewart_osc_invalid_total", "counter",
+                      "OSC datagrams that couldn't be parsed",
+                      adapter_get_invalid(adapters[ADAPTER_OSC]));
+    }
+    if (adapters[ADAPTER_TELEMETRY]) {
+        metrics_value(out, "stewart_telemetry_packets_total", "counter",
+                      "Telemetry datagrams received",
+                      adapter_get_received(adapters[ADAPTER_TELEMETRY]));
+        metrics_value(out, "stewart_telemetry_invalid_total", "counter",
+                      "Telemetry datagrams shorter than the layout",
+                      adapter_get_invalid(adapters[ADAPTER_TELEMETRY]));
+    }
+    if (history) {
+        metrics_value(out, "stewart_history_entries_total", "counter",
+                      "Applied poses added to the history", history_head(history));
+    }
+    if (flight) {
+        metrics_value(out, "stewart_flight_frames_total", "counter",
+                      "Frames logged by the flight recorder", flight_head(flight));
+        metrics_value(out, "stewart_flight_dumps_total", "counter",
+                      "Flight recorder dumps written or served", flightDumps);
+    }
+}
+
+/* Format the next slice of the per client metrics. Returns 1 once they are
+ * all done. */
+int formatClients(Scrape *scrape) {
+    static const char *families[SCRAPE_CLIENT_FAMILIES][3] = {
+        { "stewart_client_messages_total", "counter",
+          "Messages received from the client" },
+        { "stewart_client_output_queued_bytes", "gauge",
+          "Replies waiting for the client to read them" },
+        { "stewart_client_input_queued_bytes", "gauge",
+          "Bytes received from the client but not yet handled" }
+    };
+    MetricsBuffer *out = &scrape->response;
+    const char *name, *transport;
+    Connection *connection;
+    unsigned long value;
+    char peer[32];
+    int budget = SCRAPE_SLOTS_PER_PASS;
+
+    while (scrape->family < SCRAPE_CLIENT_FAMILIES) {
+        name = families[scrape->family][0];
+        if (scrape->slot < 0) {
+            metrics_family(out, name, families[scrape->family][1], families[scrape->family][2]);
+            scrape->slot = 0;
+        }
+
+        while (scrape->slot < connection_pool_get_size(pool)) {
+            if (budget-- == 0) {
+                return 0;
+            }
+            connection = connection_pool_get(pool, scrape->slot++);
+            if (connection->fd == -1) {
+                continue;
+            }
+
+            switch (scrape->family) {
+                case SCRAPE_CLIENT_MESSAGES:
+                    value = connection->received;
+                    break;
+                case SCRAPE_CLIENT_OUTPUT:
+                    value = connection->channel ?
+                        (atomic_load(&connection->channel->replies.head) -
+                         atomic_load(&connection->channel->replies.tail)) *
+                        sizeof(StewartMessage) :
+                        connection->output_length - connection->output_offset;
+                    break;
+                default:
+                    value = connection->channel ?
+                        (atomic_load(&connection->channel->commands.head) -
+                         atomic_load(&connection->channel->commands.tail)) *
+                        sizeof(StewartMessage) :
+                        connection->input_head - connection->input_tail;
+                    break;
+            }
+
+            if (connection->channel) {
+                transport = "local";
+                snprintf(peer, sizeof(peer), "fd%d", connection->fd);
+            } else {
+                transport = connection->websocket ? "websocket" : "tcp";
+                snprintf(peer, sizeof(peer), "%s:%d", inet_ntoa(connection->peer.sin_addr),
+                         ntohs(connection->peer.sin_port));
+            }
+            metrics_printf(out, "%s{client=\"%s\",transport=\"%s\"} %lu\n",
+                           name, peer, transport, value);
+        }
+
+        scrape->family++;
+        scrape->slot = -1;
+    }
+
+    return 1;
+}
+
+void closeScrape(Scrape *scrape) {
+    if (scrape->state == SCRAPE_FORMAT) {
+        scraping--;
+    }
+    /* Closing also removes it from the epoll set; the response buffer is
+     * kept for the next scrape */
+    close(scrape->fd);
+    scrape->fd = -1;
+}
+
+int writeScrape(void *data, const void *bytes, size_t length) {
+    return metrics_write(data, bytes, length);
+}
+
+/* Read the request, then send the response as the socket takes it. The
+ * body is formatted in between by formatClients(). Returns -1 once the
+ * scrape is finished or has failed. */
+int serveScrape(Scrape *scrape) {
+    ssize_t ret;
+    int request;
+
+    if (scrape->state == SCRAPE_REQUEST) {
+        while (scrape->received < sizeof(scrape->request)) {
+            ret = recv(scrape->fd, scrape->request + scrape->received,
+                       sizeof(scrape->request) - scrape->received, 0);
+            if (ret == -1 && errno == EINTR) {
+                continue;
+            }
+            if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (ret <= 0) {
+                return -1;
+            }
+            scrape->received += ret;
+        }
+
+        request = metrics_request(scrape->request, scrape->received);
+        if (request == 0) {
+            return 0;
+        }
+
+        scrape->response.length = 0;
+        scrape->sent = 0;
+        if (request == METRICS_GET_FLIGHT && flight) {
+            /* Served whole; it's no bigger than the ring */
+            metrics_printf(&scrape->response, "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: application/octet-stream\r\n"
+                           "Content-Disposition: attachment; filename=\"flight.rec\"\r\n"
+                           "Connection: close\r\n"
+                           "\r\n");
+            if (flight_dump(flight, writeScrape, &scrape->response) < 0) {
+                return -1;
+            }
+            flightDumps++;
+            scrape->state = SCRAPE_SEND;
+        } else if (request != METRICS_GET_METRICS) {
+            metrics_printf(&scrape->response, "HTTP/1.1 404 Not Found\r\n"
+                           "Content-Length: 0\r\n"
+                           "Connection: close\r\n"
+                           "\r\n");
+            scrape->state = SCRAPE_SEND;
+        } else {
+            /* The body runs until the connection closes, so it can go out
+             * before its length is known */
+            metrics_printf(&scrape->response, "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Connection: close\r\n"
+                           "\r\n");
+            formatMetrics(&scrape->response);
+            scrape->state = SCRAPE_FORMAT;
+            scrape->family = 0;
+            scrape->slot = -1;
+            scraping++;
+            return 0;
+        }
+    }
+
+    if (scrape->state != SCRAPE_SEND) {
+        return 0;
+    }
+
+    while (scrape->sent < scrape->response.length) {
+        ret = send(scrape->fd, scrape->response.data + scrape->sent,
+                   scrape->response.length - scrape->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret == -1) {
+            return -1;
+        }
+        scrape->sent += ret;
+    }
+
+    return -1;
+}
+
+/* Scrapes are few and short lived; beyond SCRAPES_MAX at once they are
+ * turned away and retried on the scraper's next interval */
+int acceptScrapes(int epfd, int sock) {
+    struct epoll_event event;
+    Scrape *scrape;
+    int peer, i;
+
+    while (1) {
+        peer = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (peer == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (peer == -1 && (errno == EINTR || errno == ECONNABORTED)) {
+            continue;
+        }
+        if (peer == -1) {
+            fprintf(stderr, "Error: Unable to accept metrics connection: %s\n", strerror(errno));
+            return 0;
+        }
+
+        for (i = 0; i < SCRAPES_MAX && scrapes[i].fd != -1; i++) {
+        }
+        if (i == SCRAPES_MAX) {
+            close(peer);
+            continue;
+        }
+
+        scrape = &scrapes[i];
+        scrape->fd = peer;
+        scrape->state = SCRAPE_REQUEST;
+        scrape->received = 0;
+
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = EVENT_DATA(EVENT_METRICS, i);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, peer, &event) == -1) {
+            closeScrape(scrape);
+        }
+    }
+}
+
+/* Use the listening socket handed over for role if it is bound where this
+ * server was asked to listen (port, or path for Unix sockets); otherwise
+ * close it */
+int adoptListener(int *listeners, int role, int port, const char *path) {
+    struct sockaddr_storage addr;
+    socklen_t size = sizeof(addr);
+    int fd = listeners[role];
+
+    listeners[role] = -1;
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (getsockname(fd, (struct sockaddr *)&addr, &size) == 0 &&
+        ((addr.ss_family == AF_INET &&
+          ntohs(((struct sockaddr_in *)&addr)->sin_port) == port) ||
+         (addr.ss_family == AF_UNIX && path &&
+          !strcmp(((struct sockaddr_un *)&addr)->sun_path, path)))) {
+        return fd;
+    }
+
+    close(fd);
+    return -1;
+}
+
+/* The UDP socket for an input adapter: the one handed over if it is on the
+ * same port, else bound afresh on addr's interface. Returns -1 on error. */
+int bindAdapter(int *listeners, int role, int port, struct sockaddr_in *addr) {
+    struct sockaddr_in sin = *addr;
+    int sock;
+
+    sock = adoptListener(listeners, role, port, NULL);
+    if (sock != -1) {
+        return sock;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (sock == -1) {
+        fprintf(stderr, "Error: Unable to create UDP socket: %s\n", strerror(errno));
+        return -1;
+    }
+    sin.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+        fprintf(stderr, "Error: Unable to bind UDP port %d: %s\n", port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Ask the server on path to hand over. Returns the handoff socket with
+ * state and listeners filled in, -1 if no server is listening there or -2
+ * if one is but the handoff failed. */
+int takeOver(const char *path, HandoffState *state, int *listeners) {
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    HandoffRequest request = {
+        .magic = HANDOFF_MAGIC,
+        .version = HANDOFF_VERSION,
+        .state_size = sizeof(HandoffState),
+        .connection_size = sizeof(HandoffConnection)
+    };
+    int fds[HANDOFF_LISTENERS];
+    int count = HANDOFF_LISTENERS;
+    int sock, i, j;
+
+    for (i = 0; i < HANDOFF_LISTENERS; i++) {
+        listeners[i] = -1;
+    }
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -2;
+    }
+    strcpy(sun.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        fprintf(stderr, "Error: Unable to create handoff socket: %s\n", strerror(errno));
+        return -2;
+    }
+    if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+        close(sock);
+        return -1;
+    }
+
+    handoff_set_timeout(sock, HANDOFF_TIMEOUT);
+    if (handoff_send(sock, &request, sizeof(request), NULL, 0) ||
+        handoff_recv(sock, state, sizeof(*state), fds, &count) != sizeof(*state) ||
+        state->magic != HANDOFF_MAGIC ||
+        count != __builtin_popcount(state->listeners & ((1 << HANDOFF_LISTENERS) - 1))) {
+        fprintf(stderr, "Error: Unable to take over from the server on %s\n", path);
+        for (i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        close(sock);
+        return -2;
+    }
+
+    for (i = j = 0; i < HANDOFF_LISTENERS; i++) {
+        if (state->listeners & (1 << i)) {
+            listeners[i] = fds[j++];
+        }
+    }
+
+    return sock;
+}
+
+/* Receive the connections in batches and pick them up exactly where the
+ * old server left off: unparsed input, unsent output, subscription */
+int restoreConnections(int sock, uint32_t total, int epfd) {
+    struct epoll_event event;
+    HandoffConnection record;
+    HandoffBatch batch;
+    Connection *connection;
+    unsigned char *message;
+    int fds[HANDOFF_FDS_MAX];
+    uint32_t restored = 0;
+    size_t offset;
+    ssize_t length;
+    int count = 0, used = 0, needed, i;
+
+    message = malloc(HANDOFF_MESSAGE_MAX);
+    if (!message) {
+        fprintf(stderr, "Error: Out of memory taking over connections\n");
+        return -1;
+    }
+
+    while (restored < total) {
+        /* fds[used] on are this message's descriptors not yet taken over
+         * or closed */
+        count = HANDOFF_FDS_MAX;
+        used = 0;
+        length = handoff_recv(sock, message, HANDOFF_MESSAGE_MAX, fds, &count);
+        if (length < (ssize_t)sizeof(batch)) {
+            goto error;
+        }
+        memcpy(&batch, message, sizeof(batch));
+        if (batch.count > count) {
+            goto error;
+        }
+        offset = sizeof(batch);
+
+        for (i = 0; i < batch.count; i++) {
+            if (offset + sizeof(record) > length) {
+                goto error;
+            }
+            memcpy(&record, message + offset, sizeof(record));
+            offset += sizeof(record);
+            if (record.input_length > CONNECTION_INPUT_SIZE ||
+                record.output_length > CONNECTION_OUTPUT_SIZE ||
+                offset + record.input_length + record.output_length > length) {
+                goto error;
+            }
+            needed = record.local ? 1 + LOCAL_FDS : 1;
+            if (used + needed > count) {
+                goto error;
+            }
+
+            if (record.local) {
+                connection = localCount < LOCAL_CLIENTS_MAX ?
+                    connection_open(pool, fds[used], NULL) : NULL;
+            } else {
+                connection = connection_open(pool, fds[used], &record.peer);
+            }
+            if (!connection) {
+                fprintf(stderr, "Error: Too many connections (%d). Closing handed over "
+                        "connection.\n", connection_pool_get_size(pool));
+                for (; needed; needed--) {
+                    close(fds[used++]);
+                }
+                offset += record.input_length + record.output_length;
+                continue;
+            }
+            used++;
+            if (record.local) {
+                connection->channel_fd = fds[used + LOCAL_FD_CHANNEL];
+                connection->wake = fds[used + LOCAL_FD_WAKE];
+                connection->notify = fds[used + LOCAL_FD_NOTIFY];
+                used += LOCAL_FDS;
+            }
+            connection->protocol = record.protocol;
+            connection->websocket = record.websocket;
+            connection->received = record.received;
+            memcpy(connection->input, message + offset, record.input_length);
+            connection->input_head = record.input_length;
+            offset += record.input_length;
+            memcpy(connection->output, message + offset, record.output_length);
+            connection->output_length = record.output_length;
+            offset += record.output_length;
+            if (record.subscribed) {
+                connection_subscribe(pool, connection, record.subscribe_fields,
+                                     record.subscribe_period);
+                connection->subscribe_next = record.subscribe_next;
+            }
+            connection->status_pending = record.status_pending;
+            /* The history stays behind; a query still being answered
+             * just ends */
+            connection->history = record.history;
+            connection->history_id = record.history_id;
+
+            /* The rings carry on where the old server left them, wakeup
+             * requests and all */
+            if (record.local) {
+                connection->channel = local_channel_map(connection->channel_fd);
+                if (!connection->channel) {
+                    connection_close(pool, connection);
+                    continue;
+                }
+            }
+
+            /* Anything already waiting on the socket is reported right away */
+            event.events = record.local ? EPOLLIN | EPOLLRDHUP | EPOLLET :
+                EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = EVENT_DATA(EVENT_CLIENT, connection->id);
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, connection->fd, &event) == -1) {
+                fprintf(stderr, "Error: Unable to watch connection: %s\n", strerror(errno));
+                connection_close(pool, connection);
+                continue;
+            }
+            if (record.local) {
+                event.events = EPOLLIN | EPOLLET;
+                event.data.u64 = EVENT_DATA(EVENT_LOCAL, connection->id);
+                epoll_ctl(epfd, EPOLL_CTL_ADD, connection->wake, &event);
+                locals[localCount++] = connection;
+            }
+        }
+        if (used != count) {
+            goto error;
+        }
+        restored += batch.count;
+    }
+
+    free(message);
+    return 0;
+
+error:
+    fprintf(stderr, "Error: Invalid connections in handoff\n");
+    for (; used < count; used++) {
+        close(fds[used]);
+    }
+    free(message);
+    return -1;
+}
+
+/* Pose, tick phase and PWM shadow as the old server left them. Nothing is
+ * written to the boards; they are still outputting the last frame. */
+void restoreState(const HandoffState *state, PCA9685Group *boards) {
+    int i;
+
+    transform = state->transform;
+    memcpy(origin, state->origin, sizeof(origin));
+    memcpy(solutions, state->solutions, sizeof(solutions));
+    memcpy(rotationMatrix, state->rotation, sizeof(rotationMatrix));
+    posePending = state->pose_pending;
+    lastTick = state->last_tick;
+    for (i = 0; i < state->scheduled && i < SCHEDULE_MAX; i++) {
+        schedule[i].usec = state->schedule[i].usec;
+        schedule[i].transform = state->schedule[i].transform;
+    }
+    scheduleHead = 0;
+    scheduled = i;
+    multicastSequence = state->multicast_sequence;
+
+    for (i = 0; boards && i < state->boards && i < pca9685_group_get_count(boards); i++) {
+        pca9685_set_shadow(pca9685_group_get_board(boards, i), &state->shadows[i]);
+    }
+}
+
+/* Send every client connection, as many to a message as fit. Local
+ * clients take their shared memory channel and eventfds along. */
+int sendConnections(int sock, uint32_t total) {
+    HandoffConnection record;
+    HandoffBatch batch;
+    Connection *connection = connection_pool_first(pool);
+    unsigned char *message;
+    const void *input;
+    int fds[HANDOFF_FDS_MAX];
+    uint32_t sent = 0;
+    size_t length, pending, queued;
+    int count, needed, err = 0;
+
+    message = malloc(HANDOFF_MESSAGE_MAX);
+    if (!message) {
+        fprintf(stderr, "Error: Out of memory handing over connections\n");
+        return -1;
+    }
+
+    while (!err && sent < total) {
+        batch.count = 0;
+        count = 0;
+        length = sizeof(batch);
+
+        for (; connection; connection = connection->next) {
+            needed = connection->channel ? 1 + LOCAL_FDS : 1;
+            pending = connection->input_head - connection->input_tail;
+            queued = connection->output_length - connection->output_offset;
+            if (count + needed > HANDOFF_FDS_MAX ||
+                length + sizeof(record) + pending + queued > HANDOFF_MESSAGE_MAX) {
+                break;
+            }
+
+            memset(&record, 0, sizeof(record));
+            record.peer = connection->peer;
+            record.protocol = connection->protocol;
+            record.websocket = connection->websocket;
+            record.received = connection->received;
+            record.subscribed = connection->subscribed;
+            record.subscribe_fields = connection->subscribe_fields;
+            record.status_pending = connection->status_pending;
+            record.subscribe_period = connection->subscribe_period;
+            record.subscribe_next = connection->subscribe_next;
+            record.history = connection->history;
+            record.history_id = connection->history_id;
+            record.input_length = pending;
+            record.output_length = queued;
+            record.local = connection->channel != NULL;
+            memcpy(message + length, &record, sizeof(record));
+            length += sizeof(record);
+
+            input = connection_peek(connection, pending, message + length);
+            if (input != message + length) {
+                memcpy(message + length, input, pending);
+            }
+            length += pending;
+            memcpy(message + length, connection->output + connection->output_offset, queued);
+            length += queued;
+
+            fds[count++] = connection->fd;
+            if (connection->channel) {
+                fds[count + LOCAL_FD_CHANNEL] = connection->channel_fd;
+                fds[count + LOCAL_FD_WAKE] = connection->wake;
+                fds[count + LOCAL_FD_NOTIFY] = connection->notify;
+                count += LOCAL_FDS;
+            }
+            batch.count++;
+        }
+
+        memcpy(message, &batch, sizeof(batch));
+        err = handoff_send(sock, message, length, fds, count);
+        sent += batch.count;
+    }
+
+    free(message);
+    return err;
+}
+
+/* A new server connected to the handoff socket. Give it the listeners,
+ * clients and state and, once it has acknowledged, stop. Each step blocks
+ * for at most HANDOFF_TIMEOUT; if the new server fails this one carries on.
+ * Returns 1 once handed off. */
+int handOff(int listener, const int *listeners, StewartConfig *config, PCA9685Group *boards) {
+    HandoffRequest request;
+    HandoffState state;
+    int fds[HANDOFF_LISTENERS];
+    int count, listening, sock, i;
+    char ack;
+
+    while ((sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+        handoff_set_timeout(sock, HANDOFF_TIMEOUT);
+
+        count = 0;
+        if (handoff_recv(sock, &request, sizeof(request), NULL, &count) != sizeof(request) ||
+            request.magic != HANDOFF_MAGIC || request.version != HANDOFF_VERSION ||
+            request.state_size != sizeof(HandoffState) ||
+            request.connection_size != sizeof(HandoffConnection)) {
+            fprintf(stderr, "Error: Refusing handoff to an incompatible server\n");
+            close(sock);
+            continue;
+        }
+
+        memset(&state, 0, sizeof(state));
+        state.magic = HANDOFF_MAGIC;
+        for (i = listening = 0; i < HANDOFF_LISTENERS; i++) {
+            if (listeners[i] != -1) {
+                state.listeners |= 1 << i;
+                fds[listening++] = listeners[i];
+            }
+        }
+        state.connections = connection_pool_get_count(pool);
+        state.transform = transform;
+        memcpy(state.origin, origin, sizeof(origin));
+        memcpy(state.solutions, solutions, sizeof(solutions));
+        memcpy(state.rotation, rotationMatrix, sizeof(rotationMatrix));
+        state.pose_pending = posePending;
+        state.scheduled = scheduled;
+        for (i = 0; i < scheduled; i++) {
+            state.schedule[i].usec = schedule[(scheduleHead + i) % SCHEDULE_MAX].usec;
+            state.schedule[i].transform = schedule[(scheduleHead + i) % SCHEDULE_MAX].transform;
+        }
+        memcpy(state.servo_trim, config->servo_trim, sizeof(state.servo_trim));
+        state.last_tick = lastTick;
+        state.tick_due = ticking ? tickDue : 0;
+        state.multicast_sequence = multicastSequence;
+        if (boards) {
+            state.boards = pca9685_group_get_count(boards);
+            for (i = 0; i < state.boards; i++) {
+                pca9685_get_shadow(pca9685_group_get_board(boards, i), &state.shadows[i]);
+            }
+        }
+
+        count = 0;
+        if (handoff_send(sock, &state, sizeof(state), fds, listening) ||
+            sendConnections(sock, state.connections) ||
+            handoff_recv(sock, &ack, sizeof(ack), NULL, &count) != sizeof(ack)) {
+            fprintf(stderr, "Error: Handoff to the new server failed. Carrying on.\n");
+            close(sock);
+            continue;
+        }
+
+        close(sock);
+        if (!quiet) {
+            fprintf(stdout, "Handed over %u clients to the new server.\n", state.connections);
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Thousands of clients need more descriptors than the usual soft limit */
+void raiseFileLimit(int connections) {
+    struct rlimit limit;
+    rlim_t needed = connections + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) || limit.rlim_cur >= needed) {
+        return;
+    }
+    limit.rlim_cur = needed;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed) {
+        fprintf(stderr, "Warning: Only %ld file descriptors available for %d connections.\n",
+                (long)limit.rlim_cur, connections);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    PCA9685Group *boards = NULL;
+    StewartConfig _c;
+    StewartConfig *config = &_c;
+    StewartPlatform *platform = NULL;
+    int err = 0;
+    int sock = -1;
+    int i, port = -1;
+    char *iface = "lo";
+    int simulate = 0;
+    int frequency = 0, rate = 0;
+    int bus = 0;
+    int addrs[PCA9685_GROUP_MAX] = { 0x40 };
+    int addrCount = 1;
+    int warm = 0;
+    int dither = 0;
+    int maxConnections = CONNECTION_MAX_DEFAULT;
+    int historySize = HISTORY_DEFAULT;
+    int flightSize = FLIGHT_DEFAULT;
+    int oscPort = 0, telemetryPort = 0;
+    int adapterSocks[2] = { -1, -1 };
+    char *layout = NULL;
+    int epfd = -1, tick = -1;
+    int udpPort = 0, udp = -1;
+    int ipc = 0;
+    char *localPath = NULL;
+    int local = -1;
+    int wsPort = 0, ws = -1;
+    int metricsPort = 0, metricsSock = -1;
+    char *handoffPath = NULL;
+    int handoffSock = -1, handoff = -1;
+    HandoffState handoffState;
+    int listeners[HANDOFF_LISTENERS];
+    int adopted;
+    Scrape *scrape;
+    uint64_t expired;
+    char *group = NULL;
+    int groupPort = 0;
+    int j;
+    char *next;
+
+    struct ifaddrs *ifaddr = NULL, *p;
+    char hostIpAddr[NI_MAXHOST];
+
+    config->debug = 0;
+
+    for (i = 0; i < SCRAPES_MAX; i++) {
+        scrapes[i].fd = -1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            switch (argv[i][1]) {
+                case 's':
+                    simulate = 1;
+                    break;
+
+                case 'w':
+                    warm = 1;
+                    break;
+
+                case 'D':
+                    dither = 1;
+                    break;
+
+                case 'p': /* next is port */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    port = strtol(argv[i], NULL, 0);
+                    break;
+                case 'f': /* next is PWM frequency */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    frequency = strtol(argv[i], NULL, 0);
+                    break;
+                case 'r': /* next is control tick rate */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    rate = strtol(argv[i], NULL, 0);
+                    break;
+                case 'c': /* next is the connection limit */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    maxConnections = strtol(argv[i], NULL, 0);
+                    if (maxConnections <= 0) {
+                        usage(-1);
+                    }
+                    break;
+                case 'I':
+                    ipc = 1;
+                    break;
+                case 'l': /* next is the local Unix socket path */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    localPath = argv[i];
+                    break;
+                case 'm': /* next is the multicast GROUP:PORT */
+                    i++;
+                    if (i >= argc || !(next = strchr(argv[i], ':'))) {
+                        usage(-1);
+                    }
+                    *next = '\0';
+                    group = argv[i];
+                    groupPort = strtol(next + 1, NULL, 0);
+                    break;
+                case 'W': /* next is the WebSocket port */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    wsPort = strtol(argv[i], NULL, 0);
+                    break;
+                case 'M': /* next is the metrics port */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    metricsPort = strtol(argv[i], NULL, 0);
+                    break;
+                case 'R': /* next is the history size */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    historySize = strtol(argv[i], NULL, 0);
+                    if (historySize < 0) {
+                        usage(-1);
+                    }
+                    break;
+                case 'O': /* next is the OSC port */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    oscPort = strtol(argv[i], NULL, 0);
+                    break;
+                case 'T': /* next is the telemetry PORT:LAYOUT */
+                    i++;
+                    if (i >= argc || !(next = strchr(argv[i], ':'))) {
+                        usage(-1);
+                    }
+                    *next = '\0';
+                    telemetryPort = strtol(argv[i], NULL, 0);
+                    layout = next + 1;
+                    break;
+                case 'F': /* next is the flight recorder PATH[:FRAMES] */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    flightPath = argv[i];
+                    if ((next = strrchr(argv[i], ':'))) {
+                        *next = '\0';
+                        flightSize = strtol(next + 1, NULL, 0);
+                        if (flightSize <= 0) {
+                            usage(-1);
+                        }
+                    }
+                    break;
+                case 'H': /* next is the handoff Unix socket path */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    handoffPath = argv[i];
+                    break;
+                case 'u': /* next is the UDP setpoint port */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    udpPort = strtol(argv[i], NULL, 0);
+                    break;
+                case 'b': /* next is i2c bus */
+                    i++;
+                    if (i >= argc) {
+                        usage(-1);
+                    }
+                    bus = strtol(argv[i], NULL, 0);
                     break;
-
-                case 'p': /* next is port */
+                case 'a': /* next is comma separated board addresses */
                     i++;
                     if (i >= argc) {
                         usage(-1);
                     }
-                    port = strtol(argv[i], NULL, 0);
+                    next = argv[i];
+                    for (addrCount = 0; *next && addrCount < PCA9685_GROUP_MAX; addrCount++) {
+                        addrs[addrCount] = strtol(next, &next, 0);
+                        if (*next == ',') {
+                            next++;
+                        } else if (*next) {
+                            usage(-1);
+                        }
+                    }
+                    if (addrCount == 0 || *next) {
+                        usage(-1);
+                    }
                     break;
                 case 'q':
                     quiet = 1;
@@ -340,12 +2706,63 @@ int main(int argc, char *argv[]) {
         fprintf(stdout, "Simulating PCA9685.\n");
     }
 
-    if (init_platform(config, simulate ? NULL : &pca, &platform)) {
+    /* Initialize the default values for the Stewart platform as
+     * documented at https://01.org/developerjourney/recipe/stewert-platform
+     * and then apply any command line overrides */
+    config_get(config);
+    if (frequency) {
+        config->pulse_frequency = frequency;
+    }
+    if (rate) {
+        config->tick_rate = rate;
+    }
+    if (dither) {
+        config->dither = 1;
+    }
+    if (ipc) {
+        config->ipc = 1;
+    }
+    if (config_validate(config)) {
+        usage(-1);
+    }
+
+    if (!quiet) {
+        fprintf(stdout, "PWM frequency: %dHz, control tick rate: %dHz\n",
+                config->pulse_frequency, config_get_tick_rate(config));
+    }
+
+    for (i = 0; i < HANDOFF_LISTENERS; i++) {
+        listeners[i] = -1;
+    }
+    if (handoffPath) {
+        handoff = takeOver(handoffPath, &handoffState, listeners);
+        if (handoff == -2) {
+            return -1;
+        }
+    }
+    /* The boards are running the old server's frame; adopt them as they
+     * are */
+    if (handoff != -1) {
+        if (!quiet) {
+            fprintf(stdout, "Taking over from the server on %s (%u clients)\n",
+                    handoffPath, handoffState.connections);
+        }
+        warm = 1;
+        memcpy(config->servo_trim, handoffState.servo_trim, sizeof(config->servo_trim));
+    }
+
+    if (init_platform(config, bus, addrs, addrCount, warm,
+                      simulate ? NULL : &boards, &platform)) {
         fprintf(stderr, "Error: Unable to initializing Stewart platform.\n");
         return -1;
     }
 
-    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    /* Listening sockets handed over are already bound */
+    sock = adoptListener(listeners, HANDOFF_LISTEN_TCP, port, NULL);
+    adopted = sock != -1;
+    if (!adopted) {
+        sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    }
 
     if (sock == -1) {
         fprintf(stderr, "Error: Unable to create socket: %s\n", strerror(errno));
@@ -392,7 +2809,7 @@ int main(int argc, char *argv[]) {
     }
 
     int enable = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+    if (!adopted && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
         fprintf(stderr, "Error: Unable to SO_REUSEADDR: %s\n", strerror(errno));
         goto terminate;
     }
@@ -401,7 +2818,7 @@ int main(int argc, char *argv[]) {
     sin.sin_port = htons(port);
     sin.sin_family = AF_INET;
     inet_aton(hostIpAddr, &sin.sin_addr);
-    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+    if (!adopted && bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
         fprintf(stderr, "Error: Unable to bind to %s: %s:%d:\n%s\n",
                 iface, hostIpAddr, port, strerror(errno));
         goto terminate;
@@ -409,181 +2826,614 @@ int main(int argc, char *argv[]) {
 
     fcntl(sock, F_SETFL, O_NONBLOCK);
 
-    if (listen(sock, 10) == -1) {
-        fprintf(stderr, "Error: Unable to listen on socket: %s\n",
-                   strerror(errno));
-        goto terminate;
+    udp = adoptListener(listeners, HANDOFF_LISTEN_UDP, udpPort, NULL);
+    if (udpPort) {
+        if (udp == -1) {
+            udp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+            if (udp == -1) {
+                fprintf(stderr, "Error: Unable to create UDP socket: %s\n", strerror(errno));
+                goto terminate;
+            }
+            sin.sin_port = htons(udpPort);
+            if (bind(udp, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+                fprintf(stderr, "Error: Unable to bind UDP to %s: %s:%d:\n%s\n",
+                        iface, hostIpAddr, udpPort, strerror(errno));
+                goto terminate;
+            }
+        }
+        setpoints = setpoint_sources_create();
+        if (!setpoints) {
+            goto terminate;
+        }
+        if (!quiet) {
+            fprintf(stdout, "Setpoints: UDP %s:%d\n", hostIpAddr, udpPort);
+        }
     }
 
-    fds[0].fd = sock;
-    fds[0].events = POLLIN;
-    for (i = 1; i < sizeof(fds) / sizeof(fds[0]); i++) {
-        fds[i].fd = -1;
+    if (oscPort) {
+        adapters[ADAPTER_OSC] = adapter_create_osc();
+        adapterSocks[ADAPTER_OSC] = bindAdapter(listeners, HANDOFF_LISTEN_OSC, oscPort, &sin);
+        if (!adapters[ADAPTER_OSC] || adapterSocks[ADAPTER_OSC] == -1) {
+            goto terminate;
+        }
+        if (!quiet) {
+            fprintf(stdout, "OSC: UDP %s:%d\n", hostIpAddr, oscPort);
+        }
     }
-    int maxIndex = 1;
 
-    while (1) {
+    if (telemetryPort) {
+        adapters[ADAPTER_TELEMETRY] = adapter_create_telemetry(layout);
+        if (!adapters[ADAPTER_TELEMETRY]) {
+            goto terminate;
+        }
+        adapterSocks[ADAPTER_TELEMETRY] = bindAdapter(listeners, HANDOFF_LISTEN_TELEMETRY,
+                                                      telemetryPort, &sin);
+        if (adapterSocks[ADAPTER_TELEMETRY] == -1) {
+            goto terminate;
+        }
         if (!quiet) {
-            fprintf(stderr, "Listening to connections %d for data and for new connections.\n", maxIndex);
+            fprintf(stdout, "Telemetry: UDP %s:%d as %s\n", hostIpAddr, telemetryPort, layout);
         }
+    }
 
-        int resCount = poll(fds, maxIndex, -1);
-        if (resCount == -1) {
-            fprintf(stderr, "Error: Poll returned an error: %s\n", strerror(errno));
+    if (group) {
+        struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = htons(groupPort) };
+        unsigned char ttl = 1, loop = 1;
+
+        multicast = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+        if (multicast == -1) {
+            fprintf(stderr, "Error: Unable to create multicast socket: %s\n", strerror(errno));
+            goto terminate;
+        }
+        if (!inet_aton(group, &to.sin_addr) || !IN_MULTICAST(ntohl(to.sin_addr.s_addr))) {
+            fprintf(stderr, "Error: %s is not a multicast group\n", group);
+            goto terminate;
+        }
+        /* Send out of the interface the server is bound to; observers on
+         * this machine hear it too. Connecting saves a route lookup per
+         * datagram. */
+        if (setsockopt(multicast, IPPROTO_IP, IP_MULTICAST_IF, &sin.sin_addr,
+                       sizeof(sin.sin_addr)) == -1 ||
+            setsockopt(multicast, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == -1 ||
+            setsockopt(multicast, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == -1 ||
+            connect(multicast, (struct sockaddr *)&to, sizeof(to)) == -1) {
+            fprintf(stderr, "Error: Unable to send to multicast %s:%d: %s\n",
+                    group, groupPort, strerror(errno));
             goto terminate;
         }
+        if (!quiet) {
+            fprintf(stdout, "Status: multicast %s:%d from %s\n", group, groupPort, hostIpAddr);
+        }
+    }
 
-        /* Check the LISTEN socket for new connections */
-        if (fds[0].revents & POLLIN) {
-            resCount--;
+    ws = adoptListener(listeners, HANDOFF_LISTEN_WEBSOCKET, wsPort, NULL);
+    if (wsPort) {
+        if (ws == -1) {
+            ws = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+            if (ws == -1) {
+                fprintf(stderr, "Error: Unable to create WebSocket socket: %s\n",
+                        strerror(errno));
+                goto terminate;
+            }
+            setsockopt(ws, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            sin.sin_port = htons(wsPort);
+            if (bind(ws, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+                listen(ws, SOMAXCONN) == -1) {
+                fprintf(stderr, "Error: Unable to listen for WebSockets on %s: %s:%d:\n%s\n",
+                        iface, hostIpAddr, wsPort, strerror(errno));
+                goto terminate;
+            }
+        }
+        if (!quiet) {
+            fprintf(stdout, "WebSockets: ws://%s:%d/\n", hostIpAddr, wsPort);
+        }
+    }
 
-            /* socket accept is ready! */
-            struct sockaddr_in peerAddr;
-            socklen_t peerAddrSize = sizeof(peerAddr);
-            int peer;
-            while (1) {
-                peer = accept(fds[0].fd, (struct sockaddr *)&peerAddr, &peerAddrSize);
-                if (peer == -1 && errno == EAGAIN) {
-                    break;
-                }
-                if (peer == -1) {
-                    fprintf(stderr, "Error: Unable to accept connect: %s\n",
+    metricsSock = adoptListener(listeners, HANDOFF_LISTEN_METRICS, metricsPort, NULL);
+    if (metricsPort) {
+        if (metricsSock == -1) {
+            metricsSock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                 IPPROTO_TCP);
+            if (metricsSock == -1) {
+                fprintf(stderr, "Error: Unable to create metrics socket: %s\n",
                         strerror(errno));
-                    goto terminate;
-                }
+                goto terminate;
+            }
+            setsockopt(metricsSock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            sin.sin_port = htons(metricsPort);
+            if (bind(metricsSock, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+                listen(metricsSock, SOMAXCONN) == -1) {
+                fprintf(stderr, "Error: Unable to listen for metrics on %s: %s:%d:\n%s\n",
+                        iface, hostIpAddr, metricsPort, strerror(errno));
+                goto terminate;
+            }
+        }
+        if (!quiet) {
+            fprintf(stdout, "Metrics: http://%s:%d/metrics\n", hostIpAddr, metricsPort);
+        }
+    }
+    local = adoptListener(listeners, HANDOFF_LISTEN_LOCAL, 0, localPath);
+    if (localPath && local == -1) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+        if (strlen(localPath) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "Error: Socket path too long: %s\n", localPath);
+            goto terminate;
+        }
+        strcpy(sun.sun_path, localPath);
+        local = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(localPath);
+        if (local == -1 || bind(local, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+            listen(local, SOMAXCONN) == -1) {
+            fprintf(stderr, "Error: Unable to listen on %s: %s\n", localPath, strerror(errno));
+            goto terminate;
+        }
+    }
+    if (localPath && !quiet) {
+        fprintf(stdout, "Local clients: %s\n", localPath);
+    }
 
-                if (!quiet) {
-                    fprintf(stdout, "Connection from %s on %d (%d)\n",
-                            inet_ntoa(peerAddr.sin_addr), ntohs(peerAddr.sin_port), peer);
-                }
+    /* Whoever takes over from this server connects here. Any socket file
+     * left is stale; nothing answered on it. */
+    handoffSock = adoptListener(listeners, HANDOFF_LISTEN_HANDOFF, 0, handoffPath);
+    if (handoffPath && handoffSock == -1) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+        if (strlen(handoffPath) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "Error: Socket path too long: %s\n", handoffPath);
+            goto terminate;
+        }
+        strcpy(sun.sun_path, handoffPath);
+        handoffSock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(handoffPath);
+        if (handoffSock == -1 ||
+            bind(handoffSock, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+            listen(handoffSock, 1) == -1) {
+            fprintf(stderr, "Error: Unable to listen on %s: %s\n", handoffPath,
+                    strerror(errno));
+            goto terminate;
+        }
+    }
+    if (handoffPath && !quiet) {
+        fprintf(stdout, "Hot restart: %s\n", handoffPath);
+    }
 
-                if (maxIndex == MAX_CONNECTIONS) {
-                    fprintf(stderr, "Error: Too many connections. Closing new connection.\n");
-                    close(peer);
-                    continue;
-                }
+    raiseFileLimit(maxConnections);
+    spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pool = connection_pool_create(maxConnections);
+    if (!pool) {
+        goto terminate;
+    }
+
+    if (historySize) {
+        history = history_create(historySize);
+        if (!history) {
+            goto terminate;
+        }
+    }
+
+    if (flightPath) {
+        flight = flight_create(flightSize, config_hash(config));
+        if (!flight || catchCrashes()) {
+            goto terminate;
+        }
+        if (!quiet) {
+            fprintf(stdout, "Flight recorder: %s\n", flightPath);
+        }
+    }
+
+    if (listen(sock, SOMAXCONN) == -1) {
+        fprintf(stderr, "Error: Unable to listen on socket: %s\n",
+                   strerror(errno));
+        goto terminate;
+    }
+
+    if (config->ipc) {
+        ipcRegion = stewart_ipc_create(STEWART_IPC_NAME, config_get_tick_rate(config));
+        if (!ipcRegion) {
+            goto terminate;
+        }
+        if (!quiet) {
+            fprintf(stdout, "Status: shared memory " STEWART_IPC_NAME "\n");
+        }
+    }
+
+    signal(SIGUSR1, onSignal);
+    signal(SIGUSR2, onSignal);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    tick = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd == -1 || tick == -1) {
+        fprintf(stderr, "Error: Unable to create event loop: %s\n", strerror(errno));
+        goto terminate;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.u64 = EVENT_DATA(EVENT_LISTEN, 0)
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch socket: %s\n", strerror(errno));
+        goto terminate;
+    }
+    event.data.u64 = EVENT_DATA(EVENT_TICK, 0);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tick, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch tick timer: %s\n", strerror(errno));
+        goto terminate;
+    }
+
+    event.data.u64 = EVENT_DATA(EVENT_LOCAL_LISTEN, 0);
+    if (local != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, local, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch local socket: %s\n", strerror(errno));
+        goto terminate;
+    }
+
+    event.data.u64 = EVENT_DATA(EVENT_WEBSOCKET_LISTEN, 0);
+    if (ws != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, ws, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch WebSocket socket: %s\n", strerror(errno));
+        goto terminate;
+    }
 
-                fcntl(peer, F_SETFL,  O_NONBLOCK);
+    event.data.u64 = EVENT_DATA(EVENT_METRICS_LISTEN, 0);
+    if (metricsSock != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, metricsSock, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch metrics socket: %s\n", strerror(errno));
+        goto terminate;
+    }
+
+    event.data.u64 = EVENT_DATA(EVENT_SETPOINT, 0);
+    if (udp != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, udp, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch UDP socket: %s\n", strerror(errno));
+        goto terminate;
+    }
+
+    for (i = 0; i < 2; i++) {
+        event.data.u64 = EVENT_DATA(EVENT_ADAPTER, i);
+        if (adapterSocks[i] != -1 &&
+            epoll_ctl(epfd, EPOLL_CTL_ADD, adapterSocks[i], &event) == -1) {
+            fprintf(stderr, "Error: Unable to watch input adapter socket: %s\n",
+                    strerror(errno));
+            goto terminate;
+        }
+    }
+
+    event.data.u64 = EVENT_DATA(EVENT_HANDOFF_LISTEN, 0);
+    if (handoffSock != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, handoffSock, &event) == -1) {
+        fprintf(stderr, "Error: Unable to watch handoff socket: %s\n", strerror(errno));
+        goto terminate;
+    }
 
-                fds[maxIndex].fd = peer;
-                fds[maxIndex].events = POLLIN | POLLHUP | POLLNVAL | POLLERR;
-                fds[maxIndex].revents = 0;
-                bufferIndex[maxIndex] = 0;
-                pending[maxIndex].type = STEWART_MESSAGE_INVALID;
-                memset(buffer[maxIndex], 0, sizeof(buffer[maxIndex]));
+    struct epoll_event events[MAX_EVENTS];
+    long long tickPeriod = 1000000LL / config_get_tick_rate(config);
+
+    /* Take over the clients and carry on with the old server's pose. Until
+     * the acknowledgement the old server owns the boards, so the first frame
+     * from here is on the tick it would have run next. */
+    if (handoff != -1) {
+        if (restoreConnections(handoff, handoffState.connections, epfd)) {
+            goto terminate;
+        }
+        restoreState(&handoffState, boards);
+        if (handoffState.tick_due) {
+            long long start = handoffState.tick_due;
+            while (start < now_usec()) {
+                start += tickPeriod;
+            }
+            armTick(tick, config, 1, start);
+            ticking = 1;
+        }
+        if (handoff_send(handoff, "", 1, NULL, 0)) {
+            fprintf(stderr, "Error: Unable to acknowledge the handoff: %s\n", strerror(errno));
+            goto terminate;
+        }
+        close(handoff);
+        handoff = -1;
+    }
 
-                maxIndex++;
+    while (running) {
+        if (dumpFlight) {
+            dumpFlight = 0;
+            if (flight) {
+                dumpFlightRecorder();
+            }
+        }
+        if (dumpStats) {
+            dumpStats = 0;
+            unsigned long conflated = 0;
+            Connection *subscriber;
+            for (subscriber = connection_pool_first_subscriber(pool); subscriber;
+                 subscriber = subscriber->sub_next) {
+                conflated += subscriber->conflated;
+            }
+            fprintf(stdout, "Clients: %d of %d, %d subscribed, %lu updates conflated\n",
+                    connection_pool_get_count(pool), connection_pool_get_size(pool),
+                    connection_pool_get_subscribers(pool), conflated);
+            fprintf(stdout, "Poses: %lu replaced by a newer one before being applied\n",
+                    posesCoalesced);
+            printBoardStats(boards);
+            printSetpointStats();
+            if (multicast != -1) {
+                fprintf(stdout, "Multicast: %u status datagrams sent, %lu dropped\n",
+                        multicastSequence, multicastDropped);
             }
         }
 
-        if (!quiet) {
-            fprintf(stderr, "Checking %d sockets for data.\n", maxIndex - 1);
+        /* A pose after a quiet spell needn't wait for the tick */
+        if (posePending && now_usec() - lastTick >= tickPeriod) {
+            applyPose(config, platform, boards);
         }
 
-        int collapseTo = 0;
+        /* A scheduled pose moves the tick onto its time */
+        if (tickAlign) {
+            armTick(tick, config, 1, tickAlign);
+            tickAlign = 0;
+            if (!ticking) {
+                ticking = 1;
+                setLocalWakeup(config, platform, boards, 0);
+            }
+        }
 
-        /* Loop through all of the watched sockets until resCount descriptors
-         * have been handled */
-        for (i = 1; i < maxIndex && resCount > 0; i++) {
-            if (fds[i].revents) {
-                resCount--;
+        int dithering = boards && pca9685_group_is_dithering(boards);
+        int needTick = posePending || scheduled || dithering || ipcRegion ||
+            multicast != -1 || connection_pool_get_subscribers(pool);
+        if (needTick != ticking) {
+            long long start = lastTick + tickPeriod;
+            if (start < now_usec()) {
+                start = now_usec();
             }
+            armTick(tick, config, needTick, start);
+            ticking = needTick;
+            setLocalWakeup(config, platform, boards, !ticking);
+        }
 
-            if (fds[i].revents & POLLIN) {
-                while (1) {
-                    ret = recv(fds[i].fd, buffer[i] + bufferIndex[i], sizeof(StewartMessage), MSG_DONTWAIT);
-                    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                        break;
+        /* Scrapes being formatted carry on next pass without waiting */
+        int resCount = epoll_wait(epfd, events, MAX_EVENTS, scraping ? 0 : -1);
+        if (resCount == -1 && errno == EINTR) {
+            continue;
+        }
+        if (resCount == -1) {
+            fprintf(stderr, "Error: Poll returned an error: %s\n", strerror(errno));
+            goto terminate;
+        }
+
+        for (i = 0; i < resCount; i++) {
+            uint32_t flags = events[i].events;
+            Connection *connection;
+            uint64_t expirations;
+
+            switch (EVENT_TYPE(events[i].data.u64)) {
+                case EVENT_LISTEN:
+                    if (acceptConnections(pool, epfd, sock, 0)) {
+                        goto terminate;
                     }
+                    break;
 
-                    if (ret == 0) {
-                        fprintf(stdout, "Socket disconnected.\n");
-                        close(fds[i].fd);
-                        fds[i].fd = -1;
-                        fds[i].events = fds[i].revents = 0;
-                        bufferIndex[i] = 0;
-                        /* If an array collapse isn't already occurring, start collapsing
-                         * to replace this now unused slot */
-                        if (!collapseTo) {
-                            collapseTo = i;
-                        }
+                case EVENT_WEBSOCKET_LISTEN:
+                    if (acceptConnections(pool, epfd, ws, 1)) {
+                        goto terminate;
+                    }
+                    break;
+
+                case EVENT_TICK:
+                    expired = 0;
+                    while (read(tick, &expirations, sizeof(expirations)) > 0) {
+                        expired += expirations;
+                    }
+                    if (expired) {
+                        observeTick(tickPeriod, expired, now_usec());
+                    }
+                    for (j = 0; j < localCount; j++) {
+                        drainLocal(config, platform, boards, locals[j]);
+                    }
+                    takeScheduled(now_usec(), tickPeriod);
+                    /* Only the newest of the poses since the last tick is
+                     * solved and committed */
+                    if (posePending) {
+                        applyPose(config, platform, boards);
+                    } else if (dithering && now_usec() - lastTick >= tickPeriod / 2) {
+                        /* A pose may have just committed a frame; allow for
+                         * timer jitter but not a double frame */
+                        lastTick = now_usec();
+                        commitFrame(boards);
+                    }
+                    if (ipcRegion) {
+                        publishIPC(now_usec());
+                    }
+                    if (multicast != -1) {
+                        publishMulticast(config, platform, now_usec());
+                    }
+                    publishStatus(config, platform, now_usec());
+                    break;
+
+                case EVENT_METRICS_LISTEN:
+                    acceptScrapes(epfd, metricsSock);
+                    break;
+
+                case EVENT_HANDOFF_LISTEN:
+                    listeners[HANDOFF_LISTEN_TCP] = sock;
+                    listeners[HANDOFF_LISTEN_UDP] = udp;
+                    listeners[HANDOFF_LISTEN_WEBSOCKET] = ws;
+                    listeners[HANDOFF_LISTEN_METRICS] = metricsSock;
+                    listeners[HANDOFF_LISTEN_LOCAL] = local;
+                    listeners[HANDOFF_LISTEN_HANDOFF] = handoffSock;
+                    listeners[HANDOFF_LISTEN_OSC] = adapterSocks[ADAPTER_OSC];
+                    listeners[HANDOFF_LISTEN_TELEMETRY] = adapterSocks[ADAPTER_TELEMETRY];
+                    /* The rest of this batch of events is the new
+                     * server's to handle */
+                    if (handOff(handoffSock, listeners, config, boards)) {
+                        handedOff = 1;
+                        err = 0;
+                        goto terminate;
+                    }
+                    break;
+
+                case EVENT_METRICS:
+                    scrape = &scrapes[EVENT_ID(events[i].data.u64)];
+                    if (scrape->fd != -1 && serveScrape(scrape)) {
+                        closeScrape(scrape);
+                    }
+                    break;
+
+                case EVENT_SETPOINT:
+                    readSetpoints(config, platform, boards, udp);
+                    break;
+
+                case EVENT_ADAPTER:
+                    j = EVENT_ID(events[i].data.u64);
+                    readAdapter(config, platform, boards, adapterSocks[j], adapters[j]);
+                    break;
+
+                case EVENT_LOCAL_LISTEN:
+                    acceptLocal(pool, epfd, local);
+                    break;
+
+                case EVENT_LOCAL:
+                    connection = connection_pool_get(pool, EVENT_ID(events[i].data.u64));
+                    if (!connection || connection->wake == -1) {
                         break;
                     }
+                    while (read(connection->wake, &expirations, sizeof(expirations)) > 0) {
+                    }
+                    drainLocal(config, platform, boards, connection);
+                    break;
 
-                    if (!quiet) {
-                        fprintf(stdout, "%d bytes received. Waiting for at least %ld\n", ret, sizeof(StewartMessage));
+                case EVENT_CLIENT:
+                    connection = connection_pool_get(pool, EVENT_ID(events[i].data.u64));
+                    if (!connection || connection->fd == -1) {
+                        /* Closed earlier in this batch */
+                        break;
                     }
 
-                    bufferIndex[i] += ret;
-                    if (bufferIndex[i] >= sizeof(StewartMessage)) {
-                        if (!quiet) {
-                            fprintf(stdout, "Message received with %d bytes (%zu remaining.)\n",
-                                   bufferIndex[i], bufferIndex[i] - sizeof(StewartMessage));
+                    if (flags & EPOLLIN) {
+                        if (readConnection(config, platform, boards, connection)) {
+                            closeConnection(pool, connection, "disconnected");
+                            break;
                         }
-                        bufferIndex[i] -= sizeof(StewartMessage);
-                        processMessage(config, platform, pca, i, (StewartMessage *)buffer[i]);
-                        memcpy(buffer[i], &buffer[i][sizeof(StewartMessage)], bufferIndex[i]);
                     }
-                }
-            }
 
-            if (fds[i].revents & POLLOUT) {
-                if (!quiet) {
-                    fprintf(stdout, "Data OUT ready %d\n", fds[i].fd);
-                }
-                if (pending[i].type != STEWART_MESSAGE_INVALID) {
-                    ret = send(fds[i].fd, &pending[i], sizeof(pending[i]), MSG_DONTWAIT);
-                    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    /* Replies are sent right away; EPOLLOUT only matters when
+                     * the socket was full last time */
+                    if (connection->output_length &&
+                        connection_flush(connection) == -1) {
+                        closeConnection(pool, connection, "send failed");
                         break;
                     }
-                    if (ret != sizeof(pending[i])) {
-                        /* If this gets triggered, then we need to start tracking how many
-                         * bytes of the packet *were* sent and continue sending the data
-                         * message until the entire frame is sent. This shouldn't trigger
-                         * so long as the payload is less than a TCP packet size */
-                        fprintf(stderr, "Error: Sending did not transmit entire block!\n");
-                        goto terminate;
+
+                    if (connection->history && pumpHistory(connection)) {
+                        closeConnection(pool, connection, "send failed");
+                        break;
+                    }
+
+                    /* A subscriber that fell behind gets the newest status
+                     * as soon as it has caught up */
+                    if (connection->status_pending && !connection->output_length) {
+                        StewartStatus status;
+                        getStatus(config, platform, &status);
+                        if (sendStatus(connection, &status)) {
+                            closeConnection(pool, connection, "send failed");
+                            break;
+                        }
                     }
-                }
-                fds[i].events &= ~POLLOUT;
-            }
-
-            if (fds[i].revents & (POLLHUP | POLLNVAL | POLLERR)) {
-                fprintf(stdout, "Socket error and disconnect.\n");
-                close(fds[i].fd);
-                fds[i].fd = -1;
-                fds[i].events = fds[i].revents = 0;
-                bufferIndex[i] = 0;
-                /* If an array collapse isn't already occurring, start collapsing
-                 * to replace this now unused slot */
-                if (!collapseTo) {
-                    collapseTo = i;
-                }
-            }
 
-            if (collapseTo && fds[i].fd != -1) {
-                /* If a collapse is occurring, copy the current fd into the
-                 * collapse target, and advance the target */
-                fds[collapseTo++] = fds[i];
+                    if (flags & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+                        closeConnection(pool, connection, "error and disconnect");
+                    }
+                    break;
             }
         }
 
-        /* The array was being collapsed and all events were processed, so complete
-         * collapsing the array */
-        while (i < maxIndex && collapseTo != 0) {
-            memcpy(buffer[collapseTo], buffer[i], bufferIndex[i]);
-            fds[collapseTo++] = fds[i];
-            i++;
+        for (j = 0; scraping && j < SCRAPES_MAX; j++) {
+            scrape = &scrapes[j];
+            if (scrape->fd == -1 || scrape->state != SCRAPE_FORMAT || !formatClients(scrape)) {
+                continue;
+            }
+            scraping--;
+            scrape->state = SCRAPE_SEND;
+            if (serveScrape(scrape)) {
+                closeScrape(scrape);
+            }
         }
 
-        if (collapseTo) {
-            maxIndex = collapseTo;
-        }
+        connection_pool_reap(pool);
     }
 
     err = 0;
 
 terminate:
+    for (i = 0; i < SCRAPES_MAX; i++) {
+        if (scrapes[i].fd != -1) {
+            close(scrapes[i].fd);
+        }
+        metrics_buffer_free(&scrapes[i].response);
+    }
+
+    if (metricsSock != -1) {
+        close(metricsSock);
+    }
+
+    if (handoff != -1) {
+        close(handoff);
+    }
+
+    /* The socket file is the new server's once handed off */
+    if (handoffSock != -1) {
+        close(handoffSock);
+        if (!handedOff) {
+            unlink(handoffPath);
+        }
+    }
+
+    if (pool) {
+        connection_pool_delete(pool);
+    }
+
+    if (spareFd != -1) {
+        close(spareFd);
+    }
+
+    if (tick != -1) {
+        close(tick);
+    }
+
+    if (epfd != -1) {
+        close(epfd);
+    }
+
+    if (ws != -1) {
+        close(ws);
+    }
+
+    if (multicast != -1) {
+        close(multicast);
+    }
+
+    if (udp != -1) {
+        close(udp);
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (adapterSocks[i] != -1) {
+            close(adapterSocks[i]);
+        }
+        if (adapters[i]) {
+            adapter_delete(adapters[i]);
+        }
+    }
+
+    if (local != -1) {
+        close(local);
+        if (!handedOff) {
+            unlink(localPath);
+        }
+    }
+
+    if (setpoints) {
+        setpoint_sources_delete(setpoints);
+    }
+
+    if (ipcRegion) {
+        stewart_ipc_destroy(ipcRegion, handedOff ? NULL : STEWART_IPC_NAME);
+    }
+
     if (sock != -1) {
         close(sock);
     }
@@ -592,8 +3442,21 @@ terminate:
         stewart_platform_delete(platform);
     }
 
-    if (pca) {
-        pca9685_close(pca);
+    if (servoTable) {
+        servo_table_delete(servoTable);
+    }
+
+    if (history) {
+        history_delete(history);
+    }
+
+    if (flight) {
+        flight_delete(flight);
+        flight = NULL;
+    }
+
+    if (boards) {
+        pca9685_group_close(boards);
     }
 
     return err;
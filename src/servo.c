@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "stewart.h"
+
+#define SERVO_TABLE_SIZE \
+    ((SERVO_MAX_ANGLE - SERVO_MIN_ANGLE) * SERVO_TABLE_STEPS_PER_DEG + 1)
+
+struct _ServoTable {
+    float frequency;                         /* Effective PWM frequency */
+    uint32_t counts[6][SERVO_TABLE_SIZE];    /* Fixed point (SERVO_COUNT_SHIFT) */
+};
+
+ServoTable *servo_table_create(const StewartConfig *config) {
+    ServoTable *table;
+    double counts_per_us;
+    int prescale;
+    int i, j;
+
+    prescale = pca9685_compute_prescale(config->oscillator, config->pulse_frequency);
+    if (prescale <= 0) {
+        fprintf(stderr, "Invalid PWM frequency for servo table: %dHz\n",
+                config->pulse_frequency);
+        return NULL;
+    }
+
+    table = (ServoTable *)malloc(sizeof(*table));
+    if (!table) {
+        return NULL;
+    }
+    memset(table, 0, sizeof(*table));
+
+    /* One count is one 4096th of the period the PCA9685 actually generates,
+     * which is determined by the real oscillator and the quantized PRE_SCALE
+     * rather than the frequency that was asked for */
+    table->frequency = pca9685_compute_frequency(config->oscillator,
+                                                 config->pulse_frequency);
+    counts_per_us = (double)config->oscillator / (1000000.0 * (prescale + 1));
+
+    for (i = 0; i < 6; i++) {
+        double us_per_deg = (config->pulse_max[i] - config->pulse_min[i]) /
+            (double)(SERVO_MAX_ANGLE - SERVO_MIN_ANGLE);
+
+        for (j = 0; j < SERVO_TABLE_SIZE; j++) {
+            double angle = (double)j / SERVO_TABLE_STEPS_PER_DEG;
+            double count = (config->pulse_min[i] + angle * us_per_deg) * counts_per_us;
+
+            if (count > PCA9685_COUNTS - 1) {
+                count = PCA9685_COUNTS - 1;
+            }
+            table->counts[i][j] = count * SERVO_COUNT_ONE + 0.5;
+        }
+    }
+
+    if (config->debug) {
+        fprintf(stdout, "Servo tables: %.02fHz effective, %.03f counts/us, "
+                "%.03fdeg/count\n", table->frequency, counts_per_us,
+                SERVO_COUNT_ONE / (double)SERVO_TABLE_STEPS_PER_DEG /
+                (table->counts[0][1] - table->counts[0][0]));
+    }
+
+    return table;
+}
+
+void servo_table_delete(ServoTable *table) {
+    free(table);
+}
+
+/* Returns the count, in SERVO_COUNT_SHIFT fixed point, for the servo to be
+ * at 'angle' degrees. Angles outside the servo's travel are clamped. */
+unsigned int servo_table_lookup(const ServoTable *table, int servo, float angle) {
+    const uint32_t *counts = table->counts[servo];
+    float pos = (angle - SERVO_MIN_ANGLE) * SERVO_TABLE_STEPS_PER_DEG;
+    int index;
+
+    if (pos <= 0) {
+        return counts[0];
+    }
+    if (pos >= SERVO_TABLE_SIZE - 1) {
+        return counts[SERVO_TABLE_SIZE - 1];
+    }
+
+    index = (int)pos;
+    return counts[index] +
+        (int32_t)((pos - index) * (int32_t)(counts[index + 1] - counts[index]));
+}
+
+float servo_table_get_frequency(const ServoTable *table) {
+    return table->frequency;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __servo_h__
+#define __servo_h__
+
+#include "pca9685.h"
+#include "stewart.h"
+
+/***************************************************************************
+ *
+ * Per servo angle to PCA9685 count lookup tables.
+ *
+ * Each table is built once from the calibrated oscillator, the PWM
+ * frequency and the servo's pulse end points. Converting a solved angle
+ * to an output count is then a table lookup with linear interpolation
+ * instead of a floating point pulse width calculation followed by a
+ * truncating integer conversion in the PCA9685 driver.
+ *
+ * Counts are returned in fixed point with SERVO_COUNT_SHIFT fractional
+ * bits so callers can keep the sub-count resolution, eg. by dithering
+ * with pca9685_stage_channel_fine.
+ *
+ ***************************************************************************/
+
+#define SERVO_COUNT_SHIFT        PCA9685_FRACTION_BITS
+#define SERVO_COUNT_ONE          (1 << SERVO_COUNT_SHIFT)
+#define SERVO_COUNT_ROUND(__q)   (((__q) + SERVO_COUNT_ONE / 2) >> SERVO_COUNT_SHIFT)
+
+#define SERVO_TABLE_STEPS_PER_DEG 2 /* Table entries per degree of travel */
+
+typedef struct _ServoTable ServoTable;
+
+ServoTable *servo_table_create(const StewartConfig *config);
+void servo_table_delete(ServoTable *table);
+unsigned int servo_table_lookup(const ServoTable *table, int servo, float angle);
+float servo_table_get_frequency(const ServoTable *table);
+
+#endif
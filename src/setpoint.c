@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "setpoint.h"
+
+struct _SetpointSources {
+    SetpointSource sources[SETPOINT_SOURCES_MAX];
+    int count;
+};
+
+SetpointSource *_setpoint_find(SetpointSources *sources, const struct sockaddr_in *peer);
+void _setpoint_reset(SetpointSource *source, uint32_t sequence);
+
+SetpointSources *setpoint_sources_create(void) {
+    return calloc(1, sizeof(SetpointSources));
+}
+
+void setpoint_sources_delete(SetpointSources *sources) {
+    free(sources);
+}
+
+int setpoint_sources_get_count(SetpointSources *sources) {
+    return sources->count;
+}
+
+const SetpointSource *setpoint_sources_get(SetpointSources *sources, int index) {
+    if (index < 0 || index >= sources->count) {
+        return NULL;
+    }
+    return &sources->sources[index];
+}
+
+void _setpoint_reset(SetpointSource *source, uint32_t sequence) {
+    struct sockaddr_in peer = source->peer;
+
+    memset(source, 0, sizeof(*source));
+    source->peer = peer;
+    source->base = sequence;
+    source->highest = sequence - 1;
+    source->usec = INT64_MIN;
+}
+
+/* Find the sender's entry, or take over a free or the least recently heard
+ * from entry. The table is small and only searched once per datagram. */
+SetpointSource *_setpoint_find(SetpointSources *sources, const struct sockaddr_in *peer) {
+    SetpointSource *oldest = NULL;
+    int i;
+
+    for (i = 0; i < sources->count; i++) {
+        SetpointSource *source = &sources->sources[i];
+        if (source->peer.sin_addr.s_addr == peer->sin_addr.s_addr &&
+            source->peer.sin_port == peer->sin_port) {
+            return source;
+        }
+        if (!oldest || source->last_seen < oldest->last_seen) {
+            oldest = source;
+        }
+    }
+
+    if (sources->count < SETPOINT_SOURCES_MAX) {
+        oldest = &sources->sources[sources->count++];
+    }
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->peer = *peer;
+
+    return oldest;
+}
+
+/* Decide whether a setpoint datagram is the newest from its sender. Sequence
+ * numbers are compared modulo 2^32; a sender that was quiet for longer than
+ * SETPOINT_SOURCE_TIMEOUT starts over so a restarted client isn't ignored. */
+int setpoint_check(SetpointSources *sources, const struct sockaddr_in *peer,
+                   uint32_t sequence, int64_t usec, long long now) {
+    SetpointSource *source = _setpoint_find(sources, peer);
+    int32_t delta;
+
+    if (source->received == 0 || now - source->last_seen > SETPOINT_SOURCE_TIMEOUT) {
+        _setpoint_reset(source, sequence);
+    }
+    source->last_seen = now;
+    source->received++;
+
+    delta = (int32_t)(sequence - source->highest);
+    if (delta <= 0) {
+        /* Late or duplicate. A late datagram still counts towards loss
+         * accounting, but the pose it carries has been superseded. */
+        if (-delta >= 64) {
+            source->unique++;
+        } else if (!(source->window & (1ULL << -delta))) {
+            source->window |= 1ULL << -delta;
+            source->unique++;
+        }
+        source->reordered++;
+        return SETPOINT_REORDERED;
+    }
+
+    source->window = delta >= 64 ? 1 : (source->window << delta) | 1;
+    source->highest = sequence;
+    source->unique++;
+
+    if (usec <= source->usec) {
+        source->stale++;
+        return SETPOINT_STALE;
+    }
+
+    source->usec = usec;
+    source->accepted++;
+
+    return SETPOINT_ACCEPT;
+}
+
+/* Datagrams that never arrived: sequence numbers up to the newest that were
+ * not received at all. Late arrivals count as received. */
+unsigned long setpoint_source_get_lost(const SetpointSource *source) {
+    unsigned long expected;
+
+    if (source->received == 0) {
+        return 0;
+    }
+    expected = (uint32_t)(source->highest - source->base) + 1;
+
+    return expected > source->unique ? expected - source->unique : 0;
+}
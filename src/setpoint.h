@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __setpoint_h__
+#define __setpoint_h__
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#define SETPOINT_SOURCES_MAX     64
+#define SETPOINT_SOURCE_TIMEOUT  2000000 /* us without datagrams before a
+                                          * source is treated as restarted */
+
+#define SETPOINT_ACCEPT    0
+#define SETPOINT_REORDERED 1 /* Sequence number at or behind the newest */
+#define SETPOINT_STALE     2 /* Newer sequence but not a newer timestamp */
+
+/* Sequence tracking for one sender of UDP setpoints */
+typedef struct {
+    struct sockaddr_in peer;
+    uint32_t base;            /* First sequence number seen */
+    uint32_t highest;         /* Newest sequence number seen */
+    uint64_t window;          /* Bit n set: highest - n has arrived */
+    int64_t usec;             /* Sender timestamp of the newest accepted */
+    long long last_seen;      /* now_usec() of the last datagram */
+    unsigned long received;   /* Every datagram, including dropped ones */
+    unsigned long unique;     /* Distinct sequence numbers received */
+    unsigned long accepted;
+    unsigned long reordered;
+    unsigned long stale;
+} SetpointSource;
+
+typedef struct _SetpointSources SetpointSources;
+
+SetpointSources *setpoint_sources_create(void);
+void setpoint_sources_delete(SetpointSources *sources);
+int setpoint_sources_get_count(SetpointSources *sources);
+const SetpointSource *setpoint_sources_get(SetpointSources *sources, int index);
+
+int setpoint_check(SetpointSources *sources, const struct sockaddr_in *peer,
+                   uint32_t sequence, int64_t usec, long long now);
+unsigned long setpoint_source_get_lost(const SetpointSource *source);
+
+#endif
@@ -30,16 +30,31 @@
 #include "stewart-pubsub.h"
 #include "config.h"
 #include "delay.h"
+#include "ipc.h"
+#include "client.h"
 
 void usage(int ret) {
     fprintf(stderr,
-            "usage: status -h HOST:PORT [POLL-RATE]\n"
+            "usage: status -h HOST:PORT [RATE]\n"
+            "       status -h HOST:PORT -y SECONDS\n"
+            "       status -m GROUP:PORT [-i ADDRESS]\n"
             "\n"
-            "POLL-RATE     Times per second to ask for status. Max 50.\n"
-            "              If not specified, status runs a one-shot, exiting\n"
-            "              after fetching one status message.\n"
+            "RATE          Status updates per second. The server pushes them\n"
+            "              on its control tick, so rates above the tick rate\n"
+            "              get one update per tick. If not specified, status\n"
+            "              runs a one-shot, exiting after fetching one status\n"
+            "              message.\n"
             "-q            Quiet. Suppress non-status output.\n"
             "-h HOST:PORT  Connect to Stewart platform on HOST:PORT\n"
+            "-y SECONDS    Print the poses the server applied over the last\n"
+            "              SECONDS from its history (server -R): time, servo\n"
+            "              angles and PWM counts\n"
+            "-I            Read the status from shared memory of a server on\n"
+            "              this machine (server -I) instead of connecting\n"
+            "-m GROUP:PORT Listen to the status a server multicasts every\n"
+            "              control tick (server -m) instead of connecting\n"
+            "-i ADDRESS    Join the multicast group on the interface with\n"
+            "              ADDRESS (default: chosen by the routing table)\n"
             "\n\n");
     exit(ret);
 }
@@ -54,15 +69,177 @@ void version() {
     exit(0);
 }
 
+/* Local servers export their status in shared memory; reading it takes no
+ * round trip and no syscalls */
+int readShared(long rate) {
+    const StewartIPCRegion *region;
+    StewartIPC status;
+    int i, ret;
+
+    region = stewart_ipc_open(STEWART_IPC_NAME);
+    if (!region) {
+        return -1;
+    }
+
+    do {
+        ret = stewart_ipc_read(region, &status);
+        if (ret == -2) {
+            fprintf(stderr, "Error: The server died while publishing its status\n");
+            stewart_ipc_close(region);
+            return -1;
+        }
+        if (ret >= 0) {
+            fprintf(stdout, "%lld.%06lld:", (long long)status.ts_sec, (long long)status.ts_usec);
+            for (i = 0; i < 6; i++) {
+                fprintf(stdout, " %+6.02f", status.servos[i].angle / 1000.0);
+            }
+            fprintf(stdout, "\n");
+            fflush(stdout);
+        }
+        if (rate != -1) {
+            delay(1000000 / rate);
+        }
+    } while (rate != -1);
+
+    stewart_ipc_close(region);
+
+    return 0;
+}
+
+/* Observe the multicast status. Nothing is sent to the server, so it
+ * doesn't know or care how many observers there are. */
+int readMulticast(const char *group, int port, const char *iface, int quiet) {
+    struct sockaddr_in sin = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY)
+    };
+    struct ip_mreq mreq;
+    StewartStatusDatagram datagram;
+    unsigned long received = 0, lost = 0;
+    uint32_t expected = 0;
+    int enable = 1;
+    int sock, i;
+
+    memset(&mreq, 0, sizeof(mreq));
+    if (!inet_aton(group, &mreq.imr_multiaddr) ||
+        (iface && !inet_aton(iface, &mreq.imr_interface))) {
+        fprintf(stderr, "Error: Invalid multicast group or interface address\n");
+        return -1;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == -1) {
+        fprintf(stderr, "Error: Unable to open socket: %s\n", strerror(errno));
+        return -1;
+    }
+    /* Several observers on one machine each get every datagram */
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+        fprintf(stderr, "Error: Unable to join %s:%d: %s\n", group, port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    if (!quiet) {
+        fprintf(stdout, "Listening to %s:%d\n", group, port);
+    }
+
+    while (1) {
+        ssize_t ret = recv(sock, &datagram, sizeof(datagram), 0);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            fprintf(stderr, "Error: Unable to receive status: %s\n", strerror(errno));
+            break;
+        }
+        if (ret != sizeof(datagram)) {
+            continue;
+        }
+
+        /* Datagrams from before a gap that turn up late are just old */
+        if (received && (int32_t)(datagram.sequence - expected) < 0) {
+            continue;
+        }
+        if (received && datagram.sequence != expected) {
+            lost += datagram.sequence - expected;
+            if (!quiet) {
+                fprintf(stderr, "Lost %u status datagrams (%lu of %lu)\n",
+                        datagram.sequence - expected, lost, lost + received);
+            }
+        }
+        expected = datagram.sequence + 1;
+        received++;
+
+        fprintf(stdout, "%lld.%06lld:", (long long)datagram.status.sec,
+                (long long)datagram.status.usec);
+        for (i = 0; i < 6; i++) {
+            fprintf(stdout, " %+6.02f", datagram.status.servos[i].angle);
+        }
+        fprintf(stdout, "\n");
+        fflush(stdout);
+    }
+
+    close(sock);
+
+    return -1;
+}
+
+void printStatus(StewartClient *client, const StewartStatus *status, uint16_t id, void *data) {
+    int i;
+
+    fprintf(stdout, "%lld.%06lld:", (long long)status->sec, (long long)status->usec);
+    for (i = 0; i < 6; i++) {
+        fprintf(stdout, " %+6.02f", status->servos[i].angle);
+    }
+    fprintf(stdout, "\n");
+    fflush(stdout);
+
+    /* Only the one-shot request passes a flag to stop on */
+    if (data) {
+        *(int *)data = 1;
+    }
+}
+
+void printHistory(StewartClient *client, const HistoryEntry *entries, int count, int last,
+                  void *data) {
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        fprintf(stdout, "%lld.%06lld:", (long long)entries[i].usec / 1000000,
+                (long long)entries[i].usec % 1000000);
+        for (j = 0; j < 6; j++) {
+            fprintf(stdout, " %+6.02f", entries[i].angles[j]);
+        }
+        fprintf(stdout, " |");
+        for (j = 0; j < 6; j++) {
+            fprintf(stdout, " %7.02f", entries[i].counts[j] / (float)(1 << PCA9685_FRACTION_BITS));
+        }
+        fprintf(stdout, "\n");
+    }
+    fflush(stdout);
+
+    if (last) {
+        *(int *)data = 1;
+    }
+}
+
 int main(int argc, char *argv[]) {
     StewartConfig config;
     int err = 0;
     int port;
     char *host = NULL;
     long rate = -1;
+    double span = 0;
     int quiet = 0;
     int i;
-    int sock = -1;
+    StewartClient *client = NULL;
+    int done = 0;
+    int ipc = 0;
+    char *group = NULL, *iface = NULL;
+    int groupPort = 0;
 
     /* Parse command line arguments... */
     for (i = 1; i < argc; i++) {
@@ -72,6 +249,37 @@ int main(int argc, char *argv[]) {
                     quiet = 1;
                     break;
 
+                case 'I':
+                    ipc = 1;
+                    break;
+
+                case 'y':
+                    i++;
+                    if (i == argc || (span = strtod(argv[i], NULL)) <= 0) {
+                        fprintf(stderr, "-y SECONDS must be specified\n");
+                        usage(-1);
+                    }
+                    break;
+
+                case 'm':
+                    i++;
+                    if (i == argc || !strchr(argv[i], ':')) {
+                        fprintf(stderr, "-m GROUP:PORT must be specified\n");
+                        usage(-1);
+                    }
+                    group = argv[i];
+                    *strchr(group, ':') = '\0';
+                    groupPort = strtol(group + strlen(group) + 1, NULL, 0);
+                    break;
+
+                case 'i':
+                    i++;
+                    if (i == argc) {
+                        usage(-1);
+                    }
+                    iface = argv[i];
+                    break;
+
                 case '?':
                     usage(0);
                     break;
@@ -107,18 +315,24 @@ int main(int argc, char *argv[]) {
 
         if (rate == -1) {
             rate = strtol(argv[i], NULL, 0);
-            if (rate <= 0 || rate > 50) {
-                fprintf(stderr, "POLL-RATE must be in the range of 0-50\n");
+            if (rate <= 0 || rate > CONTROL_TICK_RATE_MAX) {
+                fprintf(stderr, "RATE must be in the range of 1-%d\n", CONTROL_TICK_RATE_MAX);
                 usage(-1);
             }
-
-            rate = 1000 / rate;
         } else {
             fprintf(stderr, "Invalid argument %d: %s\n", i, argv[i]);
             usage(-1);
         }
     }
 
+    if (ipc) {
+        return readShared(rate);
+    }
+
+    if (group) {
+        return readMulticast(group, groupPort, iface, quiet);
+    }
+
     if (host == NULL) {
         fprintf(stderr, "-h HOST:PORT must be specified\n");
         usage(-1);
@@ -128,106 +342,52 @@ int main(int argc, char *argv[]) {
      * documented at https://01.org/developerjourney/recipe/stewert-platform */
     config_get(&config);
 
-    long then, now;
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    then = now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-
-    struct addrinfo hint = {
-        .ai_family = AF_INET,
-        .ai_socktype = SOCK_STREAM,
-        .ai_protocol = IPPROTO_TCP
-    };
-
-    struct addrinfo *res;
-    if (!quiet) {
-        fprintf(stdout, "Looking up %s...", host);
-        fflush(stdout);
-    }
-    if (getaddrinfo(host, NULL, &hint, &res) == -1 || res == NULL) {
-        if (!quiet) {
-            fprintf(stdout, "\n");
-        }
-        fprintf(stderr, "Error: Unable to get host address for %s: %s\n", host, strerror(errno));
-        goto terminate;
-    }
-
-    if (!quiet) {
-        fprintf(stdout, "%s\n", inet_ntoa(((struct sockaddr_in *)res->ai_addr)->sin_addr));
-    }
-
-    sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (sock == -1) {
-        fprintf(stderr, "Error: Unable to open socket: %s\n", strerror(errno));
-        goto terminate;
-    }
-    ((struct sockaddr_in *)res->ai_addr)->sin_port = htons(port);
-
-    freeaddrinfo(res);
-
     if (!quiet) {
         fprintf(stdout, "Connecting to %s:%d...", host, port);
         fflush(stdout);
     }
 
-    if (connect(sock, res->ai_addr, res->ai_addrlen) == -1) {
+    client = stewart_client_create(host, port);
+    if (!client || stewart_client_flush(client, 5000)) {
         if (!quiet) {
             fprintf(stdout, "\n");
         }
-        fprintf(stderr, "Error: Unable to connect socket: %s\n", strerror(errno));
+        fprintf(stderr, "Error: Unable to connect to %s:%d\n", host, port);
+        err = 1;
         goto terminate;
     }
 
     if (!quiet) {
         fprintf(stdout, "done\n");
+        fprintf(stdout, "Sending %s\n", span ? "STEWART_MESSAGE_HISTORY" :
+                rate == -1 ? "STEWART_MESSAGE_GET_STATUS" : "STEWART_MESSAGE_SUBSCRIBE");
     }
 
-    do {
-        /* Only output to the PWM once per cycle */
-        gettimeofday(&tv, NULL);
-        now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-        if (now - then < rate) {
-            delay(1000 * (rate - (now - then)));
-        }
-        then = now;
-
-        StewartMessage message = {
-            .type = STEWART_MESSAGE_GET_STATUS
-        };
-
-        if (!quiet) {
-            fprintf(stdout, "Sending STEWART_MESSAGE_GET_STATUS\n");
-        }
-
-        if (send(sock, &message, sizeof(message), MSG_WAITALL) == -1) {
-            fprintf(stderr, "Error: Unable to send message to Stewart platform\n%s\n",
-                    strerror(errno));
-            goto terminate;
-        }
-
-        if (recv(sock, &message, sizeof(message), MSG_WAITALL) == -1) {
-            fprintf(stderr, "Error: Unable to receive message from Stewart platform:\n%s\n",
-                    strerror(errno));
-            goto terminate;
-        }
-
-        if (message.type != STEWART_MESSAGE_STATUS) {
-            fprintf(stderr, "Error: Invalid message type received: %d\n", message.type);
-            continue;
-        }
+    /* One-shot asks once; with a RATE the server pushes updates until the
+     * connection is closed */
+    if (span) {
+        err = stewart_client_request_history(client, -(long long)(span * 1000000), 0,
+                                             printHistory, &done) < 0;
+    } else if (rate == -1) {
+        err = stewart_client_request_status(client, printStatus, &done) < 0;
+    } else {
+        err = stewart_client_subscribe(client, rate, STEWART_FIELD_ALL, printStatus, NULL);
+    }
+    if (err) {
+        fprintf(stderr, "Error: Unable to send message to Stewart platform\n");
+        goto terminate;
+    }
 
-        if (!quiet) {
-            fprintf(stdout, "Received STEWART_MESSAGE_GET_STATUS\n");
+    while (!done) {
+        if (stewart_client_wait(client, -1)) {
+            err = 1;
+            break;
         }
-
-        fprintf(stdout, "Axis-Angle: <%+.02f, %+.02f, %+.02f>, Angle: %+.02fdeg\n",
-                message.axisAngle.x, message.axisAngle.y, message.axisAngle.z,
-                message.axisAngle.angle);
-    } while (rate != -1);
+    }
 
 terminate:
-    if (sock != -1) {
-        close(sock);
+    if (client) {
+        stewart_client_delete(client);
     }
 
     return err;
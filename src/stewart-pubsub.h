@@ -13,6 +13,7 @@
 #include <pthread.h>
 
 #define STEWART_PROTOCOL          1
+#define STEWART_PROTOCOL_V2       2  /* Framed; see StewartFrameHeader */
 
 #define STEWART_STATUS_STATIONARY 0
 #define STEWART_STATUS_MOVING     1
@@ -79,8 +80,24 @@ typedef enum {
     STEWART_MESSAGE_STATUS = 3,
     STEWART_MESSAGE_SET_TRIM = 4,
     STEWART_MESSAGE_SET_EUCLIDEAN = 5,
+    STEWART_MESSAGE_SUBSCRIBE = 6,
+    STEWART_MESSAGE_HELLO = 7,
+    STEWART_MESSAGE_CLOCK = 8,
+    STEWART_MESSAGE_SCHEDULE = 9,
+    STEWART_MESSAGE_HISTORY = 10,
+    STEWART_MESSAGE_HISTORY_DATA = 11, /* v2 only; see PROTOCOL */
+    STEWART_MESSAGE_SET_COUNTS = 12,
 } MessageType;
 
+/* StewartStatus fields selected by STEWART_MESSAGE_SUBSCRIBE; fields not
+ * selected are sent as zero */
+#define STEWART_FIELD_TIME      (1 << 0)  /* sec, usec */
+#define STEWART_FIELD_SERVOS    (1 << 1)  /* servos[] */
+#define STEWART_FIELD_STATUS    (1 << 2)  /* status */
+#define STEWART_FIELD_ORIGIN    (1 << 3)  /* origin[] */
+#define STEWART_FIELD_ROTATION  (1 << 4)  /* rotation[] */
+#define STEWART_FIELD_ALL       0x1f
+
 typedef struct {
     uint32_t version;
     uint32_t size;
@@ -111,8 +128,124 @@ typedef struct {
             uint32_t servo;
             float angle;
         } __attribute__((packed)) trim;
+        /* Ask for STEWART_MESSAGE_STATUS to be pushed every control tick,
+         * at most rate times a second. A rate of 0 stops the updates. A
+         * client that doesn't keep up only gets the newest status. */
+        struct Subscribe {
+            uint32_t rate;      /* Updates per second */
+            uint32_t fields;    /* STEWART_FIELD_* mask, 0 for all */
+        } __attribute__((packed)) subscribe;
+        /* Version handshake. The server answers with the range it speaks,
+         * its largest accepted frame and its control tick rate. */
+        struct Hello {
+            uint8_t min_version;
+            uint8_t max_version;
+            uint16_t max_frame; /* Bytes, frame header included */
+            uint32_t tick_rate; /* Hz; 0 from a client */
+        } __attribute__((packed)) hello;
+        /* Clock probe. The server answers with its CLOCK_MONOTONIC, from
+         * which a client estimates the offset to its own clock, and how
+         * well the poses it scheduled are keeping to their times. */
+        struct Clock {
+            int64_t usec;       /* Server's monotonic clock; 0 from a client */
+            int32_t early;      /* us the newest scheduled pose arrived before
+                                 * its time; negative if after */
+            int32_t late;       /* us after its time the newest due pose was
+                                 * applied */
+            uint32_t missed;    /* Scheduled poses that arrived too late */
+        } __attribute__((packed)) clock;
+        /* A pose to apply on the first control tick at or after usec on
+         * the server's monotonic clock, so servers fed by one source move
+         * together. Later times queue behind it. */
+        struct Schedule {
+            int64_t usec;
+            uint32_t type;      /* STEWART_MESSAGE_SET_{AXISANGLE,EUCLIDEAN} */
+            union {
+                struct AxisAngle axisAngle;
+                struct Euclidean euclidean;
+            };
+        } __attribute__((packed)) schedule;
+        /* Ask for the poses the server applied between from and to on its
+         * monotonic clock, inclusive; values of 0 or less are relative to
+         * now. The answer is a stream of STEWART_MESSAGE_HISTORY_DATA
+         * records, the last flagged STEWART_RECORD_LAST. */
+        struct HistoryQuery {
+            int64_t from;       /* us */
+            int64_t to;
+        } __attribute__((packed)) history;
+        /* PWM counts worked out ahead of time (see compile), applied as they
+         * are with no solving. Refused unless hash is config_hash_counts()
+         * of the server's own configuration. */
+        struct Counts {
+            uint32_t hash;
+            uint16_t counts[6]; /* 12-bit PCA9685 counts, channel 0 to 5 */
+        } __attribute__((packed)) counts;
         StewartStatus status;
     };
 } __attribute__((packed)) StewartMessage;
 
-#endif
\ No newline at end of file
+/* Pose setpoint datagram for the server's UDP port (server -u). Delivery is
+ * not reliable; the server keeps the newest pose from each source and drops
+ * datagrams that arrive behind it, using the sequence number and the
+ * sender's timestamp. */
+typedef struct {
+    uint32_t sequence;        /* Incremented by one per datagram sent */
+    int64_t usec;             /* Sender's monotonic clock when sent */
+    StewartMessage message;   /* STEWART_MESSAGE_SET_{AXISANGLE,EUCLIDEAN} */
+} __attribute__((packed)) StewartSetpoint;
+
+/* Status datagram the server sends to its multicast group every control
+ * tick (server -m). Observers only listen, so any number of them add no
+ * load; gaps in the sequence number are lost datagrams. */
+typedef struct {
+    uint32_t sequence;        /* Incremented by one per datagram sent */
+    int64_t usec;             /* Server's monotonic clock when sent */
+    StewartStatus status;
+} __attribute__((packed)) StewartStatusDatagram;
+
+/* Protocol v2 (see PROTOCOL). A frame is a header followed by one or more
+ * records, each carrying one message. The first two bytes a v1 client sends
+ * are its version (1), which is never a valid frame length, so the server
+ * tells the two apart from the first message on a connection. */
+#define STEWART_FRAME_MAX         1024  /* Largest frame, header included */
+
+#define STEWART_RECORD_QUANTIZED  (1 << 0)  /* Pose as StewartQuantized* */
+#define STEWART_RECORD_LAST       (1 << 1)  /* Ends a reply sent as several
+                                             * records */
+
+typedef struct {
+    uint16_t length;          /* Frame bytes, header included */
+    uint8_t version;          /* STEWART_PROTOCOL_V2 */
+    uint8_t records;          /* Records that follow */
+} __attribute__((packed)) StewartFrameHeader;
+
+typedef struct {
+    uint16_t length;          /* Record bytes, header included */
+    uint8_t type;             /* MessageType */
+    uint8_t flags;            /* STEWART_RECORD_* */
+    uint16_t id;              /* Chosen by the client; echoed in replies.
+                               * 0 on status pushed to a subscriber */
+} __attribute__((packed)) StewartRecordHeader;
+
+/* int16 pose encodings: axis components in 1/10000ths, angles in 1/100ths
+ * of a degree and translation in 1/1000ths of an inch */
+#define STEWART_QUANTIZE_AXIS      10000.0f
+#define STEWART_QUANTIZE_ANGLE     100.0f
+#define STEWART_QUANTIZE_TRANSLATE 1000.0f
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    int16_t angle;
+    int16_t translate[3];
+} __attribute__((packed)) StewartQuantizedAxisAngle;
+
+typedef struct {
+    int16_t yaw;
+    int16_t pitch;
+    int16_t roll;
+    int16_t translate[3];
+} __attribute__((packed)) StewartQuantizedEuclidean;
+
+#endif
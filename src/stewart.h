@@ -46,6 +46,17 @@ typedef struct {
     float theta_effector;       /* Angle (THETA) between paired effector attachment
                                  * points on Effector platform in radians */
 
+    int pulse_frequency;        /* PWM refresh rate in Hz sent to the servos */
+    int tick_rate;              /* Control loop rate in Hz. 0 runs the loop
+                                 * at pulse_frequency */
+    int oscillator;             /* Calibrated PWM oscillator frequency in Hz */
+    float pulse_min[6];         /* Pulse width in us at SERVO_MIN_ANGLE */
+    float pulse_max[6];         /* Pulse width in us at SERVO_MAX_ANGLE */
+    int dither;                 /* Set to 1 to dither between PWM counts for
+                                 * sub-count servo resolution */
+    int ipc;                    /* Set to 1 to export status every tick in
+                                 * shared memory (see PROTOCOL) */
+
     int debug;                  /* Set to 1 if you want verbose output while solving
                                  * the inverse kinematics */
 } StewartConfig;
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trajectory.h"
+
+struct _Trajectory {
+    void *data;
+    size_t length;
+};
+
+Trajectory *trajectory_open(const char *path) {
+    const TrajectoryHeader *header;
+    Trajectory *trajectory;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Unable to open '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < sizeof(*header)) {
+        fprintf(stderr, "Error: '%s' is not a compiled trajectory\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    trajectory = calloc(1, sizeof(*trajectory));
+    if (!trajectory) {
+        close(fd);
+        return NULL;
+    }
+    trajectory->length = st.st_size;
+    trajectory->data = mmap(NULL, trajectory->length, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                            fd, 0);
+    close(fd);
+    if (trajectory->data == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map '%s': %s\n", path, strerror(errno));
+        free(trajectory);
+        return NULL;
+    }
+
+    header = trajectory->data;
+    if (memcmp(header->magic, TRAJECTORY_MAGIC, sizeof(header->magic)) ||
+        header->version != TRAJECTORY_VERSION ||
+        trajectory->length != sizeof(*header) + (size_t)header->frames * sizeof(TrajectoryFrame)) {
+        fprintf(stderr, "Error: '%s' is not a compiled trajectory\n", path);
+        trajectory_close(trajectory);
+        return NULL;
+    }
+
+    return trajectory;
+}
+
+void trajectory_close(Trajectory *trajectory) {
+    munmap(trajectory->data, trajectory->length);
+    free(trajectory);
+}
+
+const TrajectoryHeader *trajectory_get_header(Trajectory *trajectory) {
+    return trajectory->data;
+}
+
+const TrajectoryFrame *trajectory_get_frames(Trajectory *trajectory) {
+    return (const TrajectoryFrame *)((const uint8_t *)trajectory->data + sizeof(TrajectoryHeader));
+}
+
+/* Write header and header->frames frames to path, replacing it only once
+ * the whole file is written */
+int trajectory_write(const char *path, const TrajectoryHeader *header,
+                     const TrajectoryFrame *frames) {
+    char temp[4096];
+    int written;
+    FILE *out;
+
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    out = fopen(temp, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Unable to create '%s': %s\n", temp, strerror(errno));
+        return -1;
+    }
+    written = fwrite(header, sizeof(*header), 1, out) == 1 &&
+        (!header->frames || fwrite(frames, sizeof(*frames), header->frames, out) == header->frames);
+    if (fclose(out) || !written) {
+        fprintf(stderr, "Error: Unable to write '%s': %s\n", temp, strerror(errno));
+        unlink(temp);
+        return -1;
+    }
+    if (rename(temp, path)) {
+        fprintf(stderr, "Error: Unable to rename '%s' to '%s': %s\n", temp, path,
+                strerror(errno));
+        unlink(temp);
+        return -1;
+    }
+
+    return 0;
+}
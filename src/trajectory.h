@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __trajectory_h__
+#define __trajectory_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compiled trajectories (see compile): a recording already solved into the
+ * PWM count for each servo, so replaying it is a matter of waiting for each
+ * frame's time and writing six numbers out. The file is a TrajectoryHeader
+ * followed by header.frames TrajectoryFrames, all fixed size, and is
+ * mapped rather than read.
+ *
+ * Counts are only right for the rig they were worked out for, so the
+ * header carries config_hash() (geometry and trims) and
+ * config_hash_counts() (that plus PWM frequency and calibration) of the
+ * configuration used. */
+
+#define TRAJECTORY_MAGIC   "STRJ"
+#define TRAJECTORY_VERSION 1
+
+typedef struct {
+    char magic[4];            /* TRAJECTORY_MAGIC */
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t config_hash;
+    uint32_t counts_hash;
+    uint32_t frequency;       /* PWM refresh rate the counts are for, Hz */
+    uint32_t frames;
+    int64_t duration;         /* usec of the last frame */
+} __attribute__((packed)) TrajectoryHeader;
+
+typedef struct {
+    int64_t usec;             /* Since the start */
+    uint16_t counts[6];       /* 12-bit PCA9685 counts, servo 0 to 5 */
+    uint8_t limited;          /* Bit per servo its solution was LIMITED */
+    uint8_t impossible;       /* Bit per servo it was IMPOSSIBLE */
+    uint8_t reserved[2];
+} __attribute__((packed)) TrajectoryFrame;
+
+typedef struct _Trajectory Trajectory;
+
+Trajectory *trajectory_open(const char *path);
+void trajectory_close(Trajectory *trajectory);
+const TrajectoryHeader *trajectory_get_header(Trajectory *trajectory);
+const TrajectoryFrame *trajectory_get_frames(Trajectory *trajectory);
+
+int trajectory_write(const char *path, const TrajectoryHeader *header,
+                     const TrajectoryFrame *frames);
+
+#endif
@@ -25,11 +25,13 @@
 #include <sys/types.h>
 
 #include "pca9685.h"
+#include "servo.h"
 
 #include "stewart.h"
 #include "stewart-pubsub.h"
 #include "config.h"
 #include "delay.h"
+#include "client.h"
 
 void usage(int ret) {
     fprintf(stderr,
@@ -53,9 +55,18 @@ void usage(int ret) {
             "-d            Debug. Turn on Stewart platform debug information\n"
             "              (if local)\n"
             "-h HOST:PORT  Connect to Stewart platform on HOST:PORT\n"
+            "-u            Send to the server's UDP setpoint port (server -u)\n"
+            "              instead of over TCP\n"
+            "-c            Compact. Send poses to the server as int16\n"
+            "              (0.01deg, 0.001in resolution)\n"
+            "-f HZ         PWM refresh rate sent to the servos (default %d, max %d)\n"
+            "-r HZ         Rate at which transforms are sent (default: matches -f)\n"
+            "-w            Warm start. Adopt a PCA9685 already running at the\n"
+            "              configured frequency without resetting the servos\n"
             "\n"
             "If -s is not provided, transform will attempt to connect to a\n"
-            "Stewart platform on i2c bus.\n\n");
+            "Stewart platform on i2c bus.\n\n",
+            PULSE_WIDTH_FREQUENCY, PULSE_WIDTH_FREQUENCY_MAX);
     exit(ret);
 }
 
@@ -123,6 +134,7 @@ int main(int argc, char *argv[]) {
       .debug = 0
     };
     StewartPlatform *platform = NULL;
+    ServoTable *table = NULL;
     int err = 0;
     int i;
     int use_stdin = 1; /* read from stdin for commands */
@@ -135,6 +147,12 @@ int main(int argc, char *argv[]) {
     int euler = 0;
     float *params = NULL;
     int param_count = 0;
+    int frequency = 0, rate = 0;
+    int warm = 0;
+    int udp = 0;
+    int compact = 0;
+    uint32_t sequence = 0;
+    StewartClient *client = NULL;
 
     /* Solve for the solution angles for the given platform transform */
     Solution solutions[6];
@@ -185,6 +203,18 @@ int main(int argc, char *argv[]) {
                 simulate = 1;
                 break;
 
+            case 'w':
+                warm = 1;
+                break;
+
+            case 'u':
+                udp = 1;
+                break;
+
+            case 'c':
+                compact = 1;
+                break;
+
             case 'h':
                 i++;
                 if (i == argc) {
@@ -202,6 +232,22 @@ int main(int argc, char *argv[]) {
                 port = strtol(colon, NULL, 0);
                 break;
 
+            case 'f':
+                i++;
+                if (i == argc) {
+                    usage(-1);
+                }
+                frequency = strtol(argv[i], NULL, 0);
+                break;
+
+            case 'r':
+                i++;
+                if (i == argc) {
+                    usage(-1);
+                }
+                rate = strtol(argv[i], NULL, 0);
+                break;
+
             case 'v':
                 version();
                 break;
@@ -244,13 +290,23 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    /* Initialize the default values for the Stewart platform as
+     * documented at https://01.org/developerjourney/recipe/stewert-platform
+     * and then apply any command line overrides */
+    config_get(&config);
+    if (frequency) {
+        config.pulse_frequency = frequency;
+    }
+    if (rate) {
+        config.tick_rate = rate;
+    }
+    if (config_validate(&config)) {
+        usage(-1);
+    }
+
     /* If transform is not connecting to a remote server, initialize the
      * stewart platform locally */
     if (host == NULL) {
-        /* Initialize the default values for the Stewart platform as
-         * documented at https://01.org/developerjourney/recipe/stewert-platform */
-        config_get(&config);
-
         /* Create the Stewart platform solver as configured */
         platform = stewart_platform_create(&config);
         if (!platform) {
@@ -262,16 +318,30 @@ int main(int argc, char *argv[]) {
             stewart_platform_dump(platform);
         }
 
+        table = servo_table_create(&config);
+        if (!table) {
+            fprintf(stderr, "Could not create servo tables!\n");
+            err = 1;
+            goto terminate;
+        }
+
         if (!simulate) {
             /* Attempt to connect to PCA9685 in order to program the servo locations */
-            pca = pca9685_open(1, 0x40);
+            if (warm) {
+                pca = pca9685_attach(1, 0x40, config.oscillator, config.pulse_frequency);
+            } else {
+                pca = pca9685_open(1, 0x40);
+            }
             if (!pca) {
                 fprintf(stderr, "Could not initialize PCA9685!\n");
                 err = 1;
                 goto terminate;
             }
 
-            err = pca9685_set_pulse_frequency(pca, PULSE_WIDTH_FREQUENCY);
+            if (!warm) {
+                pca9685_set_oscillator(pca, config.oscillator);
+                err = pca9685_set_pulse_frequency(pca, config.pulse_frequency);
+            }
             if (err) {
                 fprintf(stderr, "Could not set PWM frequency!\n");
                 err = 2;
@@ -289,16 +359,14 @@ int main(int argc, char *argv[]) {
         FD_SET(fd, &read_fd);
     }
 
-    long then, now;
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    then = now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    long long then, now, period = 1000000LL / config_get_tick_rate(&config);
+    then = now = now_usec();
 
-    if (host) {
+    if (host && udp) {
         struct addrinfo hint = {
             .ai_family = AF_INET,
-            .ai_socktype = SOCK_STREAM,
-            .ai_protocol = IPPROTO_TCP
+            .ai_socktype = SOCK_DGRAM,
+            .ai_protocol = IPPROTO_UDP
         };
 
         struct addrinfo *res;
@@ -336,15 +404,38 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (host && !udp) {
+        if (!quiet) {
+            fprintf(stdout, "Connecting to %s:%d...", host, port);
+        }
+        client = stewart_client_create(host, port);
+        if (!client) {
+            err = 1;
+            goto terminate;
+        }
+        stewart_client_set_quantize(client, compact);
+
+        /* Only the connect and HELLO; poses never wait on the network */
+        if (stewart_client_flush(client, 5000)) {
+            fprintf(stdout, "\n");
+            fprintf(stderr, "Error: Unable to connect to %s:%d\n", host, port);
+            err = 1;
+            goto terminate;
+        }
+        if (!quiet) {
+            fprintf(stdout, "done\n");
+        }
+    }
+
     while (1) {
         float params[9]; /* max of 9 parameters can be provided */
         int param_count;
 
-        /* Only output to the PWM once per cycle */
-        gettimeofday(&tv, NULL);
-        now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-        if (now - then < 1000 / PULSE_WIDTH_FREQUENCY) {
-            delay(1000 * (1000 / PULSE_WIDTH_FREQUENCY - (now - then)));
+        /* Only output to the PWM once per control tick */
+        now = now_usec();
+        if (now - then < period) {
+            delay(period - (now - then));
+            now = now_usec();
         }
         then = now;
 
@@ -398,24 +489,26 @@ int main(int argc, char *argv[]) {
             .size = sizeof(message)
         };
 
-        if (!quiet) {
-            switch (transform.type) {
-                case TRANSFORM_AXIS_ANGLE:
+        switch (transform.type) {
+            case TRANSFORM_AXIS_ANGLE:
+                if (!quiet) {
                     fprintf(stdout, "X: %+5.02f, Y: %+5.02f, Z: %+5.02f, Angle: %+5.02f\n",
                             transform.rotate.x,
                             transform.rotate.y,
                             transform.rotate.z,
                             transform.angle);
-                    message.type = STEWART_MESSAGE_SET_AXISANGLE;
-                    message.axisAngle.x = transform.rotate.x;
-                    message.axisAngle.y = transform.rotate.y;
-                    message.axisAngle.z = transform.rotate.z;
-                    message.axisAngle.translate.x = transform.translate.x;
-                    message.axisAngle.translate.y = transform.translate.y;
-                    message.axisAngle.translate.z = transform.translate.z;
-                    message.axisAngle.angle = transform.angle;
-                    break;
-                case TRANSFORM_EUCLIDEAN:
+                }
+                message.type = STEWART_MESSAGE_SET_AXISANGLE;
+                message.axisAngle.x = transform.rotate.x;
+                message.axisAngle.y = transform.rotate.y;
+                message.axisAngle.z = transform.rotate.z;
+                message.axisAngle.translate.x = transform.translate.x;
+                message.axisAngle.translate.y = transform.translate.y;
+                message.axisAngle.translate.z = transform.translate.z;
+                message.axisAngle.angle = transform.angle;
+                break;
+            case TRANSFORM_EUCLIDEAN:
+                if (!quiet) {
                     fprintf(stdout,
                             "Roll: %+5.02f, Pitch: %+5.02f, Yaw: %+5.02f,"
                             "X: %+5.02f, Y: %+5.02f, Z: %+5.02f\n",
@@ -425,21 +518,42 @@ int main(int argc, char *argv[]) {
                             transform.translate.x,
                             transform.translate.y,
                             transform.translate.z);
-                    message.type = STEWART_MESSAGE_SET_EUCLIDEAN;
-                    /* Yaw (Z-axis), Pitch (Y-axis), Roll (X-axis) */
-                    message.euclidean.yaw = transform.rotate.z;
-                    message.euclidean.pitch = transform.rotate.y;
-                    message.euclidean.roll = transform.rotate.x;
-                    message.euclidean.translate.x = transform.translate.x;
-                    message.euclidean.translate.y = transform.translate.y;
-                    message.euclidean.translate.z = transform.translate.z;
-                    break;
-            }
+                }
+                message.type = STEWART_MESSAGE_SET_EUCLIDEAN;
+                /* Yaw (Z-axis), Pitch (Y-axis), Roll (X-axis) */
+                message.euclidean.yaw = transform.rotate.z;
+                message.euclidean.pitch = transform.rotate.y;
+                message.euclidean.roll = transform.rotate.x;
+                message.euclidean.translate.x = transform.translate.x;
+                message.euclidean.translate.y = transform.translate.y;
+                message.euclidean.translate.z = transform.translate.z;
+                break;
         }
 
-        if (host) {
-            if (send(sock, &message, sizeof(message), MSG_WAITALL) == -1) {
+        if (host && udp) {
+            /* A lost datagram is superseded by the next one; keep going */
+            StewartSetpoint setpoint = {
+                .sequence = sequence++,
+                .usec = now_usec(),
+                .message = message
+            };
+            if (send(sock, &setpoint, sizeof(setpoint), 0) == -1) {
                 fprintf(stderr, "Error sending to Stewart platform: %s\n", strerror(errno));
+            }
+
+            if (!use_stdin) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (client) {
+            /* Replaces the previous pose if the socket hasn't taken it yet;
+             * replies are handled without waiting for them */
+            if (stewart_client_set_pose(client, &message) ||
+                stewart_client_wait(client, 0)) {
+                err = 1;
                 goto terminate;
             }
 
@@ -447,7 +561,7 @@ int main(int argc, char *argv[]) {
                 break;
             }
 
-             continue;
+            continue;
         }
 
         stewart_get_solutions(platform, &origin, &transform, solutions, NULL);
@@ -484,8 +598,8 @@ int main(int argc, char *argv[]) {
 
         /* Send servo positions to servos */
         for (i = 0; !simulate && i < 6; i++) {
-            pca9685_set_channel_pulse(
-                pca, i, 0, RADIANS_TO_PULSE_WIDTH(DEG2RAD(solutions[i].angle)));
+            pca9685_set_channel_count(pca, i, 0, SERVO_COUNT_ROUND(
+                servo_table_lookup(table, i, solutions[i].angle)));
         }
 
         if (!use_stdin) {
@@ -498,6 +612,10 @@ terminate:
         stewart_platform_delete(platform);
     }
 
+    if (table) {
+        servo_table_delete(table);
+    }
+
     if (pca) {
         pca9685_close(pca);
     }
@@ -506,5 +624,16 @@ terminate:
         close(sock);
     }
 
+    if (client) {
+        if (!err && stewart_client_flush(client, 1000)) {
+            fprintf(stderr, "Error: Timed out sending to Stewart platform\n");
+        }
+        if (!quiet && stewart_client_get_coalesced(client)) {
+            fprintf(stdout, "%lu poses replaced before they were sent\n",
+                    stewart_client_get_coalesced(client));
+        }
+        stewart_client_delete(client);
+    }
+
     return err;
 }
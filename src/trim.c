@@ -23,17 +23,22 @@
 
 #include "config.h"
 
+StewartConfig _config;
+
 void usage(int ret) {
     fprintf(stderr,
             "usage: servo [-u UNIT] channel [trim-in-units "
             "[pulse-width(us) [pulse-frequency(cycle-per-second)]]]\n\n");
 
     fprintf(stderr, "-u UNIT    Units for TRIM to be specified.\n"
-                    "           Options: rad, deg, us. Default us\n\n");
+                    "           Options: rad, deg, us. Default us\n"
+                    "-m HZ      Measured PWM output frequency while running at the\n"
+                    "           configured frequency. Calibrates the PCA9685\n"
+                    "           oscillator in stewart.cfg.\n\n");
     fprintf(stderr, "Compiled default values (see config.h):\n");
     fprintf(stderr, "   pulse-width defaults to %dus\n", PULSE_WIDTH_ZERO_POS);
-    fprintf(stderr, "   pulse-frequency defaults to %dHz\n\n",
-            PULSE_WIDTH_FREQUENCY);
+    fprintf(stderr, "   pulse-frequency defaults to %dHz (see stewart.cfg)\n\n",
+            _config.pulse_frequency);
     exit(ret);
 }
 
@@ -55,12 +60,12 @@ void showTrim(StewartConfig *config, int channel) {
 }
 
 int main(int argc, char *argv[]) {
-    StewartConfig _config;
     StewartConfig *c = &_config;
     PCA9685 *pca = NULL;
     int err = 0;
     int channel = -1, frequency = -1, pulse_width = -1, trim = -1;
     float trimValue = -1;
+    float measured = -1;
     int i;
     typedef enum {
         US = 1,
@@ -99,6 +104,17 @@ int main(int argc, char *argv[]) {
                     }
                     unitWord = argv[i];
                     break;
+                case 'm':
+                    i++;
+                    if (i == argc) {
+                        usage(-1);
+                    }
+                    measured = strtof(argv[i], NULL);
+                    if (measured <= 0) {
+                        fprintf(stderr, "Measured frequency must be higher than 0Hz!\n\n");
+                        usage(-1);
+                    }
+                    break;
                 case 'v':
                     version();
                     break;
@@ -146,6 +162,25 @@ int main(int argc, char *argv[]) {
         usage(-1);
     }
 
+    /* The PWM period is the oscillator divided by 4096 * (PRE_SCALE + 1). With
+     * PRE_SCALE known from the configured values, the measured output gives
+     * the real oscillator frequency */
+    if (measured != -1) {
+        int prescale = pca9685_compute_prescale(c->oscillator, c->pulse_frequency);
+
+        fprintf(stdout, "Configured oscillator : %dHz\n", c->oscillator);
+        c->oscillator = measured * 4096.0 * (prescale + 1) + 0.5;
+        fprintf(stdout, "Calibrated oscillator : %dHz (PRE_SCALE %d, %.02fHz measured)\n",
+                c->oscillator, prescale, measured);
+        if (config_validate(c)) {
+            return -1;
+        }
+        if (config_write(c) == 0) {
+            fprintf(stdout, "\nstewart.cfg updated\n\n");
+        }
+        return 0;
+    }
+
     /* Only set the actual "trim" field if the trimValue was specified on the
      * command line */
     if (trimValue != -1) {
@@ -201,7 +236,7 @@ int main(int argc, char *argv[]) {
             PULSE_WIDTH_TO_RADIANS(trim + PULSE_WIDTH_ZERO_POS));
 
     if (frequency == -1) {
-        frequency = PULSE_WIDTH_FREQUENCY;
+        frequency = c->pulse_frequency;
     }
     fprintf(stdout, "Pulse frequency       : %dHz\n", frequency);
 
@@ -229,6 +264,7 @@ int main(int argc, char *argv[]) {
     }
 
     if (pca) {
+        pca9685_set_oscillator(pca, c->oscillator);
         err = pca9685_set_pulse_frequency(pca, frequency);
         if (err) {
             fprintf(stderr, "Warning: Could not set PWM frequency!\n");
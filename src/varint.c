@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include "varint.h"
+
+/* Returns the bytes written, VARINT_MAX at most */
+size_t varint_put(uint8_t *out, uint64_t value) {
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+
+    return length;
+}
+
+/* Returns the bytes read, 0 if the varint runs past length or VARINT_MAX */
+size_t varint_get(const uint8_t *data, size_t length, uint64_t *value) {
+    size_t i;
+
+    *value = 0;
+    for (i = 0; i < length && i < VARINT_MAX; i++) {
+        *value |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
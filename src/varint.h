@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __varint_h__
+#define __varint_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Little endian base 128 varints, as the status history and recordings
+ * store them: seven bits a byte, the top bit set on all but the last. */
+
+#define VARINT_MAX 10 /* Bytes in the longest varint */
+
+/* Signed deltas go through zigzag first so small negatives stay short */
+#define ZIGZAG(v)   (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define UNZIGZAG(u) ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+size_t varint_put(uint8_t *out, uint64_t value);
+size_t varint_get(const uint8_t *data, size_t length, uint64_t *value);
+
+#endif
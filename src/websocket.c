@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "websocket.h"
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+void _sha1(const uint8_t *data, size_t length, uint8_t digest[20]);
+void _sha1_block(uint32_t h[5], const uint8_t *block);
+void _base64(const uint8_t *data, size_t length, char *out);
+const char *_header_value(const char *request, size_t length, const char *name, size_t *value);
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void _sha1_block(uint32_t h[5], const uint8_t *block) {
+    uint32_t w[80], a, b, c, d, e, f, k, t;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+            (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+    for (i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = ROL(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = ROL(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+/* Only ever hashes the short handshake key, so it isn't streamed */
+void _sha1(const uint8_t *data, size_t length, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    uint8_t block[64];
+    uint64_t bits = (uint64_t)length * 8;
+    size_t i;
+
+    for (i = 0; i + 64 <= length; i += 64) {
+        _sha1_block(h, data + i);
+    }
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, data + i, length - i);
+    block[length - i] = 0x80;
+    if (length - i >= 56) {
+        _sha1_block(h, block);
+        memset(block, 0, sizeof(block));
+    }
+    for (i = 0; i < 8; i++) {
+        block[63 - i] = bits >> (i * 8);
+    }
+    _sha1_block(h, block);
+
+    for (i = 0; i < 20; i++) {
+        digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+    }
+}
+
+void _base64(const uint8_t *data, size_t length, char *out) {
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i;
+
+    for (i = 0; i + 2 < length; i += 3) {
+        *out++ = table[data[i] >> 2];
+        *out++ = table[((data[i] & 0x03) << 4) | (data[i + 1] >> 4)];
+        *out++ = table[((data[i + 1] & 0x0f) << 2) | (data[i + 2] >> 6)];
+        *out++ = table[data[i + 2] & 0x3f];
+    }
+    if (length - i == 1) {
+        *out++ = table[data[i] >> 2];
+        *out++ = table[(data[i] & 0x03) << 4];
+        *out++ = '=';
+        *out++ = '=';
+    } else if (length - i == 2) {
+        *out++ = table[data[i] >> 2];
+        *out++ = table[((data[i] & 0x03) << 4) | (data[i + 1] >> 4)];
+        *out++ = table[(data[i + 1] & 0x0f) << 2];
+        *out++ = '=';
+    }
+    *out = '\0';
+}
+
+/* Find header name (case insensitive) in the request head and return its
+ * value with surrounding whitespace removed, or NULL */
+const char *_header_value(const char *request, size_t length, const char *name, size_t *value) {
+    size_t len = strlen(name);
+    const char *line = request, *end = request + length, *eol, *start;
+
+    while (line < end) {
+        eol = memchr(line, '\n', end - line);
+        if (!eol) {
+            eol = end;
+        }
+        if (eol - line > len && line[len] == ':' && !strncasecmp(line, name, len)) {
+            start = line + len + 1;
+            while (start < eol && isspace((unsigned char)*start)) {
+                start++;
+            }
+            while (eol > start && isspace((unsigned char)eol[-1])) {
+                eol--;
+            }
+            *value = eol - start;
+            return start;
+        }
+        line = eol + 1;
+    }
+
+    return NULL;
+}
+
+/* Handle the HTTP upgrade request. Returns 0 until the whole request head
+ * has arrived, then the number of request bytes used with the 101 response
+ * in response. Returns -1 with a 400 response for anything that isn't a
+ * WebSocket upgrade. */
+int websocket_handshake(const char *request, size_t length, char *response, size_t size) {
+    uint8_t key[128], digest[20];
+    const char *end = NULL, *value;
+    char accept[32];
+    size_t i, len;
+
+    for (i = 3; i < length; i++) {
+        if (!memcmp(request + i - 3, "\r\n\r\n", 4)) {
+            end = request + i + 1;
+            break;
+        }
+    }
+    if (!end) {
+        if (length < WEBSOCKET_REQUEST_MAX) {
+            return 0;
+        }
+        goto bad;
+    }
+
+    if (length < 4 || memcmp(request, "GET ", 4)) {
+        goto bad;
+    }
+
+    value = _header_value(request, end - request, "Upgrade", &len);
+    if (!value || len != 9 || strncasecmp(value, "websocket", 9)) {
+        goto bad;
+    }
+
+    value = _header_value(request, end - request, "Sec-WebSocket-Key", &len);
+    if (!value || len == 0 || len + sizeof(WEBSOCKET_GUID) > sizeof(key)) {
+        goto bad;
+    }
+    memcpy(key, value, len);
+    memcpy(key + len, WEBSOCKET_GUID, sizeof(WEBSOCKET_GUID) - 1);
+    _sha1(key, len + sizeof(WEBSOCKET_GUID) - 1, digest);
+    _base64(digest, sizeof(digest), accept);
+
+    snprintf(response, size,
+             "HTTP/1.1 101 Switching Protocols\r\n"
+             "Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "Sec-WebSocket-Accept: %s\r\n"
+             "\r\n", accept);
+
+    return end - request;
+
+bad:
+    snprintf(response, size,
+             "HTTP/1.1 400 Bad Request\r\n"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+    return -1;
+}
+
+/* Decode a frame header. Returns 1 once the whole header is available, 0 if
+ * more bytes are needed and -1 for a header no client may send. */
+int websocket_parse(const void *data, size_t available, WebSocketFrame *frame) {
+    const uint8_t *p = data;
+    size_t need = 2;
+    int i;
+
+    if (available < need) {
+        return 0;
+    }
+
+    frame->fin = p[0] >> 7;
+    frame->opcode = p[0] & 0x0f;
+    frame->masked = p[1] >> 7;
+    frame->length = p[1] & 0x7f;
+
+    /* Reserved bits need an extension, and clients must mask */
+    if ((p[0] & 0x70) || !frame->masked) {
+        return -1;
+    }
+
+    if (frame->length == 126) {
+        need += 2;
+    } else if (frame->length == 127) {
+        need += 8;
+    }
+    need += 4;
+    if (available < need) {
+        return 0;
+    }
+
+    if (frame->length == 126) {
+        frame->length = (uint64_t)p[2] << 8 | p[3];
+    } else if (frame->length == 127) {
+        frame->length = 0;
+        for (i = 0; i < 8; i++) {
+            frame->length = frame->length << 8 | p[2 + i];
+        }
+    }
+    memcpy(frame->mask, p + need - 4, 4);
+    frame->header = need;
+
+    /* Lengths take the shortest form, and a 64-bit one has its top bit
+     * clear, so nothing downstream has to worry about it wrapping */
+    if ((need == 8 && frame->length < 126) ||
+        (need == 14 && (frame->length <= 0xffff || frame->length >> 63))) {
+        return -1;
+    }
+
+    /* Control frames are short and never fragmented */
+    if ((frame->opcode & 0x8) && (frame->length > 125 || !frame->fin)) {
+        return -1;
+    }
+
+    return 1;
+}
+
+void websocket_unmask(void *payload, size_t length, const uint8_t mask[4]) {
+    uint8_t *p = payload;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        p[i] ^= mask[i & 3];
+    }
+}
+
+/* Write the header of an unmasked, unfragmented server frame. Returns its
+ * length; at most WEBSOCKET_HEADER_MAX. */
+size_t websocket_header(uint8_t *header, int opcode, size_t length) {
+    int i;
+
+    header[0] = 0x80 | opcode;
+    if (length < 126) {
+        header[1] = length;
+        return 2;
+    }
+    if (length <= 0xffff) {
+        header[1] = 126;
+        header[2] = length >> 8;
+        header[3] = length;
+        return 4;
+    }
+    header[1] = 127;
+    for (i = 0; i < 8; i++) {
+        header[2 + i] = (uint64_t)length >> (56 - i * 8);
+    }
+    return 10;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2015-2017, Intel Corporation.
+ *
+ * This program is licensed under the terms and conditions of the
+ * Apache License, version 2.0.  The full text of the Apache License is at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+#ifndef __websocket_h__
+#define __websocket_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Server side of RFC 6455: the HTTP upgrade and frame headers. Payloads are
+ * left where they were received; only the client's mask is undone, in
+ * place. */
+
+#define WEBSOCKET_OP_CONTINUATION 0x0
+#define WEBSOCKET_OP_TEXT         0x1
+#define WEBSOCKET_OP_BINARY       0x2
+#define WEBSOCKET_OP_CLOSE        0x8
+#define WEBSOCKET_OP_PING         0x9
+#define WEBSOCKET_OP_PONG         0xa
+
+#define WEBSOCKET_HEADER_MAX      14   /* Longest frame header */
+#define WEBSOCKET_REQUEST_MAX     2048 /* Largest upgrade request accepted */
+#define WEBSOCKET_RESPONSE_MAX    256
+
+typedef struct _WebSocketFrame {
+    int fin;
+    int opcode;                   /* WEBSOCKET_OP_* */
+    int masked;
+    uint8_t mask[4];
+    uint64_t length;              /* Payload bytes */
+    size_t header;                /* Header bytes before the payload */
+} WebSocketFrame;
+
+int websocket_handshake(const char *request, size_t length, char *response, size_t size);
+int websocket_parse(const void *data, size_t available, WebSocketFrame *frame);
+void websocket_unmask(void *payload, size_t length, const uint8_t mask[4]);
+size_t websocket_header(uint8_t *header, int opcode, size_t length);
+
+#endif